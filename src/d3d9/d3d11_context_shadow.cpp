@@ -0,0 +1,188 @@
+#include "d3d11_context_shadow.h"
+#include <cstring>
+
+namespace dxup {
+
+  D3D11ContextShadow::D3D11ContextShadow(ID3D11DeviceContext1* context)
+    : m_context{ context } {
+    invalidate();
+  }
+
+  void D3D11ContextShadow::invalidate() {
+    m_vertexBuffersValid = 0;
+    m_indexBufferValid = false;
+    m_inputLayoutValid = false;
+    m_topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    m_vertexShaderValid = false;
+    m_pixelShaderValid = false;
+    m_srvsValid = { 0, 0 };
+    m_samplersValid = { 0, 0 };
+    m_constantBuffers[0].valid = false;
+    m_constantBuffers[1].valid = false;
+    m_rasterizerStateValid = false;
+    m_blendStateValid = false;
+    m_depthStencilStateValid = false;
+    m_renderTargetsValid = false;
+    m_viewportValid = false;
+    m_scissorRectValid = false;
+  }
+
+  void D3D11ContextShadow::setVertexBuffers(UINT start, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) {
+    UINT first = start + count;
+    UINT end = start;
+
+    for (UINT i = 0; i < count; i++) {
+      UINT slot = start + i;
+
+      bool valid = m_vertexBuffersValid & (1u << slot);
+      m_vertexBuffersValid |= 1u << slot;
+
+      if (valid
+        && m_vertexBuffers[slot] == buffers[i]
+        && m_vertexStrides[slot] == strides[i]
+        && m_vertexOffsets[slot] == offsets[i])
+        continue;
+
+      m_vertexBuffers[slot] = buffers[i];
+      m_vertexStrides[slot] = strides[i];
+      m_vertexOffsets[slot] = offsets[i];
+
+      first = std::min(first, slot);
+      end = slot + 1;
+    }
+
+    if (first >= end)
+      return;
+
+    m_context->IASetVertexBuffers(first, end - first, &m_vertexBuffers[first], &m_vertexStrides[first], &m_vertexOffsets[first]);
+  }
+
+  void D3D11ContextShadow::setIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) {
+    if (m_indexBufferValid && m_indexBuffer == buffer && m_indexFormat == format && m_indexOffset == offset)
+      return;
+
+    m_indexBuffer = buffer;
+    m_indexFormat = format;
+    m_indexOffset = offset;
+    m_indexBufferValid = true;
+
+    m_context->IASetIndexBuffer(buffer, format, offset);
+  }
+
+  void D3D11ContextShadow::setInputLayout(ID3D11InputLayout* layout) {
+    if (m_inputLayoutValid && m_inputLayout == layout)
+      return;
+
+    m_inputLayout = layout;
+    m_inputLayoutValid = true;
+
+    m_context->IASetInputLayout(layout);
+  }
+
+  void D3D11ContextShadow::setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) {
+    if (m_topology == topology)
+      return;
+
+    m_topology = topology;
+
+    m_context->IASetPrimitiveTopology(topology);
+  }
+
+  void D3D11ContextShadow::setVertexShader(ID3D11VertexShader* shader) {
+    if (m_vertexShaderValid && m_vertexShader == shader)
+      return;
+
+    m_vertexShader = shader;
+    m_vertexShaderValid = true;
+
+    m_context->VSSetShader(shader, nullptr, 0);
+  }
+
+  void D3D11ContextShadow::setPixelShader(ID3D11PixelShader* shader) {
+    if (m_pixelShaderValid && m_pixelShader == shader)
+      return;
+
+    m_pixelShader = shader;
+    m_pixelShaderValid = true;
+
+    m_context->PSSetShader(shader, nullptr, 0);
+  }
+
+  void D3D11ContextShadow::setRasterizerState(ID3D11RasterizerState* state) {
+    if (m_rasterizerStateValid && m_rasterizerState == state)
+      return;
+
+    m_rasterizerState = state;
+    m_rasterizerStateValid = true;
+
+    m_context->RSSetState(state);
+  }
+
+  void D3D11ContextShadow::setBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask) {
+    if (m_blendStateValid
+      && m_blendState == state
+      && m_sampleMask == sampleMask
+      && std::memcmp(m_blendFactor.data(), blendFactor, sizeof(m_blendFactor)) == 0)
+      return;
+
+    m_blendState = state;
+    std::memcpy(m_blendFactor.data(), blendFactor, sizeof(m_blendFactor));
+    m_sampleMask = sampleMask;
+    m_blendStateValid = true;
+
+    m_context->OMSetBlendState(state, blendFactor, sampleMask);
+  }
+
+  void D3D11ContextShadow::setDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) {
+    if (m_depthStencilStateValid && m_depthStencilState == state && m_stencilRef == stencilRef)
+      return;
+
+    m_depthStencilState = state;
+    m_stencilRef = stencilRef;
+    m_depthStencilStateValid = true;
+
+    m_context->OMSetDepthStencilState(state, stencilRef);
+  }
+
+  void D3D11ContextShadow::setRenderTargets(UINT count, ID3D11RenderTargetView* const* rtvs, ID3D11DepthStencilView* dsv) {
+    bool changed = !m_renderTargetsValid || m_rtvCount != count || m_dsv != dsv;
+    for (UINT i = 0; i < count && !changed; i++)
+      changed = m_rtvs[i] != rtvs[i];
+
+    if (!changed)
+      return;
+
+    m_rtvs.fill(nullptr);
+    for (UINT i = 0; i < count; i++)
+      m_rtvs[i] = rtvs[i];
+    m_rtvCount = count;
+    m_dsv = dsv;
+    m_renderTargetsValid = true;
+
+    m_context->OMSetRenderTargets(count, rtvs, dsv);
+
+    // The runtime unbinds any SRVs that alias the new outputs behind our back.
+    m_srvsValid = { 0, 0 };
+  }
+
+  void D3D11ContextShadow::setViewport(const D3D11_VIEWPORT& viewport) {
+    if (m_viewportValid && std::memcmp(&m_viewport, &viewport, sizeof(viewport)) == 0)
+      return;
+
+    m_viewport = viewport;
+    m_viewportValid = true;
+
+    m_context->RSSetViewports(1, &viewport);
+  }
+
+  void D3D11ContextShadow::setScissorRect(const D3D11_RECT& rect) {
+    if (m_scissorRectValid && std::memcmp(&m_scissorRect, &rect, sizeof(rect)) == 0)
+      return;
+
+    m_scissorRect = rect;
+    m_scissorRectValid = true;
+
+    m_context->RSSetScissorRects(1, &rect);
+  }
+
+}
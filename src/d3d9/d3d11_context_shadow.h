@@ -0,0 +1,165 @@
+#pragma once
+
+#include "d3d9_base.h"
+#include <array>
+#include <algorithm>
+
+namespace dxup {
+
+  // Mirrors what is actually bound on the immediate context so we only make the calls that change something.
+  // Array bindings only issue the smallest contiguous range covering the slots that differ.
+  class D3D11ContextShadow {
+
+  public:
+
+    D3D11ContextShadow(ID3D11DeviceContext1* context);
+
+    // Call if something outside of here touched the context's pipeline state.
+    void invalidate();
+
+    void setVertexBuffers(UINT start, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets);
+    void setIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+    void setInputLayout(ID3D11InputLayout* layout);
+    void setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+
+    void setVertexShader(ID3D11VertexShader* shader);
+    void setPixelShader(ID3D11PixelShader* shader);
+
+    template <bool Pixel>
+    void setShaderResources(UINT start, UINT count, ID3D11ShaderResourceView* const* srvs) {
+      UINT first, end;
+      if (!updateRange(m_srvs[Pixel], m_srvsValid[Pixel], start, count, srvs, &first, &end))
+        return;
+
+      if constexpr (Pixel)
+        m_context->PSSetShaderResources(first, end - first, &m_srvs[Pixel][first]);
+      else
+        m_context->VSSetShaderResources(first, end - first, &m_srvs[Pixel][first]);
+    }
+
+    template <bool Pixel>
+    void setSamplers(UINT start, UINT count, ID3D11SamplerState* const* samplers) {
+      UINT first, end;
+      if (!updateRange(m_samplers[Pixel], m_samplersValid[Pixel], start, count, samplers, &first, &end))
+        return;
+
+      if constexpr (Pixel)
+        m_context->PSSetSamplers(first, end - first, &m_samplers[Pixel][first]);
+      else
+        m_context->VSSetSamplers(first, end - first, &m_samplers[Pixel][first]);
+    }
+
+    // We only ever use slot 0.
+    template <bool Pixel>
+    void setConstantBuffer(ID3D11Buffer* buffer, UINT firstConstant, UINT numConstants) {
+      ConstantBufferBinding& bound = m_constantBuffers[Pixel];
+
+      if (bound.valid && bound.buffer == buffer && bound.firstConstant == firstConstant && bound.numConstants == numConstants)
+        return;
+
+      bound = ConstantBufferBinding{ buffer, firstConstant, numConstants, true };
+
+      if constexpr (Pixel)
+        m_context->PSSetConstantBuffers1(0, 1, &buffer, &firstConstant, &numConstants);
+      else
+        m_context->VSSetConstantBuffers1(0, 1, &buffer, &firstConstant, &numConstants);
+    }
+
+    void setRasterizerState(ID3D11RasterizerState* state);
+    void setBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask);
+    void setDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef);
+    void setRenderTargets(UINT count, ID3D11RenderTargetView* const* rtvs, ID3D11DepthStencilView* dsv);
+
+    void setViewport(const D3D11_VIEWPORT& viewport);
+    void setScissorRect(const D3D11_RECT& rect);
+
+  private:
+
+    // Updates the shadow and returns the [first, end) range of slots that changed, false if none did.
+    // validMask has a bit per slot we know the contents of.
+    template <typename T, size_t N>
+    static bool updateRange(std::array<T, N>& bound, uint32_t& validMask, UINT start, UINT count, const T* values, UINT* first, UINT* end) {
+      UINT lo = start + count;
+      UINT hi = start;
+
+      for (UINT i = 0; i < count; i++) {
+        bool valid = validMask & (1u << (start + i));
+        validMask |= 1u << (start + i);
+
+        if (valid && bound[start + i] == values[i])
+          continue;
+
+        bound[start + i] = values[i];
+        lo = std::min(lo, start + i);
+        hi = start + i + 1;
+      }
+
+      *first = lo;
+      *end = hi;
+      return lo < hi;
+    }
+
+    struct ConstantBufferBinding {
+      ID3D11Buffer* buffer;
+      UINT firstConstant;
+      UINT numConstants;
+      bool valid;
+    };
+
+    // I exist as long as my parent D3D9 device exists. No need for COM.
+    ID3D11DeviceContext1* m_context;
+
+    std::array<ID3D11Buffer*, 16> m_vertexBuffers;
+    std::array<UINT, 16> m_vertexStrides;
+    std::array<UINT, 16> m_vertexOffsets;
+    uint32_t m_vertexBuffersValid;
+
+    ID3D11Buffer* m_indexBuffer;
+    DXGI_FORMAT m_indexFormat;
+    UINT m_indexOffset;
+    bool m_indexBufferValid;
+
+    ID3D11InputLayout* m_inputLayout;
+    bool m_inputLayoutValid;
+
+    D3D11_PRIMITIVE_TOPOLOGY m_topology;
+
+    ID3D11VertexShader* m_vertexShader;
+    bool m_vertexShaderValid;
+    ID3D11PixelShader* m_pixelShader;
+    bool m_pixelShaderValid;
+
+    std::array<std::array<ID3D11ShaderResourceView*, 16>, 2> m_srvs;
+    std::array<uint32_t, 2> m_srvsValid;
+
+    std::array<std::array<ID3D11SamplerState*, 16>, 2> m_samplers;
+    std::array<uint32_t, 2> m_samplersValid;
+
+    std::array<ConstantBufferBinding, 2> m_constantBuffers;
+
+    ID3D11RasterizerState* m_rasterizerState;
+    bool m_rasterizerStateValid;
+
+    ID3D11BlendState* m_blendState;
+    std::array<FLOAT, 4> m_blendFactor;
+    UINT m_sampleMask;
+    bool m_blendStateValid;
+
+    ID3D11DepthStencilState* m_depthStencilState;
+    UINT m_stencilRef;
+    bool m_depthStencilStateValid;
+
+    std::array<ID3D11RenderTargetView*, 4> m_rtvs;
+    UINT m_rtvCount;
+    ID3D11DepthStencilView* m_dsv;
+    bool m_renderTargetsValid;
+
+    D3D11_VIEWPORT m_viewport;
+    bool m_viewportValid;
+
+    D3D11_RECT m_scissorRect;
+    bool m_scissorRectValid;
+
+  };
+
+}
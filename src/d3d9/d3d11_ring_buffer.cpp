@@ -0,0 +1,143 @@
+#include "d3d11_ring_buffer.h"
+#include <cstring>
+#include <algorithm>
+
+namespace dxup {
+
+  namespace {
+    const uint32_t initialChunkSize = 256 * 1024;
+    const uint32_t maxChunkGrowth = 16 * 1024 * 1024;
+    const uint32_t invalidChunk = UINT32_MAX;
+  }
+
+  D3D11RingBuffer::D3D11RingBuffer(ID3D11Device* device, uint32_t bindFlags, uint32_t alignment)
+    : m_device{ device }
+    , m_bindFlags{ bindFlags }
+    , m_alignment{ alignment }
+    , m_current{ invalidChunk }
+    , m_offset{ 0 }
+    , m_nextChunkSize{ initialChunkSize } {}
+
+  ID3D11Buffer* D3D11RingBuffer::getBuffer() {
+    if (m_current == invalidChunk)
+      return nullptr;
+
+    return m_chunks[m_current].buffer.ptr();
+  }
+
+  uint32_t D3D11RingBuffer::getOffset() {
+    return m_offset;
+  }
+
+  bool D3D11RingBuffer::isChunkFree(ID3D11DeviceContext* context, Chunk& chunk) {
+    if (chunk.usedThisFrame)
+      return false;
+
+    if (chunk.fence == nullptr)
+      return true;
+
+    if (context->GetData(chunk.fence.ptr(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+      return false;
+
+    chunk.fence = nullptr;
+    return true;
+  }
+
+  uint32_t D3D11RingBuffer::createChunk(uint32_t length) {
+    uint32_t size = m_nextChunkSize;
+    while (size < length)
+      size *= 2;
+
+    D3D11_BUFFER_DESC desc;
+    desc.ByteWidth = size;
+    desc.BindFlags = m_bindFlags;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    desc.Usage = D3D11_USAGE_DYNAMIC;
+    desc.MiscFlags = 0;
+    desc.StructureByteStride = 0;
+
+    Com<ID3D11Buffer> buffer;
+    HRESULT result = m_device->CreateBuffer(&desc, nullptr, &buffer);
+    if (FAILED(result)) {
+      log::warn("D3D11RingBuffer: CreateBuffer failed (length = %d).", size);
+      return invalidChunk;
+    }
+
+    Chunk chunk;
+    chunk.buffer = buffer;
+    chunk.size = size;
+    chunk.usedThisFrame = false;
+    m_chunks.push_back(chunk);
+
+    m_nextChunkSize = std::min(size * 2, maxChunkGrowth);
+
+    return uint32_t(m_chunks.size() - 1);
+  }
+
+  void D3D11RingBuffer::reserve(ID3D11DeviceContext* context, uint32_t length) {
+    if (m_current != invalidChunk && m_offset + length <= m_chunks[m_current].size)
+      return;
+
+    // The current chunk stays marked as used this frame, it gets fenced in endFrame.
+    m_current = invalidChunk;
+    m_offset = 0;
+
+    for (uint32_t i = 0; i < m_chunks.size(); i++) {
+      if (m_chunks[i].size >= length && isChunkFree(context, m_chunks[i])) {
+        m_current = i;
+        break;
+      }
+    }
+
+    if (m_current == invalidChunk)
+      m_current = createChunk(length);
+
+    if (m_current != invalidChunk)
+      m_chunks[m_current].usedThisFrame = true;
+  }
+
+  void D3D11RingBuffer::map(ID3D11DeviceContext* context, void** data, uint32_t length) {
+    // Anything before m_offset may still be in use by the GPU, past it is ours.
+    // A chunk we just picked up has passed its fence so discarding it costs nothing.
+    D3D11_MAPPED_SUBRESOURCE res;
+    context->Map(m_chunks[m_current].buffer.ptr(), 0, m_offset == 0 ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &res);
+    uint8_t* resourceData = (uint8_t*)res.pData;
+    *data = resourceData + m_offset;
+  }
+
+  uint32_t D3D11RingBuffer::unmap(ID3D11DeviceContext* context, uint32_t length) {
+    context->Unmap(m_chunks[m_current].buffer.ptr(), 0);
+    uint32_t offset = m_offset;
+    m_offset += alignTo(length, m_alignment);
+    return offset;
+  }
+
+  void D3D11RingBuffer::endFrame(ID3D11DeviceContext* context) {
+    Com<ID3D11Query> fence;
+
+    D3D11_QUERY_DESC desc;
+    desc.Query = D3D11_QUERY_EVENT;
+    desc.MiscFlags = 0;
+    HRESULT result = m_device->CreateQuery(&desc, &fence);
+    if (FAILED(result))
+      log::warn("D3D11RingBuffer: failed to create frame fence.");
+    else
+      context->End(fence.ptr());
+
+    for (Chunk& chunk : m_chunks) {
+      if (!chunk.usedThisFrame)
+        continue;
+
+      // Without a fence we have no idea when the GPU is done with it, so nobody gets it back.
+      if (fence == nullptr)
+        continue;
+
+      chunk.fence = fence;
+      chunk.usedThisFrame = false;
+    }
+
+    // Keep filling the current chunk next frame, nothing after m_offset has been handed out.
+    if (m_current != invalidChunk)
+      m_chunks[m_current].usedThisFrame = true;
+  }
+}
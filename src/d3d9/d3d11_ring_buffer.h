@@ -0,0 +1,55 @@
+#pragma once
+
+#include "d3d9_base.h"
+#include <vector>
+
+namespace dxup {
+
+  // Streams transient data (UP draws, fan indices, constants) into a set of dynamic buffers.
+  // We fill one chunk linearly, when it runs out we move to another one that the GPU is done with or make a bigger one.
+  // Chunks used in a frame are fenced with an event query at the end of it and only recycled once that has passed.
+  class D3D11RingBuffer {
+
+  public:
+
+    // Every allocation starts at a multiple of alignment.
+    D3D11RingBuffer(ID3D11Device* device, uint32_t bindFlags, uint32_t alignment);
+
+    // Makes sure the next map of this length fits in the current chunk.
+    void reserve(ID3D11DeviceContext* context, uint32_t length);
+    void map(ID3D11DeviceContext* context, void** data, uint32_t length);
+    uint32_t unmap(ID3D11DeviceContext* context, uint32_t length);
+    void endFrame(ID3D11DeviceContext* context);
+
+    ID3D11Buffer* getBuffer();
+    // Where the next map will write to.
+    uint32_t getOffset();
+
+  private:
+
+    struct Chunk {
+      Com<ID3D11Buffer> buffer;
+      uint32_t size;
+      bool usedThisFrame;
+
+      // Last frame that touched this chunk, nullptr once the GPU is done.
+      Com<ID3D11Query> fence;
+    };
+
+    bool isChunkFree(ID3D11DeviceContext* context, Chunk& chunk);
+    uint32_t createChunk(uint32_t length);
+
+    ID3D11Device* m_device;
+    uint32_t m_bindFlags;
+    uint32_t m_alignment;
+
+    std::vector<Chunk> m_chunks;
+    uint32_t m_current;
+    uint32_t m_offset;
+
+    // Next chunk we make will be at least this big.
+    uint32_t m_nextChunkSize;
+
+  };
+
+}
@@ -0,0 +1,259 @@
+#include "d3d11_staging_pool.h"
+#include "d3d9_format.h"
+#include "d3d9_util.h"
+#include <algorithm>
+#include <iterator>
+
+namespace dxup {
+
+  D3D11StagingPool::D3D11StagingPool(ID3D11Device* device, uint64_t budget)
+    : m_device{ device }
+    , m_budget{ budget }
+    , m_idleBytes{ 0 }
+    , m_totalBytes{ 0 }
+    , m_peakBytes{ 0 }
+    , m_created{ 0 }
+    , m_reused{ 0 }
+    , m_intact{ 0 }
+    , m_evicted{ 0 } {
+    InitializeCriticalSection(&m_lock);
+  }
+
+  D3D11StagingPool::~D3D11StagingPool() {
+    DeleteCriticalSection(&m_lock);
+  }
+
+  bool D3D11StagingPool::Key::operator == (const Key& other) const {
+    return dimension == other.dimension &&
+           format == other.format &&
+           width == other.width &&
+           height == other.height &&
+           depth == other.depth &&
+           mips == other.mips &&
+           arraySize == other.arraySize;
+  }
+
+  D3D11StagingPool::Key D3D11StagingPool::makeKey(ID3D11Resource* resource) {
+    Key key;
+    resource->GetType(&key.dimension);
+
+    if (key.dimension == D3D11_RESOURCE_DIMENSION_TEXTURE3D) {
+      D3D11_TEXTURE3D_DESC desc;
+      useAs<ID3D11Texture3D>(resource)->GetDesc(&desc);
+
+      key.format = desc.Format;
+      key.width = desc.Width;
+      key.height = desc.Height;
+      key.depth = desc.Depth;
+      key.mips = desc.MipLevels;
+      key.arraySize = 1;
+    }
+    else {
+      D3D11_TEXTURE2D_DESC desc;
+      useAs<ID3D11Texture2D>(resource)->GetDesc(&desc);
+
+      key.format = desc.Format;
+      key.width = desc.Width;
+      key.height = desc.Height;
+      key.depth = 1;
+      key.mips = desc.MipLevels;
+      key.arraySize = desc.ArraySize;
+    }
+
+    return key;
+  }
+
+  uint64_t D3D11StagingPool::calcSize(const Key& key) {
+    uint64_t size = 0;
+    for (UINT mip = 0; mip < key.mips; mip++) {
+      UINT width = std::max(1u, key.width >> mip);
+      UINT height = std::max(1u, key.height >> mip);
+      UINT depth = std::max(1u, key.depth >> mip);
+
+      size += uint64_t(rowPitch(key.format, width)) * rowCount(key.format, height) * depth;
+    }
+
+    return size * key.arraySize;
+  }
+
+  HRESULT D3D11StagingPool::create(const Key& key, Com<ID3D11Resource>& staging) {
+    HRESULT result;
+
+    if (key.dimension == D3D11_RESOURCE_DIMENSION_TEXTURE3D) {
+      D3D11_TEXTURE3D_DESC desc;
+      desc.Width = key.width;
+      desc.Height = key.height;
+      desc.Depth = key.depth;
+      desc.MipLevels = key.mips;
+      desc.Format = key.format;
+      desc.Usage = D3D11_USAGE_STAGING;
+      desc.BindFlags = 0;
+      desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
+      desc.MiscFlags = 0;
+
+      result = m_device->CreateTexture3D(&desc, nullptr, reinterpret_cast<ID3D11Texture3D**>(&staging));
+    }
+    else {
+      D3D11_TEXTURE2D_DESC desc;
+      desc.Width = key.width;
+      desc.Height = key.height;
+      desc.MipLevels = key.mips;
+      desc.ArraySize = key.arraySize;
+      desc.Format = key.format;
+      desc.SampleDesc.Count = 1;
+      desc.SampleDesc.Quality = 0;
+      desc.Usage = D3D11_USAGE_STAGING;
+      desc.BindFlags = 0;
+      desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
+      desc.MiscFlags = 0;
+
+      result = m_device->CreateTexture2D(&desc, nullptr, reinterpret_cast<ID3D11Texture2D**>(&staging));
+    }
+
+    return result;
+  }
+
+  bool D3D11StagingPool::isRetired(ID3D11DeviceContext* context, const Entry& entry) {
+    if (entry.fence == nullptr)
+      return true;
+
+    return context->GetData(entry.fence.ptr(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK;
+  }
+
+  bool D3D11StagingPool::acquire(ID3D11DeviceContext* context, DXUPResource* owner, ID3D11Resource* resource, Com<ID3D11Resource>& staging, bool* intact) {
+    Key key = makeKey(resource);
+
+    EnterCriticalSection(&m_lock);
+
+    // Our own old one is best, it saves the caller refilling it. Otherwise the oldest one the GPU is done with,
+    // taking a busy one would just move the wait to the Map after.
+    auto match = m_idle.end();
+    for (auto entry = m_idle.begin(); entry != m_idle.end(); ++entry) {
+      if (!(entry->key == key))
+        continue;
+
+      if (entry->owner == owner) {
+        match = entry;
+        break;
+      }
+
+      if (match == m_idle.end() && isRetired(context, *entry))
+        match = entry;
+    }
+
+    if (match != m_idle.end()) {
+      *intact = match->owner == owner;
+      staging = std::move(match->staging);
+
+      if (*intact)
+        m_intact++;
+      else
+        m_reused++;
+
+      if (match->fence != nullptr)
+        m_freeFences.push_back(std::move(match->fence));
+
+      m_idleBytes -= match->size;
+      m_idle.erase(match);
+
+      LeaveCriticalSection(&m_lock);
+      return true;
+    }
+
+    LeaveCriticalSection(&m_lock);
+
+    *intact = false;
+
+    HRESULT result = create(key, staging);
+    if (FAILED(result)) {
+      log::warn("D3D11StagingPool: failed to create staging texture (%ux%ux%u, format: %d).", key.width, key.height, key.depth, key.format);
+      return false;
+    }
+
+    EnterCriticalSection(&m_lock);
+    m_created++;
+    m_totalBytes += calcSize(key);
+    m_peakBytes = std::max(m_peakBytes, m_totalBytes);
+    LeaveCriticalSection(&m_lock);
+
+    return true;
+  }
+
+  void D3D11StagingPool::release(ID3D11DeviceContext* context, DXUPResource* owner, ID3D11Resource* staging) {
+    Entry entry;
+    entry.key = makeKey(staging);
+    entry.size = calcSize(entry.key);
+    entry.staging = staging;
+    entry.owner = owner;
+
+    EnterCriticalSection(&m_lock);
+
+    if (context != nullptr) {
+      if (!m_freeFences.empty()) {
+        entry.fence = std::move(m_freeFences.back());
+        m_freeFences.pop_back();
+      }
+      else {
+        D3D11_QUERY_DESC desc = { D3D11_QUERY_EVENT, 0 };
+        m_device->CreateQuery(&desc, &entry.fence);
+      }
+
+      if (entry.fence != nullptr)
+        context->End(entry.fence.ptr());
+    }
+
+    m_idle.push_back(std::move(entry));
+    m_idleBytes += m_idle.back().size;
+    trim();
+
+    LeaveCriticalSection(&m_lock);
+  }
+
+  void D3D11StagingPool::forget(DXUPResource* owner) {
+    EnterCriticalSection(&m_lock);
+
+    for (Entry& entry : m_idle) {
+      if (entry.owner == owner)
+        entry.owner = nullptr;
+    }
+
+    LeaveCriticalSection(&m_lock);
+  }
+
+  void D3D11StagingPool::evict(std::list<Entry>::iterator entry) {
+    if (entry->fence != nullptr)
+      m_freeFences.push_back(std::move(entry->fence));
+
+    m_idleBytes -= entry->size;
+    m_totalBytes -= entry->size;
+    m_evicted++;
+
+    m_idle.erase(entry);
+  }
+
+  void D3D11StagingPool::trim() {
+    if (m_idle.empty())
+      return;
+
+    // What was just given back goes last, and only if nobody owns it. A texture bigger than the whole budget
+    // would otherwise be thrown out on every release and cost a new staging texture and a full refill on every lock.
+    auto newest = std::prev(m_idle.end());
+    while (m_idleBytes > m_budget && m_idle.begin() != newest)
+      evict(m_idle.begin());
+
+    if (m_idleBytes > m_budget && newest->owner == nullptr)
+      evict(newest);
+  }
+
+  void D3D11StagingPool::logStats() {
+    log::msg("Staging pool: %llu created, %llu reused, %llu reclaimed intact, %llu evicted, %llu bytes live (%llu idle), %llu bytes peak.",
+      m_created,
+      m_reused,
+      m_intact,
+      m_evicted,
+      m_totalBytes,
+      m_idleBytes,
+      m_peakBytes);
+  }
+
+}
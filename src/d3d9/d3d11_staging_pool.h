@@ -0,0 +1,86 @@
+#pragma once
+
+#include "d3d9_base.h"
+#include <list>
+#include <vector>
+
+namespace dxup {
+
+  class DXUPResource;
+
+  // Staging textures shared by every DEFAULT texture on the device.
+  // A texture borrows one while it is locked or read back and hands it back once the copy out of it is queued.
+  // Idle ones are kept, least recently returned first out, up to a budget so the next lock of that shape needs no new allocation.
+  // The one returned last is kept past the budget while its owner is alive.
+  class D3D11StagingPool {
+
+  public:
+
+    D3D11StagingPool(ID3D11Device* device, uint64_t budget);
+    ~D3D11StagingPool();
+
+    // Finds or makes a staging texture with resource's layout.
+    // intact is set if it's the one owner gave back last and nobody has had it since, it then still holds what owner left in it.
+    bool acquire(ID3D11DeviceContext* context, DXUPResource* owner, ID3D11Resource* resource, Com<ID3D11Resource>& staging, bool* intact);
+
+    // Fences the staging on context so it's only handed to someone else once the GPU is done with it.
+    // Without a context it is assumed to be free already.
+    void release(ID3D11DeviceContext* context, DXUPResource* owner, ID3D11Resource* staging);
+
+    // owner is going away, nothing it gave back is intact for whoever gets its address next.
+    void forget(DXUPResource* owner);
+
+    void logStats();
+
+  private:
+
+    struct Key {
+      D3D11_RESOURCE_DIMENSION dimension;
+      DXGI_FORMAT format;
+      UINT width;
+      UINT height;
+      UINT depth;
+      UINT mips;
+      UINT arraySize;
+
+      bool operator == (const Key& other) const;
+    };
+
+    struct Entry {
+      Key key;
+      uint64_t size;
+      Com<ID3D11Resource> staging;
+      Com<ID3D11Query> fence;
+      DXUPResource* owner;
+    };
+
+    static Key makeKey(ID3D11Resource* resource);
+    static uint64_t calcSize(const Key& key);
+
+    HRESULT create(const Key& key, Com<ID3D11Resource>& staging);
+    bool isRetired(ID3D11DeviceContext* context, const Entry& entry);
+    void evict(std::list<Entry>::iterator entry);
+    void trim();
+
+    // I exist as long as my parent D3D9 device exists. No need for COM.
+    ID3D11Device* m_device;
+    uint64_t m_budget;
+
+    // Textures can be released on the command stream's worker.
+    CRITICAL_SECTION m_lock;
+
+    std::list<Entry> m_idle;
+    std::vector<Com<ID3D11Query>> m_freeFences;
+
+    uint64_t m_idleBytes;
+    uint64_t m_totalBytes;
+    uint64_t m_peakBytes;
+
+    uint64_t m_created;
+    uint64_t m_reused;
+    uint64_t m_intact;
+    uint64_t m_evicted;
+
+  };
+
+}
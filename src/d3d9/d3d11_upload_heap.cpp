@@ -0,0 +1,129 @@
+#include "d3d11_upload_heap.h"
+#include <cstring>
+#include <algorithm>
+
+namespace dxup {
+
+  namespace {
+    const uint32_t geometryAlignment = 16;
+    // *SetConstantBuffers1 offsets are in multiples of 16 constants.
+    const uint32_t constantAlignment = 16 * 4 * sizeof(float);
+  }
+
+  D3D11UploadHeap::D3D11UploadHeap(ID3D11Device* device)
+    : m_geometry{ device, D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_INDEX_BUFFER, geometryAlignment }
+    , m_constants{ device, D3D11_BIND_CONSTANT_BUFFER, constantAlignment }
+    , m_mappedRing{ nullptr }
+    , m_mappedData{ nullptr }
+    , m_mappedOffset{ 0 }
+    , m_mappedLength{ 0 }
+    , m_cursor{ 0 }
+    , m_peakFrameBytes{ 0 }
+    , m_frames{ 0 }
+    , m_maps{ 0 } {
+    m_frameBytes.fill(0);
+    m_totalBytes.fill(0);
+  }
+
+  uint32_t D3D11UploadHeap::alignedLength(uint32_t length) {
+    return alignTo(length, geometryAlignment);
+  }
+
+  D3D11RingBuffer& D3D11UploadHeap::getRing(uint32_t usage) {
+    return usage == uploadUsage::constants ? m_constants : m_geometry;
+  }
+
+  void D3D11UploadHeap::begin(ID3D11DeviceContext* context, uint32_t usage, uint32_t length) {
+    if (m_mappedRing != nullptr) {
+      log::warn("D3D11UploadHeap: begin called while already mapped.");
+      end(context);
+    }
+
+    D3D11RingBuffer& ring = getRing(usage);
+    ring.reserve(context, length);
+
+    void* data;
+    ring.map(context, &data, length);
+
+    m_mappedRing = &ring;
+    m_mappedOffset = ring.getOffset();
+    m_mappedData = reinterpret_cast<uint8_t*>(data);
+    m_mappedLength = length;
+    m_cursor = 0;
+    m_maps++;
+  }
+
+  void* D3D11UploadHeap::push(uint32_t usage, uint32_t length, uint32_t* offset) {
+    if (m_mappedRing != &getRing(usage) || m_cursor + length > m_mappedLength) {
+      log::fail("D3D11UploadHeap: push doesn't fit what was mapped.");
+      return nullptr;
+    }
+
+    // The ring keeps us aligned on the outside so we only need to keep pushes aligned relative to each other.
+    void* data = m_mappedData + m_cursor;
+    *offset = m_mappedOffset + m_cursor;
+    m_cursor += usage == uploadUsage::constants ? alignTo(length, constantAlignment) : alignedLength(length);
+
+    m_frameBytes[usage] += length;
+    return data;
+  }
+
+  uint32_t D3D11UploadHeap::push(uint32_t usage, const void* data, uint32_t length) {
+    uint32_t offset = 0;
+    void* dst = push(usage, length, &offset);
+    if (dst != nullptr)
+      std::memcpy(dst, data, length);
+
+    return offset;
+  }
+
+  ID3D11Buffer* D3D11UploadHeap::end(ID3D11DeviceContext* context) {
+    if (m_mappedRing == nullptr)
+      return nullptr;
+
+    m_mappedRing->unmap(context, m_cursor);
+
+    ID3D11Buffer* buffer = m_mappedRing->getBuffer();
+    m_mappedRing = nullptr;
+    m_mappedData = nullptr;
+
+    return buffer;
+  }
+
+  uint32_t D3D11UploadHeap::upload(ID3D11DeviceContext* context, uint32_t usage, const void* data, uint32_t length, ID3D11Buffer** buffer) {
+    begin(context, usage, length);
+    uint32_t offset = push(usage, data, length);
+    *buffer = end(context);
+
+    return offset;
+  }
+
+  void D3D11UploadHeap::endFrame(ID3D11DeviceContext* context) {
+    m_geometry.endFrame(context);
+    m_constants.endFrame(context);
+
+    uint64_t frameBytes = 0;
+    for (uint32_t i = 0; i < uploadUsage::count; i++) {
+      frameBytes += m_frameBytes[i];
+      m_totalBytes[i] += m_frameBytes[i];
+    }
+
+    m_frameBytes.fill(0);
+    m_peakFrameBytes = std::max(m_peakFrameBytes, frameBytes);
+    m_frames++;
+  }
+
+  void D3D11UploadHeap::logStats() {
+    if (m_frames == 0)
+      return;
+
+    log::msg("Upload heap: %llu bytes/frame average (vertices: %llu, indices: %llu, constants: %llu), %llu bytes peak, %llu maps/frame.",
+      (m_totalBytes[uploadUsage::vertices] + m_totalBytes[uploadUsage::indices] + m_totalBytes[uploadUsage::constants]) / m_frames,
+      m_totalBytes[uploadUsage::vertices] / m_frames,
+      m_totalBytes[uploadUsage::indices] / m_frames,
+      m_totalBytes[uploadUsage::constants] / m_frames,
+      m_peakFrameBytes,
+      m_maps / m_frames);
+  }
+
+}
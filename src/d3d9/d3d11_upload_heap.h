@@ -0,0 +1,66 @@
+#pragma once
+
+#include "d3d9_base.h"
+#include "d3d11_ring_buffer.h"
+#include <array>
+
+namespace dxup {
+
+  namespace uploadUsage {
+    enum : uint32_t {
+      vertices,
+      indices,
+      constants,
+
+      count
+    };
+  }
+
+  // Everything transient a draw needs goes through here.
+  // Vertices and indices share one backing ring, constant buffers can't be bound as anything else so they get their own.
+  class D3D11UploadHeap {
+
+  public:
+
+    D3D11UploadHeap(ID3D11Device* device);
+
+    // Rounds a push up to where the next one would start, sum these for begin.
+    static uint32_t alignedLength(uint32_t length);
+
+    // Maps once for several pushes that go into the same backing buffer.
+    // Pushes return their offset in the buffer that end hands back.
+    void begin(ID3D11DeviceContext* context, uint32_t usage, uint32_t length);
+    uint32_t push(uint32_t usage, const void* data, uint32_t length);
+    // For when the data gets generated in place, returns where to write it.
+    void* push(uint32_t usage, uint32_t length, uint32_t* offset);
+    ID3D11Buffer* end(ID3D11DeviceContext* context);
+
+    // Single push shorthand, returns the offset.
+    uint32_t upload(ID3D11DeviceContext* context, uint32_t usage, const void* data, uint32_t length, ID3D11Buffer** buffer);
+
+    void endFrame(ID3D11DeviceContext* context);
+
+    void logStats();
+
+  private:
+
+    D3D11RingBuffer& getRing(uint32_t usage);
+
+    D3D11RingBuffer m_geometry;
+    D3D11RingBuffer m_constants;
+
+    D3D11RingBuffer* m_mappedRing;
+    uint8_t* m_mappedData;
+    uint32_t m_mappedOffset;
+    uint32_t m_mappedLength;
+    uint32_t m_cursor;
+
+    std::array<uint64_t, uploadUsage::count> m_frameBytes;
+    std::array<uint64_t, uploadUsage::count> m_totalBytes;
+    uint64_t m_peakFrameBytes;
+    uint64_t m_frames;
+    uint64_t m_maps;
+
+  };
+
+}
@@ -3,6 +3,8 @@
 #include "d3d9_resource.h"
 #include "d3d9_d3d11_resource.h"
 #include <vector>
+#include <cstring>
+#include <algorithm>
 
 namespace dxup {
 
@@ -64,8 +66,7 @@ namespace dxup {
       : Direct3DVertexBuffer9Base{ device, resource, d3d9Desc } { }
 
     HRESULT STDMETHODCALLTYPE GetDesc(D3DVERTEXBUFFER_DESC *pDesc) override {
-      D3D11_BUFFER_DESC desc;
-      this->GetDXUPResource()->GetResourceAs<ID3D11Buffer>()->GetDesc(&desc);
+      const D3D11_BUFFER_DESC& desc = this->GetDXUPResource()->GetBufferDesc();
 
       pDesc->Format = D3DFMT_VERTEXDATA;
       pDesc->FVF = this->GetD3D9Desc().FVF;
@@ -82,12 +83,59 @@ namespace dxup {
   class Direct3DIndexBuffer9 final : public Direct3DIndexBuffer9Base {
   public:
     Direct3DIndexBuffer9(Direct3DDevice9Ex* device, DXUPResource* resource, const D3D9ResourceDesc& d3d9Desc)
-      : Direct3DIndexBuffer9Base{ device, resource, d3d9Desc } {}
+      : Direct3DIndexBuffer9Base{ device, resource, d3d9Desc }
+      , m_lockData{ nullptr }
+      , m_lockOffset{ 0 }
+      , m_lockSize{ 0 }
+      , m_lockReadOnly{ false } {}
 
-    HRESULT STDMETHODCALLTYPE GetDesc(D3DINDEXBUFFER_DESC *pDesc) override {
-      D3D11_BUFFER_DESC d3d11Desc;
-      this->GetDXUPResource()->GetResourceAs<ID3D11Buffer>()->GetDesc(&d3d11Desc);
+    HRESULT STDMETHODCALLTYPE Lock(UINT OffsetToLock, UINT SizeToLock, void** ppbData, DWORD Flags) override {
+      HRESULT result = Direct3DIndexBuffer9Base::Lock(OffsetToLock, SizeToLock, ppbData, Flags);
+      if (FAILED(result))
+        return result;
+
+      m_lockData = reinterpret_cast<uint8_t*>(*ppbData);
+      m_lockOffset = OffsetToLock;
+      m_lockSize = SizeToLock == 0 ? getSize() - OffsetToLock : SizeToLock;
+      m_lockReadOnly = (Flags & D3DLOCK_READONLY) != 0;
+
+      return D3D_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE Unlock() override {
+      if (m_lockData != nullptr && !m_lockReadOnly) {
+        // Only buffers that got drawn as fans have a shadow, grab what the app wrote before it goes away.
+        if (!m_shadow.empty())
+          std::memcpy(&m_shadow[m_lockOffset], m_lockData, std::min(m_lockSize, uint32_t(m_shadow.size()) - m_lockOffset));
+      }
+
+      m_lockData = nullptr;
+      return Direct3DIndexBuffer9Base::Unlock();
+    }
+
+    // Where the PrimitiveCount + 2 indices of a fan from StartIndex are on the CPU. Write-only buffers already keep what the app wrote,
+    // others get a shadow read back once and kept current by Unlock. Only good until the app next locks us.
+    HRESULT GetFanIndices(UINT StartIndex, UINT PrimitiveCount, const uint8_t** ppIndices) {
+      *ppIndices = nullptr;
+
+      const UINT indexSize = this->GetD3D9Desc().Format == D3DFMT_INDEX32 ? 4 : 2;
+      if (uint64_t(StartIndex) + PrimitiveCount + 2 > getSize() / indexSize)
+        return log::d3derr(D3DERR_INVALIDCALL, "GetFanIndices: fan of %u primitives from index %u runs past the end of the buffer.", PrimitiveCount, StartIndex);
+
+      const uint8_t* data = this->GetDXUPResource()->GetBufferData();
+      if (data == nullptr) {
+        if (m_shadow.empty() && !createShadow())
+          return log::d3derr(D3DERR_INVALIDCALL, "GetFanIndices: failed to read back index data.");
+
+        data = m_shadow.data();
+      }
 
+      *ppIndices = data + StartIndex * indexSize;
+      return D3D_OK;
+    }
+
+    HRESULT STDMETHODCALLTYPE GetDesc(D3DINDEXBUFFER_DESC *pDesc) override {
+      const D3D11_BUFFER_DESC& d3d11Desc = this->GetDXUPResource()->GetBufferDesc();
       const D3D9ResourceDesc& d3d9Desc = this->GetD3D9Desc();
 
       pDesc->Format = d3d9Desc.Format;
@@ -98,6 +146,59 @@ namespace dxup {
 
       return D3D_OK;
     }
+
+  private:
+
+    uint32_t getSize() {
+      return this->GetDXUPResource()->GetBufferDesc().ByteWidth;
+    }
+
+    bool createShadow() {
+      ID3D11DeviceContext* context = this->GetContext();
+      const uint32_t size = getSize();
+
+      // Write-only dynamic buffers have no staging, copy into a throwaway one.
+      Com<ID3D11Resource> readback = this->GetDXUPResource()->GetStaging();
+      if (readback == nullptr) {
+        D3D11_BUFFER_DESC desc;
+        desc.ByteWidth = size;
+        desc.Usage = D3D11_USAGE_STAGING;
+        desc.BindFlags = 0;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+        desc.MiscFlags = 0;
+        desc.StructureByteStride = 0;
+
+        Com<ID3D11Buffer> staging;
+        HRESULT result = this->GetD3D11Device()->CreateBuffer(&desc, nullptr, &staging);
+        if (FAILED(result)) {
+          log::warn("createShadow: failed to create readback buffer.");
+          return false;
+        }
+
+        context->CopyResource(staging.ptr(), this->GetDXUPResource()->GetResource());
+        readback = staging.ptr();
+      }
+
+      D3D11_MAPPED_SUBRESOURCE res;
+      HRESULT result = context->Map(readback.ptr(), 0, D3D11_MAP_READ, 0, &res);
+      if (FAILED(result)) {
+        log::warn("createShadow: failed to map index data.");
+        return false;
+      }
+
+      m_shadow.resize(size);
+      std::memcpy(m_shadow.data(), res.pData, size);
+      context->Unmap(readback.ptr(), 0);
+
+      return true;
+    }
+
+    std::vector<uint8_t> m_shadow;
+
+    uint8_t* m_lockData;
+    uint32_t m_lockOffset;
+    uint32_t m_lockSize;
+    bool m_lockReadOnly;
   };
 
 }
\ No newline at end of file
@@ -0,0 +1,209 @@
+#include "d3d9_command_stream.h"
+#include "d3d9_renderer.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace dxup {
+
+  namespace {
+    size_t alignCommand(size_t length) {
+      const size_t alignment = alignof(std::max_align_t);
+      return (length + alignment - 1) & ~(alignment - 1);
+    }
+  }
+
+  D3D9CommandChunk::D3D9CommandChunk(size_t size)
+    : m_data{ new uint8_t[size] }
+    , m_size{ size }
+    , m_used{ 0 }
+    , m_head{ nullptr }
+    , m_tail{ nullptr } {}
+
+  D3D9CommandChunk::~D3D9CommandChunk() {
+    reset();
+  }
+
+  bool D3D9CommandChunk::fits(size_t length) const {
+    return m_used + alignCommand(length) <= m_size;
+  }
+
+  void* D3D9CommandChunk::alloc(size_t length) {
+    if (!fits(length))
+      return nullptr;
+
+    length = alignCommand(length);
+
+    void* memory = &m_data[m_used];
+    m_used += length;
+    return memory;
+  }
+
+  void D3D9CommandChunk::exec(D3D9ImmediateRenderer* renderer) {
+    for (D3D9Command* command = m_head; command != nullptr; command = command->next)
+      command->exec(renderer);
+
+    reset();
+  }
+
+  void D3D9CommandChunk::reset() {
+    D3D9Command* command = m_head;
+    while (command != nullptr) {
+      D3D9Command* next = command->next;
+      command->~D3D9Command();
+      command = next;
+    }
+
+    m_head = nullptr;
+    m_tail = nullptr;
+    m_used = 0;
+  }
+
+  //
+
+  D3D9CommandStream::D3D9CommandStream(D3D9ImmediateRenderer* renderer)
+    : m_renderer{ renderer }
+    , m_submitted{ 0 }
+    , m_executed{ 0 }
+    , m_stopping{ false }
+    , m_thread{ nullptr }
+    , m_threadId{ 0 } {
+    InitializeCriticalSection(&m_lock);
+    InitializeConditionVariable(&m_submittedCond);
+    InitializeConditionVariable(&m_executedCond);
+
+    m_chunk = allocChunk(chunkSize);
+
+    m_thread = CreateThread(nullptr, 0, threadProc, this, 0, &m_threadId);
+    if (m_thread == nullptr)
+      log::fail("Failed to create command stream thread.");
+  }
+
+  D3D9CommandStream::~D3D9CommandStream() {
+    flush();
+
+    EnterCriticalSection(&m_lock);
+    m_stopping = true;
+    LeaveCriticalSection(&m_lock);
+    WakeAllConditionVariable(&m_submittedCond);
+
+    if (m_thread != nullptr) {
+      WaitForSingleObject(m_thread, INFINITE);
+      CloseHandle(m_thread);
+    }
+
+    DeleteCriticalSection(&m_lock);
+  }
+
+  void D3D9CommandStream::begin(std::initializer_list<size_t> dataLengths) {
+    // Already open, whoever opened it made room for everything.
+    if (m_open)
+      return;
+
+    size_t length = 0;
+    for (size_t dataLength : dataLengths)
+      length += alignCommand(dataLength);
+
+    if (!m_chunk->fits(length + maxCommandSize)) {
+      flush();
+
+      if (!m_chunk->fits(length + maxCommandSize))
+        m_chunk = allocChunk(length + maxCommandSize);
+    }
+
+    m_open = true;
+    m_reserved = length;
+  }
+
+  void* D3D9CommandStream::allocData(size_t length) {
+    if (!m_open)
+      begin({ length });
+
+    // Past what begin() made room for, this could spill into a chunk the command won't be in.
+    if (alignCommand(length) > m_reserved)
+      log::fail("D3D9CommandStream::allocData: command data outgrew what it began with.");
+
+    m_reserved -= std::min(alignCommand(length), m_reserved);
+    return m_chunk->alloc(length);
+  }
+
+  void* D3D9CommandStream::copyData(const void* data, size_t length) {
+    void* memory = allocData(length);
+    std::memcpy(memory, data, length);
+    return memory;
+  }
+
+  uint64_t D3D9CommandStream::flush() {
+    EnterCriticalSection(&m_lock);
+
+    if (!m_chunk->empty()) {
+      m_queue.push_back(std::move(m_chunk));
+      m_submitted++;
+
+      if (!m_freeChunks.empty()) {
+        m_chunk = std::move(m_freeChunks.back());
+        m_freeChunks.pop_back();
+      }
+    }
+
+    uint64_t sequence = m_submitted;
+    LeaveCriticalSection(&m_lock);
+
+    if (m_chunk == nullptr)
+      m_chunk = allocChunk(chunkSize);
+
+    WakeAllConditionVariable(&m_submittedCond);
+    return sequence;
+  }
+
+  void D3D9CommandStream::synchronize(uint64_t sequence) {
+    EnterCriticalSection(&m_lock);
+
+    while (m_executed < sequence)
+      SleepConditionVariableCS(&m_executedCond, &m_lock, INFINITE);
+
+    LeaveCriticalSection(&m_lock);
+  }
+
+  void D3D9CommandStream::synchronize() {
+    synchronize(flush());
+  }
+
+  DWORD WINAPI D3D9CommandStream::threadProc(void* param) {
+    reinterpret_cast<D3D9CommandStream*>(param)->run();
+    return 0;
+  }
+
+  void D3D9CommandStream::run() {
+    EnterCriticalSection(&m_lock);
+
+    while (true) {
+      while (m_queue.empty() && !m_stopping)
+        SleepConditionVariableCS(&m_submittedCond, &m_lock, INFINITE);
+
+      if (m_queue.empty())
+        break;
+
+      std::unique_ptr<D3D9CommandChunk> chunk = std::move(m_queue.front());
+      m_queue.pop_front();
+
+      LeaveCriticalSection(&m_lock);
+      chunk->exec(m_renderer);
+      EnterCriticalSection(&m_lock);
+
+      // Oversized chunks for big UP draws aren't worth keeping around.
+      if (chunk->size() == chunkSize)
+        m_freeChunks.push_back(std::move(chunk));
+
+      m_executed++;
+      WakeAllConditionVariable(&m_executedCond);
+    }
+
+    LeaveCriticalSection(&m_lock);
+  }
+
+  std::unique_ptr<D3D9CommandChunk> D3D9CommandStream::allocChunk(size_t size) {
+    return std::make_unique<D3D9CommandChunk>(size);
+  }
+
+}
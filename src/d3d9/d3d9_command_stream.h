@@ -0,0 +1,176 @@
+#pragma once
+
+#include "d3d9_base.h"
+#include <memory>
+#include <deque>
+#include <initializer_list>
+#include <vector>
+#include <new>
+#include <type_traits>
+
+namespace dxup {
+
+  class D3D9ImmediateRenderer;
+
+  class D3D9Command {
+
+  public:
+
+    virtual ~D3D9Command() {}
+    virtual void exec(D3D9ImmediateRenderer* renderer) = 0;
+
+    D3D9Command* next = nullptr;
+  };
+
+  template <typename Fn>
+  class D3D9TypedCommand final : public D3D9Command {
+
+  public:
+
+    template <typename F>
+    D3D9TypedCommand(F&& fn)
+      : m_fn{ std::forward<F>(fn) } {}
+
+    void exec(D3D9ImmediateRenderer* renderer) override {
+      m_fn(renderer);
+    }
+
+  private:
+
+    Fn m_fn;
+  };
+
+  // Linear block holding a run of commands and any app data they copied.
+  class D3D9CommandChunk {
+
+  public:
+
+    D3D9CommandChunk(size_t size);
+    ~D3D9CommandChunk();
+
+    bool fits(size_t length) const;
+    void* alloc(size_t length);
+
+    template <typename Fn>
+    bool push(Fn&& fn) {
+      using Command = D3D9TypedCommand<std::decay_t<Fn>>;
+
+      void* memory = alloc(sizeof(Command));
+      if (memory == nullptr)
+        return false;
+
+      D3D9Command* command = new (memory) Command(std::forward<Fn>(fn));
+
+      if (m_tail != nullptr)
+        m_tail->next = command;
+      else
+        m_head = command;
+
+      m_tail = command;
+      return true;
+    }
+
+    // Runs everything in order then empties the chunk for reuse.
+    void exec(D3D9ImmediateRenderer* renderer);
+    void reset();
+
+    bool empty() const {
+      return m_used == 0;
+    }
+
+    size_t size() const {
+      return m_size;
+    }
+
+  private:
+
+    std::unique_ptr<uint8_t[]> m_data;
+    size_t m_size;
+    size_t m_used;
+
+    D3D9Command* m_head;
+    D3D9Command* m_tail;
+  };
+
+  // Records renderer calls on the app's thread and plays them back on a worker that owns the D3D11 context.
+  // Anything else that wants the context has to synchronize() first.
+  class D3D9CommandStream {
+
+  public:
+
+    D3D9CommandStream(D3D9ImmediateRenderer* renderer);
+    ~D3D9CommandStream();
+
+    static const size_t chunkSize = 64 << 10;
+    static const size_t maxCommandSize = 256;
+
+    template <typename Fn>
+    void emit(Fn&& fn) {
+      static_assert(sizeof(D3D9TypedCommand<std::decay_t<Fn>>) <= maxCommandSize, "Command too large, copy its data with copyData.");
+
+      m_open = false;
+      m_reserved = 0;
+
+      if (m_chunk->push(std::forward<Fn>(fn)))
+        return;
+
+      flush();
+      m_chunk->push(std::forward<Fn>(fn));
+    }
+
+    // Makes room in one chunk for the next command and each of its allocData calls, flushing at most once.
+    // Data in a flushed chunk gets recycled once the worker is through with it, so the command has to land next to it.
+    // Does nothing if the command has already begun.
+    void begin(std::initializer_list<size_t> dataLengths);
+
+    // Space in the stream for the next emitted command's data, it stays valid until that command has run.
+    // Commands taking more than one block have to begin() with all of them first.
+    void* allocData(size_t length);
+    void* copyData(const void* data, size_t length);
+
+    // Hands the current chunk to the worker, returns its sequence number.
+    uint64_t flush();
+
+    // Chunks handed to the worker so far.
+    uint64_t submitted() const {
+      return m_submitted;
+    }
+
+    // Waits for the worker to finish the given chunk, or everything recorded so far.
+    void synchronize(uint64_t sequence);
+    void synchronize();
+
+    bool isWorkerThread() const {
+      return GetCurrentThreadId() == m_threadId;
+    }
+
+  private:
+
+    static DWORD WINAPI threadProc(void* param);
+    void run();
+
+    std::unique_ptr<D3D9CommandChunk> allocChunk(size_t size);
+
+    D3D9ImmediateRenderer* m_renderer;
+
+    std::unique_ptr<D3D9CommandChunk> m_chunk;
+
+    // Whether a command has begun but not been emitted, and how much of its data is still to be allocated.
+    bool m_open = false;
+    size_t m_reserved = 0;
+
+    CRITICAL_SECTION m_lock;
+    CONDITION_VARIABLE m_submittedCond;
+    CONDITION_VARIABLE m_executedCond;
+
+    std::deque<std::unique_ptr<D3D9CommandChunk>> m_queue;
+    std::vector<std::unique_ptr<D3D9CommandChunk>> m_freeChunks;
+    uint64_t m_submitted;
+    uint64_t m_executed;
+    bool m_stopping;
+
+    HANDLE m_thread;
+    DWORD m_threadId;
+  };
+
+}
@@ -4,9 +4,12 @@
 #include "d3d9_base.h"
 #include <array>
 #include <memory>
+#include <vector>
 #include <cstring>
+#include <algorithm>
 #include "../util/vectypes.h"
-#include "d3d11_dynamic_buffer.h"
+#include "d3d11_upload_heap.h"
+#include "d3d11_context_shadow.h"
 
 namespace dxup {
 
@@ -20,6 +23,37 @@ namespace dxup {
     std::array<Vector<float, 4>, 256> floatConstants;
     std::array<Vector<int, 4>, 16> intConstants;
     std::array<int, 16> boolConstants;
+
+    // Shaders see the bools as a single word, bit n set if bN is.
+    uint32_t packBools() const {
+      uint32_t bits = 0;
+      for (uint32_t i = 0; i < boolConstants.size(); i++) {
+        if (boolConstants[i] != 0)
+          bits |= 1u << i;
+      }
+      return bits;
+    }
+  };
+
+  struct D3D9ConstantRange {
+    uint32_t begin = UINT32_MAX;
+    uint32_t end = 0;
+
+    void add(uint32_t first, uint32_t count) {
+      begin = std::min(begin, first);
+      end = std::max(end, first + count);
+    }
+
+    bool empty() const {
+      return begin >= end;
+    }
+  };
+
+  // Registers written since the last upload.
+  struct D3D9ConstantRanges {
+    D3D9ConstantRange floats;
+    D3D9ConstantRange ints;
+    D3D9ConstantRange bools;
   };
 
   template <bool Pixel>
@@ -27,11 +61,37 @@ namespace dxup {
 
   public:
 
-    D3D9ConstantBuffer(ID3D11Device1* device, ID3D11DeviceContext1* context)
+    D3D9ConstantBuffer(ID3D11Device1* device, ID3D11DeviceContext1* context, D3D11ContextShadow* shadow, D3D11UploadHeap* heap)
       : m_device{ device }
       , m_context{ context }
-      , m_buffer{ device, D3D11_BIND_CONSTANT_BUFFER }
+      , m_shadow{ shadow }
+      , m_heap{ heap }
+      , m_boundBuffer{ nullptr }
       , m_offset{ 0 } {
+      // Partial constant buffer updates let us only send the registers that changed.
+      // Otherwise we fall back to uploading everything into the dynamic buffer.
+      D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+      HRESULT result = m_device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options));
+      if (FAILED(result) || !options.ConstantBufferPartialUpdate)
+        return;
+
+      D3D11_BUFFER_DESC desc;
+      desc.ByteWidth = getLength();
+      desc.Usage = D3D11_USAGE_DEFAULT;
+      desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+      desc.CPUAccessFlags = 0;
+      desc.MiscFlags = 0;
+      desc.StructureByteStride = 0;
+
+      std::vector<uint8_t> zeroes(getLength());
+      D3D11_SUBRESOURCE_DATA data;
+      data.pSysMem = zeroes.data();
+      data.SysMemPitch = 0;
+      data.SysMemSlicePitch = 0;
+
+      result = m_device->CreateBuffer(&desc, &data, &m_partialBuffer);
+      if (FAILED(result))
+        log::warn("D3D9ConstantBuffer: failed to create partial update buffer, uploading everything instead.");
     }
 
     constexpr uint32_t getConstantSize() {
@@ -39,7 +99,8 @@ namespace dxup {
     }
 
     constexpr uint32_t getLength() {
-      uint32_t length = sizeof(D3D9ShaderConstants::floatConstants) + sizeof(D3D9ShaderConstants::intConstants) + (4 * sizeof(D3D9ShaderConstants::boolConstants));
+      // Bools get one register, see packBools.
+      uint32_t length = sizeof(D3D9ShaderConstants::floatConstants) + sizeof(D3D9ShaderConstants::intConstants) + getConstantSize();
       return alignTo(length, 16 * getConstantSize());
     }
 
@@ -47,24 +108,28 @@ namespace dxup {
       return getLength() / (getConstantSize());
     }
 
-    void update(const D3D9ShaderConstants& constants) {
+    void update(const D3D9ShaderConstants& constants, const D3D9ConstantRanges& dirty) {
+      if (m_partialBuffer != nullptr) {
+        updatePartial(constants, dirty);
+        return;
+      }
+
       const uint32_t length = getLength();
-      m_buffer.reserve(length); // TODO make bool constants a bitfield.
 
-      uint8_t* data;
-      m_buffer.map(m_context, (void**)(&data), length);
+      // Without partial updates every change sends the whole block, written straight into the upload heap.
+      // Looking for an earlier upload with the same contents would mean hashing and comparing all of it, which costs what the copy does.
+      m_heap->begin(m_context, uploadUsage::constants, length);
 
-      // This can probably be consolidated into a single one.
-      std::memcpy(data, constants.floatConstants.data(), sizeof(constants.floatConstants));
-      std::memcpy(data + sizeof(constants.floatConstants), constants.intConstants.data(), sizeof(constants.intConstants));
+      uint8_t* data = reinterpret_cast<uint8_t*>(m_heap->push(uploadUsage::constants, length, &m_offset));
+      if (data != nullptr) {
+        std::memcpy(data, constants.floatConstants.data(), sizeof(constants.floatConstants));
+        std::memcpy(data + sizeof(constants.floatConstants), constants.intConstants.data(), sizeof(constants.intConstants));
 
-      int* boolData = (int*)(data + sizeof(constants.floatConstants) + sizeof(constants.intConstants));
-      for (uint32_t i = 0; i < constants.boolConstants.size(); i++) {
-        for (uint32_t j = 0; j < 4; j++)
-          boolData[i * 4 + j] = constants.boolConstants[i];
+        const std::array<uint32_t, 4> boolData = { constants.packBools(), 0, 0, 0 };
+        std::memcpy(data + sizeof(constants.floatConstants) + sizeof(constants.intConstants), boolData.data(), sizeof(boolData));
       }
 
-      m_offset = m_buffer.unmap(m_context, length);
+      m_boundBuffer = m_heap->end(m_context);
       bind();
     }
 
@@ -72,26 +137,46 @@ namespace dxup {
       const uint32_t constantOffset = m_offset / getConstantSize();
       const uint32_t constantCount = getConstantCount();
 
-      ID3D11Buffer* buffer = m_buffer.getBuffer();
-
-      if constexpr (Pixel)
-        m_context->PSSetConstantBuffers1(0, 1, &buffer, &constantOffset, &constantCount);
-      else
-        m_context->VSSetConstantBuffers1(0, 1, &buffer, &constantOffset, &constantCount);
+      m_shadow->setConstantBuffer<Pixel>(m_boundBuffer, constantOffset, constantCount);
     }
 
-    void endFrame() {
-      m_buffer.endFrame();
+  private:
+
+    void updatePartial(const D3D9ShaderConstants& constants, const D3D9ConstantRanges& dirty) {
+      const uint32_t intOffset = sizeof(constants.floatConstants);
+      const uint32_t boolOffset = intOffset + sizeof(constants.intConstants);
+
+      if (!dirty.floats.empty())
+        updateRegion(dirty.floats.begin * getConstantSize(), &constants.floatConstants[dirty.floats.begin], (dirty.floats.end - dirty.floats.begin) * getConstantSize());
+
+      if (!dirty.ints.empty())
+        updateRegion(intOffset + dirty.ints.begin * getConstantSize(), &constants.intConstants[dirty.ints.begin], (dirty.ints.end - dirty.ints.begin) * getConstantSize());
+
+      if (!dirty.bools.empty()) {
+        const std::array<uint32_t, 4> boolData = { constants.packBools(), 0, 0, 0 };
+        updateRegion(boolOffset, boolData.data(), sizeof(boolData));
+      }
+
+      m_shadow->setConstantBuffer<Pixel>(m_partialBuffer.ptr(), 0, getConstantCount());
     }
 
-  private:
+    void updateRegion(uint32_t offset, const void* data, uint32_t length) {
+      D3D11_BOX box = { offset, 0, 0, offset + length, 1, 1 };
+      m_context->UpdateSubresource1(m_partialBuffer.ptr(), 0, &box, data, 0, 0, 0);
+    }
 
     // I exist as long as my parent D3D9 device exists. No need for COM.
     ID3D11Device1* m_device;
     ID3D11DeviceContext1* m_context;
+    D3D11ContextShadow* m_shadow;
+
+    D3D11UploadHeap* m_heap;
 
-    D3D11DynamicBuffer m_buffer;
+    // Where our last upload went, the heap keeps older chunks alive until the GPU is done with them.
+    ID3D11Buffer* m_boundBuffer;
     uint32_t m_offset;
+
+    Com<ID3D11Buffer> m_partialBuffer;
   };
 
 }
\ No newline at end of file
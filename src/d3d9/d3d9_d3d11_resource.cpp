@@ -1,6 +1,13 @@
 #include "d3d9_d3d11_resource.h"
 #include "d3d9_util.h"
+#include "d3d9_format.h"
+#include "d3d9_format_convert.h"
+#include "d3d11_staging_pool.h"
+#include "../util/config.h"
+#include "../util/misc_helpers.h"
 #include <algorithm>
+#include <cstring>
+#include <malloc.h>
 
 namespace dxup {
 
@@ -11,7 +18,7 @@ namespace dxup {
     if (d3d11Usage == D3D11_USAGE_DEFAULT)
       return true;
 
-    if (d3d9Format == D3DFMT_R8G8B8)
+    if (needsConversion(d3d9Format))
       return true;
 
     if (d3d11Usage == D3D11_USAGE_STAGING)
@@ -23,6 +30,12 @@ namespace dxup {
     return false;
   }
 
+  // Textures that are only locked now and then shouldn't each hold on to a staging copy of themselves.
+  // Converted formats need their fixup texture to line up with the staging one, so those keep their own.
+  bool DXUPResource::CanPoolStaging(D3D11_USAGE d3d11Usage, D3DFORMAT d3d9Format) {
+    return d3d11Usage == D3D11_USAGE_DEFAULT && !needsConversion(d3d9Format);
+  }
+
   DXUPResource* DXUPResource::CreateTexture3D(Direct3DDevice9Ex* device, ID3D11Texture3D* texture, DWORD d3d9Usage, D3DFORMAT d3d9Format) {
     D3D11_TEXTURE3D_DESC desc;
     texture->GetDesc(&desc);
@@ -45,17 +58,25 @@ namespace dxup {
       device->GetD3D11Device()->CreateShaderResourceView(texture, &srvDesc, &srvSRGB);
     }
 
+    bool pooled = CanPoolStaging(desc.Usage, d3d9Format);
+
     Com<ID3D11Texture3D> stagingTexture;
-    if (NeedsStaging(desc.Usage, d3d9Usage, d3d9Format)) {
+    Com<ID3D11Texture3D> fixup8888;
+    if (!pooled && NeedsStaging(desc.Usage, d3d9Usage, d3d9Format)) {
       makeStagingDesc(desc, d3d9Usage, d3d9Format);
 
       device->GetD3D11Device()->CreateTexture3D(&desc, nullptr, &stagingTexture);
 
-      if (d3d9Format == D3DFMT_R8G8B8)
-        log::warn("CreateTexture3D: has format D3DFMT_R8G8B8.");
+      if (needsConversion(d3d9Format))
+        device->GetD3D11Device()->CreateTexture3D(&desc, nullptr, &fixup8888);
     }
 
-    return new DXUPResource(device, texture, stagingTexture.ptr(), nullptr, srv.ptr(), srvSRGB.ptr(), desc.Format, 1, std::max(desc.MipLevels, 1u), desc.Usage == D3D11_USAGE_DYNAMIC);
+    DXUPResource* resource = new DXUPResource(device, texture, stagingTexture.ptr(), fixup8888.ptr(), srv.ptr(), srvSRGB.ptr(), desc.Format, desc.Width, desc.Height, desc.Depth, 1, std::max(desc.MipLevels, 1u), desc.Usage == D3D11_USAGE_DYNAMIC);
+    resource->m_pooledStaging = pooled;
+    resource->m_autogenMips = d3d9Usage & D3DUSAGE_AUTOGENMIPMAP;
+    if (resource->m_fixup8888 != nullptr)
+      resource->m_conversionFormat = d3d9Format;
+    return resource;
   }
 
   DXUPResource* DXUPResource::CreateTexture2D(Direct3DDevice9Ex* device, ID3D11Texture2D* texture, DWORD d3d9Usage, D3DFORMAT d3d9Format) {
@@ -89,32 +110,114 @@ namespace dxup {
       device->GetD3D11Device()->CreateShaderResourceView(texture, &srvDesc, &srvSRGB);
     }
 
+    // Multisampled textures can't be copied to staging directly.
+    bool pooled = CanPoolStaging(desc.Usage, d3d9Format) && desc.SampleDesc.Count == 1;
+
     Com<ID3D11Texture2D> stagingTexture;
     Com<ID3D11Texture2D> fixup8888;
-    if (NeedsStaging(desc.Usage, d3d9Usage, d3d9Format)) {
+    if (!pooled && NeedsStaging(desc.Usage, d3d9Usage, d3d9Format)) {
       makeStagingDesc(desc, d3d9Usage, d3d9Format);
 
       device->GetD3D11Device()->CreateTexture2D(&desc, nullptr, &stagingTexture);
 
-      if (d3d9Format == D3DFMT_R8G8B8)
+      if (needsConversion(d3d9Format))
         device->GetD3D11Device()->CreateTexture2D(&desc, nullptr, &fixup8888);
     }
 
-    return new DXUPResource(device, texture, stagingTexture.ptr(), fixup8888.ptr(), srv.ptr(), srvSRGB.ptr(), desc.Format, desc.ArraySize, std::max(desc.MipLevels, 1u), desc.Usage == D3D11_USAGE_DYNAMIC);
+    DXUPResource* resource = new DXUPResource(device, texture, stagingTexture.ptr(), fixup8888.ptr(), srv.ptr(), srvSRGB.ptr(), desc.Format, desc.Width, desc.Height, 1, desc.ArraySize, std::max(desc.MipLevels, 1u), desc.Usage == D3D11_USAGE_DYNAMIC);
+    resource->m_pooledStaging = pooled;
+    resource->m_autogenMips = d3d9Usage & D3DUSAGE_AUTOGENMIPMAP;
+    if (resource->m_fixup8888 != nullptr)
+      resource->m_conversionFormat = d3d9Format;
+    return resource;
   }
 
   DXUPResource* DXUPResource::CreateBuffer(Direct3DDevice9Ex* device, ID3D11Buffer* buffer, DWORD d3d9Usage) {
     D3D11_BUFFER_DESC desc;
     buffer->GetDesc(&desc);
 
+    // Nothing reads these back, a copy in plain memory is all the staging they need.
+    // Dynamic ones only need it to keep their locks off the command stream's worker.
+    bool shadowed = desc.Usage == D3D11_USAGE_DEFAULT || (desc.Usage == D3D11_USAGE_DYNAMIC && device->HasCommandStream());
+
+    uint8_t* data = nullptr;
+    if (shadowed && (d3d9Usage & D3DUSAGE_WRITEONLY)) {
+      data = reinterpret_cast<uint8_t*>(_aligned_malloc(desc.ByteWidth, 16));
+      if (data != nullptr)
+        std::memset(data, 0, desc.ByteWidth);
+    }
+
     Com<ID3D11Buffer> stagingBuffer;
-    if (NeedsStaging(desc.Usage, d3d9Usage, D3DFMT_UNKNOWN)) {
-      makeStagingDesc(desc, d3d9Usage, D3DFMT_UNKNOWN);
+    if (data == nullptr && NeedsStaging(desc.Usage, d3d9Usage, D3DFMT_UNKNOWN)) {
+      D3D11_BUFFER_DESC stagingDesc = desc;
+      makeStagingDesc(stagingDesc, d3d9Usage, D3DFMT_UNKNOWN);
 
-      device->GetD3D11Device()->CreateBuffer(&desc, nullptr, &stagingBuffer);
+      device->GetD3D11Device()->CreateBuffer(&stagingDesc, nullptr, &stagingBuffer);
     }
 
-    return new DXUPResource(device, buffer, stagingBuffer.ptr(), nullptr, nullptr, nullptr, DXGI_FORMAT_R8_TYPELESS, 1, 1, desc.Usage == D3D11_USAGE_DYNAMIC);
+    // Dynamic buffers we read through staging are mapped like any other staging resource.
+    bool dynamic = desc.Usage == D3D11_USAGE_DYNAMIC && stagingBuffer == nullptr;
+
+    DXUPResource* resource = new DXUPResource(device, buffer, stagingBuffer.ptr(), nullptr, nullptr, nullptr, DXGI_FORMAT_R8_TYPELESS, desc.ByteWidth, 1, 1, 1, 1, dynamic);
+    resource->m_bufferData = data;
+    resource->m_bufferDesc = desc;
+
+    // Dynamic buffers can't be read, so only ones the app promised not to read from qualify.
+    // They take our memory copy with them, it's what lets a lock that promised nothing discard rather than wait.
+    resource->m_promoteAfter = uint32_t(config::getInt(config::PromoteLockFrames));
+    resource->m_promotable = resource->m_promoteAfter != 0 && desc.Usage == D3D11_USAGE_DEFAULT && data != nullptr;
+    return resource;
+  }
+
+  DXUPResource* DXUPResource::CreateSystemMemory(Direct3DDevice9Ex* device, D3DFORMAT d3d9Format, UINT width, UINT height, UINT depth, UINT slices, UINT mips) {
+    // Same as D3D11, 0 means the full chain.
+    if (mips == 0) {
+      mips = 1;
+      while ((std::max({ width, height, depth }) >> mips) != 0)
+        mips++;
+    }
+
+    DXGI_FORMAT format = convert::format(d3d9Format);
+    if (bitsPerPixel(format) == 0) {
+      log::warn("CreateSystemMemory: unknown size for DXGI format %d.", format);
+      return nullptr;
+    }
+
+    DXUPResource* resource = new DXUPResource(device, nullptr, nullptr, nullptr, nullptr, nullptr, format, width, height, depth, slices, mips, false);
+
+    // We keep what the app wrote as it wrote it, UpdateTexture converts on the way up.
+    if (needsConversion(d3d9Format))
+      resource->m_conversionFormat = d3d9Format;
+
+    size_t size = 0;
+    resource->m_systemMemoryLayout.resize(resource->GetSubresources());
+
+    for (UINT slice = 0; slice < slices; slice++) {
+      for (UINT mip = 0; mip < mips; mip++) {
+        SystemMemoryLayout& layout = resource->m_systemMemoryLayout[D3D11CalcSubresource(mip, slice, mips)];
+        layout.offset = size;
+        layout.rowPitch = alignTo(resource->CalcRowPitch(resource->GetWidth(mip)), 4u);
+        layout.slicePitch = layout.rowPitch * rowCount(format, resource->GetHeight(mip));
+
+        size += alignTo<size_t>(layout.slicePitch * resource->GetDepth(mip), 16);
+      }
+    }
+
+    resource->m_systemMemory = reinterpret_cast<uint8_t*>(_aligned_malloc(size, 16));
+    if (resource->m_systemMemory == nullptr) {
+      delete resource;
+      return nullptr;
+    }
+
+    std::memset(resource->m_systemMemory, 0, size);
+
+    // A new texture is dirty all over as far as UpdateTexture is concerned.
+    for (UINT slice = 0; slice < slices; slice++) {
+      for (UINT mip = 0; mip < mips; mip++)
+        resource->AddUploadBox(slice, mip, nullptr);
+    }
+
+    return resource;
   }
 
   DXUPResource* DXUPResource::Create(Direct3DDevice9Ex* device, ID3D11Resource* resource, DWORD d3d9Usage, D3DFORMAT d3d9Format) {
@@ -165,6 +268,16 @@ namespace dxup {
     return m_slices * m_mips;
   }
 
+  UINT DXUPResource::GetWidth(UINT mip) {
+    return std::max(1u, m_width >> mip);
+  }
+  UINT DXUPResource::GetHeight(UINT mip) {
+    return std::max(1u, m_height >> mip);
+  }
+  UINT DXUPResource::GetDepth(UINT mip) {
+    return std::max(1u, m_depth >> mip);
+  }
+
   void DXUPResource::SetMipMapped(UINT slice, UINT mip) {
     m_mappedSubresources[slice] |= 1ull << mip;
   }
@@ -202,20 +315,69 @@ namespace dxup {
     return m_dxgiFormat;
   }
 
-  DXUPResource::DXUPResource(Direct3DDevice9Ex* device, ID3D11Resource* resource, ID3D11Resource* staging, ID3D11Resource* fixup8888, ID3D11ShaderResourceView* srv, ID3D11ShaderResourceView* srvSRGB, DXGI_FORMAT dxgiFormat, UINT slices, UINT mips, bool dynamic)
+  UINT DXUPResource::CalcRowPitch(UINT width) {
+    if (m_conversionFormat != D3DFMT_UNKNOWN)
+      return width * conversionBitsPerPixel(m_conversionFormat) / 8;
+
+    return rowPitch(m_dxgiFormat, width);
+  }
+
+  DXUPResource::DXUPResource(Direct3DDevice9Ex* device, ID3D11Resource* resource, ID3D11Resource* staging, ID3D11Resource* fixup8888, ID3D11ShaderResourceView* srv, ID3D11ShaderResourceView* srvSRGB, DXGI_FORMAT dxgiFormat, UINT width, UINT height, UINT depth, UINT slices, UINT mips, bool dynamic)
     : m_device{ device }
     , m_resource{ resource }
     , m_staging{ staging }
     , m_fixup8888{ fixup8888 }
+    , m_conversionFormat{ D3DFMT_UNKNOWN }
+    , m_pooledStaging{ false }
+    , m_holdStaging{ false }
     , m_srv{ srv }
     , m_srvSRGB{ srvSRGB }
+    , m_width{ width }
+    , m_height{ height }
+    , m_depth{ depth }
     , m_slices{ slices }
     , m_mips{ mips }
     , m_dxgiFormat{ dxgiFormat }
-    , m_dynamic{ dynamic } {
+    , m_dynamic{ dynamic }
+    , m_autogenMips{ false }
+    , m_promotable{ false }
+    , m_promoted{ false }
+    , m_promoteAfter{ 0 }
+    , m_lockedFrames{ 0 }
+    , m_lastLockFrame{ UINT64_MAX }
+    , m_mipsStale{ false }
+    , m_lockCount{ 0 }
+    , m_readbackPending{ false }
+    , m_readbackTracked{ false }
+    , m_idleReadbackScenes{ 0 }
+    , m_bufferData{ nullptr }
+    , m_bufferCopyFlags{ 0 }
+    , m_systemMemory{ nullptr } {
     m_stagingBoxes.resize(GetSubresources());
+    m_uploadBoxes.resize(GetSubresources());
     ResetMipMapTracking();
     for (uint32_t i = 0; i < 6; i++)
       m_dirtySubresources[i] = 0;
   }
+
+  DXUPResource::~DXUPResource() {
+    if (m_readbackTracked)
+      m_device->UntrackReadback(this);
+
+    // We might be going away on the command stream's worker, so no fence, the next Map of it will wait if it has to.
+    if (m_pooledStaging && m_staging != nullptr)
+      m_device->GetStagingPool()->release(nullptr, nullptr, m_staging.ptr());
+
+    for (QueuedReadback& readback : m_queuedReadbacks)
+      m_device->GetStagingPool()->release(nullptr, nullptr, readback.staging.ptr());
+
+    if (m_pooledStaging || IsSystemMemory())
+      m_device->GetStagingPool()->forget(this);
+
+    if (m_systemMemory != nullptr)
+      _aligned_free(m_systemMemory);
+
+    if (m_bufferData != nullptr)
+      _aligned_free(m_bufferData);
+  }
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "d3d9_base.h"
 #include "d3d9_device.h"
+#include "d3d9_dirty_boxes.h"
+#include <atomic>
 
 namespace dxup {
 
@@ -11,6 +13,11 @@ namespace dxup {
 
     static DXUPResource* Create(Direct3DDevice9Ex* device, ID3D11Resource* resource, DWORD d3d9Usage, D3DFORMAT d3d9Format);
 
+    // SYSTEMMEM and SCRATCH textures only ever live in plain memory, there's no D3D11 resource behind them.
+    static DXUPResource* CreateSystemMemory(Direct3DDevice9Ex* device, D3DFORMAT d3d9Format, UINT width, UINT height, UINT depth, UINT slices, UINT mips);
+
+    ~DXUPResource();
+
     bool HasStaging();
 
     template <typename T>
@@ -35,21 +42,98 @@ namespace dxup {
     ID3D11Resource* GetStaging();
     ID3D11Resource* GetMapping();
 
+    // What the app's thread asks about a buffer, renaming swaps the D3D11 buffer but never this.
+    const D3D11_BUFFER_DESC& GetBufferDesc() {
+      return m_bufferDesc;
+    }
+
+    // The CPU copy write-only buffers are locked through, nullptr for everything else.
+    const uint8_t* GetBufferData() {
+      return m_bufferData;
+    }
+
     ID3D11ShaderResourceView* GetSRV(bool srgb);
 
     UINT GetSlices();
     UINT GetMips();
     UINT GetSubresources();
 
+    UINT GetWidth(UINT mip);
+    UINT GetHeight(UINT mip);
+    UINT GetDepth(UINT mip);
+
+    bool IsSystemMemory() {
+      return m_systemMemory != nullptr;
+    }
+
+    // Address of the given texel of a system memory subresource.
+    uint8_t* GetSystemMemory(UINT subresource, UINT x, UINT y, UINT z, UINT* rowPitch, UINT* slicePitch);
+
+    // Copies box of src into our system memory at x, y by way of staging borrowed from the device's pool.
+    // Only the GPU's half happens now, the rest waits for FinishReadbacks.
+    HRESULT QueueReadback(ID3D11DeviceContext* context, DXUPResource* src, UINT srcSubresource, const D3D11_BOX& box, UINT subresource, UINT x, UINT y);
+
+    // Brings queued readbacks into our memory, stalling only on ones the GPU hasn't got to. With doNotWait it returns false instead.
+    // Anything reading or writing our memory on the CPU has to call this first.
+    bool FinishReadbacks(ID3D11DeviceContext* context, bool doNotWait);
+
+    bool HasQueuedReadbacks() {
+      return !m_queuedReadbacks.empty();
+    }
+
+    // The D3D9 format the app's data is in if it has to be converted on its way to the GPU, D3DFMT_UNKNOWN otherwise.
+    D3DFORMAT GetConversionFormat() {
+      return m_conversionFormat;
+    }
+
+    // Bytes in a row of width pixels as the app lays them out.
+    UINT CalcRowPitch(UINT width);
+
     void SetMipMapped(UINT slice, UINT mip);
     void SetMipUnmapped(UINT slice, UINT mip);
     void MarkDirty(UINT slice, UINT mip);
-    void MakeClean();
+
+    // D3DUSAGE_AUTOGENMIPMAP textures only regenerate their mips once sampled after the top level changed.
+    bool HasAutogenMips() {
+      return m_autogenMips;
+    }
+    void GenerateMipsIfStale(ID3D11DeviceContext* context);
+    bool MakeClean();
+
+    // Copies any dirty mips to staging now and fences them, so a later read lock only waits on that copy.
+    void StartReadback();
+
+    // Run by the device at the end of every scene while we're tracked, returns false once we should no longer be.
+    // Hands pooled staging back once its copy has landed, and starts the next one.
+    bool UpdateReadback();
+
+    // Borrows staging from the device's pool if we don't own one. Unless fill is false it's brought up to date with the resource.
+    void AcquireStaging(bool fill);
+
+    // Same for a lock of subresource. Only the locked box is filled if staging isn't the one we had last, the rest is left for the next read to refill.
+    void AcquireStagingForLock(UINT subresource, bool fill);
+    void ReleaseStaging();
+
+    bool IsLocked() {
+      return m_lockCount != 0;
+    }
 
     uint64_t GetChangedMips(UINT slice);
 
     bool CanPushStaging();
 
+    // Records a region of one subresource written through staging that needs copying to the resource, nullptr means all of it.
+    void AddUploadBox(UINT slice, UINT mip, const D3DBOX* pBox);
+
+    // AddDirtyRect/AddDirtyBox, the box is in top level coordinates and covers every mip of the slice.
+    void AddDirtyBox(UINT slice, const D3DBOX* pBox);
+
+    // For system memory textures these are what UpdateTexture still has to copy.
+    const D3D9DirtyBoxes& GetUploadBoxes(UINT subresource) {
+      return m_uploadBoxes[subresource];
+    }
+    void ClearUploadBoxes();
+
     void ResetMipMapTracking();
 
     HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppvObj) override;
@@ -57,6 +141,10 @@ namespace dxup {
     HRESULT D3D9LockBox(UINT slice, UINT mip, D3DLOCKED_BOX* pLockedBox, CONST D3DBOX* pBox, DWORD Flags, DWORD Usage);
     HRESULT D3D9UnlockBox(UINT slice, UINT mip);
 
+    // Writes the given ranges to a buffer kept in m_bufferData. Unless packed, data is laid out like the buffer,
+    // otherwise each box's bytes follow the last's. copyFlags are D3D11_COPY_*, 0 if the locks made no promises.
+    void UploadBufferData(ID3D11DeviceContext* context, const D3D11_BOX* boxes, UINT count, const uint8_t* data, bool packed, UINT copyFlags);
+
     DXGI_FORMAT GetDXGIFormat();
 
   private:
@@ -67,35 +155,124 @@ namespace dxup {
 
     void PushStaging();
 
+    // DISCARD locks of DEFAULT buffers swap in a copy the GPU is done with rather than write under it.
+    // m_bufferData keeps the CPU side, so for those only the D3D11 buffer changes hands.
+    bool CanRename();
+    bool Rename(ID3D11DeviceContext* context);
+
+    // Write-only DEFAULT buffers locked with DISCARD or NOOVERWRITE frame after frame get made dynamic.
+    void TrackLockFrequency(DWORD d3d9LockFlags);
+    bool PromoteToDynamic(ID3D11DeviceContext* context);
+
+    // Converts what the app wrote to staging in the locked box into m_fixup8888.
+    void ConvertLockedBox(ID3D11DeviceContext* context, UINT subresource);
+
+    HRESULT LockBufferData(D3DLOCKED_BOX* pLockedBox, CONST D3DBOX* pBox, DWORD Flags);
+    void UnlockBufferData();
+
     Direct3DDevice9Ex* m_device;
 
     static bool NeedsStaging(D3D11_USAGE d3d11Usage, DWORD d3d9Usage, D3DFORMAT d3d9Format);
+    static bool CanPoolStaging(D3D11_USAGE d3d11Usage, D3DFORMAT d3d9Format);
     static DXUPResource* CreateTexture2D(Direct3DDevice9Ex* device, ID3D11Texture2D* texture, DWORD d3d9Usage, D3DFORMAT d3d9Format);
     static DXUPResource* CreateTexture3D(Direct3DDevice9Ex* device, ID3D11Texture3D* texture, DWORD d3d9Usage, D3DFORMAT d3d9Format);
     static DXUPResource* CreateBuffer(Direct3DDevice9Ex* device, ID3D11Buffer* buffer, DWORD d3d9Usage);
 
-    DXUPResource(Direct3DDevice9Ex* device, ID3D11Resource* resource, ID3D11Resource* staging, ID3D11Resource* fixup8888, ID3D11ShaderResourceView* srv, ID3D11ShaderResourceView* srvSRGB, DXGI_FORMAT dxgiFormat, UINT slices, UINT mips, bool dynamic);
+    DXUPResource(Direct3DDevice9Ex* device, ID3D11Resource* resource, ID3D11Resource* staging, ID3D11Resource* fixup8888, ID3D11ShaderResourceView* srv, ID3D11ShaderResourceView* srvSRGB, DXGI_FORMAT dxgiFormat, UINT width, UINT height, UINT depth, UINT slices, UINT mips, bool dynamic);
 
+    UINT m_width;
+    UINT m_height;
+    UINT m_depth;
     UINT m_slices;
     UINT m_mips;
     DXGI_FORMAT m_dxgiFormat;
 
     uint64_t m_mappedSubresources[6];
     uint64_t m_unmappedSubresources[6];
-    uint64_t m_dirtySubresources[6];
+    // Draws on the command stream's worker dirty these while the app's thread may be checking them.
+    std::atomic<uint64_t> m_dirtySubresources[6];
 
+    // With DXUP_CSTHREAD uploads rename buffers on the worker, so for buffers m_resource and m_retiredBuffers belong to it.
+    // The app's thread only touches them once it has synchronized, ie. through the device's GetContext.
     Com<ID3D11Resource> m_resource;
     Com<ID3D11Resource> m_staging;
     Com<ID3D11Resource> m_fixup8888;
+    D3DFORMAT m_conversionFormat;
+
+    // m_staging is only borrowed while we're locked or being read back.
+    bool m_pooledStaging;
 
     bool IsStagingBoxDegenerate(UINT subresource);
     std::vector<D3DBOX> m_stagingBoxes;
 
+    std::vector<D3D9DirtyBoxes> m_uploadBoxes;
+
+    // A D3DLOCK_NO_DIRTY_UPDATE lock wrote to staging without saying where, keep it until we're told.
+    bool m_holdStaging;
+
     bool m_dynamic;
 
+    D3D11_BUFFER_DESC m_bufferDesc = {};
+
+    struct RetiredBuffer {
+      Com<ID3D11Resource> resource;
+      Com<ID3D11Resource> staging;
+      Com<ID3D11Query> fence;
+    };
+
+    static const size_t maxRetiredBuffers = 3;
+    std::vector<RetiredBuffer> m_retiredBuffers;
+
+    // Write-only DEFAULT buffers keep their contents here rather than in staging, still once promoted, and with DXUP_CSTHREAD so do write-only dynamic ones.
+    // Locks hand out this memory and unlocks send just the written ranges, so none of them have to wait on the worker.
+    uint8_t* m_bufferData;
+    UINT m_bufferCopyFlags;
+
+    bool m_promotable;
+    bool m_promoted;
+    uint32_t m_promoteAfter;
+    uint32_t m_lockedFrames;
+    uint64_t m_lastLockFrame;
+
+    bool m_autogenMips;
+    bool m_mipsStale;
+
     Com<ID3D11ShaderResourceView> m_srv;
     Com<ID3D11ShaderResourceView> m_srvSRGB;
 
+    // Read by the worker at the end of each scene, write-only buffer locks change it without waiting for the worker.
+    // Everything else about a readback is only touched by the app's thread after synchronizing with the worker.
+    std::atomic<UINT> m_lockCount;
+
+    // Scenes a tracked resource can go without a read lock before it's untracked.
+    static const uint32_t maxIdleReadbackScenes = 16;
+
+    Com<ID3D11Query> m_readbackFence;
+    bool m_readbackPending;
+    bool m_readbackTracked;
+    uint32_t m_idleReadbackScenes;
+
+    struct SystemMemoryLayout {
+      size_t offset;
+      UINT rowPitch;
+      UINT slicePitch;
+    };
+
+    uint8_t* m_systemMemory;
+    std::vector<SystemMemoryLayout> m_systemMemoryLayout;
+
+    // The staging holds box where src had it, it goes to x, y of subresource in our memory. m_readbackFence follows the last one.
+    struct QueuedReadback {
+      Com<ID3D11Resource> staging;
+      UINT stagingSubresource;
+      D3D11_BOX box;
+      UINT subresource;
+      UINT x;
+      UINT y;
+    };
+
+    std::vector<QueuedReadback> m_queuedReadbacks;
+
   };
 
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include "d3d9_d3d11_resource.h"
 #include "d3d9_format.h"
+#include "d3d9_format_convert.h"
+#include <algorithm>
+#include <cstring>
+#include <malloc.h>
 
 namespace dxup {
 
@@ -30,9 +34,19 @@ namespace dxup {
   }
 
   void DXUPResource::MarkDirty(UINT slice, UINT mip) {
-    m_dirtySubresources[slice] = 1ull << mip;
+    m_dirtySubresources[slice] |= 1ull << mip;
+
+    if (mip == 0 && m_autogenMips)
+      m_mipsStale = true;
+  }
+  void DXUPResource::GenerateMipsIfStale(ID3D11DeviceContext* context) {
+    if (!m_mipsStale || m_srv == nullptr)
+      return;
+
+    context->GenerateMips(m_srv.ptr());
+    m_mipsStale = false;
   }
-  void DXUPResource::MakeClean() {
+  bool DXUPResource::MakeClean() {
     bool dirty = false;
     for (uint32_t slice = 0; slice < m_slices; slice++) {
       if (m_dirtySubresources[slice] != 0)
@@ -40,7 +54,22 @@ namespace dxup {
     }
 
     if (!dirty)
-      return;
+      return false;
+
+    // The GPU's copy is 8888, it can't go back into the layout the app locks. Staging keeps what the app last wrote.
+    if (m_conversionFormat != D3DFMT_UNKNOWN) {
+      for (uint32_t slice = 0; slice < m_slices; slice++)
+        m_dirtySubresources[slice] = 0;
+
+      return false;
+    }
+
+    if (m_pooledStaging) {
+      AcquireStaging(true);
+
+      if (GetStaging() == nullptr)
+        return false;
+    }
 
     // This is needed for RTs, we only want staging buffers for them if they NEED them.
     if (GetStaging() == nullptr) {
@@ -53,16 +82,208 @@ namespace dxup {
     }
 
     for (uint32_t slice = 0; slice < m_slices; slice++) {
-      uint64_t* dirtyFlags = &m_dirtySubresources[slice];
+      uint64_t dirtyFlags = m_dirtySubresources[slice].exchange(0);
 
       for (uint64_t mip = 0; mip < m_mips; mip++) {
         UINT subresource = D3D11CalcSubresource(mip, slice, m_mips);
-        if (*dirtyFlags & (1ull << mip))
+        if (dirtyFlags & (1ull << mip))
           m_device->GetContext()->CopySubresourceRegion(GetStaging(), subresource, 0, 0, 0, GetResource(), subresource, nullptr);
       }
+    }
+
+    return true;
+  }
+  void DXUPResource::AcquireStaging(bool fill) {
+    if (!m_pooledStaging || m_staging != nullptr)
+      return;
+
+    ID3D11DeviceContext* context = m_device->GetContext();
+
+    bool intact;
+    if (!m_device->GetStagingPool()->acquire(context, this, GetResource(), m_staging, &intact))
+      return;
+
+    // Anything the GPU wrote since we last had it is still covered by the dirty mips.
+    if (intact || !fill)
+      return;
+
+    context->CopyResource(GetStaging(), GetResource());
+    for (uint32_t slice = 0; slice < m_slices; slice++)
+      m_dirtySubresources[slice] = 0;
+  }
+  void DXUPResource::AcquireStagingForLock(UINT subresource, bool fill) {
+    if (!m_pooledStaging || m_staging != nullptr)
+      return;
+
+    ID3D11DeviceContext* context = m_device->GetContext();
 
-      *dirtyFlags = 0;
+    bool intact;
+    if (!m_device->GetStagingPool()->acquire(context, this, GetResource(), m_staging, &intact))
+      return;
+
+    if (intact)
+      return;
+
+    // Someone else's leftovers, whatever reads staging next has to refill all of it.
+    uint64_t allMips = (1ull << m_mips) - 1;
+    for (uint32_t slice = 0; slice < m_slices; slice++)
+      m_dirtySubresources[slice] = allMips;
+
+    if (!fill)
+      return;
+
+    // The app can only get at the box it locked, so that's all it needs to see. Block compressed boxes are widened to whole blocks.
+    UINT mip = subresource % m_mips;
+    UINT align = alignment(m_dxgiFormat);
+
+    D3D11_BOX box = { 0, 0, 0, GetWidth(mip), GetHeight(mip), GetDepth(mip) };
+    if (!IsStagingBoxDegenerate(subresource)) {
+      const D3DBOX& locked = m_stagingBoxes[subresource];
+      box.left = alignDown(locked.Left, align);
+      box.top = alignDown(locked.Top, align);
+      box.front = locked.Front;
+      box.right = std::min(alignTo(locked.Right, align), box.right);
+      box.bottom = std::min(alignTo(locked.Bottom, align), box.bottom);
+      box.back = std::max(locked.Back, locked.Front + 1);
+    }
+
+    context->CopySubresourceRegion(GetStaging(), subresource, box.left, box.top, box.front, GetResource(), subresource, &box);
+  }
+  void DXUPResource::ReleaseStaging() {
+    if (!m_pooledStaging || m_staging == nullptr)
+      return;
+
+    m_device->GetStagingPool()->release(m_device->GetContext(), this, GetStaging());
+    m_staging = nullptr;
+  }
+  void DXUPResource::StartReadback() {
+    if (!MakeClean())
+      return;
+
+    if (m_readbackFence == nullptr) {
+      D3D11_QUERY_DESC desc = { D3D11_QUERY_EVENT, 0 };
+      if (FAILED(m_device->GetD3D11Device()->CreateQuery(&desc, &m_readbackFence)))
+        return;
     }
+
+    m_device->GetContext()->End(m_readbackFence.ptr());
+    m_readbackPending = true;
+  }
+  bool DXUPResource::UpdateReadback() {
+    // The lock owns staging until it's done with it.
+    if (IsLocked())
+      return true;
+
+    ID3D11DeviceContext* context = m_device->GetContext();
+
+    // Staging goes back to the pool once the copy into it has landed. Nobody else wanting that shape, our next lock gets it back intact.
+    // If someone does take it, the lock refills it from the resource.
+    if (m_readbackPending && context->GetData(m_readbackFence.ptr(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK) {
+      m_readbackPending = false;
+      ReleaseStaging();
+    }
+
+    if (++m_idleReadbackScenes > maxIdleReadbackScenes) {
+      m_readbackPending = false;
+      ReleaseStaging();
+
+      m_readbackTracked = false;
+      return false;
+    }
+
+    StartReadback();
+    return true;
+  }
+
+  uint8_t* DXUPResource::GetSystemMemory(UINT subresource, UINT x, UINT y, UINT z, UINT* rowPitch, UINT* slicePitch) {
+    const SystemMemoryLayout& layout = m_systemMemoryLayout[subresource];
+
+    *rowPitch = layout.rowPitch;
+    *slicePitch = layout.slicePitch;
+
+    size_t offset = layout.offset + z * layout.slicePitch + (y / alignment(m_dxgiFormat)) * layout.rowPitch + CalcRowPitch(x);
+    return &m_systemMemory[offset];
+  }
+
+  HRESULT DXUPResource::QueueReadback(ID3D11DeviceContext* context, DXUPResource* src, UINT srcSubresource, const D3D11_BOX& box, UINT subresource, UINT x, UINT y) {
+    if (m_readbackFence == nullptr) {
+      D3D11_QUERY_DESC desc = { D3D11_QUERY_EVENT, 0 };
+      HRESULT result = m_device->GetD3D11Device()->CreateQuery(&desc, &m_readbackFence);
+      if (FAILED(result))
+        return result;
+    }
+
+    // Apps reading back every frame without locking in between would queue forever, older copies this one covers needn't land.
+    UINT right = x + (box.right - box.left);
+    UINT bottom = y + (box.bottom - box.top);
+    m_queuedReadbacks.erase(std::remove_if(m_queuedReadbacks.begin(), m_queuedReadbacks.end(), [&] (const QueuedReadback& queued) {
+      bool covered = queued.subresource == subresource &&
+                     queued.x >= x && queued.y >= y &&
+                     queued.x + (queued.box.right - queued.box.left) <= right &&
+                     queued.y + (queued.box.bottom - queued.box.top) <= bottom;
+
+      if (covered)
+        m_device->GetStagingPool()->release(context, this, queued.staging.ptr());
+
+      return covered;
+    }), m_queuedReadbacks.end());
+
+    QueuedReadback readback;
+    bool intact;
+    if (!m_device->GetStagingPool()->acquire(context, this, src->GetResource(), readback.staging, &intact))
+      return E_OUTOFMEMORY;
+
+    // Same place in staging as in src, staging is shaped like all of src.
+    context->CopySubresourceRegion(readback.staging.ptr(), srcSubresource, box.left, box.top, 0, src->GetResource(), srcSubresource, &box);
+    context->End(m_readbackFence.ptr());
+    m_readbackPending = true;
+
+    readback.stagingSubresource = srcSubresource;
+    readback.box = box;
+    readback.subresource = subresource;
+    readback.x = x;
+    readback.y = y;
+    m_queuedReadbacks.push_back(std::move(readback));
+
+    return S_OK;
+  }
+
+  bool DXUPResource::FinishReadbacks(ID3D11DeviceContext* context, bool doNotWait) {
+    if (m_queuedReadbacks.empty())
+      return true;
+
+    if (doNotWait && m_readbackPending && context->GetData(m_readbackFence.ptr(), nullptr, 0, 0) == S_FALSE)
+      return false;
+
+    m_readbackPending = false;
+
+    for (QueuedReadback& readback : m_queuedReadbacks) {
+      // Waits for the copy itself if the GPU hasn't got to it yet.
+      D3D11_MAPPED_SUBRESOURCE mapped;
+      if (SUCCEEDED(context->Map(readback.staging.ptr(), readback.stagingSubresource, D3D11_MAP_READ, 0, &mapped))) {
+        UINT rowPitch;
+        UINT slicePitch;
+        uint8_t* dst = GetSystemMemory(readback.subresource, readback.x, readback.y, 0, &rowPitch, &slicePitch);
+
+        const uint8_t* src = reinterpret_cast<const uint8_t*>(mapped.pData);
+        src += (readback.box.top / alignment(m_dxgiFormat)) * mapped.RowPitch + CalcRowPitch(readback.box.left);
+
+        UINT rowBytes = CalcRowPitch(readback.box.right - readback.box.left);
+        UINT rows = rowCount(m_dxgiFormat, readback.box.bottom - readback.box.top);
+        for (UINT row = 0; row < rows; row++)
+          std::memcpy(&dst[row * rowPitch], &src[row * mapped.RowPitch], rowBytes);
+
+        context->Unmap(readback.staging.ptr(), readback.stagingSubresource);
+      }
+      else
+        log::warn("FinishReadbacks: failed to map staging.");
+
+      // We've read it, so the GPU is done with it too.
+      m_device->GetStagingPool()->release(nullptr, this, readback.staging.ptr());
+    }
+
+    m_queuedReadbacks.clear();
+    return true;
   }
 
   HRESULT DXUPResource::D3D9LockBox(UINT slice, UINT mip, D3DLOCKED_BOX* pLockedBox, CONST D3DBOX* pBox, DWORD Flags, DWORD Usage) {
@@ -82,11 +303,66 @@ namespace dxup {
     else
       m_stagingBoxes[subresource] = *pBox;
 
-    if (!(Flags & D3DLOCK_DISCARD) && !(Flags & D3DLOCK_NOOVERWRITE) && !(Usage & D3DUSAGE_WRITEONLY))
-      MakeClean();
+    // Nothing to map, and nothing the worker could be touching.
+    if (IsSystemMemory()) {
+      // Copies from the GPU only land in our memory now.
+      if (HasQueuedReadbacks() && !FinishReadbacks(m_device->GetContext(), Flags & D3DLOCK_DONOTWAIT))
+        return D3DERR_WASSTILLDRAWING;
+
+      UINT rowPitch;
+      UINT slicePitch;
+      if (pBox == nullptr)
+        pLockedBox->pBits = GetSystemMemory(subresource, 0, 0, 0, &rowPitch, &slicePitch);
+      else
+        pLockedBox->pBits = GetSystemMemory(subresource, pBox->Left, pBox->Top, pBox->Front, &rowPitch, &slicePitch);
+
+      pLockedBox->RowPitch = rowPitch;
+      pLockedBox->SlicePitch = slicePitch;
+
+      if (!(Flags & (D3DLOCK_READONLY | D3DLOCK_NO_DIRTY_UPDATE)))
+        AddUploadBox(slice, mip, pBox);
+
+      return D3D_OK;
+    }
+
+    TrackLockFrequency(Flags);
+
+    // Only the unlock touches the context for these, and it goes through the command stream.
+    if (m_bufferData != nullptr)
+      return LockBufferData(pLockedBox, pBox, Flags);
+
+    ID3D11DeviceContext* context = m_device->GetContext();
+
+    if ((Flags & D3DLOCK_DISCARD) && CanRename() && Rename(context))
+      m_device->RebindBuffer(this);
+
+    if (!(Flags & D3DLOCK_DISCARD) && !(Flags & D3DLOCK_NOOVERWRITE) && !(Usage & D3DUSAGE_WRITEONLY)) {
+      bool dirty = false;
+      for (uint32_t i = 0; i < m_slices; i++)
+        dirty |= m_dirtySubresources[i] != 0;
+
+      // Nobody started this copy ahead of time, have the device do it at the end of the next scene.
+      if (dirty && !m_readbackTracked) {
+        m_device->TrackReadback(this);
+        m_readbackTracked = true;
+      }
+
+      m_idleReadbackScenes = 0;
+
+      StartReadback();
+
+      if (m_readbackPending && (Flags & D3DLOCK_DONOTWAIT)) {
+        if (context->GetData(m_readbackFence.ptr(), nullptr, 0, 0) == S_FALSE)
+          return D3DERR_WASSTILLDRAWING;
+      }
+
+      m_readbackPending = false;
+    }
+
+    AcquireStagingForLock(subresource, !(Flags & D3DLOCK_DISCARD));
 
     D3D11_MAPPED_SUBRESOURCE res;
-    HRESULT result = m_device->GetContext()->Map(GetMapping(), subresource, CalcMapType(Flags, Usage), CalcMapFlags(Flags), &res);
+    HRESULT result = context->Map(GetMapping(), subresource, CalcMapType(Flags, Usage), CalcMapFlags(Flags), &res);
 
     if (result == DXGI_ERROR_WAS_STILL_DRAWING)
       return D3DERR_WASSTILLDRAWING;
@@ -95,11 +371,22 @@ namespace dxup {
       return log::d3derr(D3DERR_INVALIDCALL, "D3D9LockRect: unknown error mapping subresource.");
 
     SetMipMapped(slice, mip);
+    m_lockCount++;
+
+    if (!(Flags & D3DLOCK_READONLY)) {
+      if (Flags & D3DLOCK_NO_DIRTY_UPDATE)
+        m_holdStaging = true;
+      else
+        AddUploadBox(slice, mip, pBox);
+    }
 
     size_t offset = 0;
 
-    if (!IsStagingBoxDegenerate(subresource))
-      offset = (m_stagingBoxes[subresource].Top * res.RowPitch) + (m_stagingBoxes[subresource].Left * bitsPerPixel(m_dxgiFormat) / 8);
+    if (!IsStagingBoxDegenerate(subresource)) {
+      const D3DBOX& box = m_stagingBoxes[subresource];
+      UINT pixelBits = m_conversionFormat != D3DFMT_UNKNOWN ? conversionBitsPerPixel(m_conversionFormat) : bitsPerPixel(m_dxgiFormat);
+      offset = (box.Front * res.DepthPitch) + (box.Top * res.RowPitch) + (box.Left * pixelBits / 8);
+    }
 
     uint8_t* data = (uint8_t*)res.pData;
     pLockedBox->pBits = &data[offset];
@@ -109,94 +396,359 @@ namespace dxup {
     return D3D_OK;
   }
 
+  void DXUPResource::ConvertLockedBox(ID3D11DeviceContext* context, UINT subresource) {
+    UINT mip = subresource % m_mips;
+
+    D3DBOX box = m_stagingBoxes[subresource];
+    if (IsStagingBoxDegenerate(subresource)) {
+      box.Left = 0;
+      box.Top = 0;
+      box.Front = 0;
+      box.Right = GetWidth(mip);
+      box.Bottom = GetHeight(mip);
+      box.Back = GetDepth(mip);
+    }
+
+    D3D11_MAPPED_SUBRESOURCE d3d9Res;
+    if (FAILED(context->Map(GetStaging(), subresource, D3D11_MAP_READ, 0, &d3d9Res)))
+      return;
+
+    // Staging maps keep their contents, the rest of the fixup stays as converted last time.
+    D3D11_MAPPED_SUBRESOURCE fixupRes;
+    if (FAILED(context->Map(m_fixup8888.ptr(), subresource, D3D11_MAP_WRITE, 0, &fixupRes))) {
+      context->Unmap(GetStaging(), subresource);
+      return;
+    }
+
+    const uint8_t* read = reinterpret_cast<const uint8_t*>(d3d9Res.pData);
+    read += box.Front * d3d9Res.DepthPitch + box.Top * d3d9Res.RowPitch + box.Left * conversionBitsPerPixel(m_conversionFormat) / 8;
+
+    uint8_t* write = reinterpret_cast<uint8_t*>(fixupRes.pData);
+    write += box.Front * fixupRes.DepthPitch + box.Top * fixupRes.RowPitch + box.Left * bitsPerPixel(m_dxgiFormat) / 8;
+
+    convertPixels(
+      m_conversionFormat,
+      m_device->GetCurrentPalette(),
+      write, fixupRes.RowPitch, fixupRes.DepthPitch,
+      read, d3d9Res.RowPitch, d3d9Res.DepthPitch,
+      box.Right - box.Left, box.Bottom - box.Top, std::max(box.Back, box.Front + 1) - box.Front);
+
+    context->Unmap(m_fixup8888.ptr(), subresource);
+    context->Unmap(GetStaging(), subresource);
+  }
+
   HRESULT DXUPResource::D3D9UnlockBox(UINT slice, UINT mip) {
     CriticalSection cs(m_device);
 
+    if (IsSystemMemory())
+      return D3D_OK;
+
+    if (m_bufferData != nullptr) {
+      UnlockBufferData();
+      return D3D_OK;
+    }
+
     UINT subresource = D3D11CalcSubresource(mip, slice, m_mips);
 
     ID3D11DeviceContext* context = m_device->GetContext();
+
     context->Unmap(GetMapping(), D3D11CalcSubresource(mip, slice, m_mips));
     SetMipUnmapped(slice, mip);
+    m_lockCount--;
 
-    // We need to make this format an 8888. DXGI has no 888 type.
-    if (m_fixup8888 != nullptr) {
-      D3D11_MAPPED_SUBRESOURCE d3d9Res;
-      D3D11_MAPPED_SUBRESOURCE fixupRes;
-      context->Map(GetStaging(), subresource, D3D11_MAP_READ, 0, &d3d9Res);
-      context->Map(m_fixup8888.ptr(), subresource, D3D11_MAP_WRITE, 0, &fixupRes);
+    if (m_fixup8888 != nullptr)
+      ConvertLockedBox(context, subresource);
 
-      D3D11_TEXTURE2D_DESC desc;
-      ID3D11Texture2D* texture = reinterpret_cast<ID3D11Texture2D*>(m_staging.ptr());
-      texture->GetDesc(&desc);
-
-      uint8_t* read = (uint8_t*)d3d9Res.pData;
-      uint8_t* write = (uint8_t*)fixupRes.pData;
-
-      // TODO: Investigate if this is right or good enough.
-      uint32_t mippedHeight = std::max(1u, desc.Height >> mip);
-      uint32_t mippedWidth = std::max(1u, desc.Width >> mip);
-
-      for (uint32_t y = 0; y < mippedHeight; y++) {
-        for (uint32_t x = 0; x < mippedWidth; x++) {
-          for (uint32_t c = 0; c < 3; c++) {
-            write[y * fixupRes.RowPitch + x * 4 + c] = read[y * fixupRes.RowPitch + x * 3 + c];
-          }
-          write[y * fixupRes.RowPitch + x * 4 + 3] = 255;
-        }
+    if (HasStaging() && CanPushStaging()) {
+      PushStaging();
+
+      if (!m_holdStaging)
+        ReleaseStaging();
+    }
+
+    return D3D_OK;
+  }
+
+  void DXUPResource::AddUploadBox(UINT slice, UINT mip, const D3DBOX* pBox) {
+    UINT width = GetWidth(mip);
+    UINT height = GetHeight(mip);
+    UINT depth = GetDepth(mip);
+
+    D3D11_BOX whole = { 0, 0, 0, width, height, depth };
+    D3D11_BOX box = whole;
+
+    if (pBox != nullptr && !isBoxDegenerate(*pBox)) {
+      box.left = alignRectForFormat(true, m_dxgiFormat, pBox->Left);
+      box.top = alignRectForFormat(true, m_dxgiFormat, pBox->Top);
+      box.front = pBox->Front;
+      box.right = std::min(alignRectForFormat(false, m_dxgiFormat, pBox->Right), width);
+      box.bottom = std::min(alignRectForFormat(false, m_dxgiFormat, pBox->Bottom), height);
+      box.back = std::min(pBox->Back, depth);
+
+      // Better to copy too much than lose a write, ie. buffer locks to the end have no size.
+      if (box.left >= box.right || box.top >= box.bottom || box.front >= box.back)
+        box = whole;
+    }
+
+    m_uploadBoxes[D3D11CalcSubresource(mip, slice, m_mips)].add(box);
+  }
+
+  void DXUPResource::ClearUploadBoxes() {
+    for (D3D9DirtyBoxes& boxes : m_uploadBoxes)
+      boxes.clear();
+  }
+
+  void DXUPResource::AddDirtyBox(UINT slice, const D3DBOX* pBox) {
+    for (UINT mip = 0; mip < m_mips; mip++) {
+      if (pBox == nullptr) {
+        AddUploadBox(slice, mip, nullptr);
+        continue;
       }
 
-      context->Unmap(m_fixup8888.ptr(), subresource);
-      context->Unmap(GetStaging(), subresource);
+      // Round outwards so the mip still covers everything the top level box touched.
+      UINT round = (1u << mip) - 1;
+
+      D3DBOX mipBox;
+      mipBox.Left = pBox->Left >> mip;
+      mipBox.Top = pBox->Top >> mip;
+      mipBox.Front = pBox->Front >> mip;
+      mipBox.Right = (pBox->Right + round) >> mip;
+      mipBox.Bottom = (pBox->Bottom + round) >> mip;
+      mipBox.Back = (pBox->Back + round) >> mip;
+      AddUploadBox(slice, mip, &mipBox);
     }
 
-    if (HasStaging() && CanPushStaging())
+    if (IsSystemMemory() || IsLocked())
+      return;
+
+    if (HasStaging() && CanPushStaging()) {
       PushStaging();
 
+      m_holdStaging = false;
+      ReleaseStaging();
+    }
+  }
+
+  bool DXUPResource::CanRename() {
+    if (m_dynamic || m_pooledStaging)
+      return false;
+
+    // Buffers keeping their contents in m_bufferData are never mapped and have no staging, they only swap the D3D11 buffer.
+    if (m_bufferData == nullptr && (m_staging == nullptr || IsLocked()))
+      return false;
+
+    return m_bufferDesc.ByteWidth != 0;
+  }
+
+  bool DXUPResource::Rename(ID3D11DeviceContext* context) {
+    RetiredBuffer next;
+
+    auto retired = std::find_if(m_retiredBuffers.begin(), m_retiredBuffers.end(), [context](const RetiredBuffer& buffer) {
+      return context->GetData(buffer.fence.ptr(), nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK;
+    });
+
+    if (retired != m_retiredBuffers.end()) {
+      next = std::move(*retired);
+      m_retiredBuffers.erase(retired);
+    }
+    else if (m_retiredBuffers.size() < maxRetiredBuffers) {
+      // Staging goes with it, mapping ours again would wait on the copy out of it just the same.
+      D3D11_BUFFER_DESC desc = m_bufferDesc;
+      if (FAILED(m_device->GetD3D11Device()->CreateBuffer(&desc, nullptr, reinterpret_cast<ID3D11Buffer**>(&next.resource))))
+        return false;
+
+      if (m_staging != nullptr) {
+        GetStagingAs<ID3D11Buffer>()->GetDesc(&desc);
+        if (FAILED(m_device->GetD3D11Device()->CreateBuffer(&desc, nullptr, reinterpret_cast<ID3D11Buffer**>(&next.staging))))
+          return false;
+      }
+
+      D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+      if (FAILED(m_device->GetD3D11Device()->CreateQuery(&queryDesc, &next.fence)))
+        return false;
+    }
+    else
+      return false;
+
+    context->End(next.fence.ptr());
+
+    RetiredBuffer current;
+    current.resource = std::move(m_resource);
+    current.staging = std::move(m_staging);
+    current.fence = std::move(next.fence);
+    m_retiredBuffers.push_back(std::move(current));
+
+    m_resource = std::move(next.resource);
+    m_staging = std::move(next.staging);
+
+    return true;
+  }
+
+  void DXUPResource::TrackLockFrequency(DWORD d3d9LockFlags) {
+    if (!m_promotable || m_promoted)
+      return;
+
+    // A lock that wants the old contents with the GPU in sync gains nothing from it.
+    if (!(d3d9LockFlags & (D3DLOCK_DISCARD | D3DLOCK_NOOVERWRITE))) {
+      m_lockedFrames = 0;
+      return;
+    }
+
+    uint64_t frame = m_device->GetFrameCount();
+    if (frame == m_lastLockFrame)
+      return;
+
+    m_lockedFrames = frame == m_lastLockFrame + 1 ? m_lockedFrames + 1 : 1;
+    m_lastLockFrame = frame;
+
+    // A one off, worth waiting on the worker for.
+    if (m_lockedFrames >= m_promoteAfter && !PromoteToDynamic(m_device->GetContext()))
+      m_promotable = false;
+  }
+
+  bool DXUPResource::PromoteToDynamic(ID3D11DeviceContext* context) {
+    if (IsLocked())
+      return true;
+
+    D3D11_BUFFER_DESC desc = m_bufferDesc;
+    desc.Usage = D3D11_USAGE_DYNAMIC;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+    Com<ID3D11Buffer> buffer;
+    if (FAILED(m_device->GetD3D11Device()->CreateBuffer(&desc, nullptr, &buffer))) {
+      log::warn("PromoteToDynamic: failed to create dynamic buffer (%u bytes).", desc.ByteWidth);
+      return false;
+    }
+
+    // Our memory copy holds everything written so far, dynamic buffers can't be copied into. It stays with us, see UnlockBufferData.
+    D3D11_MAPPED_SUBRESOURCE dst;
+    if (FAILED(context->Map(buffer.ptr(), 0, D3D11_MAP_WRITE_DISCARD, 0, &dst))) {
+      log::warn("PromoteToDynamic: failed to map dynamic buffer.");
+      return false;
+    }
+
+    std::memcpy(dst.pData, m_bufferData, desc.ByteWidth);
+    context->Unmap(buffer.ptr(), 0);
+
+    log::msg("PromoteToDynamic: %u byte buffer locked %u frames in a row, now dynamic.", desc.ByteWidth, m_lockedFrames);
+
+    m_resource = buffer.ptr();
+    m_bufferDesc = desc;
+    m_staging = nullptr;
+    m_retiredBuffers.clear();
+    m_dynamic = true;
+    m_promoted = true;
+
+    m_device->RebindBuffer(this);
+    return true;
+  }
+
+  HRESULT DXUPResource::LockBufferData(D3DLOCKED_BOX* pLockedBox, CONST D3DBOX* pBox, DWORD Flags) {
+    // The app's own promises carry over, a lock that made none leaves the driver to sort it out.
+    UINT copyFlags = 0;
+    if (Flags & D3DLOCK_NOOVERWRITE)
+      copyFlags = D3D11_COPY_NO_OVERWRITE;
+    else if (Flags & D3DLOCK_DISCARD)
+      copyFlags = D3D11_COPY_DISCARD;
+
+    // Overlapping locks get whatever's safe for all of them.
+    m_bufferCopyFlags = IsLocked() ? (m_bufferCopyFlags & copyFlags) : copyFlags;
+    m_lockCount++;
+
+    if (!(Flags & D3DLOCK_READONLY))
+      AddUploadBox(0, 0, pBox);
+
+    UINT offset = (pBox != nullptr && !isBoxDegenerate(*pBox)) ? pBox->Left : 0;
+
+    pLockedBox->pBits = &m_bufferData[offset];
+    pLockedBox->RowPitch = m_width;
+    pLockedBox->SlicePitch = m_width;
+
     return D3D_OK;
   }
 
+  void DXUPResource::UnlockBufferData() {
+    m_lockCount--;
+    if (IsLocked())
+      return;
+
+    // Dynamic buffers only map DISCARD or NOOVERWRITE. Rather than wait for the GPU on a lock that promised neither,
+    // send all of our copy in a fresh buffer, there's nothing in the old one we don't have.
+    if (m_dynamic && m_bufferCopyFlags == 0 && !m_uploadBoxes[0].empty()) {
+      m_uploadBoxes[0].clear();
+      m_uploadBoxes[0].add(D3D11_BOX{ 0, 0, 0, m_bufferDesc.ByteWidth, 1, 1 });
+      m_bufferCopyFlags = D3D11_COPY_DISCARD;
+    }
+
+    m_device->UploadBufferData(this, m_uploadBoxes[0], m_bufferData, m_bufferCopyFlags);
+    m_uploadBoxes[0].clear();
+  }
+
+  void DXUPResource::UploadBufferData(ID3D11DeviceContext* context, const D3D11_BOX* boxes, UINT count, const uint8_t* data, bool packed, UINT copyFlags) {
+    if (copyFlags == D3D11_COPY_DISCARD && CanRename() && Rename(context)) {
+      m_device->RebindBuffer(this);
+
+      // Nothing has used the new buffer yet, our copies to it needn't discard anything.
+      copyFlags = D3D11_COPY_NO_OVERWRITE;
+    }
+
+    if (m_dynamic) {
+      // UnlockBufferData turned any lock that promised nothing into a discard of the whole buffer.
+      D3D11_MAPPED_SUBRESOURCE res;
+      D3D11_MAP mapType = copyFlags == D3D11_COPY_DISCARD ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+      if (FAILED(context->Map(GetResource(), 0, mapType, 0, &res))) {
+        log::warn("UploadBufferData: failed to map dynamic buffer.");
+        return;
+      }
+
+      for (UINT i = 0; i < count; i++) {
+        UINT length = boxes[i].right - boxes[i].left;
+        std::memcpy(reinterpret_cast<uint8_t*>(res.pData) + boxes[i].left, packed ? data : &data[boxes[i].left], length);
+
+        if (packed)
+          data += length;
+      }
+
+      context->Unmap(GetResource(), 0);
+      return;
+    }
+
+    ID3D11DeviceContext1* context1 = useAs<ID3D11DeviceContext1>(context);
+
+    // Only the first copy may discard, the rest would throw away the ones before them.
+    for (UINT i = 0; i < count; i++) {
+      context1->UpdateSubresource1(GetResource(), 0, &boxes[i], packed ? data : &data[boxes[i].left], 0, 0, copyFlags);
+
+      if (packed)
+        data += boxes[i].right - boxes[i].left;
+
+      if (copyFlags == D3D11_COPY_DISCARD)
+        copyFlags = D3D11_COPY_NO_OVERWRITE;
+    }
+  }
+
   void DXUPResource::PushStaging() {
-    for (uint32_t slice = 0; slice < m_slices; slice++) {
-      uint64_t delta = GetChangedMips(slice);
+    ID3D11Resource* source = m_fixup8888 == nullptr ? GetStaging() : m_fixup8888.ptr();
 
-      for (uint64_t mip = 0; mip < m_mips; mip++) {
+    for (uint32_t slice = 0; slice < m_slices; slice++) {
+      for (uint32_t mip = 0; mip < m_mips; mip++) {
         UINT subresource = D3D11CalcSubresource(mip, slice, m_mips);
+        D3D9DirtyBoxes& boxes = m_uploadBoxes[subresource];
 
-        bool useRect = !IsStagingBoxDegenerate(subresource);
-
-        D3D11_BOX box = { 0 };
-        if (useRect) {
-          D3D11_RESOURCE_DIMENSION dimension;
-          GetResource()->GetType(&dimension);
-
-          if (dimension == D3D11_RESOURCE_DIMENSION_BUFFER) {
-            box.top = 0;
-            box.bottom = 1;
-            box.left = m_stagingBoxes[subresource].Left;
-            box.right = m_stagingBoxes[subresource].Right;
-          }
-          else {
-            box.top = alignRectForFormat(true, m_dxgiFormat, m_stagingBoxes[subresource].Top);
-            box.bottom = alignRectForFormat(false, m_dxgiFormat, m_stagingBoxes[subresource].Bottom);
-            box.left = alignRectForFormat(true, m_dxgiFormat, m_stagingBoxes[subresource].Left);
-            box.right = alignRectForFormat(false, m_dxgiFormat, m_stagingBoxes[subresource].Right);
-          }
-
-          if (dimension == D3D11_RESOURCE_DIMENSION_TEXTURE2D || dimension == D3D11_RESOURCE_DIMENSION_BUFFER) {
-            box.front = 0;
-            box.back = 1;
-          }
-          else {
-            box.front = alignRectForFormat(true, m_dxgiFormat, m_stagingBoxes[subresource].Front);
-            box.back = alignRectForFormat(false, m_dxgiFormat, m_stagingBoxes[subresource].Back);
-          }
+        if (mip == 0 && m_autogenMips && !boxes.empty())
+          m_mipsStale = true;
+
+        for (const D3D11_BOX& box : boxes) {
+          bool whole = box.left == 0 && box.top == 0 && box.front == 0 &&
+                       box.right == GetWidth(mip) && box.bottom == GetHeight(mip) && box.back == GetDepth(mip);
+
+          m_device->GetContext()->CopySubresourceRegion(GetResource(), subresource, box.left, box.top, box.front, source, subresource, whole ? nullptr : &box);
         }
 
-        if (delta & (1ull << mip))
-          m_device->GetContext()->CopySubresourceRegion(GetResource(), subresource, box.left, box.top, 0, m_fixup8888 == nullptr ? GetStaging() : m_fixup8888.ptr(), subresource, useRect ? &box : nullptr);
+        boxes.clear();
       }
     }
-    
+
     ResetMipMapTracking();
   }
 
@@ -16,11 +16,115 @@
 #include "d3d9_query.h"
 #include "d3d9_state.h"
 #include "d3d9_renderer.h"
+#include "d3d9_command_stream.h"
+#include "d3d11_staging_pool.h"
+#include "d3d9_format_convert.h"
 #include <d3d11_4.h>
 #include <float.h>
+#include <algorithm>
 
 namespace dxup {
 
+  namespace {
+    // How many vertices or indices a UP draw reads from the app's memory.
+    UINT upElementCount(D3DPRIMITIVETYPE type, UINT primitiveCount) {
+      if (type == D3DPT_TRIANGLEFAN)
+        return primitiveCount + 2;
+
+      D3D_PRIMITIVE_TOPOLOGY topology;
+      return convert::primitiveData(type, primitiveCount, topology);
+    }
+
+    void copyRows(uint8_t* dst, UINT dstPitch, const uint8_t* src, UINT srcPitch, UINT rowBytes, UINT rows) {
+      for (UINT i = 0; i < rows; i++)
+        std::memcpy(&dst[i * dstPitch], &src[i * srcPitch], rowBytes);
+    }
+
+    // Uploads a box of a system memory texture, formats we keep as 8888 on the GPU are converted on the way.
+    void uploadSystemMemory(ID3D11DeviceContext* context, ID3D11Resource* dst, UINT dstSubresource, const D3D11_BOX& dstBox, DXUPResource* src, UINT srcSubresource, UINT x, UINT y, UINT z, const PALETTEENTRY* palette) {
+      UINT srcPitch;
+      UINT srcSlicePitch;
+      const uint8_t* data = src->GetSystemMemory(srcSubresource, x, y, z, &srcPitch, &srcSlicePitch);
+
+      if (src->GetConversionFormat() == D3DFMT_UNKNOWN) {
+        context->UpdateSubresource(dst, dstSubresource, &dstBox, data, srcPitch, srcSlicePitch);
+        return;
+      }
+
+      UINT width = dstBox.right - dstBox.left;
+      UINT height = dstBox.bottom - dstBox.top;
+      UINT depth = dstBox.back - dstBox.front;
+
+      UINT convertedPitch = rowPitch(src->GetDXGIFormat(), width);
+      UINT convertedSlicePitch = convertedPitch * height;
+      std::vector<uint8_t> converted(size_t(convertedSlicePitch) * depth);
+
+      convertPixels(
+        src->GetConversionFormat(),
+        palette,
+        converted.data(), convertedPitch, convertedSlicePitch,
+        data, srcPitch, srcSlicePitch,
+        width, height, depth);
+
+      context->UpdateSubresource(dst, dstSubresource, &dstBox, converted.data(), convertedPitch, convertedSlicePitch);
+    }
+
+    DXUPResource* baseTextureResource(IDirect3DBaseTexture9* texture, DWORD* usage) {
+      switch (texture->GetType()) {
+
+      case D3DRTYPE_TEXTURE: {
+        Direct3DTexture9* tex = reinterpret_cast<Direct3DTexture9*>(texture);
+        *usage = tex->GetD3D9Desc().Usage;
+        return tex->GetDXUPResource();
+      }
+
+      case D3DRTYPE_CUBETEXTURE: {
+        Direct3DCubeTexture9* tex = reinterpret_cast<Direct3DCubeTexture9*>(texture);
+        *usage = tex->GetD3D9Desc().Usage;
+        return tex->GetDXUPResource();
+      }
+
+      case D3DRTYPE_VOLUMETEXTURE: {
+        Direct3DVolumeTexture9* tex = reinterpret_cast<Direct3DVolumeTexture9*>(texture);
+        *usage = tex->GetD3D9Desc().Usage;
+        return tex->GetDXUPResource();
+      }
+
+      default: return nullptr;
+
+      }
+    }
+  }
+
+  template <typename Fn>
+  void Direct3DDevice9Ex::runRenderer(Fn&& fn) {
+    if (m_cs == nullptr) {
+      fn(m_renderer);
+      return;
+    }
+
+    // The worker only ever sees what changed since the last command it got, written into the stream alongside it.
+    beginCommand(0);
+
+    const uint8_t* dirty = nullptr;
+    if (m_state->hasDirty()) {
+      uint8_t* data = reinterpret_cast<uint8_t*>(m_cs->allocData(m_state->dirtySize()));
+      m_state->encodeDirty(data);
+      dirty = data;
+    }
+
+    m_cs->emit([dirty, csState = m_csState, fn = std::forward<Fn>(fn)] (D3D9ImmediateRenderer* renderer) mutable {
+      if (dirty != nullptr)
+        csState->decodeDirty(dirty);
+
+      fn(renderer);
+    });
+  }
+
+  void Direct3DDevice9Ex::beginCommand(size_t dataLength) {
+    m_cs->begin({ dataLength, m_state->hasDirty() ? m_state->dirtySize() : 0 });
+  }
+
   Direct3DDevice9Ex::Direct3DDevice9Ex(
     UINT adapterNum,
     IDXGIAdapter1* adapter,
@@ -42,9 +146,18 @@ namespace dxup {
     , m_flags{ flags }
     , m_deviceType{ deviceType }
     , m_state{ new D3D9State(this, 0) }
-    , m_stateBlock{ nullptr } {
-    m_renderer = new D3D9ImmediateRenderer{ device, context, m_state };
+    , m_stateBlock{ nullptr }
+    , m_stagingPool{ new D3D11StagingPool(device, uint64_t(config::getInt(config::StagingBudget)) << 20) } {
+    if (config::getBool(config::CommandStream)) {
+      m_csState = new D3D9State(this, 0);
+      m_renderer = new D3D9ImmediateRenderer{ device, context, m_csState };
+      m_cs = new D3D9CommandStream{ m_renderer };
+    }
+    else
+      m_renderer = new D3D9ImmediateRenderer{ device, context, m_state };
+
     InitializeCriticalSection(&m_criticalSection);
+    InitializeCriticalSection(&m_readbackLock);
 
     if (!(behaviourFlags & D3DCREATE_FPU_PRESERVE))
       setupFPUFlags();
@@ -355,7 +468,10 @@ namespace dxup {
       SetClipPlane(i, plane);
     }
 
-    m_renderer->undirtyContext(); // This should free up the swapchain SRVs on the d3d11 context.
+    runRenderer([] (D3D9ImmediateRenderer* renderer) {
+      renderer->undirtyContext(); // This should free up the swapchain SRVs on the d3d11 context.
+    });
+    FlushRenderer();
 
     if (GetInternalSwapchain(0) == nullptr) {
       result = CreateAdditionalSwapChain(pPresentationParameters, (IDirect3DSwapChain9**)&m_swapchains[0]);
@@ -419,7 +535,18 @@ namespace dxup {
   }
 
   Direct3DDevice9Ex::~Direct3DDevice9Ex() {
+    // Finishes off whatever is still queued.
+    delete m_cs;
+
+    if (config::getBool(config::Stats)) {
+      m_state->logSetStats();
+      m_renderer->logStats();
+      m_stagingPool->logStats();
+    }
+
+    DeleteCriticalSection(&m_readbackLock);
     DeleteCriticalSection(&m_criticalSection);
+    delete m_csState;
     delete m_state;
   }
 
@@ -438,6 +565,11 @@ namespace dxup {
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::TestCooperativeLevel() {
     CriticalSection cs(this);
 
+    // A deferred present may already have found the device gone.
+    HRESULT deferred = m_deferredPresentResult.load();
+    if (FAILED(deferred))
+      return deferred;
+
     if (m_flags & DeviceFlag_Ex)
       return D3D_OK;
 
@@ -594,7 +726,9 @@ namespace dxup {
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::Present(CONST RECT* pSourceRect, CONST RECT* pDestRect, HWND hDestWindowOverride, CONST RGNDATA* pDirtyRegion) {
     CriticalSection cs(this);
 
-    m_renderer->endFrame();
+    runRenderer([] (D3D9ImmediateRenderer* renderer) {
+      renderer->endFrame();
+    });
     return PresentEx(pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion, 0);
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetBackBuffer(UINT iSwapChain, UINT iBackBuffer, D3DBACKBUFFER_TYPE Type, IDirect3DSurface9** ppBackBuffer) {
@@ -693,8 +827,6 @@ namespace dxup {
     if (!ppIndexBuffer)
       return log::d3derr(D3DERR_INVALIDCALL, "CreateIndexBuffer: ppIndexBuffer was nullptr.");
 
-    Usage &= ~D3DUSAGE_WRITEONLY; // We don't care about this for index buffers as we need staging on them for tri fan fixup.
-
     D3D11_BUFFER_DESC desc;
     desc.ByteWidth = Length;
     desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
@@ -786,9 +918,50 @@ namespace dxup {
     if (srcDesc.Format != dstDesc.Format)
       return log::d3derr(D3DERR_INVALIDCALL, "UpdateSurface: src format is not the same as dst format.");
 
-    // TODO: do we need to do staging here too? Look into this.
-    m_context->CopySubresourceRegion(dst->GetDXUPResource()->GetResource(), dst->GetSubresource(), dstX, dstY, 0, src->GetDXUPResource()->GetResource(), src->GetSubresource(), &srcBox);
-    dst->GetDXUPResource()->MarkDirty(dst->GetSlice(), dst->GetMip());
+    DXUPResource* srcResource = src->GetDXUPResource();
+    DXUPResource* dstResource = dst->GetDXUPResource();
+    DXGI_FORMAT format = srcResource->GetDXGIFormat();
+
+    UINT srcPitch;
+    UINT dstPitch;
+    UINT slicePitch;
+
+    // Copies from the GPU still on their way into system memory have to land before it's read or written on the CPU.
+    if (srcResource->HasQueuedReadbacks())
+      srcResource->FinishReadbacks(GetContext(), false);
+
+    if (srcResource->IsSystemMemory() && dstResource->HasQueuedReadbacks())
+      dstResource->FinishReadbacks(GetContext(), false);
+
+    if (srcResource->IsSystemMemory() && dstResource->IsSystemMemory()) {
+      const uint8_t* srcData = srcResource->GetSystemMemory(src->GetSubresource(), srcBox.left, srcBox.top, 0, &srcPitch, &slicePitch);
+      uint8_t* dstData = dstResource->GetSystemMemory(dst->GetSubresource(), dstX, dstY, 0, &dstPitch, &slicePitch);
+      copyRows(dstData, dstPitch, srcData, srcPitch, srcResource->CalcRowPitch(srcBox.right - srcBox.left), rowCount(format, srcBox.bottom - srcBox.top));
+
+      return D3D_OK;
+    }
+
+    FlushRenderer();
+
+    if (srcResource->IsSystemMemory()) {
+      // Straight from system memory into the texture, no staging copy of our own in between.
+      D3D11_BOX dstBox = { dstX, dstY, 0, dstX + (srcBox.right - srcBox.left), dstY + (srcBox.bottom - srcBox.top), 1 };
+      uploadSystemMemory(m_context.ptr(), dstResource->GetResource(), dst->GetSubresource(), dstBox, srcResource, src->GetSubresource(), srcBox.left, srcBox.top, 0, GetCurrentPalette());
+    }
+    else if (dstResource->IsSystemMemory()) {
+      if (dstResource->GetConversionFormat() != D3DFMT_UNKNOWN)
+        return log::d3derr(D3DERR_INVALIDCALL, "UpdateSurface: can't read back format %d, it's converted on upload.", dstDesc.Format);
+
+      // Apps tend to lock the result a while later, by then the GPU has likely done its part.
+      if (FAILED(dstResource->QueueReadback(m_context.ptr(), srcResource, src->GetSubresource(), srcBox, dst->GetSubresource(), dstX, dstY)))
+        return log::d3derr(D3DERR_INVALIDCALL, "UpdateSurface: failed to read back into system memory.");
+
+      return D3D_OK;
+    }
+    else
+      m_context->CopySubresourceRegion(dstResource->GetResource(), dst->GetSubresource(), dstX, dstY, 0, srcResource->GetResource(), src->GetSubresource(), &srcBox);
+
+    dstResource->MarkDirty(dst->GetSlice(), dst->GetMip());
     
     return D3D_OK;
   }
@@ -804,32 +977,69 @@ namespace dxup {
     if (pSourceTexture->GetType() != pDestinationTexture->GetType())
       return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: resource types don't match.");
 
-    switch (pSourceTexture->GetType()) {
+    DWORD srcUsage;
+    DWORD dstUsage;
+    DXUPResource* src = baseTextureResource(pSourceTexture, &srcUsage);
+    DXUPResource* dst = baseTextureResource(pDestinationTexture, &dstUsage);
 
-    case D3DRTYPE_TEXTURE: {
+    if (src == nullptr || dst == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: unsupported resource type (%d).", pSourceTexture->GetType());
 
-      IDirect3DTexture9* srcTex = reinterpret_cast<Direct3DTexture9*>(pSourceTexture);
-      IDirect3DTexture9* dstTex = reinterpret_cast<Direct3DTexture9*>(pDestinationTexture);
+    if (src->GetDXGIFormat() != dst->GetDXGIFormat())
+      return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: src format is not the same as dst format.");
 
-      // TODO! Avoid COM here.
-      Com<IDirect3DSurface9> srcSurface;
-      Com<IDirect3DSurface9> dstSurface;
+    if (src->GetSlices() != dst->GetSlices())
+      return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: slice counts don't match.");
 
-      srcTex->GetSurfaceLevel(0, &srcSurface);
-      dstTex->GetSurfaceLevel(0, &dstSurface);
+    if (dst->IsSystemMemory())
+      return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: dst is in system memory.");
 
-      StretchRect(srcSurface.ptr(), NULL, dstSurface.ptr(), NULL, D3DTEXF_NONE);
-      dstTex->GenerateMipSubLevels();
+    // The source can have extra levels on top, the destination's first level is whichever one matches its size.
+    UINT srcFirstMip = 0;
+    while (srcFirstMip < src->GetMips() &&
+          (src->GetWidth(srcFirstMip) != dst->GetWidth(0) || src->GetHeight(srcFirstMip) != dst->GetHeight(0) || src->GetDepth(srcFirstMip) != dst->GetDepth(0)))
+      srcFirstMip++;
 
-      return D3D_OK;
-    }
+    // Autogen textures only take the top level, the rest are theirs to generate.
+    bool autogen = dstUsage & D3DUSAGE_AUTOGENMIPMAP;
+    UINT mips = autogen ? 1 : dst->GetMips();
 
-    default: return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: unsupported resource type (%d).", pSourceTexture->GetType());
+    if (srcFirstMip + mips > src->GetMips())
+      return log::d3derr(D3DERR_INVALIDCALL, "UpdateTexture: src has no levels matching dst.");
+
+    FlushRenderer();
+
+    src->FinishReadbacks(m_context.ptr(), false);
+
+    for (UINT slice = 0; slice < dst->GetSlices(); slice++) {
+      for (UINT mip = 0; mip < mips; mip++) {
+        UINT srcSubresource = D3D11CalcSubresource(srcFirstMip + mip, slice, src->GetMips());
+        UINT dstSubresource = D3D11CalcSubresource(mip, slice, dst->GetMips());
+
+        if (!src->IsSystemMemory()) {
+          m_context->CopySubresourceRegion(dst->GetResource(), dstSubresource, 0, 0, 0, src->GetResource(), srcSubresource, nullptr);
+          dst->MarkDirty(slice, mip);
+          continue;
+        }
+
+        const D3D9DirtyBoxes& boxes = src->GetUploadBoxes(srcSubresource);
+        for (const D3D11_BOX& box : boxes)
+          uploadSystemMemory(m_context.ptr(), dst->GetResource(), dstSubresource, box, src, srcSubresource, box.left, box.top, box.front, GetCurrentPalette());
+
+        if (!boxes.empty())
+          dst->MarkDirty(slice, mip);
+      }
     }
+
+    // Autogen destinations have their top level marked dirty, they regenerate once sampled.
+    src->ClearUploadBoxes();
+
+    return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetRenderTargetData(IDirect3DSurface9* pRenderTarget, IDirect3DSurface9* pDestSurface) {
     CriticalSection cs(this);
 
+    // The copy down to system memory is queued there, it lands once the app locks the surface.
     return UpdateSurface(pRenderTarget, nullptr, pDestSurface, nullptr);
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetFrontBufferData(UINT iSwapChain, IDirect3DSurface9* pDestSurface) {
@@ -849,6 +1059,11 @@ namespace dxup {
     Direct3DSurface9* src = reinterpret_cast<Direct3DSurface9*>(pSourceSurface);
     Direct3DSurface9* dst = reinterpret_cast<Direct3DSurface9*>(pDestSurface);
 
+    if (src->GetDXUPResource()->IsSystemMemory() || dst->GetDXUPResource()->IsSystemMemory())
+      return log::d3derr(D3DERR_INVALIDCALL, "StretchRect: system memory surfaces can't be stretched to or from.");
+
+    FlushRenderer();
+
     if (pSourceRect != nullptr && pDestRect != nullptr) {
       UINT x = pDestRect->left;
       UINT y = pDestRect->top;
@@ -886,6 +1101,7 @@ namespace dxup {
     float d3d11Color[4];
     convert::color(color, d3d11Color);
 
+    FlushRenderer();
     m_context->ClearView(src->GetD3D11RenderTarget(false), d3d11Color, pRect, pRect == nullptr ? 0 : 1);
 
     return D3D_OK;
@@ -909,7 +1125,9 @@ namespace dxup {
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetDepthStencilSurface(IDirect3DSurface9* pNewZStencil) {
     CriticalSection cs(this);
-    m_renderer->handleDepthStencilDiscard(); // TODO! Does this only get done in d3d9 if it gets set.
+    runRenderer([] (D3D9ImmediateRenderer* renderer) {
+      renderer->handleDepthStencilDiscard(); // TODO! Does this only get done in d3d9 if it gets set.
+    });
     return GetEditState()->SetDepthStencilSurface(pNewZStencil);
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetDepthStencilSurface(IDirect3DSurface9** ppZStencilSurface) {
@@ -922,12 +1140,33 @@ namespace dxup {
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::EndScene() {
     CriticalSection cs(this);
-    m_context->Flush();
+    runRenderer([this, context = m_context.ptr()] (D3D9ImmediateRenderer* renderer) {
+      renderer->flushBatch();
+
+      // Resources the app stopped reading back drop out of the list.
+      EnterCriticalSection(&m_readbackLock);
+      m_readbacks.erase(std::remove_if(m_readbacks.begin(), m_readbacks.end(), [] (DXUPResource* resource) {
+        return !resource->UpdateReadback();
+      }), m_readbacks.end());
+      LeaveCriticalSection(&m_readbackLock);
+
+      context->Flush();
+    });
     return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::Clear(DWORD Count, CONST D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil) {
     CriticalSection cs(this);
-    return m_renderer->Clear(Count, pRects, Flags, Color, Z, Stencil);
+
+    if (m_cs == nullptr)
+      return m_renderer->Clear(Count, pRects, Flags, Color, Z, Stencil);
+
+    beginCommand(pRects != nullptr ? sizeof(D3DRECT) * Count : 0);
+    const D3DRECT* rects = pRects != nullptr ? reinterpret_cast<const D3DRECT*>(m_cs->copyData(pRects, sizeof(D3DRECT) * Count)) : nullptr;
+    runRenderer([=] (D3D9ImmediateRenderer* renderer) {
+      renderer->Clear(Count, rects, Flags, Color, Z, Stencil);
+    });
+
+    return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetTransform(D3DTRANSFORMSTATETYPE State, CONST D3DMATRIX* pMatrix) {
     CriticalSection cs(this);
@@ -1098,30 +1337,52 @@ namespace dxup {
     *pNumPasses = 1;
     return D3D_OK;
   }
+  // P8 textures are expanded with the current palette when they're unlocked, changing it later doesn't touch them.
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetPaletteEntries(UINT PaletteNumber, CONST PALETTEENTRY* pEntries) {
     CriticalSection cs(this);
 
-    log::stub("Direct3DDevice9Ex::SetPaletteEntries");
+    if (pEntries == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "SetPaletteEntries: pEntries was nullptr.");
+
+    std::array<PALETTEENTRY, 256>& palette = m_palettes[PaletteNumber];
+    std::memcpy(palette.data(), pEntries, sizeof(PALETTEENTRY) * palette.size());
     return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetPaletteEntries(UINT PaletteNumber, PALETTEENTRY* pEntries) {
     CriticalSection cs(this);
 
-    log::stub("Direct3DDevice9Ex::GetPaletteEntries");
+    if (pEntries == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "GetPaletteEntries: pEntries was nullptr.");
+
+    auto palette = m_palettes.find(PaletteNumber);
+    if (palette == m_palettes.end())
+      return log::d3derr(D3DERR_INVALIDCALL, "GetPaletteEntries: palette %d was never set.", PaletteNumber);
+
+    std::memcpy(pEntries, palette->second.data(), sizeof(PALETTEENTRY) * palette->second.size());
     return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetCurrentTexturePalette(UINT PaletteNumber) {
     CriticalSection cs(this);
 
-    log::stub("Direct3DDevice9Ex::SetCurrentTexturePalette");
+    m_currentPalette = PaletteNumber;
     return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetCurrentTexturePalette(UINT *PaletteNumber) {
     CriticalSection cs(this);
 
-    log::stub("Direct3DDevice9Ex::GetCurrentTexturePalette");
+    if (PaletteNumber == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "GetCurrentTexturePalette: PaletteNumber was nullptr.");
+
+    *PaletteNumber = m_currentPalette;
     return D3D_OK;
   }
+  const PALETTEENTRY* Direct3DDevice9Ex::GetCurrentPalette() {
+    auto palette = m_palettes.find(m_currentPalette);
+    if (palette == m_palettes.end())
+      return nullptr;
+
+    return palette->second.data();
+  }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetScissorRect(CONST RECT* pRect) {
     CriticalSection cs(this);
     return GetEditState()->SetScissorRect(pRect);
@@ -1155,19 +1416,94 @@ namespace dxup {
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex, UINT PrimitiveCount) {
     CriticalSection cs(this);
-    return m_renderer->DrawPrimitive(PrimitiveType, StartVertex, PrimitiveCount);
+
+    if (m_cs == nullptr)
+      return m_renderer->DrawPrimitive(PrimitiveType, StartVertex, PrimitiveCount);
+
+    runRenderer([=] (D3D9ImmediateRenderer* renderer) {
+      renderer->DrawPrimitive(PrimitiveType, StartVertex, PrimitiveCount);
+    });
+
+    return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::DrawIndexedPrimitive(D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex, UINT NumVertices, UINT startIndex, UINT primCount) {
     CriticalSection cs(this);
-    return m_renderer->DrawIndexedPrimitive(PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+
+    if (m_cs == nullptr)
+      return m_renderer->DrawIndexedPrimitive(PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+
+    // The app can lock and rewrite the index buffer as soon as we return, the worker converts the fan from a copy.
+    if (PrimitiveType == D3DPT_TRIANGLEFAN) {
+      if (m_state->indexBuffer == nullptr)
+        return log::d3derr(D3DERR_INVALIDCALL, "DrawIndexedPrimitive: no index buffer bound.");
+
+      const uint8_t* fan = nullptr;
+      HRESULT result = m_state->indexBuffer->GetFanIndices(startIndex, primCount, &fan);
+      if (FAILED(result))
+        return result;
+
+      const D3DFORMAT format = m_state->indexBuffer->GetD3D9Desc().Format;
+      const UINT fanLength = upElementCount(D3DPT_TRIANGLEFAN, primCount) * (format == D3DFMT_INDEX32 ? 4 : 2);
+      beginCommand(fanLength);
+      const void* indices = m_cs->copyData(fan, fanLength);
+      runRenderer([=] (D3D9ImmediateRenderer* renderer) {
+        renderer->DrawIndexedTriangleFan(BaseVertexIndex, primCount, indices, format);
+      });
+
+      return D3D_OK;
+    }
+
+    runRenderer([=] (D3D9ImmediateRenderer* renderer) {
+      renderer->DrawIndexedPrimitive(PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
+    });
+
+    return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::DrawPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, CONST void* pVertexStreamZeroData, UINT VertexStreamZeroStride) {
     CriticalSection cs(this);
-    return m_renderer->DrawPrimitiveUP(PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride);
+
+    if (m_cs == nullptr)
+      return m_renderer->DrawPrimitiveUP(PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride);
+
+    if (pVertexStreamZeroData == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "DrawPrimitiveUP: pVertexStreamZeroData was nullptr.");
+
+    // The app is free to reuse its memory once we return.
+    const UINT vertexLength = upElementCount(PrimitiveType, PrimitiveCount) * VertexStreamZeroStride;
+    beginCommand(vertexLength);
+    const void* vertices = m_cs->copyData(pVertexStreamZeroData, vertexLength);
+    runRenderer([=] (D3D9ImmediateRenderer* renderer) {
+      renderer->DrawPrimitiveUP(PrimitiveType, PrimitiveCount, vertices, VertexStreamZeroStride);
+    });
+
+    return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::DrawIndexedPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices, UINT PrimitiveCount, CONST void* pIndexData, D3DFORMAT IndexDataFormat, CONST void* pVertexStreamZeroData, UINT VertexStreamZeroStride) {
     CriticalSection cs(this);
-    return m_renderer->DrawIndexedPrimitiveUP(PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData, IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride);
+
+    if (m_cs == nullptr)
+      return m_renderer->DrawIndexedPrimitiveUP(PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData, IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride);
+
+    if (pVertexStreamZeroData == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "DrawIndexedPrimitiveUP: pVertexStreamZeroData was nullptr.");
+
+    if (pIndexData == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "DrawIndexedPrimitiveUP: pIndexData was nullptr.");
+
+    // One block for both so they can't end up in different chunks.
+    const UINT vertexLength = (MinVertexIndex + NumVertices) * VertexStreamZeroStride;
+    const UINT indexLength = upElementCount(PrimitiveType, PrimitiveCount) * (IndexDataFormat == D3DFMT_INDEX32 ? 4 : 2);
+
+    beginCommand(vertexLength + indexLength);
+    uint8_t* data = reinterpret_cast<uint8_t*>(m_cs->allocData(vertexLength + indexLength));
+    std::memcpy(data, pVertexStreamZeroData, vertexLength);
+    std::memcpy(data + vertexLength, pIndexData, indexLength);
+
+    runRenderer([=] (D3D9ImmediateRenderer* renderer) {
+      renderer->DrawIndexedPrimitiveUP(PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, data + vertexLength, IndexDataFormat, data, VertexStreamZeroStride);
+    });
+
+    return D3D_OK;
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::ProcessVertices(UINT SrcStartIndex, UINT DestIndex, UINT VertexCount, IDirect3DVertexBuffer9* pDestBuffer, IDirect3DVertexDeclaration9* pVertexDecl, DWORD Flags) {
     CriticalSection cs(this);
@@ -1378,15 +1714,11 @@ namespace dxup {
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetStreamSourceFreq(UINT StreamNumber, UINT Setting) {
     CriticalSection cs(this);
-
-    log::stub("Direct3DDevice9Ex::SetStreamSourceFreq");
-    return D3D_OK;
+    return GetEditState()->SetStreamSourceFreq(StreamNumber, Setting);
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::GetStreamSourceFreq(UINT StreamNumber, UINT* pSetting) {
     CriticalSection cs(this);
-
-    log::stub("Direct3DDevice9Ex::GetStreamSourceFreq");
-    return D3D_OK;
+    return m_state->GetStreamSourceFreq(StreamNumber, pSetting);
   }
   HRESULT STDMETHODCALLTYPE Direct3DDevice9Ex::SetIndices(IDirect3DIndexBuffer9* pIndexData) {
     CriticalSection cs(this);
@@ -1570,12 +1902,43 @@ namespace dxup {
     CriticalSection cs(this);
 
     // Not sure what swapchain to use here, going with this one ~ Josh
-    HRESULT result = GetInternalSwapchain(0)->Present(pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion, dwFlags);
+    Direct3DSwapChain9Ex* swapchain = GetInternalSwapchain(0);
+    HRESULT result = D3D_OK;
+
+    // DONOTWAIT wants to hear back if the present would block so that one can't be deferred.
+    if (m_cs != nullptr && !(dwFlags & D3DPRESENT_DONOTWAIT)) {
+      Com<Direct3DSwapChain9Ex> presentSwapchain = swapchain;
+      runRenderer([this, presentSwapchain, hDestWindowOverride, dwFlags, ex = (m_flags & DeviceFlag_Ex) != 0] (D3D9ImmediateRenderer* renderer) {
+        // The swapchain ignores the rects and region anyway.
+        HRESULT result = presentSwapchain->PresentD3D11(nullptr, nullptr, hDestWindowOverride, nullptr, dwFlags, 0, ex);
+        if (FAILED(result))
+          log::warn("PresentEx: deferred present failed (%d).", result);
+
+        m_deferredPresentResult.store(result);
+
+        renderer->handleDepthStencilDiscard();
+      });
 
-    m_renderer->handleDepthStencilDiscard();
+      // Let the app record at most one frame ahead of the worker.
+      uint64_t present = m_cs->flush();
+      m_cs->synchronize(m_lastPresent);
+      m_lastPresent = present;
+
+      // This frame's present may not have run yet, the app gets the last one that did.
+      result = m_deferredPresentResult.load();
+    }
+    else {
+      result = swapchain->Present(pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion, dwFlags);
+
+      runRenderer([] (D3D9ImmediateRenderer* renderer) {
+        renderer->handleDepthStencilDiscard();
+      });
+    }
 
     if (m_pendingCursorUpdate.update)
       SetCursorPosition(m_pendingCursorUpdate.x, m_pendingCursorUpdate.y, D3DCURSOR_IMMEDIATE_UPDATE);
+
+    m_frameCount++;
     
     return result;
   }
@@ -1614,8 +1977,87 @@ namespace dxup {
     *parent = static_cast<Direct3D9Ex*>( ref(m_parent) );
   }
   ID3D11DeviceContext* Direct3DDevice9Ex::GetContext() {
+    // Whoever wants the context is about to do something that has to land after the draws we have batched up.
+    FlushRenderer();
     return m_context.ptr();
   }
+  void Direct3DDevice9Ex::FlushRenderer() {
+    if (m_cs == nullptr || m_cs->isWorkerThread()) {
+      m_renderer->flushBatch();
+      return;
+    }
+
+    m_cs->emit([] (D3D9ImmediateRenderer* renderer) {
+      renderer->flushBatch();
+    });
+    m_cs->synchronize();
+  }
+  void Direct3DDevice9Ex::TrackReadback(DXUPResource* resource) {
+    EnterCriticalSection(&m_readbackLock);
+    m_readbacks.push_back(resource);
+    LeaveCriticalSection(&m_readbackLock);
+  }
+
+  void Direct3DDevice9Ex::UntrackReadback(DXUPResource* resource) {
+    EnterCriticalSection(&m_readbackLock);
+    m_readbacks.erase(std::remove(m_readbacks.begin(), m_readbacks.end(), resource), m_readbacks.end());
+    LeaveCriticalSection(&m_readbackLock);
+  }
+
+  void Direct3DDevice9Ex::RebindBuffer(DXUPResource* resource) {
+    // Uploads rename on the worker, the state it draws from is the one that has to see that.
+    if (m_cs != nullptr && m_cs->isWorkerThread())
+      m_csState->rebindBuffer(resource);
+    else
+      m_state->rebindBuffer(resource);
+  }
+
+  void Direct3DDevice9Ex::UploadBufferData(DXUPResource* resource, const D3D9DirtyBoxes& boxes, const uint8_t* data, UINT copyFlags) {
+    if (boxes.empty())
+      return;
+
+    const UINT count = UINT(boxes.end() - boxes.begin());
+
+    if (m_cs == nullptr) {
+      FlushRenderer();
+      resource->UploadBufferData(m_context.ptr(), boxes.begin(), count, data, false, copyFlags);
+      return;
+    }
+
+    // The app may write m_bufferData again before the worker gets here, so it gets its own copy of just the written ranges.
+    size_t length = 0;
+    for (const D3D11_BOX& box : boxes)
+      length += box.right - box.left;
+
+    uint8_t* stream = reinterpret_cast<uint8_t*>(m_cs->allocData(sizeof(D3D11_BOX) * count + length));
+
+    D3D11_BOX* streamBoxes = reinterpret_cast<D3D11_BOX*>(stream);
+    std::memcpy(streamBoxes, boxes.begin(), sizeof(D3D11_BOX) * count);
+
+    uint8_t* packed = stream + sizeof(D3D11_BOX) * count;
+    uint8_t* write = packed;
+    for (const D3D11_BOX& box : boxes) {
+      std::memcpy(write, &data[box.left], box.right - box.left);
+      write += box.right - box.left;
+    }
+
+    m_cs->emit([resource = Com<DXUPResource>(resource), context = m_context.ptr(), streamBoxes, count, packed, copyFlags] (D3D9ImmediateRenderer* renderer) {
+      resource->UploadBufferData(context, streamBoxes, count, packed, true, copyFlags);
+    });
+  }
+
+  D3D11StagingPool* Direct3DDevice9Ex::GetStagingPool() {
+    return m_stagingPool.get();
+  }
+
+  D3D9ImmediateRenderer* Direct3DDevice9Ex::GetRenderer() {
+    // Callers use the renderer directly, the worker has to be idle for that.
+    if (m_cs != nullptr && !m_cs->isWorkerThread())
+      m_cs->synchronize();
+
+    return m_renderer;
+  }
+
   ID3D11Device* Direct3DDevice9Ex::GetD3D11Device() {
     return m_device.ptr();
   }
@@ -4,11 +4,19 @@
 #include "d3d9_constant_buffer.h"
 #include "d3d9_state_caches.h"
 #include <array>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace dxup {
 
   class D3D9State;
   class D3D9ImmediateRenderer;
+  class D3D9CommandStream;
+  class DXUPResource;
+  class D3D11StagingPool;
+  class D3D9DirtyBoxes;
   class Direct3DStateBlock9;
 
   class Direct3DDevice9Ex final : public Unknown<IDirect3DDevice9Ex> {
@@ -158,6 +166,9 @@ namespace dxup {
 
     void GetParent(Direct3D9Ex** parent);
     ID3D11DeviceContext* GetContext();
+
+    // Makes sure everything recorded so far has reached the D3D11 context before the caller touches it.
+    void FlushRenderer();
     ID3D11Device* GetD3D11Device();
 
     static HRESULT Create(
@@ -175,10 +186,31 @@ namespace dxup {
       return m_parent->CheckDeviceFormat(m_adapterNum, m_deviceType, D3DFMT_X8R8G8B8, usage, type, format) == D3D_OK;
     }
 
-    inline D3D9ImmediateRenderer* GetRenderer() {
-      return m_renderer;
+    D3D9ImmediateRenderer* GetRenderer();
+    D3D11StagingPool* GetStagingPool();
+
+    // Resources the app reads back from, their copies to staging are started at the end of every scene.
+    void TrackReadback(DXUPResource* resource);
+    void UntrackReadback(DXUPResource* resource);
+
+    // A buffer swapped what's behind it, anywhere it's bound has to be bound again.
+    void RebindBuffer(DXUPResource* resource);
+
+    // Sends the ranges of a buffer's m_bufferData an unlock wrote, in order with the draws around it.
+    // With DXUP_CSTHREAD they're copied into the stream so the app can lock again without waiting for the worker.
+    void UploadBufferData(DXUPResource* resource, const D3D9DirtyBoxes& boxes, const uint8_t* data, UINT copyFlags);
+
+    inline bool HasCommandStream() {
+      return m_cs != nullptr;
+    }
+
+    inline uint64_t GetFrameCount() {
+      return m_frameCount;
     }
 
+    // Entries of the palette set with SetCurrentTexturePalette, nullptr if it was never filled in.
+    const PALETTEENTRY* GetCurrentPalette();
+
     inline HWND getWindow() {
       return m_window;
     }
@@ -208,10 +240,20 @@ namespace dxup {
       uint8_t flags
     );
 
+    // Ahead of anything that might own textures, they give their staging back to it as they go.
+    std::unique_ptr<D3D11StagingPool> m_stagingPool;
+
     std::array< Com<IDirect3DSwapChain9Ex>, D3DPRESENT_BACK_BUFFERS_MAX_EX > m_swapchains;
 
     D3D9State* GetEditState();
 
+    // Runs fn against the renderer, on the command stream's worker if there is one.
+    template <typename Fn>
+    void runRenderer(Fn&& fn);
+
+    // Makes room for a command copying dataLength bytes of app data along with the dirty state runRenderer adds to it.
+    void beginCommand(size_t dataLength);
+
     D3D9State* m_state;
     ComPrivate<Direct3DStateBlock9> m_stateBlock;
 
@@ -240,6 +282,23 @@ namespace dxup {
     BOOL m_softwareVertexProcessing = 0;
 
     D3D9ImmediateRenderer* m_renderer;
+
+    // Only with DXUP_CSTHREAD. The renderer then reads m_csState, which is fed the dirty parts of m_state through the stream.
+    D3D9CommandStream* m_cs = nullptr;
+    D3D9State* m_csState = nullptr;
+    uint64_t m_lastPresent = 0;
+
+    // What the worker's last present returned, the app hears about it on its next Present or TestCooperativeLevel.
+    std::atomic<HRESULT> m_deferredPresentResult = { D3D_OK };
+
+    uint64_t m_frameCount = 0;
+
+    std::unordered_map<UINT, std::array<PALETTEENTRY, 256>> m_palettes;
+    UINT m_currentPalette = 0;
+
+    // Separate from m_criticalSection, resources can go away on the command stream's worker.
+    CRITICAL_SECTION m_readbackLock;
+    std::vector<DXUPResource*> m_readbacks;
   };
 
   class CriticalSection {
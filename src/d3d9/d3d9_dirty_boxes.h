@@ -0,0 +1,90 @@
+#pragma once
+
+#include "d3d9_base.h"
+#include <array>
+#include <algorithm>
+
+namespace dxup {
+
+  // Regions of a subresource written on the CPU that still have to reach the GPU.
+  // Only a few boxes are kept, past that a new one is merged into whichever existing box it grows the least.
+  class D3D9DirtyBoxes {
+
+  public:
+
+    static const uint32_t maxBoxes = 8;
+
+    void add(const D3D11_BOX& box) {
+      for (uint32_t i = 0; i < m_count; i++) {
+        if (contains(m_boxes[i], box))
+          return;
+      }
+
+      uint32_t kept = 0;
+      for (uint32_t i = 0; i < m_count; i++) {
+        if (!contains(box, m_boxes[i]))
+          m_boxes[kept++] = m_boxes[i];
+      }
+      m_count = kept;
+
+      if (m_count < maxBoxes) {
+        m_boxes[m_count++] = box;
+        return;
+      }
+
+      uint32_t best = 0;
+      uint64_t bestGrowth = UINT64_MAX;
+      for (uint32_t i = 0; i < m_count; i++) {
+        uint64_t growth = volume(merge(m_boxes[i], box)) - volume(m_boxes[i]);
+        if (growth < bestGrowth) {
+          best = i;
+          bestGrowth = growth;
+        }
+      }
+
+      m_boxes[best] = merge(m_boxes[best], box);
+    }
+
+    void clear() {
+      m_count = 0;
+    }
+
+    bool empty() const {
+      return m_count == 0;
+    }
+
+    const D3D11_BOX* begin() const {
+      return m_boxes.data();
+    }
+
+    const D3D11_BOX* end() const {
+      return m_boxes.data() + m_count;
+    }
+
+  private:
+
+    static bool contains(const D3D11_BOX& outer, const D3D11_BOX& inner) {
+      return outer.left <= inner.left && outer.top <= inner.top && outer.front <= inner.front &&
+             outer.right >= inner.right && outer.bottom >= inner.bottom && outer.back >= inner.back;
+    }
+
+    static D3D11_BOX merge(const D3D11_BOX& a, const D3D11_BOX& b) {
+      D3D11_BOX box;
+      box.left = std::min(a.left, b.left);
+      box.top = std::min(a.top, b.top);
+      box.front = std::min(a.front, b.front);
+      box.right = std::max(a.right, b.right);
+      box.bottom = std::max(a.bottom, b.bottom);
+      box.back = std::max(a.back, b.back);
+      return box;
+    }
+
+    static uint64_t volume(const D3D11_BOX& box) {
+      return uint64_t(box.right - box.left) * (box.bottom - box.top) * (box.back - box.front);
+    }
+
+    std::array<D3D11_BOX, maxBoxes> m_boxes;
+    uint32_t m_count = 0;
+  };
+
+}
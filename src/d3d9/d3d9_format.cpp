@@ -187,6 +187,16 @@ namespace dxup {
      }
   }
 
+  UINT rowPitch(DXGI_FORMAT fmt, UINT width) {
+    UINT block = alignment(fmt);
+    return (alignTo(width, block) * block * bitsPerPixel(fmt)) / 8;
+  }
+
+  UINT rowCount(DXGI_FORMAT fmt, UINT height) {
+    UINT block = alignment(fmt);
+    return alignTo(height, block) / block;
+  }
+
   uint32_t alignRectForFormat(bool down, DXGI_FORMAT format, uint32_t measure) {
     UINT block = alignment(format);
 
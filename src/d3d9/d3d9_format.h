@@ -24,6 +24,10 @@ namespace dxup {
   UINT bitsPerPixel(DXGI_FORMAT fmt);
   UINT alignment(DXGI_FORMAT fmt);
 
+  // Bytes in a row of pixels (or blocks) of the given width, and how many of those rows cover the given height.
+  UINT rowPitch(DXGI_FORMAT fmt, UINT width);
+  UINT rowCount(DXGI_FORMAT fmt, UINT height);
+
   uint32_t alignRectForFormat(bool down, DXGI_FORMAT format, uint32_t measure);
 
 }
\ No newline at end of file
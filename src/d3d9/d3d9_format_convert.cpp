@@ -0,0 +1,365 @@
+#include "d3d9_format_convert.h"
+#include "d3d9_base.h"
+#include <algorithm>
+#include <array>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define DXUP_TARGET(isa)
+#else
+#include <cpuid.h>
+#define DXUP_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace dxup {
+
+  namespace {
+
+    // Converts one row, lut is the format's lookup table if it has one.
+    using RowConverter = void(*)(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut);
+
+    struct CpuFeatures {
+      bool sse2;
+      bool ssse3;
+    };
+
+    CpuFeatures detectCpu() {
+      int info[4] = {};
+#if defined(_MSC_VER) && !defined(__clang__)
+      __cpuid(info, 1);
+#else
+      unsigned int eax, ebx, ecx, edx;
+      if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        info[2] = int(ecx);
+        info[3] = int(edx);
+      }
+#endif
+      CpuFeatures features;
+      features.sse2 = (info[3] >> 26) & 1;
+      features.ssse3 = (info[2] >> 9) & 1;
+      return features;
+    }
+
+    inline uint32_t bgra(uint32_t b, uint32_t g, uint32_t r, uint32_t a) {
+      return b | (g << 8) | (r << 16) | (a << 24);
+    }
+
+    inline uint32_t expand2(uint32_t x) {
+      return x * 0x55;
+    }
+
+    inline uint32_t expand3(uint32_t x) {
+      return (x << 5) | (x << 2) | (x >> 1);
+    }
+
+    inline uint32_t expand4(uint32_t x) {
+      return x * 0x11;
+    }
+
+    // Scales an n bit two's complement value to a snorm8 one, the extra negative value clamps to -1 like D3D does.
+    inline uint32_t snorm8(uint32_t value, uint32_t bits) {
+      int32_t max = (1 << (bits - 1)) - 1;
+      int32_t signedValue = int32_t(value << (32 - bits)) >> (32 - bits);
+      int32_t scaled = std::max(signedValue * 127 / max, -127);
+      return uint8_t(int8_t(scaled));
+    }
+
+    // The 8 bit formats that pack several channels go through a table, so do L6V5U5's channels one by one.
+    struct ConversionTables {
+      std::array<uint32_t, 256> a4l4;
+      std::array<uint32_t, 256> r3g3b2;
+
+      // 16 byte aligned, the SSSE3 kernel shuffles straight out of them.
+      alignas(16) std::array<uint8_t, 64> l6;
+      alignas(16) std::array<uint8_t, 32> snorm5;
+
+      ConversionTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+          uint32_t l = expand4(i & 0xF);
+          a4l4[i] = bgra(l, l, l, expand4(i >> 4));
+          r3g3b2[i] = bgra(expand2(i & 0x3), expand3((i >> 2) & 0x7), expand3(i >> 5), 0xFF);
+        }
+
+        for (uint32_t i = 0; i < 64; i++)
+          l6[i] = uint8_t(i * 127 / 63);
+
+        for (uint32_t i = 0; i < 32; i++)
+          snorm5[i] = uint8_t(snorm8(i, 5));
+      }
+    };
+
+    const ConversionTables& conversionTables() {
+      static const ConversionTables tables;
+      return tables;
+    }
+
+    void convertR8G8B8(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t*) {
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++)
+        out[x] = bgra(src[x * 3 + 0], src[x * 3 + 1], src[x * 3 + 2], 0xFF);
+    }
+
+    void convertL8(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t*) {
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++)
+        out[x] = bgra(src[x], src[x], src[x], 0xFF);
+    }
+
+    void convertA8L8(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t*) {
+      const uint16_t* in = reinterpret_cast<const uint16_t*>(src);
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++) {
+        uint32_t l = in[x] & 0xFF;
+        out[x] = bgra(l, l, l, in[x] >> 8);
+      }
+    }
+
+    void convertX4R4G4B4(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t*) {
+      const uint16_t* in = reinterpret_cast<const uint16_t*>(src);
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++)
+        out[x] = bgra(expand4(in[x] & 0xF), expand4((in[x] >> 4) & 0xF), expand4((in[x] >> 8) & 0xF), 0xFF);
+    }
+
+    void convertA8R3G3B2(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      const uint16_t* in = reinterpret_cast<const uint16_t*>(src);
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++)
+        out[x] = (lut[in[x] & 0xFF] & 0x00FFFFFF) | (uint32_t(in[x] >> 8) << 24);
+    }
+
+    // A4L4, R3G3B2 and P8.
+    void convertLookup8(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++)
+        out[x] = lut[src[x]];
+    }
+
+    // Signed U and V go to red and green, unsigned L to blue.
+    void convertL6V5U5(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t*) {
+      const ConversionTables& tables = conversionTables();
+      const uint16_t* in = reinterpret_cast<const uint16_t*>(src);
+      uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+      for (UINT x = 0; x < width; x++)
+        out[x] = bgra(tables.snorm5[in[x] & 0x1F], tables.snorm5[(in[x] >> 5) & 0x1F], tables.l6[(in[x] >> 10) & 0x3F], 127);
+    }
+
+    DXUP_TARGET("ssse3")
+    void convertR8G8B8Ssse3(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+      const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+
+      // Each load takes 16 bytes to get 4 pixels, stop while the next one still ends inside the row.
+      UINT x = 0;
+      for (; x + 6 <= width; x += 4) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x * 3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[x * 4]), _mm_or_si128(_mm_shuffle_epi8(in, shuffle), alpha));
+      }
+
+      convertR8G8B8(&dst[x * 4], &src[x * 3], width - x, lut);
+    }
+
+    // Looks each byte of index up in a table of 16 * Chunks bytes. pshufb only sees 16 of them at a time and zeroes
+    // lanes with the top bit set, so each chunk gets the lanes that index it and the rest saturate past 0x7F.
+    template <uint32_t Chunks>
+    DXUP_TARGET("ssse3")
+    inline __m128i lookupSsse3(const uint8_t* table, __m128i index) {
+      const __m128i outOfChunk = _mm_set1_epi8(0x70);
+
+      __m128i result = _mm_setzero_si128();
+      for (uint32_t i = 0; i < Chunks; i++) {
+        __m128i chunk = _mm_load_si128(reinterpret_cast<const __m128i*>(&table[i * 16]));
+        __m128i local = _mm_adds_epu8(_mm_xor_si128(index, _mm_set1_epi8(char(i * 16))), outOfChunk);
+        result = _mm_or_si128(result, _mm_shuffle_epi8(chunk, local));
+      }
+      return result;
+    }
+
+    DXUP_TARGET("ssse3")
+    void convertL6V5U5Ssse3(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      const ConversionTables& tables = conversionTables();
+      const __m128i five = _mm_set1_epi16(0x1F);
+      const __m128i six = _mm_set1_epi16(0x3F);
+      const __m128i alpha = _mm_set1_epi8(127);
+
+      UINT x = 0;
+      for (; x + 16 <= width; x += 16) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x * 2]));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x * 2 + 16]));
+
+        // One byte per pixel for each channel, then through its table.
+        __m128i u = _mm_packus_epi16(_mm_and_si128(lo, five), _mm_and_si128(hi, five));
+        __m128i v = _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(lo, 5), five), _mm_and_si128(_mm_srli_epi16(hi, 5), five));
+        __m128i l = _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(lo, 10), six), _mm_and_si128(_mm_srli_epi16(hi, 10), six));
+
+        u = lookupSsse3<2>(tables.snorm5.data(), u);
+        v = lookupSsse3<2>(tables.snorm5.data(), v);
+        l = lookupSsse3<4>(tables.l6.data(), l);
+
+        __m128i uvLo = _mm_unpacklo_epi8(u, v);
+        __m128i uvHi = _mm_unpackhi_epi8(u, v);
+        __m128i laLo = _mm_unpacklo_epi8(l, alpha);
+        __m128i laHi = _mm_unpackhi_epi8(l, alpha);
+
+        __m128i* out = reinterpret_cast<__m128i*>(&dst[x * 4]);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(uvLo, laLo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(uvLo, laLo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(uvHi, laHi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(uvHi, laHi));
+      }
+
+      convertL6V5U5(&dst[x * 4], &src[x * 2], width - x, lut);
+    }
+
+    DXUP_TARGET("sse2")
+    void convertL8Sse2(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+
+      UINT x = 0;
+      for (; x + 16 <= width; x += 16) {
+        __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x]));
+        __m128i lo = _mm_unpacklo_epi8(l, l);
+        __m128i hi = _mm_unpackhi_epi8(l, l);
+
+        __m128i* out = reinterpret_cast<__m128i*>(&dst[x * 4]);
+        _mm_storeu_si128(out + 0, _mm_or_si128(_mm_unpacklo_epi16(lo, lo), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_unpackhi_epi16(lo, lo), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_unpacklo_epi16(hi, hi), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_unpackhi_epi16(hi, hi), alpha));
+      }
+
+      convertL8(&dst[x * 4], &src[x], width - x, lut);
+    }
+
+    DXUP_TARGET("sse2")
+    void convertA8L8Sse2(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      const __m128i lowByte = _mm_set1_epi16(0x00FF);
+
+      UINT x = 0;
+      for (; x + 8 <= width; x += 8) {
+        __m128i al = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x * 2]));
+        __m128i l = _mm_and_si128(al, lowByte);
+        __m128i ll = _mm_or_si128(l, _mm_slli_epi16(l, 8));
+
+        // LL from the first, LA from the second makes LLLA.
+        __m128i* out = reinterpret_cast<__m128i*>(&dst[x * 4]);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(ll, al));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(ll, al));
+      }
+
+      convertA8L8(&dst[x * 4], &src[x * 2], width - x, lut);
+    }
+
+    DXUP_TARGET("sse2")
+    void convertX4R4G4B4Sse2(uint8_t* dst, const uint8_t* src, UINT width, const uint32_t* lut) {
+      const __m128i nibble = _mm_set1_epi16(0x000F);
+      const __m128i scale = _mm_set1_epi16(0x11);
+      const __m128i alpha = _mm_set1_epi16(short(0xFF00));
+
+      UINT x = 0;
+      for (; x + 8 <= width; x += 8) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[x * 2]));
+        __m128i b = _mm_mullo_epi16(_mm_and_si128(in, nibble), scale);
+        __m128i g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(in, 4), nibble), scale);
+        __m128i r = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(in, 8), nibble), scale);
+
+        __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        __m128i ra = _mm_or_si128(r, alpha);
+
+        __m128i* out = reinterpret_cast<__m128i*>(&dst[x * 4]);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bg, ra));
+      }
+
+      convertX4R4G4B4(&dst[x * 4], &src[x * 2], width - x, lut);
+    }
+
+    bool scalarOnly = false;
+
+    RowConverter rowConverter(D3DFORMAT format) {
+      static const CpuFeatures detected = detectCpu();
+      const CpuFeatures cpu = scalarOnly ? CpuFeatures{ false, false } : detected;
+
+      switch (format) {
+      case D3DFMT_R8G8B8: return cpu.ssse3 ? convertR8G8B8Ssse3 : convertR8G8B8;
+      case D3DFMT_L8: return cpu.sse2 ? convertL8Sse2 : convertL8;
+      case D3DFMT_A8L8: return cpu.sse2 ? convertA8L8Sse2 : convertA8L8;
+      case D3DFMT_X4R4G4B4: return cpu.sse2 ? convertX4R4G4B4Sse2 : convertX4R4G4B4;
+      case D3DFMT_A8R3G3B2: return convertA8R3G3B2;
+      case D3DFMT_L6V5U5: return cpu.ssse3 ? convertL6V5U5Ssse3 : convertL6V5U5;
+      case D3DFMT_A4L4:
+      case D3DFMT_R3G3B2:
+      case D3DFMT_P8: return convertLookup8;
+      default: return nullptr;
+      }
+    }
+  }
+
+  void forceScalarConversion(bool scalar) {
+    scalarOnly = scalar;
+  }
+
+  bool needsConversion(D3DFORMAT format) {
+    return conversionBitsPerPixel(format) != 0;
+  }
+
+  UINT conversionBitsPerPixel(D3DFORMAT format) {
+    switch (format) {
+    case D3DFMT_R8G8B8:
+      return 24;
+
+    case D3DFMT_A8L8:
+    case D3DFMT_X4R4G4B4:
+    case D3DFMT_A8R3G3B2:
+    case D3DFMT_L6V5U5:
+      return 16;
+
+    case D3DFMT_L8:
+    case D3DFMT_A4L4:
+    case D3DFMT_R3G3B2:
+    case D3DFMT_P8:
+      return 8;
+
+    default:
+      return 0;
+    }
+  }
+
+  void convertPixels(
+    D3DFORMAT format,
+    const PALETTEENTRY* palette,
+    uint8_t* dst, UINT dstRowPitch, UINT dstSlicePitch,
+    const uint8_t* src, UINT srcRowPitch, UINT srcSlicePitch,
+    UINT width, UINT height, UINT depth) {
+    RowConverter convert = rowConverter(format);
+    if (convert == nullptr) {
+      log::warn("convertPixels: no conversion for format %d.", format);
+      return;
+    }
+
+    std::array<uint32_t, 256> paletteTable;
+    const uint32_t* lut = nullptr;
+
+    if (format == D3DFMT_A4L4)
+      lut = conversionTables().a4l4.data();
+    else if (format == D3DFMT_R3G3B2 || format == D3DFMT_A8R3G3B2)
+      lut = conversionTables().r3g3b2.data();
+    else if (format == D3DFMT_P8) {
+      for (uint32_t i = 0; i < 256; i++) {
+        if (palette != nullptr)
+          paletteTable[i] = bgra(palette[i].peBlue, palette[i].peGreen, palette[i].peRed, palette[i].peFlags);
+        else
+          paletteTable[i] = bgra(i, i, i, 0xFF);
+      }
+      lut = paletteTable.data();
+    }
+
+    for (UINT z = 0; z < depth; z++) {
+      for (UINT y = 0; y < height; y++)
+        convert(&dst[z * dstSlicePitch + y * dstRowPitch], &src[z * srcSlicePitch + y * srcRowPitch], width, lut);
+    }
+  }
+
+}
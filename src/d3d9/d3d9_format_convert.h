@@ -0,0 +1,25 @@
+#pragma once
+
+#include "d3d9_includes.h"
+
+namespace dxup {
+
+  // D3D9 formats DXGI has nothing laid out like, these live on the GPU as 8888 and are converted on the CPU as they're uploaded.
+  bool needsConversion(D3DFORMAT format);
+
+  // Bits per pixel of the D3D9 layout apps read and write for a format we convert.
+  UINT conversionBitsPerPixel(D3DFORMAT format);
+
+  // Converts a width x height x depth block from format's D3D9 layout into its 8888 stand-in.
+  // P8 looks its pixels up in palette, without one the index is taken as an opaque grey.
+  void convertPixels(
+    D3DFORMAT format,
+    const PALETTEENTRY* palette,
+    uint8_t* dst, UINT dstRowPitch, UINT dstSlicePitch,
+    const uint8_t* src, UINT srcRowPitch, UINT srcSlicePitch,
+    UINT width, UINT height, UINT depth);
+
+  // Keeps convertPixels off the SIMD kernels, so they can be checked against the scalar ones.
+  void forceScalarConversion(bool scalar);
+
+}
@@ -155,7 +155,7 @@ namespace dxup {
     }
 
     if (CheckFormat == D3DFMT_INST) // weird hack every driver implements.
-      return D3DERR_NOTAVAILABLE; // TODO! Instancing.
+      return D3D_OK;
 
     // Table modified from SwiftShader.
 
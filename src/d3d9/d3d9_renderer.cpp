@@ -8,16 +8,95 @@
 
 namespace dxup {
 
+  namespace stateKey {
+
+    // Anything out of range converts to the default, same as 0 does, so fold them together.
+    inline uint64_t enumBits(DWORD value, DWORD max) {
+      return value <= max ? value : 0;
+    }
+
+    inline uint64_t filterBits(DWORD filter) {
+      switch (filter) {
+      case D3DTEXF_NONE:
+      case D3DTEXF_POINT: return 0;
+      case D3DTEXF_ANISOTROPIC: return 2;
+      default: return 1;
+      }
+    }
+
+    inline D3D9StateKey depthStencil(const DWORD* rs) {
+      return D3D9StateKeyPacker()
+        .push(rs[D3DRS_ZENABLE] != D3DZB_FALSE, 1)
+        .push(rs[D3DRS_ZWRITEENABLE] == TRUE, 1)
+        .push(enumBits(rs[D3DRS_ZFUNC], D3DCMP_ALWAYS), 4)
+        .push(rs[D3DRS_STENCILENABLE] == TRUE, 1)
+        .push(enumBits(rs[D3DRS_STENCILFAIL], D3DSTENCILOP_DECR), 4)
+        .push(enumBits(rs[D3DRS_STENCILZFAIL], D3DSTENCILOP_DECR), 4)
+        .push(enumBits(rs[D3DRS_STENCILPASS], D3DSTENCILOP_DECR), 4)
+        .push(enumBits(rs[D3DRS_STENCILFUNC], D3DCMP_ALWAYS), 4)
+        .push(enumBits(rs[D3DRS_CCW_STENCILFAIL], D3DSTENCILOP_DECR), 4)
+        .push(enumBits(rs[D3DRS_CCW_STENCILZFAIL], D3DSTENCILOP_DECR), 4)
+        .push(enumBits(rs[D3DRS_CCW_STENCILPASS], D3DSTENCILOP_DECR), 4)
+        .push(enumBits(rs[D3DRS_CCW_STENCILFUNC], D3DCMP_ALWAYS), 4)
+        .push(rs[D3DRS_STENCILMASK], 8)
+        .push(rs[D3DRS_STENCILWRITEMASK], 8)
+        .key();
+    }
+
+    inline D3D9StateKey rasterizer(const DWORD* rs) {
+      return D3D9StateKeyPacker()
+        .push(enumBits(rs[D3DRS_CULLMODE], D3DCULL_CCW), 2)
+        .push(enumBits(rs[D3DRS_FILLMODE], D3DFILL_SOLID), 2)
+        .push(rs[D3DRS_SCISSORTESTENABLE] == TRUE, 1)
+        .push((uint32_t)(INT)reinterpret::dwordToFloat(rs[D3DRS_DEPTHBIAS]), 32)
+        .push(rs[D3DRS_SLOPESCALEDEPTHBIAS], 32)
+        .key();
+    }
+
+    inline D3D9StateKey blendState(const DWORD* rs) {
+      bool separateAlpha = rs[D3DRS_SEPARATEALPHABLENDENABLE] == TRUE;
+
+      return D3D9StateKeyPacker()
+        .push(rs[D3DRS_ALPHABLENDENABLE] == TRUE, 1)
+        .push(enumBits(rs[D3DRS_BLENDOP], D3DBLENDOP_MAX), 3)
+        .push(enumBits(rs[D3DRS_SRCBLEND], D3DBLEND_INVSRCCOLOR2), 5)
+        .push(enumBits(rs[D3DRS_DESTBLEND], D3DBLEND_INVSRCCOLOR2), 5)
+        .push(rs[D3DRS_COLORWRITEENABLE], 8)
+        .push(separateAlpha, 1)
+        .push(separateAlpha ? enumBits(rs[D3DRS_BLENDOPALPHA], D3DBLENDOP_MAX) : 0, 3)
+        .push(separateAlpha ? enumBits(rs[D3DRS_SRCBLENDALPHA], D3DBLEND_INVSRCCOLOR2) : 0, 5)
+        .push(separateAlpha ? enumBits(rs[D3DRS_DESTBLENDALPHA], D3DBLEND_INVSRCCOLOR2) : 0, 5)
+        .key();
+    }
+
+    inline D3D9StateKey sampler(const DWORD* ss) {
+      return D3D9StateKeyPacker()
+        .push(enumBits(ss[D3DSAMP_ADDRESSU], D3DTADDRESS_MIRRORONCE), 3)
+        .push(enumBits(ss[D3DSAMP_ADDRESSV], D3DTADDRESS_MIRRORONCE), 3)
+        .push(enumBits(ss[D3DSAMP_ADDRESSW], D3DTADDRESS_MIRRORONCE), 3)
+        .push(filterBits(ss[D3DSAMP_MAGFILTER]), 2)
+        .push(filterBits(ss[D3DSAMP_MINFILTER]), 2)
+        .push(filterBits(ss[D3DSAMP_MIPFILTER]), 2)
+        .push(std::clamp((UINT)ss[D3DSAMP_MAXANISOTROPY], 0u, 16u), 5)
+        .push(ss[D3DSAMP_BORDERCOLOR], 32)
+        .push(ss[D3DSAMP_MIPMAPLODBIAS], 32)
+        .push(ss[D3DSAMP_MAXMIPLEVEL], 32)
+        .key();
+    }
+
+  }
+
   D3D9ImmediateRenderer::D3D9ImmediateRenderer(ID3D11Device1* device, ID3D11DeviceContext1* context, D3D9State* state)
     : m_device{ device }
     , m_context{ context }
     , m_state{ state }
-    , m_upVertexBuffer{ device, D3D11_BIND_VERTEX_BUFFER }
-    , m_upIndexBuffer{ device, D3D11_BIND_INDEX_BUFFER }
-    , m_fanIndexBuffer{ device, D3D11_BIND_INDEX_BUFFER }
-    , m_fanIndexed{ false }
-    , m_vsConstants{ device, context }
-    , m_psConstants{ device, context } {
+    , m_shadow{ context }
+    , m_autogenTextures{ 0 }
+    , m_uploadHeap{ device }
+    , m_batchedDraws{ 0 }
+    , m_batchFlushes{ 0 }
+    , m_vsConstants{ device, context, &m_shadow, &m_uploadHeap }
+    , m_psConstants{ device, context, &m_shadow, &m_uploadHeap } {
   
     D3D11_SAMPLER_DESC blitSampler;
     blitSampler.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
@@ -47,15 +126,128 @@ namespace dxup {
   }
 
   void D3D9ImmediateRenderer::endFrame() {
-    m_fanIndexBuffer.endFrame();
-    m_upIndexBuffer.endFrame();
-    m_upVertexBuffer.endFrame();
+    flushBatch();
+
+    m_uploadHeap.endFrame(m_context);
+  }
+
+  void D3D9ImmediateRenderer::logStats() {
+    m_uploadHeap.logStats();
+    log::msg("UP draws merged: %llu into %llu draws.", m_batchedDraws, m_batchFlushes);
+  }
+
+  namespace {
+    // Don't let a batch grow forever if the app never changes state.
+    const uint32_t maxBatchLength = 4 * 1024 * 1024;
+
+    bool isListType(D3DPRIMITIVETYPE type) {
+      return type == D3DPT_POINTLIST || type == D3DPT_LINELIST || type == D3DPT_TRIANGLELIST;
+    }
+  }
+
+  bool D3D9ImmediateRenderer::canContinueBatch(D3DPRIMITIVETYPE type, UINT stride, D3DFORMAT indexFormat, UINT vertexCount, UINT vertexLength) {
+    if (!m_batch.active || m_batch.type != type || m_batch.stride != stride || m_batch.indexFormat != indexFormat)
+      return false;
+
+    if (m_batch.vertices.size() + vertexLength > maxBatchLength)
+      return false;
+
+    // Indices get rebased, they have to still fit.
+    if (indexFormat == D3DFMT_INDEX16 && m_batch.vertexCount + vertexCount > 0x10000)
+      return false;
+
+    // UP draws dirty stream 0 and the index buffer themselves, anything else means the app changed something.
+    return (m_state->dirtyFlags & ~dirtyFlags::indexBuffer) == 0 &&
+           (m_state->dirtyVertexBuffers & ~1u) == 0 &&
+           m_state->dirtySamplers == 0 &&
+           m_state->dirtyTextures == 0 &&
+           m_state->dirtyRenderTargets == 0;
+  }
+
+  void D3D9ImmediateRenderer::startBatch(D3DPRIMITIVETYPE type, D3D_PRIMITIVE_TOPOLOGY topology, UINT stride, D3DFORMAT indexFormat) {
+    m_batch.active = true;
+    m_batch.type = type;
+    m_batch.topology = topology;
+    m_batch.stride = stride;
+    m_batch.indexFormat = indexFormat;
+    m_batch.vertices.clear();
+    m_batch.indices.clear();
+    m_batch.vertexCount = 0;
+    m_batch.indexCount = 0;
+    m_batch.draws = 0;
+  }
+
+  void D3D9ImmediateRenderer::appendBatch(const void* vertices, UINT vertexCount, const void* indices, UINT indexCount) {
+    const uint8_t* vertexData = reinterpret_cast<const uint8_t*>(vertices);
+    m_batch.vertices.insert(m_batch.vertices.end(), vertexData, vertexData + vertexCount * m_batch.stride);
+
+    const UINT base = m_batch.vertexCount;
+    if (m_batch.indexFormat == D3DFMT_INDEX16) {
+      const uint16_t* indexData = reinterpret_cast<const uint16_t*>(indices);
+      size_t offset = m_batch.indices.size();
+      m_batch.indices.resize(offset + indexCount * sizeof(uint16_t));
+
+      uint16_t* dst = reinterpret_cast<uint16_t*>(&m_batch.indices[offset]);
+      for (UINT i = 0; i < indexCount; i++)
+        dst[i] = uint16_t(indexData[i] + base);
+    }
+    else if (m_batch.indexFormat == D3DFMT_INDEX32) {
+      const uint32_t* indexData = reinterpret_cast<const uint32_t*>(indices);
+      size_t offset = m_batch.indices.size();
+      m_batch.indices.resize(offset + indexCount * sizeof(uint32_t));
+
+      uint32_t* dst = reinterpret_cast<uint32_t*>(&m_batch.indices[offset]);
+      for (UINT i = 0; i < indexCount; i++)
+        dst[i] = indexData[i] + base;
+    }
+
+    m_batch.vertexCount += vertexCount;
+    m_batch.indexCount += indexCount;
+    m_batch.draws++;
+
+    // UP draws leave stream 0 and the index buffer for the next real draw to put back.
+    m_state->dirtyVertexBuffers |= 1;
+    if (m_batch.indexFormat != D3DFMT_UNKNOWN)
+      m_state->dirtyFlags |= dirtyFlags::indexBuffer;
+  }
+
+  void D3D9ImmediateRenderer::flushBatch() {
+    if (!m_batch.active)
+      return;
+
+    m_batch.active = false;
+
+    if (m_batch.vertexCount == 0)
+      return;
+
+    const bool indexed = m_batch.indexFormat != D3DFMT_UNKNOWN;
+    const uint32_t vertexLength = uint32_t(m_batch.vertices.size());
+    const uint32_t indexLength = uint32_t(m_batch.indices.size());
+
+    // Vertices and indices share a buffer, one map for both.
+    m_uploadHeap.begin(m_context, uploadUsage::vertices, D3D11UploadHeap::alignedLength(vertexLength) + D3D11UploadHeap::alignedLength(indexLength));
+    uint32_t offset = m_uploadHeap.push(uploadUsage::vertices, m_batch.vertices.data(), vertexLength);
+    uint32_t indexOffset = indexed ? m_uploadHeap.push(uploadUsage::indices, m_batch.indices.data(), indexLength) : 0;
+    ID3D11Buffer* buffer = m_uploadHeap.end(m_context);
+
+    m_shadow.setVertexBuffers(0, 1, &buffer, &m_batch.stride, &offset);
+    if (indexed)
+      m_shadow.setIndexBuffer(buffer, m_batch.indexFormat == D3DFMT_INDEX32 ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT, indexOffset);
+
+    m_shadow.setPrimitiveTopology(m_batch.topology);
+    if (indexed)
+      m_context->DrawIndexed(m_batch.indexCount, 0, 0);
+    else
+      m_context->Draw(m_batch.vertexCount, 0);
 
-    m_vsConstants.endFrame();
-    m_psConstants.endFrame();
+    if (m_batch.draws > 1)
+      m_batchedDraws += m_batch.draws;
+    m_batchFlushes++;
   }
 
   HRESULT D3D9ImmediateRenderer::Clear(DWORD Count, const D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil) {
+    flushBatch();
+
     if (Count >= 1) {
       bool fullRectClear = pRects->x1 == 0 &&
                            pRects->x2 == (LONG) m_state->viewport.Width &&
@@ -83,8 +275,10 @@ namespace dxup {
           continue;
 
         ID3D11RenderTargetView* rtv = m_state->renderTargets[i]->GetD3D11RenderTarget(m_state->renderState[D3DRS_SRGBWRITEENABLE] == TRUE);
-        if (rtv)
+        if (rtv) {
           m_context->ClearRenderTargetView(rtv, color);
+          m_state->renderTargets[i]->GetDXUPResource()->MarkDirty(m_state->renderTargets[i]->GetSlice(), m_state->renderTargets[i]->GetMip());
+        }
       }
     }
 
@@ -101,46 +295,83 @@ namespace dxup {
     return D3D_OK;
   }
 
-  HRESULT D3D9ImmediateRenderer::drawTriangleFan(bool indexed, D3DPRIMITIVETYPE PrimitiveType, UINT StartIndex, UINT PrimitiveCount, UINT BaseVertexIndex) {
-    const uint32_t newPrimitiveCount = PrimitiveCount * 3;
-    const uint32_t length = newPrimitiveCount * sizeof(uint16_t);
+  namespace {
+    template <typename T>
+    void fanToList(const T* fan, T* list, UINT primitiveCount) {
+      for (UINT i = 0; i < primitiveCount; i++) {
+        list[3 * i + 0] = fan[i + 1];
+        list[3 * i + 1] = fan[i + 2];
+        list[3 * i + 2] = fan[0];
+      }
+    }
 
-    m_fanIndexBuffer.reserve(length);
+    void fanToList(D3DFORMAT format, const void* fan, void* list, UINT primitiveCount) {
+      if (format == D3DFMT_INDEX32)
+        fanToList(reinterpret_cast<const uint32_t*>(fan), reinterpret_cast<uint32_t*>(list), primitiveCount);
+      else
+        fanToList(reinterpret_cast<const uint16_t*>(fan), reinterpret_cast<uint16_t*>(list), primitiveCount);
+    }
 
-    uint16_t* data = nullptr;
-    m_fanIndexBuffer.map(m_context, (void**)&data, length);
+    // 1, 2, 0, 2, 3, 0... what fanToList makes of a fan that isn't indexed.
+    template <typename T>
+    void fanListIndices(T* list, UINT primitiveCount) {
+      for (UINT i = 0; i < primitiveCount; i++) {
+        list[3 * i + 0] = T(i + 1);
+        list[3 * i + 1] = T(i + 2);
+        list[3 * i + 2] = 0;
+      }
+    }
 
-    if (indexed && m_state->indexBuffer != nullptr) {
-      D3D11_MAPPED_SUBRESOURCE res;
-      ID3D11Resource* originalIndexBuffer = m_state->indexBuffer->GetDXUPResource()->GetStaging();
-      m_context->Map(originalIndexBuffer, 0, D3D11_MAP_READ, 0, &res);
+    UINT indexSize(D3DFORMAT format) {
+      return format == D3DFMT_INDEX32 ? 4 : 2;
+    }
 
-      uint16_t* originalIndices = reinterpret_cast<uint16_t*>(res.pData);
+    DXGI_FORMAT indexFormat(D3DFORMAT format) {
+      return format == D3DFMT_INDEX32 ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+    }
+  }
 
-      for (UINT i = 0; i < PrimitiveCount; i++) {
-        data[3 * i + 0] = originalIndices[StartIndex + i + 1];
-        data[3 * i + 1] = originalIndices[StartIndex + i + 2];
-        data[3 * i + 2] = originalIndices[StartIndex + 0];
-      }
+  HRESULT D3D9ImmediateRenderer::drawTriangleFan(const void* fan, D3DFORMAT fanFormat, UINT PrimitiveCount, INT BaseVertexIndex, const void* vertices, UINT vertexLength, UINT stride) {
+    // Indices we make up ourselves only have to reach PrimitiveCount + 1.
+    D3DFORMAT format = fanFormat;
+    if (fan == nullptr)
+      format = PrimitiveCount + 1 <= UINT16_MAX ? D3DFMT_INDEX16 : D3DFMT_INDEX32;
+
+    const UINT indexLength = PrimitiveCount * 3 * indexSize(format);
+
+    m_uploadHeap.begin(m_context, uploadUsage::indices, D3D11UploadHeap::alignedLength(vertexLength) + D3D11UploadHeap::alignedLength(indexLength));
+    uint32_t offset = vertices != nullptr ? m_uploadHeap.push(uploadUsage::vertices, vertices, vertexLength) : 0;
+    uint32_t indexOffset = 0;
+    void* list = m_uploadHeap.push(uploadUsage::indices, indexLength, &indexOffset);
+    if (list != nullptr) {
+      if (fan != nullptr)
+        fanToList(format, fan, list, PrimitiveCount);
+      else if (format == D3DFMT_INDEX32)
+        fanListIndices(reinterpret_cast<uint32_t*>(list), PrimitiveCount);
+      else
+        fanListIndices(reinterpret_cast<uint16_t*>(list), PrimitiveCount);
+    }
+    ID3D11Buffer* buffer = m_uploadHeap.end(m_context);
 
-      m_context->Unmap(originalIndexBuffer, 0);
+    if (list == nullptr || buffer == nullptr) {
+      log::warn("drawTriangleFan: failed to upload list indices, skipping draw.");
+      postDraw();
+      return D3D_OK;
     }
-    else {
-      for (UINT i = 0; i < PrimitiveCount; i++) {
-        data[3 * i + 0] = i + 1;
-        data[3 * i + 1] = i + 2;
-        data[3 * i + 2] = 0;
-      }
+
+    if (vertices != nullptr) {
+      m_shadow.setVertexBuffers(0, 1, &buffer, &stride, &offset);
+      m_state->dirtyVertexBuffers |= 1;
     }
 
-    uint32_t offset = m_fanIndexBuffer.unmap(m_context, length);
+    m_shadow.setIndexBuffer(buffer, indexFormat(format), indexOffset);
+    m_state->dirtyFlags |= dirtyFlags::indexBuffer;
 
-    m_fanIndexed = indexed;
+    m_shadow.setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    m_context->DrawIndexed(PrimitiveCount * 3, 0, BaseVertexIndex);
 
-    m_context->IASetIndexBuffer(m_fanIndexBuffer.getBuffer(), DXGI_FORMAT_R16_UINT, offset);
-    HRESULT result = DrawIndexedPrimitive(D3DPT_TRIANGLELIST, BaseVertexIndex, 0, PrimitiveCount + 2, 0, newPrimitiveCount);
-    m_state->dirtyFlags |= dirtyFlags::indexBuffer;
-    return result;
+    postDraw();
+    return D3D_OK;
   }
 
   HRESULT D3D9ImmediateRenderer::DrawPrimitive(D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex, UINT PrimitiveCount) {
@@ -151,12 +382,12 @@ namespace dxup {
     }
 
     if (PrimitiveType == D3DPT_TRIANGLEFAN)
-      return this->drawTriangleFan(false, PrimitiveType, 0, PrimitiveCount, StartVertex);
+      return this->drawTriangleFan(nullptr, D3DFMT_UNKNOWN, PrimitiveCount, StartVertex, nullptr, 0, 0);
 
     D3D_PRIMITIVE_TOPOLOGY topology;
     UINT drawCount = convert::primitiveData(PrimitiveType, PrimitiveCount, topology);
 
-    m_context->IASetPrimitiveTopology(topology);
+    m_shadow.setPrimitiveTopology(topology);
     m_context->Draw(drawCount, StartVertex);
 
     postDraw();
@@ -167,6 +398,16 @@ namespace dxup {
     if (pVertexStreamZeroData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "DrawPrimitiveUP: pVertexStreamZeroData was nullptr.");
 
+    // Fans get rewritten below, don't bother converting them.
+    D3D_PRIMITIVE_TOPOLOGY topology;
+    UINT drawCount = PrimitiveType != D3DPT_TRIANGLEFAN ? convert::primitiveData(PrimitiveType, PrimitiveCount, topology) : 0;
+    UINT length = drawCount * VertexStreamZeroStride;
+
+    if (isListType(PrimitiveType) && canContinueBatch(PrimitiveType, VertexStreamZeroStride, D3DFMT_UNKNOWN, drawCount, length)) {
+      appendBatch(pVertexStreamZeroData, drawCount, nullptr, 0);
+      return D3D_OK;
+    }
+
     if (!preDraw()) {
       log::warn("Invalid internal render state achieved.");
       postDraw();
@@ -174,22 +415,23 @@ namespace dxup {
     }
 
     if (PrimitiveType == D3DPT_TRIANGLEFAN)
-      return this->drawTriangleFan(false, PrimitiveType, 0, PrimitiveCount, 0);
-
-    D3D_PRIMITIVE_TOPOLOGY topology;
-    UINT drawCount = convert::primitiveData(PrimitiveType, PrimitiveCount, topology);
-    UINT length = drawCount * VertexStreamZeroStride;
+      return this->drawTriangleFan(nullptr, D3DFMT_UNKNOWN, PrimitiveCount, 0, pVertexStreamZeroData, (PrimitiveCount + 2) * VertexStreamZeroStride, VertexStreamZeroStride);
 
-    m_upVertexBuffer.reserve(length);
-    uint32_t offset = m_upVertexBuffer.update(m_context, pVertexStreamZeroData, length);
+    if (isListType(PrimitiveType)) {
+      startBatch(PrimitiveType, topology, VertexStreamZeroStride, D3DFMT_UNKNOWN);
+      appendBatch(pVertexStreamZeroData, drawCount, nullptr, 0);
+      postDraw();
+      return D3D_OK;
+    }
 
-    ID3D11Buffer* buffer = m_upVertexBuffer.getBuffer();
-    m_context->IASetVertexBuffers(0, 1, &buffer, &VertexStreamZeroStride, &offset);
+    ID3D11Buffer* buffer = nullptr;
+    uint32_t offset = m_uploadHeap.upload(m_context, uploadUsage::vertices, pVertexStreamZeroData, length, &buffer);
+    m_shadow.setVertexBuffers(0, 1, &buffer, &VertexStreamZeroStride, &offset);
 
-    m_context->IASetPrimitiveTopology(topology);
+    m_shadow.setPrimitiveTopology(topology);
     m_context->Draw(drawCount, 0);
 
-    m_state->dirtyFlags |= dirtyFlags::vertexBuffers;
+    m_state->dirtyVertexBuffers |= 1;
 
     postDraw();
 
@@ -202,6 +444,17 @@ namespace dxup {
     if (pIndexData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "DrawIndexedPrimitiveUP: pIndexData was nullptr.");
 
+    D3D_PRIMITIVE_TOPOLOGY topology;
+    UINT drawCount = PrimitiveType != D3DPT_TRIANGLEFAN ? convert::primitiveData(PrimitiveType, PrimitiveCount, topology) : 0;
+    UINT vertexCount = MinVertexIndex + NumVertices;
+    UINT vertexLength = vertexCount * VertexStreamZeroStride;
+    UINT indexLength = drawCount * indexSize(IndexDataFormat);
+
+    if (isListType(PrimitiveType) && canContinueBatch(PrimitiveType, VertexStreamZeroStride, IndexDataFormat, vertexCount, vertexLength)) {
+      appendBatch(pVertexStreamZeroData, vertexCount, pIndexData, drawCount);
+      return D3D_OK;
+    }
+
     if (!preDraw()) {
       log::warn("Invalid internal render state achieved.");
       postDraw();
@@ -209,28 +462,28 @@ namespace dxup {
     }
 
     if (PrimitiveType == D3DPT_TRIANGLEFAN)
-      return this->drawTriangleFan(true, PrimitiveType, 0, PrimitiveCount, 0);
+      return this->drawTriangleFan(pIndexData, IndexDataFormat, PrimitiveCount, 0, pVertexStreamZeroData, vertexLength, VertexStreamZeroStride);
 
-    D3D_PRIMITIVE_TOPOLOGY topology;
-    UINT drawCount = convert::primitiveData(PrimitiveType, PrimitiveCount, topology);
-    UINT length = (MinVertexIndex + NumVertices) * VertexStreamZeroStride;
-
-    m_upVertexBuffer.reserve(length);
-    uint32_t offset = m_upVertexBuffer.update(m_context, pVertexStreamZeroData, length);
-
-    ID3D11Buffer* buffer = m_upVertexBuffer.getBuffer();
-    m_context->IASetVertexBuffers(0, 1, &buffer, &VertexStreamZeroStride, &offset);
+    if (isListType(PrimitiveType)) {
+      startBatch(PrimitiveType, topology, VertexStreamZeroStride, IndexDataFormat);
+      appendBatch(pVertexStreamZeroData, vertexCount, pIndexData, drawCount);
+      postDraw();
+      return D3D_OK;
+    }
 
-    length *= IndexDataFormat == D3DFMT_INDEX32 ? 4 : 2;
+    // Vertices and indices share a buffer, one map for both.
+    m_uploadHeap.begin(m_context, uploadUsage::vertices, D3D11UploadHeap::alignedLength(vertexLength) + D3D11UploadHeap::alignedLength(indexLength));
+    uint32_t offset = m_uploadHeap.push(uploadUsage::vertices, pVertexStreamZeroData, vertexLength);
+    uint32_t indexOffset = m_uploadHeap.push(uploadUsage::indices, pIndexData, indexLength);
+    ID3D11Buffer* buffer = m_uploadHeap.end(m_context);
 
-    m_upIndexBuffer.reserve(length);
-    m_upIndexBuffer.update(m_context, pIndexData, length);
-    m_context->IASetIndexBuffer(m_upIndexBuffer.getBuffer(), IndexDataFormat == D3DFMT_INDEX32 ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT, 0);
+    m_shadow.setVertexBuffers(0, 1, &buffer, &VertexStreamZeroStride, &offset);
+    m_shadow.setIndexBuffer(buffer, indexFormat(IndexDataFormat), indexOffset);
 
-    m_context->IASetPrimitiveTopology(topology);
+    m_shadow.setPrimitiveTopology(topology);
     m_context->DrawIndexed(drawCount, 0, 0);
 
-    m_state->dirtyFlags |= dirtyFlags::vertexBuffers;
+    m_state->dirtyVertexBuffers |= 1;
     m_state->dirtyFlags |= dirtyFlags::indexBuffer;
 
     postDraw();
@@ -244,22 +497,52 @@ namespace dxup {
       return D3D_OK; // Lies!
     }
 
-    if (PrimitiveType == D3DPT_TRIANGLEFAN)
-      return this->drawTriangleFan(true, PrimitiveType, startIndex, primCount, BaseVertexIndex);
+    if (PrimitiveType == D3DPT_TRIANGLEFAN) {
+      if (m_state->indexBuffer == nullptr) {
+        postDraw();
+        return log::d3derr(D3DERR_INVALIDCALL, "DrawIndexedPrimitive: no index buffer bound.");
+      }
+
+      const uint8_t* fan = nullptr;
+      HRESULT result = m_state->indexBuffer->GetFanIndices(startIndex, primCount, &fan);
+      if (FAILED(result)) {
+        postDraw();
+        return result;
+      }
+
+      return this->drawTriangleFan(fan, m_state->indexBuffer->GetD3D9Desc().Format, primCount, BaseVertexIndex, nullptr, 0, 0);
+    }
 
     D3D_PRIMITIVE_TOPOLOGY topology;
     UINT drawCount = convert::primitiveData(PrimitiveType, primCount, topology);
 
-    m_context->IASetPrimitiveTopology(topology);
-    m_context->DrawIndexed(drawCount, startIndex, BaseVertexIndex);
+    m_shadow.setPrimitiveTopology(topology);
+
+    // D3D9 only instances indexed draws, the instance count comes from stream 0's indexed data setting.
+    const UINT geometryFreq = m_state->streamFreqs[0];
+    if (geometryFreq & D3DSTREAMSOURCE_INDEXEDDATA)
+      m_context->DrawIndexedInstanced(drawCount, geometryFreq & ~D3DSTREAMSOURCE_INDEXEDDATA, startIndex, BaseVertexIndex, 0);
+    else
+      m_context->DrawIndexed(drawCount, startIndex, BaseVertexIndex);
 
     postDraw();
     return D3D_OK;
   }
+  HRESULT D3D9ImmediateRenderer::DrawIndexedTriangleFan(INT BaseVertexIndex, UINT PrimitiveCount, const void* pIndexData, D3DFORMAT IndexDataFormat) {
+    if (!preDraw()) {
+      log::warn("Invalid internal render state achieved.");
+      postDraw();
+      return D3D_OK; // Lies!
+    }
+
+    return this->drawTriangleFan(pIndexData, IndexDataFormat, PrimitiveCount, BaseVertexIndex, nullptr, 0, 0);
+  }
 
   //
 
   void D3D9ImmediateRenderer::blit(Direct3DSurface9* dst, Direct3DSurface9* src) {
+    flushBatch();
+
     D3DSURFACE_DESC desc;
     src->GetDesc(&desc);
 
@@ -270,43 +553,44 @@ namespace dxup {
     viewport.Height = (float)desc.Height;
     viewport.MinDepth = 0.0f;
     viewport.MaxDepth = 1.0f;
-    m_context->RSSetViewports(1, &viewport);
+    m_shadow.setViewport(viewport);
     m_state->dirtyFlags |= dirtyFlags::viewport;
 
-    m_context->PSSetSamplers(0, 1, &m_blitSampler);
+    m_shadow.setSamplers<true>(0, 1, &m_blitSampler);
     m_state->dirtySamplers |= 1;
 
-    m_context->RSSetState(nullptr);
+    m_shadow.setRasterizerState(nullptr);
     m_state->dirtyFlags |= dirtyFlags::rasterizer;
 
-    m_context->OMSetDepthStencilState(nullptr, 0);
+    m_shadow.setDepthStencilState(nullptr, 0);
     m_state->dirtyFlags |= dirtyFlags::depthStencilState;
 
     // TODO! Do I need to do any SRGB-ness here.
     ID3D11RenderTargetView* dstRTV = dst->GetD3D11RenderTarget(false);
-    m_context->OMSetRenderTargets(1, &dstRTV, nullptr);
+    m_shadow.setRenderTargets(1, &dstRTV, nullptr);
     m_state->dirtyFlags |= dirtyFlags::renderTargets;
     
     ID3D11ShaderResourceView* srcSRV = src->GetDXUPResource()->GetSRV(false);
-    m_context->PSSetShaderResources(0, 1, &srcSRV);
-    m_state->dirtyFlags |= dirtyFlags::textures;
+    m_shadow.setShaderResources<true>(0, 1, &srcSRV);
+    m_state->dirtyTextures |= 1;
 
-    m_context->VSSetShader(m_blitVS.ptr(), nullptr, 0);
+    m_shadow.setVertexShader(m_blitVS.ptr());
     m_state->dirtyFlags |= dirtyFlags::vertexShader;
 
-    m_context->PSSetShader(m_blitPS.ptr(), nullptr, 0);
+    m_shadow.setPixelShader(m_blitPS.ptr());
     m_state->dirtyFlags |= dirtyFlags::pixelShader;
 
-    m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    m_shadow.setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    m_context->IASetInputLayout(nullptr);
+    m_shadow.setInputLayout(nullptr);
     m_state->dirtyFlags |= dirtyFlags::vertexDecl;
 
     m_context->Draw(3, 0);
   }
 
   void D3D9ImmediateRenderer::updateScissorRect() {
-    m_context->RSSetScissorRects(1, (D3D11_RECT*)&m_state->scissorRect);
+    m_shadow.setScissorRect(*(D3D11_RECT*)&m_state->scissorRect);
+    m_state->dirtyFlags &= ~dirtyFlags::scissorRect;
   }
 
   void D3D9ImmediateRenderer::updateViewport() {
@@ -317,23 +601,36 @@ namespace dxup {
     viewport.MaxDepth = m_state->viewport.MaxZ;
     viewport.Width = (FLOAT)m_state->viewport.Width;
     viewport.Height = (FLOAT)m_state->viewport.Height;
-    m_context->RSSetViewports(1, &viewport);
+    m_shadow.setViewport(viewport);
+
+    m_state->dirtyFlags &= ~dirtyFlags::viewport;
   }
 
   void D3D9ImmediateRenderer::updateVertexShaderAndInputLayout() {
     if (m_state->vertexDecl == nullptr || m_state->vertexShader == nullptr)
       return;
 
-    auto& elements = m_state->vertexDecl->GetD3D11Descs();
+    uint32_t instanceStreams = 0;
+    std::array<UINT, 16> stepRates;
+    for (uint32_t i = 0; i < m_state->streamFreqs.size(); i++) {
+      const UINT setting = m_state->streamFreqs[i];
+      stepRates[i] = setting & ~(D3DSTREAMSOURCE_INDEXEDDATA | D3DSTREAMSOURCE_INSTANCEDATA);
+
+      if (setting & D3DSTREAMSOURCE_INSTANCEDATA)
+        instanceStreams |= 1u << i;
+    }
+
+    uint32_t variant = 0;
+    auto& elements = m_state->vertexDecl->GetD3D11Descs(instanceStreams, stepRates.data(), &variant);
     auto* vertexShdrBytecode = m_state->vertexShader->GetTranslation();
 
-    ID3D11InputLayout* layout = m_state->vertexShader->GetLinkedInput(m_state->vertexDecl.ptr());
+    ID3D11InputLayout* layout = m_state->vertexShader->GetLinkedInput(m_state->vertexDecl.ptr(), variant);
 
     if (layout == nullptr) {
       HRESULT result = m_device->CreateInputLayout(&elements[0], elements.size(), vertexShdrBytecode->getBytecode(), vertexShdrBytecode->getByteSize(), &layout);
 
       if (!FAILED(result)) {
-        m_state->vertexShader->LinkInput(layout, m_state->vertexDecl.ptr());
+        m_state->vertexShader->LinkInput(layout, m_state->vertexDecl.ptr(), variant);
 
         layout->Release();
       }
@@ -345,11 +642,11 @@ namespace dxup {
     m_state->dirtyFlags &= ~dirtyFlags::vertexDecl;
     m_state->dirtyFlags &= ~dirtyFlags::vertexShader;
 
-    m_context->IASetInputLayout(layout);
+    m_shadow.setInputLayout(layout);
 
-    m_context->VSSetShader(m_state->vertexShader->GetD3D11Shader(), nullptr, 0);
+    m_shadow.setVertexShader(m_state->vertexShader->GetD3D11Shader());
   }
-  void D3D9ImmediateRenderer::updateDepthStencilState() {
+  ID3D11DepthStencilState* D3D9ImmediateRenderer::createDepthStencilState() {
     D3D11_DEPTH_STENCIL_DESC desc;
     desc.BackFace.StencilDepthFailOp = convert::stencilOp(m_state->renderState[D3DRS_CCW_STENCILZFAIL]);
     desc.BackFace.StencilFailOp = convert::stencilOp(m_state->renderState[D3DRS_CCW_STENCILFAIL]);
@@ -370,7 +667,7 @@ namespace dxup {
     desc.StencilWriteMask = (UINT8)(m_state->renderState[D3DRS_STENCILWRITEMASK] & 0x000000FF);
 
     size_t hash = m_caches.depthStencil.hash(desc);
-    ID3D11DepthStencilState* state = m_caches.depthStencil.lookupObject(hash);
+    ID3D11DepthStencilState* state = m_caches.depthStencil.lookupObject(hash, desc);
 
     if (state == nullptr) {
       Com<ID3D11DepthStencilState> comState;
@@ -378,18 +675,32 @@ namespace dxup {
       HRESULT result = m_device->CreateDepthStencilState(&desc, &comState);
       if (FAILED(result)) {
         log::fail("Failed to create depth stencil state.");
-        return;
+        return nullptr;
       }
 
       m_caches.depthStencil.pushState(hash, desc, comState.ptr());
       state = comState.ptr();
     }
 
-    m_context->OMSetDepthStencilState(state, (UINT)m_state->renderState[D3DRS_STENCILREF]);
+    return state;
+  }
+  void D3D9ImmediateRenderer::updateDepthStencilState() {
+    D3D9StateKey key = stateKey::depthStencil(m_state->renderState.data());
+    ID3D11DepthStencilState* state = m_caches.depthStencilKeys.lookupObject(key);
+
+    if (state == nullptr) {
+      state = createDepthStencilState();
+      if (state == nullptr)
+        return;
+
+      m_caches.depthStencilKeys.pushState(key, state);
+    }
+
+    m_shadow.setDepthStencilState(state, (UINT)m_state->renderState[D3DRS_STENCILREF]);
 
     m_state->dirtyFlags &= ~dirtyFlags::depthStencilState;
   }
-  void D3D9ImmediateRenderer::updateRasterizer() {
+  ID3D11RasterizerState1* D3D9ImmediateRenderer::createRasterizerState() {
     D3D11_RASTERIZER_DESC1 desc;
     desc.AntialiasedLineEnable = false;
     desc.CullMode = convert::cullMode(m_state->renderState[D3DRS_CULLMODE]);
@@ -404,7 +715,7 @@ namespace dxup {
     desc.SlopeScaledDepthBias = reinterpret::dwordToFloat(m_state->renderState[D3DRS_SLOPESCALEDEPTHBIAS]);
 
     size_t hash = m_caches.rasterizer.hash(desc);
-    ID3D11RasterizerState1* state = m_caches.rasterizer.lookupObject(hash);
+    ID3D11RasterizerState1* state = m_caches.rasterizer.lookupObject(hash, desc);
 
     if (state == nullptr) {
       Com<ID3D11RasterizerState1> comState;
@@ -412,18 +723,32 @@ namespace dxup {
       HRESULT result = m_device->CreateRasterizerState1(&desc, &comState);
       if (FAILED(result)) {
         log::fail("Failed to create rasterizer state.");
-        return;
+        return nullptr;
       }
 
       m_caches.rasterizer.pushState(hash, desc, comState.ptr());
       state = comState.ptr();
     }
 
-    m_context->RSSetState(state);
+    return state;
+  }
+  void D3D9ImmediateRenderer::updateRasterizer() {
+    D3D9StateKey key = stateKey::rasterizer(m_state->renderState.data());
+    ID3D11RasterizerState1* state = m_caches.rasterizerKeys.lookupObject(key);
+
+    if (state == nullptr) {
+      state = createRasterizerState();
+      if (state == nullptr)
+        return;
+
+      m_caches.rasterizerKeys.pushState(key, state);
+    }
+
+    m_shadow.setRasterizerState(state);
 
     m_state->dirtyFlags &= ~dirtyFlags::rasterizer;
   }
-  void D3D9ImmediateRenderer::updateBlendState() {
+  ID3D11BlendState1* D3D9ImmediateRenderer::createBlendState() {
     D3D11_BLEND_DESC1 desc;
     desc.AlphaToCoverageEnable = false;
     desc.IndependentBlendEnable = false;
@@ -459,7 +784,7 @@ namespace dxup {
     }
 
     size_t hash = m_caches.blendState.hash(desc);
-    ID3D11BlendState1* state = m_caches.blendState.lookupObject(hash);
+    ID3D11BlendState1* state = m_caches.blendState.lookupObject(hash, desc);
 
     if (state == nullptr) {
       Com<ID3D11BlendState1> comState;
@@ -467,18 +792,34 @@ namespace dxup {
       HRESULT result = m_device->CreateBlendState1(&desc, &comState);
       if (FAILED(result)) {
         log::fail("Failed to create blend state.");
-        return;
+        return nullptr;
       }
 
       m_caches.blendState.pushState(hash, desc, comState.ptr());
       state = comState.ptr();
     }
 
+    return state;
+  }
+  void D3D9ImmediateRenderer::updateBlendState() {
+    D3D9StateKey key = stateKey::blendState(m_state->renderState.data());
+    ID3D11BlendState1* state = m_caches.blendStateKeys.lookupObject(key);
+
+    if (state == nullptr) {
+      state = createBlendState();
+      if (state == nullptr)
+        return;
+
+      m_caches.blendStateKeys.pushState(key, state);
+    }
+
     float blendFactor[4];
     convert::color((D3DCOLOR)m_state->renderState[D3DRS_BLENDFACTOR], blendFactor);
-    m_context->OMSetBlendState(state, blendFactor, 0xFFFFFFFF);
+    m_shadow.setBlendState(state, blendFactor, 0xFFFFFFFF);
+
+    m_state->dirtyFlags &= ~dirtyFlags::blendState;
   }
-  void D3D9ImmediateRenderer::updateSampler(uint32_t sampler) {
+  ID3D11SamplerState* D3D9ImmediateRenderer::createSamplerState(uint32_t sampler) {
     auto& samplerState = m_state->samplerStates[sampler];
 
     D3D11_SAMPLER_DESC desc;
@@ -494,7 +835,7 @@ namespace dxup {
     desc.MinLOD = -FLT_MAX;
 
     size_t hash = m_caches.sampler.hash(desc);
-    ID3D11SamplerState* state = m_caches.sampler.lookupObject(hash);
+    ID3D11SamplerState* state = m_caches.sampler.lookupObject(hash, desc);
 
     if (state == nullptr) {
       Com<ID3D11SamplerState> comState;
@@ -502,60 +843,119 @@ namespace dxup {
       HRESULT result = m_device->CreateSamplerState(&desc, &comState);
       if (FAILED(result)) {
         log::fail("Failed to create sampler state.");
-        return;
+        return nullptr;
       }
 
       m_caches.sampler.pushState(hash, desc, comState.ptr());
       state = comState.ptr();
     }
 
-    if (sampler < 16)
-      m_context->PSSetSamplers(sampler, 1, &state);
-    else {
-      sampler -= 16;
-      m_context->VSSetSamplers(sampler, 1, &state);
+    return state;
+  }
+  void D3D9ImmediateRenderer::updateSampler(uint32_t sampler) {
+    D3D9StateKey key = stateKey::sampler(m_state->samplerStates[sampler].data());
+    ID3D11SamplerState* state = m_caches.samplerKeys.lookupObject(key);
+
+    if (state == nullptr) {
+      state = createSamplerState(sampler);
+      if (state == nullptr)
+        return;
+
+      m_caches.samplerKeys.pushState(key, state);
     }
 
-    m_state->dirtySamplers &= ~(1ull << sampler);
+    m_state->dirtySamplers &= ~(1u << sampler);
+
+    if (sampler < 16)
+      m_shadow.setSamplers<true>(sampler, 1, &state);
+    else
+      m_shadow.setSamplers<false>(sampler - 16, 1, &state);
   }
   void D3D9ImmediateRenderer::updateSamplers() {
-    for (uint32_t i = 0; i < 20; i++) {
-      if (m_state->dirtySamplers & (1ull << i))
-        updateSampler(i);
+    uint32_t dirty = m_state->dirtySamplers;
+    while (dirty != 0) {
+      uint32_t i = bit::lowest(dirty);
+      dirty &= dirty - 1;
+
+      updateSampler(i);
+    }
+  }
+  DXUPResource* D3D9ImmediateRenderer::getTextureResource(uint32_t stage) {
+    IDirect3DBaseTexture9* pTexture = m_state->textures[stage];
+
+    if (pTexture == nullptr)
+      return nullptr;
+
+    switch (pTexture->GetType()) {
+
+    case D3DRTYPE_TEXTURE: {
+      Direct3DTexture9* tex = reinterpret_cast<Direct3DTexture9*>(pTexture);
+      return tex->GetDXUPResource();
+    }
+
+    case D3DRTYPE_CUBETEXTURE: {
+      Direct3DCubeTexture9* tex = reinterpret_cast<Direct3DCubeTexture9*>(pTexture);
+      return tex->GetDXUPResource();
+    }
+
+    default: log::warn("updateTextures: unknown resource type as a texture."); return nullptr;
+
+    }
+  }
+  ID3D11ShaderResourceView* D3D9ImmediateRenderer::getTextureSRV(uint32_t stage) {
+    DXUPResource* resource = getTextureResource(stage);
+    bool srgb = m_state->samplerStates[stage][D3DSAMP_SRGBTEXTURE] == TRUE;
+
+    m_autogenTextures &= ~(1u << stage);
+
+    if (resource == nullptr)
+      return nullptr;
+
+    if (resource->HasAutogenMips())
+      m_autogenTextures |= 1u << stage;
+
+    return resource->GetSRV(srgb);
+  }
+  void D3D9ImmediateRenderer::generateStaleMips() {
+    uint32_t autogen = m_autogenTextures;
+
+    while (autogen != 0) {
+      uint32_t i = bit::lowest(autogen);
+      autogen &= autogen - 1;
+
+      DXUPResource* resource = getTextureResource(i);
+      if (resource != nullptr)
+        resource->GenerateMipsIfStale(m_context);
     }
   }
   void D3D9ImmediateRenderer::updateTextures() {
     std::array<ID3D11ShaderResourceView*, 20> srvs;
 
-    for (uint32_t i = 0; i < 20; i++) {
-      IDirect3DBaseTexture9* pTexture = m_state->textures[i];
-      bool srgb = m_state->samplerStates[i][D3DSAMP_SRGBTEXTURE] == TRUE;
+    uint32_t psDirty = m_state->dirtyTextures & 0xFFFF;
+    uint32_t vsDirty = m_state->dirtyTextures >> 16;
 
-      srvs[i] = nullptr;
+    // One bind covering the dirty slots per stage, the shadow trims it further.
+    if (psDirty != 0) {
+      uint32_t first = bit::lowest(psDirty);
+      uint32_t last = bit::highest(psDirty);
 
-      if (pTexture != nullptr) {
-        switch (pTexture->GetType()) {
+      for (uint32_t i = first; i <= last; i++)
+        srvs[i] = getTextureSRV(i);
 
-        case D3DRTYPE_TEXTURE: {
-          Direct3DTexture9* tex = reinterpret_cast<Direct3DTexture9*>(pTexture);
-          srvs[i] = tex->GetDXUPResource()->GetSRV(srgb);
-          break;
-        }
+      m_shadow.setShaderResources<true>(first, last - first + 1, &srvs[first]);
+    }
 
-        case D3DRTYPE_CUBETEXTURE: {
-          Direct3DCubeTexture9* tex = reinterpret_cast<Direct3DCubeTexture9*>(pTexture);
-          srvs[i] = tex->GetDXUPResource()->GetSRV(srgb);
-          break;
-        }
+    if (vsDirty != 0) {
+      uint32_t first = bit::lowest(vsDirty);
+      uint32_t last = bit::highest(vsDirty);
 
-        default: log::warn("updateTextures: unknown resource type as a texture."); break;
+      for (uint32_t i = first; i <= last; i++)
+        srvs[16 + i] = getTextureSRV(16 + i);
 
-        }
-      }
+      m_shadow.setShaderResources<false>(first, last - first + 1, &srvs[16 + first]);
     }
 
-    m_context->PSSetShaderResources(0, 16, &srvs[0]);
-    m_context->VSSetShaderResources(0, 4, &srvs[16]);
+    m_state->dirtyTextures = 0;
   }
   void D3D9ImmediateRenderer::updateRenderTargets() {
     std::array<ID3D11RenderTargetView*, 4> rtvs = { nullptr, nullptr, nullptr, nullptr };
@@ -563,7 +963,6 @@ namespace dxup {
     {
       if (m_state->renderTargets[i] != nullptr) {
         rtvs[i] = m_state->renderTargets[i]->GetD3D11RenderTarget(m_state->renderState[D3DRS_SRGBWRITEENABLE] == TRUE);
-        m_state->renderTargets[i]->GetDXUPResource()->MarkDirty(0, 0); // Mark dirty so we copy to staging when read on the CPU again.
         if (rtvs[i] == nullptr)
           log::warn("No render target view for bound render target surface.");
       }
@@ -576,29 +975,41 @@ namespace dxup {
         log::warn("No depth stencil view for bound depth stencil surface.");
     }
 
-    m_context->OMSetRenderTargets(4, &rtvs[0], dsv);
+    m_shadow.setRenderTargets(4, &rtvs[0], dsv);
 
     m_state->dirtyFlags &= ~dirtyFlags::renderTargets;
+    m_state->dirtyRenderTargets = 0;
+
+    // Binding outputs can unbind SRVs of the same resource, rebind any textures we have.
+    for (uint32_t i = 0; i < m_state->textures.size(); i++) {
+      if (m_state->textures[i] != nullptr)
+        m_state->dirtyTextures |= 1u << i;
+    }
   }
   void D3D9ImmediateRenderer::updatePixelShader() {
     if (m_state->pixelShader != nullptr)
-      m_context->PSSetShader(m_state->pixelShader->GetD3D11Shader(), nullptr, 0);
+      m_shadow.setPixelShader(m_state->pixelShader->GetD3D11Shader());
     else
-      m_context->PSSetShader(nullptr, nullptr, 0);
+      m_shadow.setPixelShader(nullptr);
 
     m_state->dirtyFlags &= ~dirtyFlags::pixelShader;
   }
   void D3D9ImmediateRenderer::updateVertexBuffer() {
+    uint32_t first = bit::lowest(m_state->dirtyVertexBuffers);
+    uint32_t last = bit::highest(m_state->dirtyVertexBuffers);
+
     std::array<ID3D11Buffer*, 16> buffers;
-    for (uint32_t i = 0; i < 16; i++) {
+    for (uint32_t i = first; i <= last; i++) {
       Direct3DVertexBuffer9* buffer = m_state->vertexBuffers[i].ptr();
       if (buffer != nullptr)
         buffers[i] = buffer->GetDXUPResource()->GetResourceAs<ID3D11Buffer>();
       else
         buffers[i] = nullptr;
     }
-    m_context->IASetVertexBuffers(0, 16, buffers.data(), m_state->vertexStrides.data(), m_state->vertexOffsets.data());
-    m_state->dirtyFlags &= ~dirtyFlags::vertexBuffers;
+
+    const uint32_t count = last - first + 1;
+    m_shadow.setVertexBuffers(first, count, &buffers[first], &m_state->vertexStrides[first], &m_state->vertexOffsets[first]);
+    m_state->dirtyVertexBuffers = 0;
   }
   void D3D9ImmediateRenderer::updateIndexBuffer() {
     DXGI_FORMAT format = DXGI_FORMAT_R16_UINT;
@@ -611,28 +1022,33 @@ namespace dxup {
       buffer = m_state->indexBuffer->GetDXUPResource()->GetResourceAs<ID3D11Buffer>();
     }
 
-    m_context->IASetIndexBuffer(buffer, format, 0);
+    m_shadow.setIndexBuffer(buffer, format, 0);
     m_state->dirtyFlags &= ~dirtyFlags::indexBuffer;
   }
   void D3D9ImmediateRenderer::updateVertexConstants() {
-    m_vsConstants.update(m_state->vsConstants);
+    m_vsConstants.update(m_state->vsConstants, m_state->vsDirtyConstants);
+    m_state->vsDirtyConstants = D3D9ConstantRanges();
     m_state->dirtyFlags &= ~dirtyFlags::vsConstants;
   }
   void D3D9ImmediateRenderer::updatePixelConstants() {
-    m_psConstants.update(m_state->psConstants);
+    m_psConstants.update(m_state->psConstants, m_state->psDirtyConstants);
+    m_state->psDirtyConstants = D3D9ConstantRanges();
     m_state->dirtyFlags &= ~dirtyFlags::psConstants;
   }
 
   //
 
   void D3D9ImmediateRenderer::undirtyContext() {
+    // Pending UP draws were recorded against what's bound now.
+    flushBatch();
+
     if (m_state->dirtyFlags & dirtyFlags::viewport)
       updateViewport();
 
     if (m_state->dirtyFlags & dirtyFlags::scissorRect)
       updateScissorRect();
 
-    if (m_state->dirtyFlags & dirtyFlags::vertexBuffers)
+    if (m_state->dirtyVertexBuffers != 0)
       updateVertexBuffer();
 
     if (m_state->dirtyFlags & dirtyFlags::indexBuffer)
@@ -650,12 +1066,12 @@ namespace dxup {
     if (m_state->dirtySamplers != 0)
       updateSamplers();
 
-    if (m_state->dirtyFlags & dirtyFlags::textures)
-      updateTextures();
-
-    if (m_state->dirtyFlags & dirtyFlags::renderTargets)
+    if (m_state->dirtyFlags & dirtyFlags::renderTargets || m_state->dirtyRenderTargets != 0)
       updateRenderTargets();
 
+    if (m_state->dirtyTextures != 0)
+      updateTextures();
+
     if (m_state->dirtyFlags & dirtyFlags::rasterizer)
       updateRasterizer();
 
@@ -672,6 +1088,8 @@ namespace dxup {
   //
 
   void D3D9ImmediateRenderer::handleDepthStencilDiscard() {
+    flushBatch();
+
     if (m_state->depthStencil != nullptr && m_state->depthStencil->GetD3D9Desc().Discard) {
       ID3D11DepthStencilView* dsv = m_state->depthStencil->GetD3D11DepthStencil();
       if (dsv)
@@ -684,8 +1102,19 @@ namespace dxup {
   bool D3D9ImmediateRenderer::canDraw() {
     return !( (m_state->dirtyFlags & dirtyFlags::vertexDecl) || (m_state->dirtyFlags & dirtyFlags::vertexShader) );
   }
+  void D3D9ImmediateRenderer::markRenderTargetsDirty() {
+    for (uint32_t i = 0; i < 4; i++) {
+      Direct3DSurface9* surface = m_state->renderTargets[i];
+      if (surface != nullptr)
+        surface->GetDXUPResource()->MarkDirty(surface->GetSlice(), surface->GetMip());
+    }
+  }
   bool D3D9ImmediateRenderer::preDraw() {
     undirtyContext();
+    generateStaleMips();
+
+    // Every draw writes the bound targets, whether or not the binding changed since they were last read back.
+    markRenderTargetsDirty();
     return canDraw();
   }
   void D3D9ImmediateRenderer::postDraw() {
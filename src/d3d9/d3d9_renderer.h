@@ -2,7 +2,9 @@
 
 #include "d3d9_base.h"
 #include "d3d9_state.h"
-#include "d3d11_dynamic_buffer.h"
+#include "d3d11_upload_heap.h"
+#include "d3d11_context_shadow.h"
+#include <vector>
 
 namespace dxup {
 
@@ -17,6 +19,8 @@ namespace dxup {
     HRESULT DrawPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, CONST void* pVertexStreamZeroData, UINT VertexStreamZeroStride);
     HRESULT DrawIndexedPrimitiveUP(D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices, UINT PrimitiveCount, const void* pIndexData, D3DFORMAT IndexDataFormat, const void* pVertexStreamZeroData, UINT VertexStreamZeroStride);
     HRESULT DrawIndexedPrimitive(D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex, UINT NumVertices, UINT startIndex, UINT primCount);
+    // A fan drawn with DrawIndexedPrimitive whose indices were already taken out of the index buffer, from its first one on.
+    HRESULT DrawIndexedTriangleFan(INT BaseVertexIndex, UINT PrimitiveCount, const void* pIndexData, D3DFORMAT IndexDataFormat);
 
     void undirtyContext();
     void handleDepthStencilDiscard();
@@ -24,9 +28,21 @@ namespace dxup {
     void blit(Direct3DSurface9* dst, Direct3DSurface9* src);
     void endFrame();
 
+    // Issues any UP draws we are holding onto. Call before anything else touches the context.
+    void flushBatch();
+
+    void logStats();
+
   private:
 
-    HRESULT drawTriangleFan(bool indexed, D3DPRIMITIVETYPE PrimitiveType, UINT StartIndex, UINT PrimitiveCount, UINT BaseVertexIndex);
+    // Fans become lists, converted on their way into the upload heap. Without fan the indices are made up as if it counted up from 0.
+    // UP draws pass their vertices along to go up in the same map.
+    HRESULT drawTriangleFan(const void* fan, D3DFORMAT fanFormat, UINT PrimitiveCount, INT BaseVertexIndex, const void* vertices, UINT vertexLength, UINT stride);
+
+    // Consecutive list-type UP draws with nothing dirtied in between get merged into one draw.
+    bool canContinueBatch(D3DPRIMITIVETYPE type, UINT stride, D3DFORMAT indexFormat, UINT vertexCount, UINT vertexLength);
+    void startBatch(D3DPRIMITIVETYPE type, D3D_PRIMITIVE_TOPOLOGY topology, UINT stride, D3DFORMAT indexFormat);
+    void appendBatch(const void* vertices, UINT vertexCount, const void* indices, UINT indexCount);
 
     bool canDraw();
 
@@ -40,9 +56,20 @@ namespace dxup {
     void updateRasterizer();
     void updateBlendState();
     void updateSampler(uint32_t sampler);
+
+    // Only called on a packed key miss.
+    ID3D11DepthStencilState* createDepthStencilState();
+    ID3D11RasterizerState1* createRasterizerState();
+    ID3D11BlendState1* createBlendState();
+    ID3D11SamplerState* createSamplerState(uint32_t sampler);
+
     void updateSamplers();
+    DXUPResource* getTextureResource(uint32_t stage);
+    ID3D11ShaderResourceView* getTextureSRV(uint32_t stage);
+    void generateStaleMips();
     void updateTextures();
     void updateRenderTargets();
+    void markRenderTargetsDirty();
     void updatePixelShader();
     void updateVertexBuffer();
     void updateIndexBuffer();
@@ -53,10 +80,29 @@ namespace dxup {
     ID3D11DeviceContext1* m_context;
     D3D9State* m_state;
 
-    D3D11DynamicBuffer m_upVertexBuffer;
-    D3D11DynamicBuffer m_upIndexBuffer;
-    D3D11DynamicBuffer m_fanIndexBuffer;
-    bool m_fanIndexed;
+    D3D11ContextShadow m_shadow;
+
+    // Stages with an autogen mip texture bound, checked for stale mips before every draw.
+    uint32_t m_autogenTextures;
+
+    D3D11UploadHeap m_uploadHeap;
+
+    struct UPBatch {
+      bool active = false;
+      D3DPRIMITIVETYPE type;
+      D3D_PRIMITIVE_TOPOLOGY topology;
+      UINT stride;
+      D3DFORMAT indexFormat; // D3DFMT_UNKNOWN if not indexed.
+
+      std::vector<uint8_t> vertices;
+      std::vector<uint8_t> indices;
+      UINT vertexCount;
+      UINT indexCount;
+      UINT draws;
+    } m_batch;
+
+    uint64_t m_batchedDraws;
+    uint64_t m_batchFlushes;
 
     D3D9ConstantBuffer<false> m_vsConstants;
     D3D9ConstantBuffer<true> m_psConstants;
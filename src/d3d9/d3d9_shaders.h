@@ -10,6 +10,7 @@ namespace dxup {
   struct InputLink {
     Com<ID3D11InputLayout> inputLayout;
     Com<IDirect3DVertexDeclaration9> vertexDcl;
+    uint32_t variant;
   };
 
   template <typename D3D11Shader, typename Base>
@@ -71,16 +72,16 @@ namespace dxup {
       return m_shader.ptr();
     }
 
-    void LinkInput(ID3D11InputLayout* inputLayout, IDirect3DVertexDeclaration9* vertDcl) {
-      m_inputLinks.push_back(InputLink{ inputLayout, vertDcl });
+    void LinkInput(ID3D11InputLayout* inputLayout, IDirect3DVertexDeclaration9* vertDcl, uint32_t variant) {
+      m_inputLinks.push_back(InputLink{ inputLayout, vertDcl, variant });
     }
 
-    ID3D11InputLayout* GetLinkedInput(IDirect3DVertexDeclaration9* vertDcl) {
+    ID3D11InputLayout* GetLinkedInput(IDirect3DVertexDeclaration9* vertDcl, uint32_t variant) {
       if (vertDcl == nullptr)
         return nullptr;
 
       for (InputLink& link : m_inputLinks) {
-        if (link.vertexDcl == vertDcl)
+        if (link.vertexDcl == vertDcl && link.variant == variant)
           return link.inputLayout.ptr();
       }
 
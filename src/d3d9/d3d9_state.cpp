@@ -15,15 +15,28 @@ namespace dxup {
     : m_device{ device } {
     dirtyFlags = 0;
     dirtySamplers = 0;
+    dirtyTextures = 0;
+    dirtyVertexBuffers = 0;
+    dirtyRenderTargets = 0;
+    untrackedDirty = false;
+
+    setsFiltered.fill(0);
+    setsEffective.fill(0);
 
     std::memset(textures.data(), 0, sizeof(IDirect3DBaseTexture9*) * textures.size());
     std::memset(vertexOffsets.data(), 0, sizeof(UINT) * vertexOffsets.size());
     std::memset(vertexStrides.data(), 0, sizeof(UINT) * vertexStrides.size());
+    streamFreqs.fill(1);
 
     if (stateBlockType != 0)
       this->capture(stateBlockType, false);
   }
 
+  D3D9State::~D3D9State() {
+    for (uint32_t i = 0; i < textures.size(); i++)
+      bindTexture(i, nullptr);
+  }
+
   void D3D9State::capture(uint32_t stateBlockType, bool recapture) {
     // Using 0x80000000 to denote uncaptured as it'll never be a value for any of our constant types. (-0.0 fl)
     // Idea taken from SwiftShader. May or may not be accurate.
@@ -78,8 +91,10 @@ namespace dxup {
       m_device->SetVertexDeclaration(vertexDecl.ptr());
 
     for (uint32_t i = 0; i < 16; i++) {
-      if (vertexBufferCaptures[i])
+      if (vertexBufferCaptures[i]) {
         m_device->SetStreamSource(i, vertexBuffers[i].ptr(), vertexOffsets[i], vertexStrides[i]);
+        m_device->SetStreamSourceFreq(i, streamFreqs[i]);
+      }
     }
 
     for (uint32_t i = 0; i < renderState.size(); i++) {
@@ -166,49 +181,44 @@ namespace dxup {
     if (FAILED(result))
       return result;
 
-    if (textures[Stage] == pTexture)
+    if (isRedundant(stateSetters::texture, textures[Stage] == pTexture))
       return D3D_OK;
 
-    IDirect3DBaseTexture9* currentBinding = textures[Stage];
+    bindTexture(Stage, pTexture);
 
-    if (currentBinding != nullptr) {
-      switch (textures[Stage]->GetType()) {
-      case D3DRTYPE_TEXTURE: reinterpret_cast<Direct3DTexture9*>(currentBinding)->ReleasePrivate(); break;
-      case D3DRTYPE_CUBETEXTURE: reinterpret_cast<Direct3DCubeTexture9*>(currentBinding)->ReleasePrivate(); break;
-      default:
-        log::warn("Unable to find what texture stage really is to release internally.");
-        break;
-      }
+    textureCaptured[Stage] = true;
+    dirtyTextures |= 1u << Stage;
+    return D3D_OK;
+  }
+
+  bool D3D9State::addTextureRef(IDirect3DBaseTexture9* texture) {
+    switch (texture->GetType()) {
+    case D3DRTYPE_TEXTURE: reinterpret_cast<Direct3DTexture9*>(texture)->AddRefPrivate(); return true;
+    case D3DRTYPE_CUBETEXTURE: reinterpret_cast<Direct3DCubeTexture9*>(texture)->AddRefPrivate(); return true;
+    default: return false;
     }
+  }
 
-    if (pTexture != nullptr) {
-      switch (pTexture->GetType()) {
+  bool D3D9State::releaseTextureRef(IDirect3DBaseTexture9* texture) {
+    switch (texture->GetType()) {
+    case D3DRTYPE_TEXTURE: reinterpret_cast<Direct3DTexture9*>(texture)->ReleasePrivate(); return true;
+    case D3DRTYPE_CUBETEXTURE: reinterpret_cast<Direct3DCubeTexture9*>(texture)->ReleasePrivate(); return true;
+    default: return false;
+    }
+  }
 
-      case D3DRTYPE_TEXTURE: {
-        Direct3DTexture9* tex = reinterpret_cast<Direct3DTexture9*>(pTexture);
-        tex->AddRefPrivate();
-        break;
-      }
+  void D3D9State::bindTexture(uint32_t sampler, IDirect3DBaseTexture9* texture) {
+    IDirect3DBaseTexture9* currentBinding = textures[sampler];
 
-      case D3DRTYPE_CUBETEXTURE: {
-        Direct3DCubeTexture9* tex = reinterpret_cast<Direct3DCubeTexture9*>(pTexture);
-        tex->AddRefPrivate();
-        break;
-      }
+    if (currentBinding != nullptr && !releaseTextureRef(currentBinding))
+      log::warn("Unable to find what texture stage really is to release internally.");
 
-      default: {
-        textures[Stage] = nullptr;
-        log::warn("Unable to find what new texture to bind really is.");
-        break;
-      }
+    textures[sampler] = texture;
 
-      }
+    if (texture != nullptr && !addTextureRef(texture)) {
+      textures[sampler] = nullptr;
+      log::warn("Unable to find what new texture to bind really is.");
     }
-
-    textureCaptured[Stage] = true;
-    textures[Stage] = pTexture;
-    dirtyFlags |= dirtyFlags::textures;
-    return D3D_OK;
   }
 
   HRESULT D3D9State::GetRenderTarget(DWORD RenderTargetIndex, IDirect3DSurface9** ppRenderTarget) {
@@ -231,28 +241,42 @@ namespace dxup {
     if (RenderTargetIndex >= 4)
       return log::d3derr(D3DERR_INVALIDCALL, "SetRenderTarget: rendertarget index out of bounds (%d).", RenderTargetIndex);
 
-    renderTargets[RenderTargetIndex] = reinterpret_cast<Direct3DSurface9*>(pRenderTarget);
+    Direct3DSurface9* surface = reinterpret_cast<Direct3DSurface9*>(pRenderTarget);
+
+    if (!isRedundant(stateSetters::renderTarget, renderTargets[RenderTargetIndex] == surface)) {
+      renderTargets[RenderTargetIndex] = surface;
+      dirtyRenderTargets |= 1u << RenderTargetIndex;
+    }
 
+    // D3D9 resets these even if the same target gets set again.
     if (renderTargets[RenderTargetIndex] != nullptr && RenderTargetIndex == 0) {
       D3DSURFACE_DESC desc;
       renderTargets[RenderTargetIndex]->GetDesc(&desc);
 
-      viewport.X = 0;
-      viewport.Y = 0;
-      viewport.Width = desc.Width;
-      viewport.Height = desc.Height;
-      viewport.MinZ = 0;
-      viewport.MaxZ = 1;
-      dirtyFlags |= dirtyFlags::viewport;
-
-      scissorRect.left = 0;
-      scissorRect.top = 0;
-      scissorRect.right = desc.Width;
-      scissorRect.bottom = desc.Height;
-      dirtyFlags |= dirtyFlags::scissorRect;
-    }
+      D3DVIEWPORT9 newViewport;
+      newViewport.X = 0;
+      newViewport.Y = 0;
+      newViewport.Width = desc.Width;
+      newViewport.Height = desc.Height;
+      newViewport.MinZ = 0;
+      newViewport.MaxZ = 1;
+
+      if (std::memcmp(&viewport, &newViewport, sizeof(viewport)) != 0) {
+        viewport = newViewport;
+        dirtyFlags |= dirtyFlags::viewport;
+      }
 
-    dirtyFlags |= dirtyFlags::renderTargets;
+      RECT newScissorRect;
+      newScissorRect.left = 0;
+      newScissorRect.top = 0;
+      newScissorRect.right = desc.Width;
+      newScissorRect.bottom = desc.Height;
+
+      if (std::memcmp(&scissorRect, &newScissorRect, sizeof(scissorRect)) != 0) {
+        scissorRect = newScissorRect;
+        dirtyFlags |= dirtyFlags::scissorRect;
+      }
+    }
 
     return D3D_OK;
   }
@@ -272,7 +296,7 @@ namespace dxup {
   }
   HRESULT D3D9State::SetDepthStencilSurface(IDirect3DSurface9* pNewZStencil) {
     Direct3DSurface9* newSurface = reinterpret_cast<Direct3DSurface9*>(pNewZStencil);
-    if (depthStencil == newSurface)
+    if (isRedundant(stateSetters::depthStencil, depthStencil == newSurface))
       return D3D_OK;
 
     depthStencil = newSurface;
@@ -302,10 +326,11 @@ namespace dxup {
 
     renderStateCaptures[State] = true;
 
-    if (renderState[State] == Value)
+    if (isRedundant(stateSetters::renderState, renderState[State] == Value))
       return D3D_OK;
 
     renderState[State] = Value;
+    untrackedDirty = true;
 
     if (State == D3DRS_CULLMODE ||
       State == D3DRS_DEPTHBIAS ||
@@ -378,7 +403,7 @@ namespace dxup {
 
     textureStageStateCaptures[Stage][Type] = true;
 
-    if (textureStageStates[Stage][Type] == Value)
+    if (isRedundant(stateSetters::textureStageState, textureStageStates[Stage][Type] == Value))
       return D3D_OK;
 
     textureStageStates[Stage][Type] = Value;
@@ -412,11 +437,16 @@ namespace dxup {
 
     samplerStateCaptures[Sampler][Type] = true;
 
-    if (samplerStates[Sampler][Type] == Value)
+    if (isRedundant(stateSetters::samplerState, samplerStates[Sampler][Type] == Value))
       return D3D_OK;
 
     samplerStates[Sampler][Type] = Value;
-    dirtySamplers |= 1 << Sampler;
+
+    // sRGB picks which SRV we bind, not the sampler object.
+    if (Type == D3DSAMP_SRGBTEXTURE)
+      dirtyTextures |= 1u << Sampler;
+    else
+      dirtySamplers |= 1u << Sampler;
 
     return D3D_OK;
   }
@@ -426,7 +456,7 @@ namespace dxup {
 
     vertexDeclCaptured = true;
 
-    if (vertexDecl == newDecl)
+    if (isRedundant(stateSetters::vertexDecl, vertexDecl == newDecl))
       return D3D_OK;
 
     vertexDecl = newDecl;
@@ -462,16 +492,15 @@ namespace dxup {
     return D3D_OK;
   }
   HRESULT D3D9State::SetVertexShader(IDirect3DVertexShader9* pShader) {
-    dirtyFlags |= dirtyFlags::vertexShader;
+    Direct3DVertexShader9* newShader = reinterpret_cast<Direct3DVertexShader9*>(pShader);
 
     vertexShaderCaptured = true;
 
-    if (pShader == nullptr) {
-      vertexShader = nullptr;
+    if (isRedundant(stateSetters::vertexShader, vertexShader == newShader))
       return D3D_OK;
-    }
 
-    vertexShader = reinterpret_cast<Direct3DVertexShader9*>(pShader);
+    vertexShader = newShader;
+    dirtyFlags |= dirtyFlags::vertexShader;
 
     return D3D_OK;
   }
@@ -483,6 +512,9 @@ namespace dxup {
     if (pConstantData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "GetVertexShaderConstantF: pConstantData was nullptr");
 
+    if (!constantRangeValid(vsConstants.floatConstants, StartRegister, Vector4fCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "GetVertexShaderConstantF: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4fCount);
+
     arrayCopyJ(pConstantData, &vsConstants.floatConstants[StartRegister], Vector4fCount);
     return D3D_OK;
   }
@@ -493,9 +525,12 @@ namespace dxup {
     if (pConstantData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "SetVertexShaderConstantF: pConstantData was nullptr");
 
-    dirtyFlags |= dirtyFlags::vsConstants;
+    if (!constantRangeValid(vsConstants.floatConstants, StartRegister, Vector4fCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "SetVertexShaderConstantF: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4fCount);
+
+    if (updateConstants(stateSetters::vertexShaderConstantF, vsConstants.floatConstants, vsDirtyConstants.floats, StartRegister, pConstantData, Vector4fCount))
+      dirtyFlags |= dirtyFlags::vsConstants;
 
-    arrayCopyT(&vsConstants.floatConstants[StartRegister], pConstantData, Vector4fCount);
     return D3D_OK;
   }
 
@@ -506,6 +541,9 @@ namespace dxup {
     if (pConstantData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "GetVertexShaderConstantI: pConstantData was nullptr");
 
+    if (!constantRangeValid(vsConstants.intConstants, StartRegister, Vector4iCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "GetVertexShaderConstantI: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4iCount);
+
     arrayCopyJ(pConstantData, &vsConstants.intConstants[StartRegister], Vector4iCount);
     return D3D_OK;
   }
@@ -516,8 +554,12 @@ namespace dxup {
     if (pConstantData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "SetVertexShaderConstantI: pConstantData was nullptr");
 
-    dirtyFlags |= dirtyFlags::vsConstants;
-    arrayCopyT(&vsConstants.intConstants[StartRegister], pConstantData, Vector4iCount);
+    if (!constantRangeValid(vsConstants.intConstants, StartRegister, Vector4iCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "SetVertexShaderConstantI: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4iCount);
+
+    if (updateConstants(stateSetters::vertexShaderConstantI, vsConstants.intConstants, vsDirtyConstants.ints, StartRegister, pConstantData, Vector4iCount))
+      dirtyFlags |= dirtyFlags::vsConstants;
+
     return D3D_OK;
   }
 
@@ -528,6 +570,9 @@ namespace dxup {
     if (pConstantData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "GetVertexShaderConstantB: pConstantData was nullptr");
 
+    if (!constantRangeValid(vsConstants.boolConstants, StartRegister, BoolCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "GetVertexShaderConstantB: register range out of bounds (start: %d, count: %d).", StartRegister, BoolCount);
+
     arrayCopyJ(pConstantData, &vsConstants.boolConstants[StartRegister], BoolCount);
     return D3D_OK;
   }
@@ -538,8 +583,12 @@ namespace dxup {
     if (pConstantData == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "SetVertexShaderConstantB: pConstantData was nullptr");
 
-    dirtyFlags |= dirtyFlags::vsConstants;
-    arrayCopyT(&vsConstants.boolConstants[StartRegister], pConstantData, BoolCount);
+    if (!constantRangeValid(vsConstants.boolConstants, StartRegister, BoolCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "SetVertexShaderConstantB: register range out of bounds (start: %d, count: %d).", StartRegister, BoolCount);
+
+    if (updateConstants(stateSetters::vertexShaderConstantB, vsConstants.boolConstants, vsDirtyConstants.bools, StartRegister, pConstantData, BoolCount))
+      dirtyFlags |= dirtyFlags::vsConstants;
+
     return D3D_OK;
   }
 
@@ -578,11 +627,63 @@ namespace dxup {
     Direct3DVertexBuffer9* vertexBuffer = reinterpret_cast<Direct3DVertexBuffer9*>(pStreamData);
 
     vertexBufferCaptures[StreamNumber] = true;
+
+    bool equal = vertexBuffers[StreamNumber] == vertexBuffer &&
+      vertexOffsets[StreamNumber] == OffsetInBytes &&
+      vertexStrides[StreamNumber] == Stride;
+
+    if (isRedundant(stateSetters::streamSource, equal))
+      return D3D_OK;
+
     vertexBuffers[StreamNumber] = vertexBuffer;
     vertexOffsets[StreamNumber] = OffsetInBytes;
     vertexStrides[StreamNumber] = Stride;
 
-    dirtyFlags |= dirtyFlags::vertexBuffers;
+    dirtyVertexBuffers |= 1u << StreamNumber;
+
+    return D3D_OK;
+  }
+
+  HRESULT D3D9State::GetStreamSourceFreq(UINT StreamNumber, UINT* pSetting) {
+    if (StreamNumber >= 16)
+      return log::d3derr(D3DERR_INVALIDCALL, "GetStreamSourceFreq: stream number was out of bounds (range: 0-15, got: %d).", StreamNumber);
+
+    if (pSetting == nullptr)
+      return log::d3derr(D3DERR_INVALIDCALL, "GetStreamSourceFreq: pSetting was nullptr.");
+
+    *pSetting = streamFreqs[StreamNumber];
+
+    return D3D_OK;
+  }
+  HRESULT D3D9State::SetStreamSourceFreq(UINT StreamNumber, UINT Setting) {
+    if (StreamNumber >= 16)
+      return log::d3derr(D3DERR_INVALIDCALL, "SetStreamSourceFreq: stream number was out of bounds (range: 0-15, got: %d).", StreamNumber);
+
+    const bool indexedData = (Setting & D3DSTREAMSOURCE_INDEXEDDATA) != 0;
+    const bool instanceData = (Setting & D3DSTREAMSOURCE_INSTANCEDATA) != 0;
+    const UINT count = Setting & ~(D3DSTREAMSOURCE_INDEXEDDATA | D3DSTREAMSOURCE_INSTANCEDATA);
+
+    if (indexedData && instanceData)
+      return log::d3derr(D3DERR_INVALIDCALL, "SetStreamSourceFreq: stream can't be both indexed and instance data.");
+
+    if (instanceData && StreamNumber == 0)
+      return log::d3derr(D3DERR_INVALIDCALL, "SetStreamSourceFreq: stream 0 can't be instance data.");
+
+    if (count == 0)
+      return log::d3derr(D3DERR_INVALIDCALL, "SetStreamSourceFreq: setting had a frequency of 0.");
+
+    vertexBufferCaptures[StreamNumber] = true;
+
+    if (isRedundant(stateSetters::streamSourceFreq, streamFreqs[StreamNumber] == Setting))
+      return D3D_OK;
+
+    const bool layoutChanged = instanceData || (streamFreqs[StreamNumber] & D3DSTREAMSOURCE_INSTANCEDATA);
+    streamFreqs[StreamNumber] = Setting;
+    untrackedDirty = true;
+
+    // Instance data lives in the input layout.
+    if (layoutChanged)
+      dirtyFlags |= dirtyFlags::vertexDecl;
 
     return D3D_OK;
   }
@@ -605,7 +706,7 @@ namespace dxup {
 
     indexBufferCaptured = true;
 
-    if (indexBuffer == indices)
+    if (isRedundant(stateSetters::indices, indexBuffer == indices))
       return D3D_OK;
 
     indexBuffer = indices;
@@ -628,16 +729,15 @@ namespace dxup {
     return D3D_OK;
   }
   HRESULT D3D9State::SetPixelShader(IDirect3DPixelShader9* pShader) {
-    dirtyFlags |= dirtyFlags::pixelShader;
+    Direct3DPixelShader9* newShader = reinterpret_cast<Direct3DPixelShader9*>(pShader);
 
     pixelShaderCaptured = true;
 
-    if (pShader == nullptr) {
-      pixelShader = nullptr;
+    if (isRedundant(stateSetters::pixelShader, pixelShader == newShader))
       return D3D_OK;
-    }
 
-    pixelShader = reinterpret_cast<Direct3DPixelShader9*>(pShader);
+    pixelShader = newShader;
+    dirtyFlags |= dirtyFlags::pixelShader;
 
     return D3D_OK;
   }
@@ -649,6 +749,9 @@ namespace dxup {
     if (Vector4fCount == 0)
       return D3D_OK;
 
+    if (!constantRangeValid(psConstants.floatConstants, StartRegister, Vector4fCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "GetPixelShaderConstantF: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4fCount);
+
     arrayCopyJ(pConstantData, &psConstants.floatConstants[StartRegister], Vector4fCount);
     return D3D_OK;
   }
@@ -659,8 +762,12 @@ namespace dxup {
     if (Vector4fCount == 0)
       return D3D_OK;
 
-    dirtyFlags |= dirtyFlags::psConstants;
-    arrayCopyT(&psConstants.floatConstants[StartRegister], pConstantData, Vector4fCount);
+    if (!constantRangeValid(psConstants.floatConstants, StartRegister, Vector4fCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "SetPixelShaderConstantF: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4fCount);
+
+    if (updateConstants(stateSetters::pixelShaderConstantF, psConstants.floatConstants, psDirtyConstants.floats, StartRegister, pConstantData, Vector4fCount))
+      dirtyFlags |= dirtyFlags::psConstants;
+
     return D3D_OK;
   }
 
@@ -671,6 +778,9 @@ namespace dxup {
     if (Vector4iCount == 0)
       return D3D_OK;
 
+    if (!constantRangeValid(psConstants.intConstants, StartRegister, Vector4iCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "GetPixelShaderConstantI: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4iCount);
+
     arrayCopyJ(pConstantData, &psConstants.intConstants[StartRegister], Vector4iCount);
     return D3D_OK;
   }
@@ -681,8 +791,12 @@ namespace dxup {
     if (Vector4iCount == 0)
       return D3D_OK;
 
-    dirtyFlags |= dirtyFlags::psConstants;
-    arrayCopyT(&psConstants.intConstants[StartRegister], pConstantData, Vector4iCount);
+    if (!constantRangeValid(psConstants.intConstants, StartRegister, Vector4iCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "SetPixelShaderConstantI: register range out of bounds (start: %d, count: %d).", StartRegister, Vector4iCount);
+
+    if (updateConstants(stateSetters::pixelShaderConstantI, psConstants.intConstants, psDirtyConstants.ints, StartRegister, pConstantData, Vector4iCount))
+      dirtyFlags |= dirtyFlags::psConstants;
+
     return D3D_OK;
   }
 
@@ -693,6 +807,9 @@ namespace dxup {
     if (BoolCount == 0)
       return D3D_OK;
 
+    if (!constantRangeValid(psConstants.boolConstants, StartRegister, BoolCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "GetPixelShaderConstantB: register range out of bounds (start: %d, count: %d).", StartRegister, BoolCount);
+
     arrayCopyJ(pConstantData, &psConstants.boolConstants[StartRegister], BoolCount);
     return D3D_OK;
   }
@@ -703,8 +820,12 @@ namespace dxup {
     if (BoolCount == 0)
       return D3D_OK;
 
-    dirtyFlags |= dirtyFlags::psConstants;
-    arrayCopyT(&psConstants.boolConstants[StartRegister], pConstantData, BoolCount);
+    if (!constantRangeValid(psConstants.boolConstants, StartRegister, BoolCount))
+      return log::d3derr(D3DERR_INVALIDCALL, "SetPixelShaderConstantB: register range out of bounds (start: %d, count: %d).", StartRegister, BoolCount);
+
+    if (updateConstants(stateSetters::pixelShaderConstantB, psConstants.boolConstants, psDirtyConstants.bools, StartRegister, pConstantData, BoolCount))
+      dirtyFlags |= dirtyFlags::psConstants;
+
     return D3D_OK;
   }
 
@@ -719,9 +840,12 @@ namespace dxup {
     if (pRect == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "SetScissorRect: pRect was nullptr.");
 
-    scissorRect = *pRect;
     scissorRectCaptured = true;
 
+    if (isRedundant(stateSetters::scissorRect, std::memcmp(&scissorRect, pRect, sizeof(scissorRect)) == 0))
+      return D3D_OK;
+
+    scissorRect = *pRect;
     dirtyFlags |= dirtyFlags::scissorRect;
     return D3D_OK;
   }
@@ -737,13 +861,343 @@ namespace dxup {
     if (pViewport == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "SetViewport: pViewport was nullptr.");
 
-    viewport = *pViewport;
     viewportCaptured = true;
 
+    if (isRedundant(stateSetters::viewport, std::memcmp(&viewport, pViewport, sizeof(viewport)) == 0))
+      return D3D_OK;
+
+    viewport = *pViewport;
     dirtyFlags |= dirtyFlags::viewport;
     return D3D_OK;
   }
 
+  void D3D9State::logSetStats() {
+    static const char* setterNames[stateSetters::count] = {
+      "SetRenderState",
+      "SetTextureStageState",
+      "SetSamplerState",
+      "SetTexture",
+      "SetRenderTarget",
+      "SetDepthStencilSurface",
+      "SetVertexDeclaration",
+      "SetVertexShader",
+      "SetPixelShader",
+      "SetStreamSource",
+      "SetStreamSourceFreq",
+      "SetIndices",
+      "SetScissorRect",
+      "SetViewport",
+      "SetVertexShaderConstantF",
+      "SetVertexShaderConstantI",
+      "SetVertexShaderConstantB",
+      "SetPixelShaderConstantF",
+      "SetPixelShaderConstantI",
+      "SetPixelShaderConstantB",
+    };
+
+    for (uint32_t i = 0; i < stateSetters::count; i++) {
+      uint64_t total = setsFiltered[i] + setsEffective[i];
+      if (total == 0)
+        continue;
+
+      log::msg("%s: %llu calls, %llu redundant (%.1f%%).", setterNames[i], total, setsFiltered[i], (100.0 * setsFiltered[i]) / total);
+    }
+  }
+
+  //
+
+  void D3D9State::rebindBuffer(DXUPResource* resource) {
+    for (uint32_t i = 0; i < vertexBuffers.size(); i++) {
+      if (vertexBuffers[i] != nullptr && vertexBuffers[i]->GetDXUPResource() == resource)
+        dirtyVertexBuffers |= 1u << i;
+    }
+
+    if (indexBuffer != nullptr && indexBuffer->GetDXUPResource() == resource)
+      dirtyFlags |= dirtyFlags::indexBuffer;
+  }
+
+  namespace {
+    struct DirtyHeader {
+      uint32_t flags;
+      uint32_t samplers;
+      uint32_t textures;
+      uint32_t vertexBuffers;
+      uint32_t renderTargets;
+      uint32_t untracked;
+      D3D9ConstantRanges vsConstants;
+      D3D9ConstantRanges psConstants;
+    };
+
+    template <typename T>
+    void writeDirty(uint8_t*& data, const T& value) {
+      std::memcpy(data, &value, sizeof(T));
+      data += sizeof(T);
+    }
+
+    template <typename T>
+    void readDirty(const uint8_t*& data, T& value) {
+      std::memcpy(&value, data, sizeof(T));
+      data += sizeof(T);
+    }
+
+    // The ref taken here is handed over to the worker's state by readObject.
+    template <typename T>
+    void writeObject(uint8_t*& data, const ComPrivate<T>& object) {
+      if (object != nullptr)
+        object->AddRefPrivate();
+
+      writeDirty(data, object.ptr());
+    }
+
+    template <typename T>
+    void readObject(const uint8_t*& data, ComPrivate<T>& object) {
+      T* ptr;
+      readDirty(data, ptr);
+
+      object = ptr;
+      if (ptr != nullptr)
+        ptr->ReleasePrivate();
+    }
+
+    template <typename T, size_t N>
+    size_t constantsSize(const std::array<T, N>&, const D3D9ConstantRange& range) {
+      return range.empty() ? 0 : sizeof(T) * (range.end - range.begin);
+    }
+
+    template <typename T, size_t N>
+    void writeConstants(uint8_t*& data, const std::array<T, N>& constants, const D3D9ConstantRange& range) {
+      const size_t size = constantsSize(constants, range);
+      if (size == 0)
+        return;
+
+      std::memcpy(data, &constants[range.begin], size);
+      data += size;
+    }
+
+    template <typename T, size_t N>
+    void readConstants(const uint8_t*& data, std::array<T, N>& constants, const D3D9ConstantRange& range, D3D9ConstantRange& dstRange) {
+      const size_t size = constantsSize(constants, range);
+      if (size == 0)
+        return;
+
+      std::memcpy(&constants[range.begin], data, size);
+      data += size;
+      dstRange.add(range.begin, range.end - range.begin);
+    }
+  }
+
+  size_t D3D9State::dirtySize() const {
+    size_t size = sizeof(DirtyHeader);
+
+    if (untrackedDirty)
+      size += sizeof(renderState) + sizeof(streamFreqs);
+
+    const uint32_t samplers = dirtySamplers | dirtyTextures;
+    for (uint32_t i = 0; i < samplerStates.size(); i++) {
+      if (samplers & (1u << i))
+        size += sizeof(samplerStates[i]);
+
+      if (dirtyTextures & (1u << i))
+        size += sizeof(IDirect3DBaseTexture9*);
+    }
+
+    for (uint32_t i = 0; i < vertexBuffers.size(); i++) {
+      if (dirtyVertexBuffers & (1u << i))
+        size += sizeof(Direct3DVertexBuffer9*) + sizeof(UINT) * 2;
+    }
+
+    for (uint32_t i = 0; i < renderTargets.size(); i++) {
+      if (dirtyRenderTargets & (1u << i))
+        size += sizeof(Direct3DSurface9*);
+    }
+
+    if (dirtyFlags & dirtyFlags::renderTargets)
+      size += sizeof(Direct3DSurface9*);
+
+    if (dirtyFlags & dirtyFlags::vertexShader)
+      size += sizeof(Direct3DVertexShader9*);
+
+    if (dirtyFlags & dirtyFlags::pixelShader)
+      size += sizeof(Direct3DPixelShader9*);
+
+    if (dirtyFlags & dirtyFlags::vertexDecl)
+      size += sizeof(Direct3DVertexDeclaration9*);
+
+    if (dirtyFlags & dirtyFlags::indexBuffer)
+      size += sizeof(Direct3DIndexBuffer9*);
+
+    if (dirtyFlags & dirtyFlags::viewport)
+      size += sizeof(viewport);
+
+    if (dirtyFlags & dirtyFlags::scissorRect)
+      size += sizeof(scissorRect);
+
+    size += constantsSize(vsConstants.floatConstants, vsDirtyConstants.floats);
+    size += constantsSize(vsConstants.intConstants, vsDirtyConstants.ints);
+    size += constantsSize(vsConstants.boolConstants, vsDirtyConstants.bools);
+    size += constantsSize(psConstants.floatConstants, psDirtyConstants.floats);
+    size += constantsSize(psConstants.intConstants, psDirtyConstants.ints);
+    size += constantsSize(psConstants.boolConstants, psDirtyConstants.bools);
+
+    return size;
+  }
+
+  void D3D9State::encodeDirty(uint8_t* data) {
+    DirtyHeader header;
+    header.flags = dirtyFlags;
+    header.samplers = dirtySamplers;
+    header.textures = dirtyTextures;
+    header.vertexBuffers = dirtyVertexBuffers;
+    header.renderTargets = dirtyRenderTargets;
+    header.untracked = untrackedDirty;
+    header.vsConstants = vsDirtyConstants;
+    header.psConstants = psDirtyConstants;
+    writeDirty(data, header);
+
+    if (untrackedDirty) {
+      writeDirty(data, renderState);
+      writeDirty(data, streamFreqs);
+    }
+
+    const uint32_t samplers = dirtySamplers | dirtyTextures;
+    for (uint32_t i = 0; i < samplerStates.size(); i++) {
+      if (samplers & (1u << i))
+        writeDirty(data, samplerStates[i]);
+
+      if (dirtyTextures & (1u << i)) {
+        if (textures[i] != nullptr)
+          addTextureRef(textures[i]);
+
+        writeDirty(data, textures[i]);
+      }
+    }
+
+    for (uint32_t i = 0; i < vertexBuffers.size(); i++) {
+      if (!(dirtyVertexBuffers & (1u << i)))
+        continue;
+
+      writeObject(data, vertexBuffers[i]);
+      writeDirty(data, vertexOffsets[i]);
+      writeDirty(data, vertexStrides[i]);
+    }
+
+    for (uint32_t i = 0; i < renderTargets.size(); i++) {
+      if (dirtyRenderTargets & (1u << i))
+        writeObject(data, renderTargets[i]);
+    }
+
+    if (dirtyFlags & dirtyFlags::renderTargets)
+      writeObject(data, depthStencil);
+
+    if (dirtyFlags & dirtyFlags::vertexShader)
+      writeObject(data, vertexShader);
+
+    if (dirtyFlags & dirtyFlags::pixelShader)
+      writeObject(data, pixelShader);
+
+    if (dirtyFlags & dirtyFlags::vertexDecl)
+      writeObject(data, vertexDecl);
+
+    if (dirtyFlags & dirtyFlags::indexBuffer)
+      writeObject(data, indexBuffer);
+
+    if (dirtyFlags & dirtyFlags::viewport)
+      writeDirty(data, viewport);
+
+    if (dirtyFlags & dirtyFlags::scissorRect)
+      writeDirty(data, scissorRect);
+
+    writeConstants(data, vsConstants.floatConstants, vsDirtyConstants.floats);
+    writeConstants(data, vsConstants.intConstants, vsDirtyConstants.ints);
+    writeConstants(data, vsConstants.boolConstants, vsDirtyConstants.bools);
+    writeConstants(data, psConstants.floatConstants, psDirtyConstants.floats);
+    writeConstants(data, psConstants.intConstants, psDirtyConstants.ints);
+    writeConstants(data, psConstants.boolConstants, psDirtyConstants.bools);
+
+    dirtyFlags = 0;
+    dirtySamplers = 0;
+    dirtyTextures = 0;
+    dirtyVertexBuffers = 0;
+    dirtyRenderTargets = 0;
+    untrackedDirty = false;
+    vsDirtyConstants = D3D9ConstantRanges();
+    psDirtyConstants = D3D9ConstantRanges();
+  }
+
+  void D3D9State::decodeDirty(const uint8_t* data) {
+    DirtyHeader header;
+    readDirty(data, header);
+
+    if (header.untracked) {
+      readDirty(data, renderState);
+      readDirty(data, streamFreqs);
+    }
+
+    const uint32_t samplers = header.samplers | header.textures;
+    for (uint32_t i = 0; i < samplerStates.size(); i++) {
+      if (samplers & (1u << i))
+        readDirty(data, samplerStates[i]);
+
+      if (header.textures & (1u << i)) {
+        IDirect3DBaseTexture9* texture;
+        readDirty(data, texture);
+
+        bindTexture(i, texture);
+        if (texture != nullptr)
+          releaseTextureRef(texture);
+      }
+    }
+
+    for (uint32_t i = 0; i < vertexBuffers.size(); i++) {
+      if (!(header.vertexBuffers & (1u << i)))
+        continue;
+
+      readObject(data, vertexBuffers[i]);
+      readDirty(data, vertexOffsets[i]);
+      readDirty(data, vertexStrides[i]);
+    }
+
+    for (uint32_t i = 0; i < renderTargets.size(); i++) {
+      if (header.renderTargets & (1u << i))
+        readObject(data, renderTargets[i]);
+    }
+
+    if (header.flags & dirtyFlags::renderTargets)
+      readObject(data, depthStencil);
+
+    if (header.flags & dirtyFlags::vertexShader)
+      readObject(data, vertexShader);
+
+    if (header.flags & dirtyFlags::pixelShader)
+      readObject(data, pixelShader);
+
+    if (header.flags & dirtyFlags::vertexDecl)
+      readObject(data, vertexDecl);
+
+    if (header.flags & dirtyFlags::indexBuffer)
+      readObject(data, indexBuffer);
+
+    if (header.flags & dirtyFlags::viewport)
+      readDirty(data, viewport);
+
+    if (header.flags & dirtyFlags::scissorRect)
+      readDirty(data, scissorRect);
+
+    readConstants(data, vsConstants.floatConstants, header.vsConstants.floats, vsDirtyConstants.floats);
+    readConstants(data, vsConstants.intConstants, header.vsConstants.ints, vsDirtyConstants.ints);
+    readConstants(data, vsConstants.boolConstants, header.vsConstants.bools, vsDirtyConstants.bools);
+    readConstants(data, psConstants.floatConstants, header.psConstants.floats, psDirtyConstants.floats);
+    readConstants(data, psConstants.intConstants, header.psConstants.ints, psDirtyConstants.ints);
+    readConstants(data, psConstants.boolConstants, header.psConstants.bools, psDirtyConstants.bools);
+
+    dirtyFlags |= header.flags;
+    dirtySamplers |= header.samplers;
+    dirtyTextures |= header.textures;
+    dirtyVertexBuffers |= header.vertexBuffers;
+    dirtyRenderTargets |= header.renderTargets;
+    untrackedDirty |= header.untracked != 0;
+  }
+
   //
 
   void D3D9State::captureRenderState(D3DRENDERSTATETYPE state, bool recapture) {
@@ -995,6 +1449,10 @@ namespace dxup {
       UINT stride;
       m_device->GetStreamSource(i, &tempBuffer, &offset, &stride);
       SetStreamSource(i, tempBuffer.ptr(), offset, stride);
+
+      UINT setting;
+      m_device->GetStreamSourceFreq(i, &setting);
+      SetStreamSourceFreq(i, setting);
     }
   }
 
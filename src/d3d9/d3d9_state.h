@@ -18,18 +18,44 @@ namespace dxup {
     const uint32_t depthStencilState = 1 << 4;
     const uint32_t rasterizer = 1 << 5;
     const uint32_t blendState = 1 << 6;
-    const uint32_t textures = 1 << 7;
     const uint32_t vsConstants = 1 << 8;
     const uint32_t psConstants = 1 << 9;
-    const uint32_t vertexBuffers = 1 << 10;
     const uint32_t indexBuffer = 1 << 11;
     const uint32_t scissorRect = 1 << 12;
     const uint32_t viewport = 1 << 13;
   }
 
+  namespace stateSetters {
+    enum : uint32_t {
+      renderState,
+      textureStageState,
+      samplerState,
+      texture,
+      renderTarget,
+      depthStencil,
+      vertexDecl,
+      vertexShader,
+      pixelShader,
+      streamSource,
+      streamSourceFreq,
+      indices,
+      scissorRect,
+      viewport,
+      vertexShaderConstantF,
+      vertexShaderConstantI,
+      vertexShaderConstantB,
+      pixelShaderConstantF,
+      pixelShaderConstantI,
+      pixelShaderConstantB,
+
+      count
+    };
+  }
+
   class D3D9State {
   public:
     D3D9State(Direct3DDevice9Ex* device, uint32_t stateBlockType);
+    ~D3D9State();
 
     HRESULT GetTexture(DWORD Stage, IDirect3DBaseTexture9** ppTexture);
     HRESULT SetTexture(DWORD Stage, IDirect3DBaseTexture9* pTexture);
@@ -67,6 +93,9 @@ namespace dxup {
     HRESULT GetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9** ppStreamData, UINT* pOffsetInBytes, UINT* pStride);
     HRESULT SetStreamSource(UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride);
 
+    HRESULT GetStreamSourceFreq(UINT StreamNumber, UINT* pSetting);
+    HRESULT SetStreamSourceFreq(UINT StreamNumber, UINT Setting);
+
     HRESULT GetIndices(IDirect3DIndexBuffer9** ppIndexData);
     HRESULT SetIndices(IDirect3DIndexBuffer9* pIndexData);
 
@@ -91,13 +120,73 @@ namespace dxup {
     void capture(uint32_t stateBlockType, bool recapture);
     void apply();
 
+    void logSetStats();
+
+    // Hands what's dirty to the command stream's worker, written into the stream rather than a whole state.
+    // encodeDirty clears it here, the objects it writes keep a private ref until decodeDirty applies them to the worker's state.
+    size_t dirtySize() const;
+    void encodeDirty(uint8_t* data);
+    void decodeDirty(const uint8_t* data);
+
+    // Dirties any stream or index binding of the resource so the renderer picks up its new D3D11 buffer.
+    void rebindBuffer(DXUPResource* resource);
+
+    bool hasDirty() const {
+      return dirtyFlags != 0 || dirtySamplers != 0 || dirtyTextures != 0 || dirtyVertexBuffers != 0 || dirtyRenderTargets != 0 || untrackedDirty;
+    }
+
   protected:
 
     friend class D3D9ImmediateRenderer;
 
+    // Counts the set and returns true if it changes nothing so the setter can bail before dirtying anything.
+    inline bool isRedundant(uint32_t setter, bool equal) {
+      if (equal)
+        setsFiltered[setter]++;
+      else
+        setsEffective[setter]++;
+
+      return equal;
+    }
+
+    // Swaps the texture in an internal sampler slot, textures are manually ref counted.
+    void bindTexture(uint32_t sampler, IDirect3DBaseTexture9* texture);
+
+    // Private refs on whichever texture type it really is, false if it's one we don't know.
+    static bool addTextureRef(IDirect3DBaseTexture9* texture);
+    static bool releaseTextureRef(IDirect3DBaseTexture9* texture);
+
+    template <typename T, size_t N>
+    static bool constantRangeValid(const std::array<T, N>& constants, UINT start, UINT count) {
+      return start < N && count <= N - start;
+    }
+
+    // Engines love re-setting the same matrices every draw, only copy and dirty what actually differs.
+    template <typename T, size_t N, typename J>
+    bool updateConstants(uint32_t setter, std::array<T, N>& constants, D3D9ConstantRange& dirty, UINT start, const J* data, UINT count) {
+      const size_t size = sizeof(T) * count;
+      if (isRedundant(setter, std::memcmp(&constants[start], data, size) == 0))
+        return false;
+
+      std::memcpy(&constants[start], data, size);
+      dirty.add(start, count);
+      return true;
+    }
+
+    std::array<uint64_t, stateSetters::count> setsFiltered;
+    std::array<uint64_t, stateSetters::count> setsEffective;
+
     uint32_t dirtyFlags;
     uint32_t dirtySamplers;
 
+    // Per-slot, textures are 16 PS + 4 VS like samplers.
+    uint32_t dirtyTextures;
+    uint32_t dirtyVertexBuffers;
+    uint32_t dirtyRenderTargets;
+
+    // Render states and stream frequencies the renderer reads without a dirty flag, the command stream still has to copy them.
+    bool untrackedDirty;
+
     // Replace this with bitvec sometime...
     std::array<bool, D3DRS_BLENDOPALPHA + 1> textureCaptured;
     // Manual COM
@@ -121,6 +210,9 @@ namespace dxup {
     std::array<UINT, 16> vertexOffsets;
     std::array<UINT, 16> vertexStrides;
 
+    // Raw D3DSTREAMSOURCE_* settings. The streams marked as instance data pick the input layout.
+    std::array<UINT, 16> streamFreqs;
+
     std::array<bool, D3DRS_BLENDOPALPHA + 1> renderStateCaptures;
     std::array<DWORD, D3DRS_BLENDOPALPHA + 1> renderState;
 
@@ -136,6 +228,9 @@ namespace dxup {
     D3D9ShaderConstants vsConstants;
     D3D9ShaderConstants psConstants;
 
+    D3D9ConstantRanges vsDirtyConstants;
+    D3D9ConstantRanges psDirtyConstants;
+
     D3DVIEWPORT9 viewport;
     bool viewportCaptured = false;
 
@@ -101,10 +101,12 @@ namespace dxup {
       && a.AddressW == b.AddressW
       && a.MipLODBias == b.MipLODBias
       && a.MaxAnisotropy == b.MaxAnisotropy
+      && a.ComparisonFunc == b.ComparisonFunc
       && a.BorderColor[0] == b.BorderColor[0]
       && a.BorderColor[1] == b.BorderColor[1]
       && a.BorderColor[2] == b.BorderColor[2]
       && a.BorderColor[3] == b.BorderColor[3]
+      && a.MinLOD == b.MinLOD
       && a.MaxLOD == b.MaxLOD;
   }
 }
\ No newline at end of file
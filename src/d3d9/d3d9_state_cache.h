@@ -1,5 +1,7 @@
 #pragma once
 #include <vector>
+#include <cstdint>
+#include <unordered_map>
 #include <string>
 #include "d3d9_base.h"
 
@@ -25,34 +27,246 @@ namespace dxup {
     bool operator () (const D3D11_DEPTH_STENCIL_DESC& a, const D3D11_DEPTH_STENCIL_DESC& b) const;
   };
 
+  // Open addressing (linear probing) table of D3D11 state objects.
+  // Hits are verified against the full desc so a hash collision can't hand back the wrong state.
+  // D3D11 only allows 4096 unique state objects per type so we evict the least recently used past MaxObjects.
+  // Entries are threaded on a list by slot, most recently used first, so finding that one is just the tail.
   template <typename Desc, typename Object>
   class StateCache {
 
   public:
 
-    using StatePair = std::pair<size_t, Com<Object>>;
+    static constexpr uint32_t MaxObjects = 2048;
+    static constexpr uint32_t TableSize = MaxObjects * 2;
+
+    StateCache()
+      : m_entries( TableSize ) {}
     
     size_t hash(const Desc& desc) {
       static D3D11StateDescHash hasher;
       return hasher.operator()(desc);
     }
 
-    Object* lookupObject(size_t hash) {
-      for (const auto& obj : m_objects) {
-        if (obj.first == hash)
-          return obj.second.ptr();
+    Object* lookupObject(size_t hash, const Desc& desc) {
+      static D3D11StateDescEqual equal;
+
+      for (uint32_t i = slot(hash); m_entries[i].object != nullptr; i = next(i)) {
+        Entry& entry = m_entries[i];
+
+        if (entry.hash == hash && equal(entry.desc, desc)) {
+          if (m_head != i) {
+            unlink(i);
+            linkFront(i);
+          }
+          m_hits++;
+          return entry.object.ptr();
+        }
       }
+
+      m_misses++;
       return nullptr;
     }
 
     void pushState(size_t hash, const Desc& desc, Object* object) {
-      StatePair pair = StatePair{ hash, object };
-      m_objects.push_back(pair);
+      if (m_count >= MaxObjects)
+        evictLeastRecentlyUsed();
+
+      uint32_t i = slot(hash);
+      while (m_entries[i].object != nullptr)
+        i = next(i);
+
+      Entry& entry = m_entries[i];
+      entry.hash = hash;
+      entry.desc = desc;
+      entry.object = object;
+      linkFront(i);
+
+      m_count++;
+    }
+
+    uint32_t size() const { return m_count; }
+    uint64_t hits() const { return m_hits; }
+    uint64_t misses() const { return m_misses; }
+    uint64_t evictions() const { return m_evictions; }
+
+  private:
+
+    struct Entry {
+      size_t hash = 0;
+      Desc desc = {};
+      Com<Object> object;
+
+      // Neighbours on the usage list.
+      uint32_t prev = Nil;
+      uint32_t next = Nil;
+    };
+
+    static constexpr uint32_t Nil = UINT32_MAX;
+
+    static uint32_t slot(size_t hash) {
+      return uint32_t(hash) & (TableSize - 1);
+    }
+
+    static uint32_t next(uint32_t i) {
+      return (i + 1) & (TableSize - 1);
+    }
+
+    void linkFront(uint32_t i) {
+      m_entries[i].prev = Nil;
+      m_entries[i].next = m_head;
+
+      if (m_head != Nil)
+        m_entries[m_head].prev = i;
+      else
+        m_tail = i;
+
+      m_head = i;
+    }
+
+    void unlink(uint32_t i) {
+      const Entry& entry = m_entries[i];
+
+      if (entry.prev != Nil)
+        m_entries[entry.prev].next = entry.next;
+      else
+        m_head = entry.next;
+
+      if (entry.next != Nil)
+        m_entries[entry.next].prev = entry.prev;
+      else
+        m_tail = entry.prev;
+    }
+
+    // An entry moved to slot i, its neighbours have to follow it there.
+    void relink(uint32_t i) {
+      const Entry& entry = m_entries[i];
+
+      if (entry.prev != Nil)
+        m_entries[entry.prev].next = i;
+      else
+        m_head = i;
+
+      if (entry.next != Nil)
+        m_entries[entry.next].prev = i;
+      else
+        m_tail = i;
+    }
+
+    void evictLeastRecentlyUsed() {
+      erase(m_tail);
+      m_evictions++;
+    }
+
+    // Backward shift deletion, keeps probe chains intact without tombstones.
+    void erase(uint32_t hole) {
+      unlink(hole);
+      m_entries[hole] = Entry{};
+
+      for (uint32_t i = next(hole); m_entries[i].object != nullptr; i = next(i)) {
+        uint32_t home = slot(m_entries[i].hash);
+
+        bool reachable = hole <= i
+          ? (hole < home && home <= i)
+          : (hole < home || home <= i);
+
+        if (reachable)
+          continue;
+
+        m_entries[hole] = std::move(m_entries[i]);
+        m_entries[i] = Entry{};
+        relink(hole);
+        hole = i;
+      }
+
+      m_count--;
+    }
+
+    std::vector<Entry> m_entries;
+    uint32_t m_count = 0;
+
+    uint32_t m_head = Nil;
+    uint32_t m_tail = Nil;
+
+    uint64_t m_hits = 0;
+    uint64_t m_misses = 0;
+    uint64_t m_evictions = 0;
+
+  };
+
+
+  // Compact key packed straight from the D3D9 render state / sampler state DWORDs.
+  // Equal keys must always produce equal D3D11 descs (the reverse doesn't matter).
+  struct D3D9StateKey {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    bool operator == (const D3D9StateKey& other) const { return lo == other.lo && hi == other.hi; }
+  };
+
+  struct D3D9StateKeyHash {
+    size_t operator () (const D3D9StateKey& key) const {
+      HashState state;
+      state.add(std::hash<uint64_t>{}(key.lo));
+      state.add(std::hash<uint64_t>{}(key.hi));
+      return state;
+    }
+  };
+
+  class D3D9StateKeyPacker {
+
+  public:
+
+    D3D9StateKeyPacker& push(uint64_t value, uint32_t bits) {
+      // Don't let a field straddle the two words.
+      if ((m_offset % 64) + bits > 64)
+        m_offset = (m_offset + 63) & ~63u;
+
+      uint64_t& word = m_offset < 64 ? m_key.lo : m_key.hi;
+      word |= (value & ((1ull << bits) - 1)) << (m_offset % 64);
+      m_offset += bits;
+
+      return *this;
+    }
+
+    const D3D9StateKey& key() const {
+      return m_key;
+    }
+
+  private:
+
+    D3D9StateKey m_key;
+    uint32_t m_offset = 0;
+
+  };
+
+  // Direct packed key -> object map that sits in front of a StateCache so we only build and hash descs on a miss.
+  template <typename Object>
+  class StateKeyMap {
+
+  public:
+
+    // Keeps us (along with the StateCache) well under the 4096 state object limit.
+    static constexpr size_t MaxKeys = 1024;
+
+    Object* lookupObject(const D3D9StateKey& key) {
+      auto iter = m_objects.find(key);
+      if (iter == m_objects.end())
+        return nullptr;
+
+      return iter->second.ptr();
+    }
+
+    void pushState(const D3D9StateKey& key, Object* object) {
+      // Several keys can map to one object, just start over instead of tracking usage.
+      if (m_objects.size() >= MaxKeys)
+        m_objects.clear();
+
+      m_objects.emplace(key, object);
     }
 
   private:
 
-    std::vector<StatePair> m_objects;
+    std::unordered_map<D3D9StateKey, Com<Object>, D3D9StateKeyHash> m_objects;
 
   };
 
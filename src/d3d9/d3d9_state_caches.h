@@ -10,6 +10,11 @@ namespace dxup {
     StateCache<D3D11_BLEND_DESC1, ID3D11BlendState1> blendState;
     StateCache<D3D11_DEPTH_STENCIL_DESC, ID3D11DepthStencilState> depthStencil;
     StateCache<D3D11_SAMPLER_DESC, ID3D11SamplerState> sampler;
+
+    StateKeyMap<ID3D11RasterizerState1> rasterizerKeys;
+    StateKeyMap<ID3D11BlendState1> blendStateKeys;
+    StateKeyMap<ID3D11DepthStencilState> depthStencilKeys;
+    StateKeyMap<ID3D11SamplerState> samplerKeys;
   };
 
 }
\ No newline at end of file
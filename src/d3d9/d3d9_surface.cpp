@@ -48,11 +48,14 @@ namespace dxup {
       return log::d3derr(D3DERR_INVALIDCALL, "GetDesc: pDesc was nullptr.");
 
     D3D11_TEXTURE2D_DESC desc;
-    m_resource->GetResourceAs<ID3D11Texture2D>()->GetDesc(&desc);
+    desc.SampleDesc.Count = 1;
+    desc.SampleDesc.Quality = 0;
+    if (!m_resource->IsSystemMemory())
+      m_resource->GetResourceAs<ID3D11Texture2D>()->GetDesc(&desc);
 
     pDesc->Format = m_d3d9Desc.Format;
-    pDesc->Height = std::max(1u, desc.Height >> m_mip);
-    pDesc->Width = std::max(1u, desc.Width >> m_mip);
+    pDesc->Height = m_resource->GetHeight(m_mip);
+    pDesc->Width = m_resource->GetWidth(m_mip);
     pDesc->Pool = m_d3d9Desc.Pool;
     uint32_t sampleCount = desc.SampleDesc.Count;
     if (sampleCount == 1)
@@ -188,7 +191,7 @@ namespace dxup {
         log::warn("Failed to create SRGB render target for surface!");
     }
 
-    if (config::getBool(config::GDICompatible))
+    if (config::getBool(config::GDICompatible) && !resource->IsSystemMemory())
       resource->GetResource()->QueryInterface(__uuidof(IDXGISurface1), (void**)&m_surface);
   }
   bool Direct3DSurface9::isRectValid(const RECT* rect) {
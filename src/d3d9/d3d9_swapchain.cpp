@@ -280,6 +280,9 @@ namespace dxup {
     if (hDestWindowOverride != nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "PresentD3D11: called with window override. Not presenting.");
 
+    // Everything drawn so far has to be on the context before it gets presented.
+    this->GetD3D9Device()->FlushRenderer();
+
     if (m_rtRequired && !(d3d11Flags & DXGI_PRESENT_TEST))
       this->rtBlit();
 
@@ -332,6 +335,9 @@ namespace dxup {
         if (result == DXGI_ERROR_DEVICE_RESET)
           return D3DERR_DEVICELOST;
 
+        if (result == DXGI_STATUS_OCCLUDED)
+          return S_PRESENT_OCCLUDED;
+
       }
       else {
 
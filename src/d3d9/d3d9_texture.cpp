@@ -68,8 +68,15 @@ namespace dxup {
   }
 
   HRESULT STDMETHODCALLTYPE Direct3DTexture9::AddDirtyRect(const RECT* pDirtyRect) {
-    CriticalSection(this->GetD3D9Device());
-    log::stub("Direct3DTexture9::AddDirtyRect");
+    CriticalSection cs(this->GetD3D9Device());
+
+    if (pDirtyRect == nullptr) {
+      this->GetDXUPResource()->AddDirtyBox(0, nullptr);
+      return D3D_OK;
+    }
+
+    D3DBOX box = { UINT(pDirtyRect->left), UINT(pDirtyRect->top), UINT(pDirtyRect->right), UINT(pDirtyRect->bottom), 0, 1 };
+    this->GetDXUPResource()->AddDirtyBox(0, &box);
 
     return D3D_OK;
   }
@@ -99,6 +106,20 @@ namespace dxup {
     if (outTexture == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "Direct3DTexture9::Create: outTexture was nullptr.");
 
+    D3D9ResourceDesc d3d9Desc;
+    d3d9Desc.Format = format;
+    d3d9Desc.Pool = pool;
+    d3d9Desc.Usage = usage;
+
+    if (pool == D3DPOOL_SYSTEMMEM || pool == D3DPOOL_SCRATCH) {
+      DXUPResource* resource = DXUPResource::CreateSystemMemory(device, format, width, height, 1, 1, levels);
+      if (resource == nullptr)
+        return log::d3derr(D3DERR_OUTOFMEMORY, "Direct3DTexture9::Create: failed to allocate system memory texture.");
+
+      *outTexture = ref(new Direct3DTexture9(device, resource, d3d9Desc));
+      return D3D_OK;
+    }
+
     D3D11_USAGE d3d11Usage = convert::usage(pool, usage, D3DRTYPE_TEXTURE);
 
     D3D11_TEXTURE2D_DESC desc;
@@ -138,11 +159,6 @@ namespace dxup {
     if (resource == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "Direct3DTexture9::Create: failed to create DXUP resource.");
 
-    D3D9ResourceDesc d3d9Desc;
-    d3d9Desc.Format = format;
-    d3d9Desc.Pool = pool;
-    d3d9Desc.Usage = usage;
-
     *outTexture = ref(new Direct3DTexture9(device, resource, d3d9Desc));
 
     return D3D_OK;
@@ -222,8 +238,18 @@ namespace dxup {
   }
 
   HRESULT STDMETHODCALLTYPE Direct3DCubeTexture9::AddDirtyRect(D3DCUBEMAP_FACES FaceType, const RECT* pDirtyRect) {
-    CriticalSection(this->GetD3D9Device());
-    log::stub("Direct3DCubeTexture9::AddDirtyRect");
+    CriticalSection cs(this->GetD3D9Device());
+
+    if (UINT(FaceType) >= this->GetDXUPResource()->GetSlices())
+      return log::d3derr(D3DERR_INVALIDCALL, "AddDirtyRect: face out of bounds (FaceType = %d).", FaceType);
+
+    if (pDirtyRect == nullptr) {
+      this->GetDXUPResource()->AddDirtyBox(UINT(FaceType), nullptr);
+      return D3D_OK;
+    }
+
+    D3DBOX box = { UINT(pDirtyRect->left), UINT(pDirtyRect->top), UINT(pDirtyRect->right), UINT(pDirtyRect->bottom), 0, 1 };
+    this->GetDXUPResource()->AddDirtyBox(UINT(FaceType), &box);
 
     return D3D_OK;
   }
@@ -249,6 +275,20 @@ namespace dxup {
     if (outTexture == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "Direct3DCubeTexture9::Create: outTexture was nullptr.");
 
+    D3D9ResourceDesc d3d9Desc;
+    d3d9Desc.Format = format;
+    d3d9Desc.Pool = pool;
+    d3d9Desc.Usage = usage;
+
+    if (pool == D3DPOOL_SYSTEMMEM || pool == D3DPOOL_SCRATCH) {
+      DXUPResource* resource = DXUPResource::CreateSystemMemory(device, format, edgeLength, edgeLength, 1, 6, levels);
+      if (resource == nullptr)
+        return log::d3derr(D3DERR_OUTOFMEMORY, "Direct3DCubeTexture9::Create: failed to allocate system memory texture.");
+
+      *outTexture = ref(new Direct3DCubeTexture9(device, resource, d3d9Desc));
+      return D3D_OK;
+    }
+
     D3D11_USAGE d3d11Usage = convert::usage(pool, usage, D3DRTYPE_CUBETEXTURE);
 
     D3D11_TEXTURE2D_DESC desc;
@@ -286,11 +326,6 @@ namespace dxup {
     if (resource == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "Direct3DCubeTexture9::Create: failed to create DXUP resource.");
 
-    D3D9ResourceDesc d3d9Desc;
-    d3d9Desc.Format = format;
-    d3d9Desc.Pool = pool;
-    d3d9Desc.Usage = usage;
-
     *outTexture = ref(new Direct3DCubeTexture9(device, resource, d3d9Desc));
 
     return D3D_OK;
@@ -361,8 +396,9 @@ namespace dxup {
   }
 
   HRESULT STDMETHODCALLTYPE Direct3DVolumeTexture9::AddDirtyBox(const D3DBOX* pDirtyBox) {
-    CriticalSection(this->GetD3D9Device());
-    log::stub("Direct3DVolumeTexture9::AddDirtyRect");
+    CriticalSection cs(this->GetD3D9Device());
+
+    this->GetDXUPResource()->AddDirtyBox(0, pDirtyBox);
 
     return D3D_OK;
   }
@@ -393,6 +429,20 @@ namespace dxup {
     if (outTexture == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "Direct3DVolumeTexture9::Create: outTexture was nullptr.");
 
+    D3D9ResourceDesc d3d9Desc;
+    d3d9Desc.Format = format;
+    d3d9Desc.Pool = pool;
+    d3d9Desc.Usage = usage;
+
+    if (pool == D3DPOOL_SYSTEMMEM || pool == D3DPOOL_SCRATCH) {
+      DXUPResource* resource = DXUPResource::CreateSystemMemory(device, format, width, height, depth, 1, levels);
+      if (resource == nullptr)
+        return log::d3derr(D3DERR_OUTOFMEMORY, "Direct3DVolumeTexture9::Create: failed to allocate system memory texture.");
+
+      *outTexture = ref(new Direct3DVolumeTexture9(device, resource, d3d9Desc));
+      return D3D_OK;
+    }
+
     D3D11_USAGE d3d11Usage = convert::usage(pool, usage, D3DRTYPE_VOLUMETEXTURE);
 
     D3D11_TEXTURE3D_DESC desc;
@@ -422,11 +472,6 @@ namespace dxup {
     if (resource == nullptr)
       return log::d3derr(D3DERR_INVALIDCALL, "Direct3DVolumeTexture9::Create: failed to create DXUP resource.");
 
-    D3D9ResourceDesc d3d9Desc;
-    d3d9Desc.Format = format;
-    d3d9Desc.Pool = pool;
-    d3d9Desc.Usage = usage;
-
     *outTexture = ref(new Direct3DVolumeTexture9(device, resource, d3d9Desc));
 
     return D3D_OK;
@@ -35,9 +35,10 @@ namespace dxup {
     }
 
 
+    // Binding the texture does this anyway, asking just gets it done now.
     void STDMETHODCALLTYPE GenerateMipSubLevels() {
       if (this->GetDXUPResource()->GetSRV(false) != nullptr)
-        this->GetContext()->GenerateMips(this->GetDXUPResource()->GetSRV(false));
+        this->GetDXUPResource()->GenerateMipsIfStale(this->GetContext());
       else
         log::warn("GenerateMipSubLevels called on a texture with no SRV.");
     }
@@ -42,7 +42,7 @@ namespace dxup {
       { D3DFMT_R32F, DXGI_FORMAT_R32_FLOAT },
       { D3DFMT_L16, DXGI_FORMAT_R16_UNORM }, // Swizzle
       { D3DFMT_V8U8, DXGI_FORMAT_R8G8_SNORM },
-      { D3DFMT_L8, DXGI_FORMAT_R8_UNORM }, // Swizzle
+      { D3DFMT_L8, DXGI_FORMAT_B8G8R8X8_TYPELESS }, // Converted
 
       { D3DFMT_DXT1, DXGI_FORMAT_BC1_TYPELESS },
       { D3DFMT_DXT2, DXGI_FORMAT_BC2_TYPELESS },
@@ -77,6 +77,15 @@ namespace dxup {
       { D3DFMT_R8G8B8, DXGI_FORMAT_B8G8R8X8_UNORM },
       { D3DFMT_R8G8B8, DXGI_FORMAT_B8G8R8X8_UNORM_SRGB },
 
+      // No DXGI equivalents, these are converted to 8888 on upload.
+      { D3DFMT_X4R4G4B4, DXGI_FORMAT_B8G8R8X8_TYPELESS },
+      { D3DFMT_R3G3B2, DXGI_FORMAT_B8G8R8X8_TYPELESS },
+      { D3DFMT_A8L8, DXGI_FORMAT_B8G8R8A8_TYPELESS },
+      { D3DFMT_A4L4, DXGI_FORMAT_B8G8R8A8_TYPELESS },
+      { D3DFMT_A8R3G3B2, DXGI_FORMAT_B8G8R8A8_TYPELESS },
+      { D3DFMT_P8, DXGI_FORMAT_B8G8R8A8_TYPELESS },
+      { D3DFMT_L6V5U5, DXGI_FORMAT_R8G8B8A8_SNORM },
+
       { D3DFMT_D15S1, DXGI_FORMAT_D24_UNORM_S8_UINT },
       { D3DFMT_D24S8, DXGI_FORMAT_D24_UNORM_S8_UINT },
       { D3DFMT_D24X8, DXGI_FORMAT_D24_UNORM_S8_UINT },
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "d3d9_includes.h"
+#include "d3d9_format_convert.h"
 #include "../util/log.h"
 #include "../util/shared_conversions.h"
 
@@ -175,7 +176,7 @@ namespace dxup {
   template <typename T>
   void makeStagingDesc(T& desc, UINT d3d9Usage, D3DFORMAT format) {
     desc.CPUAccessFlags = d3d9Usage & D3DUSAGE_WRITEONLY ? D3D11_CPU_ACCESS_WRITE : D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
-    if (format == D3DFMT_R8G8B8)
+    if (needsConversion(format))
       desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ | D3D11_CPU_ACCESS_WRITE;
     desc.Usage = D3D11_USAGE_STAGING;
     desc.BindFlags = 0;
@@ -48,8 +48,53 @@ namespace dxup {
       return m_d3d11Descs;
     }
 
+    // Same layout but with the elements of every stream in instanceStreams stepping per instance.
+    // stepRates holds the divisor for each stream, apps only ever use a handful of combinations so keep them all.
+    // variant identifies the result for input layout caching, 0 is the plain per-vertex layout.
+    const std::vector<D3D11_INPUT_ELEMENT_DESC>& GetD3D11Descs(uint32_t instanceStreams, const UINT* stepRates, uint32_t* variant) {
+      *variant = 0;
+      if (instanceStreams == 0)
+        return m_d3d11Descs;
+
+      for (uint32_t i = 0; i < m_instancedDescs.size(); i++) {
+        InstancedDescs& instanced = m_instancedDescs[i];
+        if (instanced.instanceStreams != instanceStreams)
+          continue;
+
+        bool match = true;
+        for (const D3D11_INPUT_ELEMENT_DESC& desc : instanced.descs) {
+          if (desc.InputSlotClass == D3D11_INPUT_PER_INSTANCE_DATA && desc.InstanceDataStepRate != stepRates[desc.InputSlot])
+            match = false;
+        }
+
+        if (match) {
+          *variant = i + 1;
+          return instanced.descs;
+        }
+      }
+
+      InstancedDescs instanced = { instanceStreams, m_d3d11Descs };
+      for (D3D11_INPUT_ELEMENT_DESC& desc : instanced.descs) {
+        if (instanceStreams & (1u << desc.InputSlot)) {
+          desc.InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+          desc.InstanceDataStepRate = stepRates[desc.InputSlot];
+        }
+      }
+
+      m_instancedDescs.push_back(std::move(instanced));
+      *variant = uint32_t(m_instancedDescs.size());
+      return m_instancedDescs.back().descs;
+    }
+
   private:
+
+    struct InstancedDescs {
+      uint32_t instanceStreams;
+      std::vector<D3D11_INPUT_ELEMENT_DESC> descs;
+    };
+
     std::vector<D3D11_INPUT_ELEMENT_DESC> m_d3d11Descs;
+    std::vector<InstancedDescs> m_instancedDescs;
     std::vector<D3DVERTEXELEMENT9> m_d3d9Descs;
 
   };
@@ -45,13 +45,10 @@ namespace dxup {
     if (!pDesc)
       return log::d3derr(D3DERR_INVALIDCALL, "GetDesc: pDesc was nullptr.");
 
-    D3D11_TEXTURE3D_DESC desc;
-    m_resource->GetResourceAs<ID3D11Texture3D>()->GetDesc(&desc);
-
     pDesc->Format = m_d3d9Desc.Format;
-    pDesc->Height = std::max(1u, desc.Height >> m_mip);
-    pDesc->Width = std::max(1u, desc.Width >> m_mip);
-    pDesc->Depth = std::max(1u, desc.Depth >> m_mip);
+    pDesc->Height = m_resource->GetHeight(m_mip);
+    pDesc->Width = m_resource->GetWidth(m_mip);
+    pDesc->Depth = m_resource->GetDepth(m_mip);
     pDesc->Pool = m_d3d9Desc.Pool;
     pDesc->Type = D3DRTYPE_VOLUME;
     pDesc->Usage = m_d3d9Desc.Usage;
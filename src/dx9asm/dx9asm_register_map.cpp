@@ -114,9 +114,9 @@ namespace dxup {
         const uint32_t constantBufferIndex = 0;
         uint32_t constId = newMapping.dx9Id;
         if (regType == D3DSPR_CONSTINT)
-          constId += 256;
+          constId += intConstantRegister;
         else if (regType == D3DSPR_CONSTBOOL)
-          constId += 256 + 16;
+          constId = boolConstantRegister; // All bools share a register, dx9Id is the bit to test.
 
         uint32_t dataWithDummyId[2] = { constantBufferIndex, constId };
         newMapping.dxbcOperand.setData(dataWithDummyId, 2);
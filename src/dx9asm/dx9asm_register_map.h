@@ -8,6 +8,11 @@ namespace dxup {
 
     class ShaderCodeTranslator;
 
+    // Layout of dx9_constant_buffer: floats, then ints, then one register holding every bool as a bit in .x
+    const uint32_t intConstantRegister = 256;
+    const uint32_t boolConstantRegister = 256 + 16;
+    const uint32_t constantRegisterCount = boolConstantRegister + 1;
+
     struct TransientRegisterMapping {
       uint32_t dxbcRegNum;
 
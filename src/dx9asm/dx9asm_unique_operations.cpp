@@ -641,8 +641,35 @@ namespace dxup {
       const DX9Operand* src0 = operation.getOperandByType(optype::Src0);
       DXBCOperand src0Op = { *this, operation, *src0, 0 };
 
+      uint32_t test = D3D10_SB_INSTRUCTION_TEST_NONZERO;
+
+      if (src0->getRegType() == D3DSPR_CONSTBOOL) {
+        // Bools are packed into the .x of one register, mask out ours and test that.
+        const uint32_t selectX = ENCODE_D3D10_SB_OPERAND_4_COMPONENT_SELECTION_MODE(D3D10_SB_OPERAND_4_COMPONENT_SELECT_1_MODE) | ENCODE_D3D10_SB_OPERAND_4_COMPONENT_SELECT_1(D3D10_SB_4_COMPONENT_X);
+        const uint32_t bit = 1u << src0->getRegNumber();
+
+        if (src0->getModifier() == D3DSPSM_NOT)
+          test = D3D10_SB_INSTRUCTION_TEST_ZERO;
+
+        src0Op.stripModifier();
+        src0Op.setSwizzleOrWritemask(selectX);
+
+        DXBCOperand tempOpSrc = getRegisterMap().getNextInternalTemp();
+        DXBCOperand tempOpDst = tempOpSrc;
+        tempOpSrc.setSwizzleOrWritemask(selectX);
+        tempOpDst.setSwizzleOrWritemask(ENCODE_D3D10_SB_OPERAND_4_COMPONENT_SELECTION_MODE(D3D10_SB_OPERAND_4_COMPONENT_MASK_MODE) | D3D10_SB_OPERAND_4_COMPONENT_MASK_X);
+
+        DXBCOperation{ D3D10_SB_OPCODE_AND, false }
+          .appendOperand(tempOpDst)
+          .appendOperand(src0Op)
+          .appendOperand(DXBCOperand{ bit, bit, bit, bit })
+          .push(*this);
+
+        src0Op = tempOpSrc;
+      }
+
       DXBCOperation{ D3D10_SB_OPCODE_IF, false }
-        .setExtra(ENCODE_D3D10_SB_INSTRUCTION_TEST_BOOLEAN(D3D10_SB_INSTRUCTION_TEST_NONZERO))
+        .setExtra(ENCODE_D3D10_SB_INSTRUCTION_TEST_BOOLEAN(test))
         .appendOperand(src0Op)
         .push(*this);
 
@@ -34,7 +34,7 @@ namespace dxup {
     void forEachVariable(ShaderBytecode& bytecode, ShaderCodeTranslator& shdrCode, T func) {
       uint32_t num = 0;
       if (shdrCode.isIndirectMarked())
-        num = 256 + 16 + 16; // Do all 256 if we use indirect addressing.
+        num = constantRegisterCount; // Do all of them if we use indirect addressing.
       else
         num = shdrCode.getRegisterMap().getDXBCTypeCount(D3D10_SB_OPERAND_TYPE_CONSTANT_BUFFER);
 
@@ -261,7 +261,8 @@ namespace dxup {
           uint32_t intVecTypeOffset = this->getChunkSize(bytecode);
           pushObject(obj, variableType);
 
-          //variableType.columns = 1;
+          variableType.varType = D3D_SVT_UINT;
+          variableType.columns = 1;
 
           uint32_t boolTypeOffset = this->getChunkSize(bytecode);
           pushObject(obj, variableType);
@@ -275,19 +276,19 @@ namespace dxup {
             //info.defaultValueOffset = defaultValueOffset;
             info.defaultValueOffset = 0;
 
-            if (i < 256) {
+            if (i < intConstantRegister) {
               // float constants
               info.size = 4 * sizeof(float);
               info.typeOffset = floatTypeOffset;
             }
-            else if (i < 256 + 16) {
+            else if (i < boolConstantRegister) {
               // int constants
               info.size = 4 * sizeof(int);
               info.typeOffset = intVecTypeOffset;
             }
             else {
-              // bool constants
-              info.size = 4 * sizeof(int); //sizeof(int);
+              // bool constants, packed as bits
+              info.size = sizeof(uint32_t);
               info.typeOffset = boolTypeOffset;
             }
 
@@ -439,7 +440,7 @@ namespace dxup {
           uint32_t cbufferCount = 0;
 
           if (shdrCode.isIndirectMarked())
-            cbufferCount = 256 + 16;
+            cbufferCount = constantRegisterCount;
           else
             cbufferCount = shdrCode.getRegisterMap().getDXBCTypeCount(D3D10_SB_OPERAND_TYPE_CONSTANT_BUFFER);
 
@@ -63,6 +63,10 @@ namespace dxup {
           initVar(var::RefactoringAllowed, "DXUP_REFACTORINGALLOWED", "1");
           initVar(var::GDICompatible, "DXUP_GDI_COMPATIBLE", "0");
           initVar(var::RespectPrecision, "DXUP_RESPECT_PRECISION", "1");
+          initVar(var::Stats, "DXUP_STATS", "0");
+          initVar(var::CommandStream, "DXUP_CSTHREAD", "0");
+          initVar(var::StagingBudget, "DXUP_STAGING_BUDGET", "32"); // MB of idle staging textures kept around.
+          initVar(var::PromoteLockFrames, "DXUP_PROMOTE_LOCK_FRAMES", "8"); // Frames in a row a buffer gets locked before it's made dynamic, 0 never does.
 
           initVar(var::RespectVSync, "DXUP_RESPECT_VSYNC", "1");
           initVar(var::UseFakes, "DXUP_USEFAKES", "1");
@@ -20,6 +20,10 @@ namespace dxup {
       RefactoringAllowed,
       GDICompatible,
       RespectPrecision,
+      Stats,
+      CommandStream,
+      StagingBudget,
+      PromoteLockFrames,
 
       RespectVSync,
       UseFakes,
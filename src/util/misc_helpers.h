@@ -4,6 +4,11 @@
 #include <vector>
 #include <memory>
 #include <cstring>
+#include <cstdint>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
 
 namespace dxup {
 
@@ -66,4 +71,29 @@ namespace dxup {
     std::memcpy((void*)dst, (const void*)src, sizeof(J) * jCount);
   }
 
+  namespace bit {
+
+    // Undefined for 0, check first.
+    inline uint32_t lowest(uint32_t n) {
+#if defined(_MSC_VER) && !defined(__clang__)
+      unsigned long index;
+      _BitScanForward(&index, n);
+      return index;
+#else
+      return __builtin_ctz(n);
+#endif
+    }
+
+    inline uint32_t highest(uint32_t n) {
+#if defined(_MSC_VER) && !defined(__clang__)
+      unsigned long index;
+      _BitScanReverse(&index, n);
+      return index;
+#else
+      return 31 - __builtin_clz(n);
+#endif
+    }
+
+  }
+
 }
\ No newline at end of file
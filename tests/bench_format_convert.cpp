@@ -0,0 +1,91 @@
+#include "../src/d3d9/d3d9_format_convert.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace dxup;
+
+namespace {
+
+  constexpr UINT Width = 1024;
+  constexpr UINT Height = 1024;
+  constexpr uint32_t Iterations = 32;
+
+  struct Format {
+    D3DFORMAT format;
+    const char* name;
+  };
+
+  const Format Formats[] = {
+    { D3DFMT_R8G8B8, "R8G8B8" },
+    { D3DFMT_L8, "L8" },
+    { D3DFMT_A8L8, "A8L8" },
+    { D3DFMT_A4L4, "A4L4" },
+    { D3DFMT_X4R4G4B4, "X4R4G4B4" },
+    { D3DFMT_R3G3B2, "R3G3B2" },
+    { D3DFMT_A8R3G3B2, "A8R3G3B2" },
+    { D3DFMT_P8, "P8" },
+    { D3DFMT_L6V5U5, "L6V5U5" }
+  };
+
+  // Megapixels a second, best of Iterations so a stray context switch doesn't count.
+  template <typename Fn>
+  double measure(Fn fn) {
+    double best = 0.0;
+    for (uint32_t i = 0; i < Iterations; i++) {
+      auto start = std::chrono::steady_clock::now();
+      fn();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      best = std::max(best, (double(Width) * Height / 1e6) / elapsed.count());
+    }
+    return best;
+  }
+
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::vector<uint8_t> src(Width * Height * 4);
+  for (uint8_t& byte : src)
+    byte = uint8_t(rng());
+
+  std::vector<uint8_t> dst(Width * Height * 4);
+
+  std::array<PALETTEENTRY, 256> palette;
+  for (uint32_t i = 0; i < 256; i++)
+    palette[i] = PALETTEENTRY{ BYTE(i), BYTE(i), BYTE(i), 0xFF };
+
+  // What an 8888 texture DXGI takes as is would cost to upload.
+  double copy = measure([&]() {
+    std::memcpy(dst.data(), src.data(), dst.size());
+  });
+
+  std::printf("%ux%u, megapixels per second\n", Width, Height);
+  std::printf("%-10s %10s %10s %10s\n", "format", "simd", "scalar", "memcpy %");
+
+  for (const Format& format : Formats) {
+    UINT srcPitch = Width * conversionBitsPerPixel(format.format) / 8;
+    const PALETTEENTRY* pal = format.format == D3DFMT_P8 ? palette.data() : nullptr;
+
+    auto convert = [&]() {
+      convertPixels(format.format, pal, dst.data(), Width * 4, Width * Height * 4, src.data(), srcPitch, srcPitch * Height, Width, Height, 1);
+    };
+
+    forceScalarConversion(false);
+    double simd = measure(convert);
+
+    forceScalarConversion(true);
+    double scalar = measure(convert);
+
+    std::printf("%-10s %10.0f %10.0f %9.0f%%\n", format.name, simd, scalar, simd / copy * 100.0);
+  }
+
+  forceScalarConversion(false);
+  return 0;
+}
@@ -0,0 +1,1062 @@
+#pragma once
+
+#include "../src/d3d9/d3d9_base.h"
+#include <vector>
+#include <string>
+#include <cstring>
+
+namespace dxup {
+
+  namespace test {
+
+    // Device children only have to exist and be told apart, the ones tests look into keep what they were made with.
+    template <typename Base>
+    class MockDeviceChild : public Unknown<Base> {
+
+    public:
+
+      MockDeviceChild(ID3D11Device* device)
+        : m_device{ device } {}
+
+      HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        InitReturnPtr(ppv);
+
+        if (ppv == nullptr)
+          return E_POINTER;
+
+        if (riid == __uuidof(Base) || riid == __uuidof(IUnknown)) {
+          *ppv = ref(this);
+          return S_OK;
+        }
+
+        return E_NOINTERFACE;
+      }
+
+      void STDMETHODCALLTYPE GetDevice(ID3D11Device** ppDevice) override {
+        *ppDevice = ref(m_device);
+      }
+
+      HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) override {
+        return DXGI_ERROR_NOT_FOUND;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) override {
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) override {
+        return S_OK;
+      }
+
+    private:
+
+      ID3D11Device* m_device;
+
+    };
+
+    // Backed by plain memory so maps and updates can be read back.
+    class MockBuffer final : public MockDeviceChild<ID3D11Buffer> {
+
+    public:
+
+      MockBuffer(ID3D11Device* device, const D3D11_BUFFER_DESC& desc, const D3D11_SUBRESOURCE_DATA* initialData)
+        : MockDeviceChild<ID3D11Buffer>{ device }
+        , m_desc{ desc }
+        , m_data( desc.ByteWidth ) {
+        if (initialData != nullptr)
+          std::memcpy(m_data.data(), initialData->pSysMem, desc.ByteWidth);
+      }
+
+      void STDMETHODCALLTYPE GetType(D3D11_RESOURCE_DIMENSION* pResourceDimension) override {
+        *pResourceDimension = D3D11_RESOURCE_DIMENSION_BUFFER;
+      }
+
+      void STDMETHODCALLTYPE SetEvictionPriority(UINT EvictionPriority) override {}
+
+      UINT STDMETHODCALLTYPE GetEvictionPriority() override {
+        return 0;
+      }
+
+      void STDMETHODCALLTYPE GetDesc(D3D11_BUFFER_DESC* pDesc) override {
+        *pDesc = m_desc;
+      }
+
+      uint8_t* data() {
+        return m_data.data();
+      }
+
+    private:
+
+      D3D11_BUFFER_DESC m_desc;
+      std::vector<uint8_t> m_data;
+
+    };
+
+    // Only its description, nothing maps or copies textures.
+    class MockTexture2D final : public MockDeviceChild<ID3D11Texture2D> {
+
+    public:
+
+      MockTexture2D(ID3D11Device* device, const D3D11_TEXTURE2D_DESC& desc)
+        : MockDeviceChild<ID3D11Texture2D>{ device }
+        , m_desc{ desc } {}
+
+      void STDMETHODCALLTYPE GetType(D3D11_RESOURCE_DIMENSION* pResourceDimension) override {
+        *pResourceDimension = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+      }
+
+      void STDMETHODCALLTYPE SetEvictionPriority(UINT EvictionPriority) override {}
+
+      UINT STDMETHODCALLTYPE GetEvictionPriority() override {
+        return 0;
+      }
+
+      void STDMETHODCALLTYPE GetDesc(D3D11_TEXTURE2D_DESC* pDesc) override {
+        *pDesc = m_desc;
+      }
+
+    private:
+
+      D3D11_TEXTURE2D_DESC m_desc;
+
+    };
+
+    // Passes once the mock GPU catches up with it, see MockContext::finishGpuWork.
+    class MockQuery final : public MockDeviceChild<ID3D11Query> {
+
+    public:
+
+      MockQuery(ID3D11Device* device, const D3D11_QUERY_DESC& desc)
+        : MockDeviceChild<ID3D11Query>{ device }
+        , m_desc{ desc } {}
+
+      UINT STDMETHODCALLTYPE GetDataSize() override {
+        return 0;
+      }
+
+      void STDMETHODCALLTYPE GetDesc(D3D11_QUERY_DESC* pDesc) override {
+        *pDesc = m_desc;
+      }
+
+      bool signaled = false;
+
+    private:
+
+      D3D11_QUERY_DESC m_desc;
+
+    };
+
+    class MockInputLayout final : public MockDeviceChild<ID3D11InputLayout> {
+
+    public:
+
+      MockInputLayout(ID3D11Device* device, const D3D11_INPUT_ELEMENT_DESC* elements, UINT count)
+        : MockDeviceChild<ID3D11InputLayout>{ device }
+        , m_elements{ elements, elements + count } {
+        for (D3D11_INPUT_ELEMENT_DESC& element : m_elements)
+          m_semanticNames.push_back(element.SemanticName);
+
+        // The caller's names don't have to outlive the call.
+        for (uint32_t i = 0; i < m_elements.size(); i++)
+          m_elements[i].SemanticName = m_semanticNames[i].c_str();
+      }
+
+      const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements() const {
+        return m_elements;
+      }
+
+    private:
+
+      std::vector<D3D11_INPUT_ELEMENT_DESC> m_elements;
+      std::vector<std::string> m_semanticNames;
+
+    };
+
+    template <typename Base, typename Desc>
+    class MockState final : public MockDeviceChild<Base> {
+
+    public:
+
+      MockState(ID3D11Device* device, const Desc& desc)
+        : MockDeviceChild<Base>{ device }
+        , m_desc{ desc } {}
+
+      void STDMETHODCALLTYPE GetDesc(Desc* pDesc) override {
+        *pDesc = m_desc;
+      }
+
+      const Desc& desc() const {
+        return m_desc;
+      }
+
+    private:
+
+      Desc m_desc;
+
+    };
+
+    using MockSamplerState = MockState<ID3D11SamplerState, D3D11_SAMPLER_DESC>;
+    using MockDepthStencilState = MockState<ID3D11DepthStencilState, D3D11_DEPTH_STENCIL_DESC>;
+
+    class MockBlendState final : public MockDeviceChild<ID3D11BlendState1> {
+
+    public:
+
+      MockBlendState(ID3D11Device* device, const D3D11_BLEND_DESC1& desc)
+        : MockDeviceChild<ID3D11BlendState1>{ device }
+        , m_desc{ desc } {}
+
+      void STDMETHODCALLTYPE GetDesc(D3D11_BLEND_DESC* pDesc) override {
+        pDesc->AlphaToCoverageEnable = m_desc.AlphaToCoverageEnable;
+        pDesc->IndependentBlendEnable = m_desc.IndependentBlendEnable;
+
+        for (uint32_t i = 0; i < 8; i++) {
+          const D3D11_RENDER_TARGET_BLEND_DESC1& src = m_desc.RenderTarget[i];
+          D3D11_RENDER_TARGET_BLEND_DESC& dst = pDesc->RenderTarget[i];
+
+          dst.BlendEnable = src.BlendEnable;
+          dst.SrcBlend = src.SrcBlend;
+          dst.DestBlend = src.DestBlend;
+          dst.BlendOp = src.BlendOp;
+          dst.SrcBlendAlpha = src.SrcBlendAlpha;
+          dst.DestBlendAlpha = src.DestBlendAlpha;
+          dst.BlendOpAlpha = src.BlendOpAlpha;
+          dst.RenderTargetWriteMask = src.RenderTargetWriteMask;
+        }
+      }
+
+      void STDMETHODCALLTYPE GetDesc1(D3D11_BLEND_DESC1* pDesc) override {
+        *pDesc = m_desc;
+      }
+
+    private:
+
+      D3D11_BLEND_DESC1 m_desc;
+
+    };
+
+    class MockRasterizerState final : public MockDeviceChild<ID3D11RasterizerState1> {
+
+    public:
+
+      MockRasterizerState(ID3D11Device* device, const D3D11_RASTERIZER_DESC1& desc)
+        : MockDeviceChild<ID3D11RasterizerState1>{ device }
+        , m_desc{ desc } {}
+
+      void STDMETHODCALLTYPE GetDesc(D3D11_RASTERIZER_DESC* pDesc) override {
+        pDesc->FillMode = m_desc.FillMode;
+        pDesc->CullMode = m_desc.CullMode;
+        pDesc->FrontCounterClockwise = m_desc.FrontCounterClockwise;
+        pDesc->DepthBias = m_desc.DepthBias;
+        pDesc->DepthBiasClamp = m_desc.DepthBiasClamp;
+        pDesc->SlopeScaledDepthBias = m_desc.SlopeScaledDepthBias;
+        pDesc->DepthClipEnable = m_desc.DepthClipEnable;
+        pDesc->ScissorEnable = m_desc.ScissorEnable;
+        pDesc->MultisampleEnable = m_desc.MultisampleEnable;
+        pDesc->AntialiasedLineEnable = m_desc.AntialiasedLineEnable;
+      }
+
+      void STDMETHODCALLTYPE GetDesc1(D3D11_RASTERIZER_DESC1* pDesc) override {
+        *pDesc = m_desc;
+      }
+
+    private:
+
+      D3D11_RASTERIZER_DESC1 m_desc;
+
+    };
+
+    using MockVertexShader = MockDeviceChild<ID3D11VertexShader>;
+    using MockPixelShader = MockDeviceChild<ID3D11PixelShader>;
+
+    // Lives on the stack of a test, so refs are counted but never free it.
+    class MockDevice final : public ID3D11Device1 {
+
+    public:
+
+      HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        InitReturnPtr(ppv);
+
+        if (ppv == nullptr)
+          return E_POINTER;
+
+        if (riid == __uuidof(ID3D11Device1) || riid == __uuidof(ID3D11Device) || riid == __uuidof(IUnknown)) {
+          *ppv = ref(this);
+          return S_OK;
+        }
+
+        return E_NOINTERFACE;
+      }
+
+      ULONG STDMETHODCALLTYPE AddRef() override {
+        return ++m_refCount;
+      }
+
+      ULONG STDMETHODCALLTYPE Release() override {
+        return --m_refCount;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateBuffer(const D3D11_BUFFER_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData, ID3D11Buffer** ppBuffer) override {
+        buffersCreated++;
+        *ppBuffer = ref(new MockBuffer(this, *pDesc, pInitialData));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateTexture1D(const D3D11_TEXTURE1D_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData, ID3D11Texture1D** ppTexture1D) override {
+        InitReturnPtr(ppTexture1D);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateTexture2D(const D3D11_TEXTURE2D_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData, ID3D11Texture2D** ppTexture2D) override {
+        texturesCreated++;
+        *ppTexture2D = ref(new MockTexture2D(this, *pDesc));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateTexture3D(const D3D11_TEXTURE3D_DESC* pDesc, const D3D11_SUBRESOURCE_DATA* pInitialData, ID3D11Texture3D** ppTexture3D) override {
+        InitReturnPtr(ppTexture3D);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateShaderResourceView(ID3D11Resource* pResource, const D3D11_SHADER_RESOURCE_VIEW_DESC* pDesc, ID3D11ShaderResourceView** ppSRView) override {
+        InitReturnPtr(ppSRView);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateUnorderedAccessView(ID3D11Resource* pResource, const D3D11_UNORDERED_ACCESS_VIEW_DESC* pDesc, ID3D11UnorderedAccessView** ppUAView) override {
+        InitReturnPtr(ppUAView);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateRenderTargetView(ID3D11Resource* pResource, const D3D11_RENDER_TARGET_VIEW_DESC* pDesc, ID3D11RenderTargetView** ppRTView) override {
+        InitReturnPtr(ppRTView);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateDepthStencilView(ID3D11Resource* pResource, const D3D11_DEPTH_STENCIL_VIEW_DESC* pDesc, ID3D11DepthStencilView** ppDepthStencilView) override {
+        InitReturnPtr(ppDepthStencilView);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* pInputElementDescs, UINT NumElements, const void* pShaderBytecodeWithInputSignature, SIZE_T BytecodeLength, ID3D11InputLayout** ppInputLayout) override {
+        MockInputLayout* layout = new MockInputLayout(this, pInputElementDescs, NumElements);
+        inputLayouts.push_back(layout);
+        *ppInputLayout = ref(layout);
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateVertexShader(const void* pShaderBytecode, SIZE_T BytecodeLength, ID3D11ClassLinkage* pClassLinkage, ID3D11VertexShader** ppVertexShader) override {
+        *ppVertexShader = ref(new MockVertexShader(this));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateGeometryShader(const void* pShaderBytecode, SIZE_T BytecodeLength, ID3D11ClassLinkage* pClassLinkage, ID3D11GeometryShader** ppGeometryShader) override {
+        InitReturnPtr(ppGeometryShader);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateGeometryShaderWithStreamOutput(const void* pShaderBytecode, SIZE_T BytecodeLength, const D3D11_SO_DECLARATION_ENTRY* pSODeclaration, UINT NumEntries, const UINT* pBufferStrides, UINT NumStrides, UINT RasterizedStream, ID3D11ClassLinkage* pClassLinkage, ID3D11GeometryShader** ppGeometryShader) override {
+        InitReturnPtr(ppGeometryShader);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreatePixelShader(const void* pShaderBytecode, SIZE_T BytecodeLength, ID3D11ClassLinkage* pClassLinkage, ID3D11PixelShader** ppPixelShader) override {
+        *ppPixelShader = ref(new MockPixelShader(this));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateHullShader(const void* pShaderBytecode, SIZE_T BytecodeLength, ID3D11ClassLinkage* pClassLinkage, ID3D11HullShader** ppHullShader) override {
+        InitReturnPtr(ppHullShader);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateDomainShader(const void* pShaderBytecode, SIZE_T BytecodeLength, ID3D11ClassLinkage* pClassLinkage, ID3D11DomainShader** ppDomainShader) override {
+        InitReturnPtr(ppDomainShader);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateComputeShader(const void* pShaderBytecode, SIZE_T BytecodeLength, ID3D11ClassLinkage* pClassLinkage, ID3D11ComputeShader** ppComputeShader) override {
+        InitReturnPtr(ppComputeShader);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateClassLinkage(ID3D11ClassLinkage** ppLinkage) override {
+        InitReturnPtr(ppLinkage);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateBlendState(const D3D11_BLEND_DESC* pBlendStateDesc, ID3D11BlendState** ppBlendState) override {
+        InitReturnPtr(ppBlendState);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* pDepthStencilDesc, ID3D11DepthStencilState** ppDepthStencilState) override {
+        statesCreated++;
+        *ppDepthStencilState = ref(new MockDepthStencilState(this, *pDepthStencilDesc));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateRasterizerState(const D3D11_RASTERIZER_DESC* pRasterizerDesc, ID3D11RasterizerState** ppRasterizerState) override {
+        InitReturnPtr(ppRasterizerState);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateSamplerState(const D3D11_SAMPLER_DESC* pSamplerDesc, ID3D11SamplerState** ppSamplerState) override {
+        statesCreated++;
+        *ppSamplerState = ref(new MockSamplerState(this, *pSamplerDesc));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateQuery(const D3D11_QUERY_DESC* pQueryDesc, ID3D11Query** ppQuery) override {
+        queriesCreated++;
+        *ppQuery = ref(new MockQuery(this, *pQueryDesc));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreatePredicate(const D3D11_QUERY_DESC* pPredicateDesc, ID3D11Predicate** ppPredicate) override {
+        InitReturnPtr(ppPredicate);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateCounter(const D3D11_COUNTER_DESC* pCounterDesc, ID3D11Counter** ppCounter) override {
+        InitReturnPtr(ppCounter);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateDeferredContext(UINT ContextFlags, ID3D11DeviceContext** ppDeferredContext) override {
+        InitReturnPtr(ppDeferredContext);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE OpenSharedResource(HANDLE hResource, REFIID ReturnedInterface, void** ppResource) override {
+        InitReturnPtr(ppResource);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CheckFormatSupport(DXGI_FORMAT Format, UINT* pFormatSupport) override {
+        *pFormatSupport = 0;
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CheckMultisampleQualityLevels(DXGI_FORMAT Format, UINT SampleCount, UINT* pNumQualityLevels) override {
+        *pNumQualityLevels = 0;
+        return E_NOTIMPL;
+      }
+
+      void STDMETHODCALLTYPE CheckCounterInfo(D3D11_COUNTER_INFO* pCounterInfo) override {
+        std::memset(pCounterInfo, 0, sizeof(*pCounterInfo));
+      }
+
+      HRESULT STDMETHODCALLTYPE CheckCounter(const D3D11_COUNTER_DESC* pDesc, D3D11_COUNTER_TYPE* pType, UINT* pActiveCounters, LPSTR szName, UINT* pNameLength, LPSTR szUnits, UINT* pUnitsLength, LPSTR szDescription, UINT* pDescriptionLength) override {
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CheckFeatureSupport(D3D11_FEATURE Feature, void* pFeatureSupportData, UINT FeatureSupportDataSize) override {
+        if (Feature != D3D11_FEATURE_D3D11_OPTIONS || FeatureSupportDataSize != sizeof(D3D11_FEATURE_DATA_D3D11_OPTIONS))
+          return E_INVALIDARG;
+
+        D3D11_FEATURE_DATA_D3D11_OPTIONS* options = reinterpret_cast<D3D11_FEATURE_DATA_D3D11_OPTIONS*>(pFeatureSupportData);
+        std::memset(options, 0, sizeof(*options));
+        options->ConstantBufferOffsetting = TRUE;
+        options->ConstantBufferPartialUpdate = partialConstantUpdates ? TRUE : FALSE;
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) override {
+        return DXGI_ERROR_NOT_FOUND;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) override {
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) override {
+        return S_OK;
+      }
+
+      D3D_FEATURE_LEVEL STDMETHODCALLTYPE GetFeatureLevel() override {
+        return D3D_FEATURE_LEVEL_11_1;
+      }
+
+      UINT STDMETHODCALLTYPE GetCreationFlags() override {
+        return 0;
+      }
+
+      HRESULT STDMETHODCALLTYPE GetDeviceRemovedReason() override {
+        return S_OK;
+      }
+
+      void STDMETHODCALLTYPE GetImmediateContext(ID3D11DeviceContext** ppImmediateContext) override {
+        *ppImmediateContext = nullptr;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetExceptionMode(UINT RaiseFlags) override {
+        return S_OK;
+      }
+
+      UINT STDMETHODCALLTYPE GetExceptionMode() override {
+        return 0;
+      }
+
+      void STDMETHODCALLTYPE GetImmediateContext1(ID3D11DeviceContext1** ppImmediateContext) override {
+        *ppImmediateContext = nullptr;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateDeferredContext1(UINT ContextFlags, ID3D11DeviceContext1** ppDeferredContext) override {
+        InitReturnPtr(ppDeferredContext);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateBlendState1(const D3D11_BLEND_DESC1* pBlendStateDesc, ID3D11BlendState1** ppBlendState) override {
+        statesCreated++;
+        *ppBlendState = ref(new MockBlendState(this, *pBlendStateDesc));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateRasterizerState1(const D3D11_RASTERIZER_DESC1* pRasterizerDesc, ID3D11RasterizerState1** ppRasterizerState) override {
+        statesCreated++;
+        *ppRasterizerState = ref(new MockRasterizerState(this, *pRasterizerDesc));
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE CreateDeviceContextState(UINT Flags, const D3D_FEATURE_LEVEL* pFeatureLevels, UINT FeatureLevels, UINT SDKVersion, REFIID EmulatedInterface, D3D_FEATURE_LEVEL* pChosenFeatureLevel, ID3DDeviceContextState** ppContextState) override {
+        InitReturnPtr(ppContextState);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE OpenSharedResource1(HANDLE hResource, REFIID returnedInterface, void** ppResource) override {
+        InitReturnPtr(ppResource);
+        return E_NOTIMPL;
+      }
+
+      HRESULT STDMETHODCALLTYPE OpenSharedResourceByName(LPCWSTR lpName, DWORD dwDesiredAccess, REFIID returnedInterface, void** ppResource) override {
+        InitReturnPtr(ppResource);
+        return E_NOTIMPL;
+      }
+
+      // Answer for D3D11_FEATURE_D3D11_OPTIONS.
+      bool partialConstantUpdates = true;
+
+      uint32_t buffersCreated = 0;
+      uint32_t texturesCreated = 0;
+      uint32_t queriesCreated = 0;
+      uint32_t statesCreated = 0;
+
+      // Every layout made, in order.
+      std::vector<Com<MockInputLayout>> inputLayouts;
+
+    private:
+
+      ULONG m_refCount = 1;
+
+    };
+
+    // Counts what reaches the context and keeps the arguments of the last call of each kind that tests look at.
+    // Everything else is accepted and dropped.
+    class MockContext final : public ID3D11DeviceContext1 {
+
+    public:
+
+      struct Calls {
+        uint32_t draw = 0;
+        uint32_t drawIndexed = 0;
+        uint32_t drawInstanced = 0;
+        uint32_t drawIndexedInstanced = 0;
+
+        uint32_t map = 0;
+        uint32_t mapDiscard = 0;
+        uint32_t mapNoOverwrite = 0;
+        uint32_t updateSubresource = 0;
+        uint64_t updateBytes = 0;
+
+        uint32_t setVertexBuffers = 0;
+        uint32_t setIndexBuffer = 0;
+        uint32_t setInputLayout = 0;
+        uint32_t setTopology = 0;
+        uint32_t setVertexShader = 0;
+        uint32_t setPixelShader = 0;
+        uint32_t setShaderResources[2] = {};
+        uint32_t setSamplers[2] = {};
+        uint32_t setConstantBuffers[2] = {};
+        uint32_t setRasterizerState = 0;
+        uint32_t setBlendState = 0;
+        uint32_t setDepthStencilState = 0;
+        uint32_t setRenderTargets = 0;
+        uint32_t setViewports = 0;
+        uint32_t setScissorRects = 0;
+
+        uint32_t end = 0;
+      };
+
+      struct SlotRange {
+        UINT start = 0;
+        UINT count = 0;
+      };
+
+      struct ConstantBufferBinding {
+        ID3D11Buffer* buffer = nullptr;
+        UINT firstConstant = 0;
+        UINT numConstants = 0;
+      };
+
+      struct DrawArgs {
+        UINT count = 0;
+        UINT instanceCount = 0;
+        UINT start = 0;
+        INT baseVertex = 0;
+        UINT startInstance = 0;
+      };
+
+      MockContext(ID3D11Device* device)
+        : m_device{ device } {}
+
+      // Everything the GPU was asked to do so far is done, fences that were ended pass.
+      void finishGpuWork() {
+        for (Com<MockQuery>& query : m_pendingQueries)
+          query->signaled = true;
+
+        m_pendingQueries.clear();
+      }
+
+      void resetCalls() {
+        calls = Calls();
+      }
+
+      Calls calls;
+
+      SlotRange lastShaderResources[2];
+      SlotRange lastSamplers[2];
+      SlotRange lastVertexBuffers;
+      ConstantBufferBinding lastConstantBuffer[2];
+      DrawArgs lastDraw;
+
+      std::vector<ID3D11Buffer*> vertexBuffers = std::vector<ID3D11Buffer*>(16, nullptr);
+      std::vector<UINT> vertexOffsets = std::vector<UINT>(16, 0);
+      ID3D11Buffer* indexBuffer = nullptr;
+      DXGI_FORMAT indexFormat = DXGI_FORMAT_UNKNOWN;
+      UINT indexOffset = 0;
+      D3D11_PRIMITIVE_TOPOLOGY topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+      ID3D11InputLayout* inputLayout = nullptr;
+
+      // IUnknown
+
+      HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** ppv) override {
+        InitReturnPtr(ppv);
+
+        if (ppv == nullptr)
+          return E_POINTER;
+
+        if (riid == __uuidof(ID3D11DeviceContext1) || riid == __uuidof(ID3D11DeviceContext) || riid == __uuidof(IUnknown)) {
+          *ppv = ref(this);
+          return S_OK;
+        }
+
+        return E_NOINTERFACE;
+      }
+
+      ULONG STDMETHODCALLTYPE AddRef() override {
+        return ++m_refCount;
+      }
+
+      ULONG STDMETHODCALLTYPE Release() override {
+        return --m_refCount;
+      }
+
+      // ID3D11DeviceChild
+
+      void STDMETHODCALLTYPE GetDevice(ID3D11Device** ppDevice) override {
+        *ppDevice = ref(m_device);
+      }
+
+      HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID guid, UINT* pDataSize, void* pData) override {
+        return DXGI_ERROR_NOT_FOUND;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID guid, UINT DataSize, const void* pData) override {
+        return S_OK;
+      }
+
+      HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID guid, const IUnknown* pData) override {
+        return S_OK;
+      }
+
+      // Draws
+
+      void STDMETHODCALLTYPE Draw(UINT VertexCount, UINT StartVertexLocation) override {
+        calls.draw++;
+        lastDraw = DrawArgs{ VertexCount, 1, StartVertexLocation, 0, 0 };
+      }
+
+      void STDMETHODCALLTYPE DrawIndexed(UINT IndexCount, UINT StartIndexLocation, INT BaseVertexLocation) override {
+        calls.drawIndexed++;
+        lastDraw = DrawArgs{ IndexCount, 1, StartIndexLocation, BaseVertexLocation, 0 };
+      }
+
+      void STDMETHODCALLTYPE DrawInstanced(UINT VertexCountPerInstance, UINT InstanceCount, UINT StartVertexLocation, UINT StartInstanceLocation) override {
+        calls.drawInstanced++;
+        lastDraw = DrawArgs{ VertexCountPerInstance, InstanceCount, StartVertexLocation, 0, StartInstanceLocation };
+      }
+
+      void STDMETHODCALLTYPE DrawIndexedInstanced(UINT IndexCountPerInstance, UINT InstanceCount, UINT StartIndexLocation, INT BaseVertexLocation, UINT StartInstanceLocation) override {
+        calls.drawIndexedInstanced++;
+        lastDraw = DrawArgs{ IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation };
+      }
+
+      void STDMETHODCALLTYPE DrawAuto() override {}
+      void STDMETHODCALLTYPE DrawIndexedInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override {}
+      void STDMETHODCALLTYPE DrawInstancedIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override {}
+      void STDMETHODCALLTYPE Dispatch(UINT ThreadGroupCountX, UINT ThreadGroupCountY, UINT ThreadGroupCountZ) override {}
+      void STDMETHODCALLTYPE DispatchIndirect(ID3D11Buffer* pBufferForArgs, UINT AlignedByteOffsetForArgs) override {}
+
+      // Resources
+
+      HRESULT STDMETHODCALLTYPE Map(ID3D11Resource* pResource, UINT Subresource, D3D11_MAP MapType, UINT MapFlags, D3D11_MAPPED_SUBRESOURCE* pMappedResource) override {
+        D3D11_RESOURCE_DIMENSION dimension;
+        pResource->GetType(&dimension);
+        if (dimension != D3D11_RESOURCE_DIMENSION_BUFFER)
+          return E_NOTIMPL;
+
+        calls.map++;
+        if (MapType == D3D11_MAP_WRITE_DISCARD)
+          calls.mapDiscard++;
+        else if (MapType == D3D11_MAP_WRITE_NO_OVERWRITE)
+          calls.mapNoOverwrite++;
+
+        MockBuffer* buffer = static_cast<MockBuffer*>(static_cast<ID3D11Buffer*>(pResource));
+
+        D3D11_BUFFER_DESC desc;
+        buffer->GetDesc(&desc);
+
+        pMappedResource->pData = buffer->data();
+        pMappedResource->RowPitch = desc.ByteWidth;
+        pMappedResource->DepthPitch = desc.ByteWidth;
+        return S_OK;
+      }
+
+      void STDMETHODCALLTYPE Unmap(ID3D11Resource* pResource, UINT Subresource) override {}
+
+      void STDMETHODCALLTYPE UpdateSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch) override {
+        UpdateSubresource1(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch, 0);
+      }
+
+      void STDMETHODCALLTYPE UpdateSubresource1(ID3D11Resource* pDstResource, UINT DstSubresource, const D3D11_BOX* pDstBox, const void* pSrcData, UINT SrcRowPitch, UINT SrcDepthPitch, UINT CopyFlags) override {
+        D3D11_RESOURCE_DIMENSION dimension;
+        pDstResource->GetType(&dimension);
+        if (dimension != D3D11_RESOURCE_DIMENSION_BUFFER)
+          return;
+
+        MockBuffer* buffer = static_cast<MockBuffer*>(static_cast<ID3D11Buffer*>(pDstResource));
+
+        D3D11_BUFFER_DESC desc;
+        buffer->GetDesc(&desc);
+
+        UINT begin = pDstBox != nullptr ? pDstBox->left : 0;
+        UINT end = pDstBox != nullptr ? pDstBox->right : desc.ByteWidth;
+
+        calls.updateSubresource++;
+        calls.updateBytes += end - begin;
+        std::memcpy(buffer->data() + begin, pSrcData, end - begin);
+      }
+
+      void STDMETHODCALLTYPE CopySubresourceRegion(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox) override {}
+      void STDMETHODCALLTYPE CopySubresourceRegion1(ID3D11Resource* pDstResource, UINT DstSubresource, UINT DstX, UINT DstY, UINT DstZ, ID3D11Resource* pSrcResource, UINT SrcSubresource, const D3D11_BOX* pSrcBox, UINT CopyFlags) override {}
+      void STDMETHODCALLTYPE CopyResource(ID3D11Resource* pDstResource, ID3D11Resource* pSrcResource) override {}
+      void STDMETHODCALLTYPE CopyStructureCount(ID3D11Buffer* pDstBuffer, UINT DstAlignedByteOffset, ID3D11UnorderedAccessView* pSrcView) override {}
+      void STDMETHODCALLTYPE ResolveSubresource(ID3D11Resource* pDstResource, UINT DstSubresource, ID3D11Resource* pSrcResource, UINT SrcSubresource, DXGI_FORMAT Format) override {}
+      void STDMETHODCALLTYPE GenerateMips(ID3D11ShaderResourceView* pShaderResourceView) override {}
+      void STDMETHODCALLTYPE SetResourceMinLOD(ID3D11Resource* pResource, FLOAT MinLOD) override {}
+
+      FLOAT STDMETHODCALLTYPE GetResourceMinLOD(ID3D11Resource* pResource) override {
+        return 0.0f;
+      }
+
+      void STDMETHODCALLTYPE DiscardResource(ID3D11Resource* pResource) override {}
+      void STDMETHODCALLTYPE DiscardView(ID3D11View* pResourceView) override {}
+      void STDMETHODCALLTYPE DiscardView1(ID3D11View* pResourceView, const D3D11_RECT* pRects, UINT NumRects) override {}
+
+      void STDMETHODCALLTYPE ClearRenderTargetView(ID3D11RenderTargetView* pRenderTargetView, const FLOAT ColorRGBA[4]) override {}
+      void STDMETHODCALLTYPE ClearUnorderedAccessViewUint(ID3D11UnorderedAccessView* pUnorderedAccessView, const UINT Values[4]) override {}
+      void STDMETHODCALLTYPE ClearUnorderedAccessViewFloat(ID3D11UnorderedAccessView* pUnorderedAccessView, const FLOAT Values[4]) override {}
+      void STDMETHODCALLTYPE ClearDepthStencilView(ID3D11DepthStencilView* pDepthStencilView, UINT ClearFlags, FLOAT Depth, UINT8 Stencil) override {}
+      void STDMETHODCALLTYPE ClearView(ID3D11View* pView, const FLOAT Color[4], const D3D11_RECT* pRect, UINT NumRects) override {}
+
+      // Queries
+
+      void STDMETHODCALLTYPE Begin(ID3D11Asynchronous* pAsync) override {}
+
+      void STDMETHODCALLTYPE End(ID3D11Asynchronous* pAsync) override {
+        calls.end++;
+
+        MockQuery* query = static_cast<MockQuery*>(static_cast<ID3D11Query*>(pAsync));
+        query->signaled = false;
+        m_pendingQueries.push_back(query);
+      }
+
+      HRESULT STDMETHODCALLTYPE GetData(ID3D11Asynchronous* pAsync, void* pData, UINT DataSize, UINT GetDataFlags) override {
+        MockQuery* query = static_cast<MockQuery*>(static_cast<ID3D11Query*>(pAsync));
+        return query->signaled ? S_OK : S_FALSE;
+      }
+
+      void STDMETHODCALLTYPE SetPredication(ID3D11Predicate* pPredicate, BOOL PredicateValue) override {}
+
+      void STDMETHODCALLTYPE GetPredication(ID3D11Predicate** ppPredicate, BOOL* pPredicateValue) override {
+        InitReturnPtr(ppPredicate);
+      }
+
+      // Input assembler
+
+      void STDMETHODCALLTYPE IASetInputLayout(ID3D11InputLayout* pInputLayout) override {
+        calls.setInputLayout++;
+        inputLayout = pInputLayout;
+      }
+
+      void STDMETHODCALLTYPE IASetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppVertexBuffers, const UINT* pStrides, const UINT* pOffsets) override {
+        calls.setVertexBuffers++;
+        lastVertexBuffers = SlotRange{ StartSlot, NumBuffers };
+
+        for (UINT i = 0; i < NumBuffers; i++) {
+          vertexBuffers[StartSlot + i] = ppVertexBuffers[i];
+          vertexOffsets[StartSlot + i] = pOffsets != nullptr ? pOffsets[i] : 0;
+        }
+      }
+
+      void STDMETHODCALLTYPE IASetIndexBuffer(ID3D11Buffer* pIndexBuffer, DXGI_FORMAT Format, UINT Offset) override {
+        calls.setIndexBuffer++;
+        indexBuffer = pIndexBuffer;
+        indexFormat = Format;
+        indexOffset = Offset;
+      }
+
+      void STDMETHODCALLTYPE IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY Topology) override {
+        calls.setTopology++;
+        topology = Topology;
+      }
+
+      void STDMETHODCALLTYPE IAGetInputLayout(ID3D11InputLayout** ppInputLayout) override {
+        InitReturnPtr(ppInputLayout);
+      }
+
+      void STDMETHODCALLTYPE IAGetVertexBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppVertexBuffers, UINT* pStrides, UINT* pOffsets) override {}
+
+      void STDMETHODCALLTYPE IAGetIndexBuffer(ID3D11Buffer** pIndexBuffer, DXGI_FORMAT* Format, UINT* Offset) override {
+        InitReturnPtr(pIndexBuffer);
+      }
+
+      void STDMETHODCALLTYPE IAGetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY* pTopology) override {
+        *pTopology = topology;
+      }
+
+      // Vertex shader
+
+      void STDMETHODCALLTYPE VSSetShader(ID3D11VertexShader* pVertexShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override {
+        calls.setVertexShader++;
+      }
+
+      void STDMETHODCALLTYPE VSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override {
+        calls.setShaderResources[0]++;
+        lastShaderResources[0] = SlotRange{ StartSlot, NumViews };
+      }
+
+      void STDMETHODCALLTYPE VSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override {
+        calls.setSamplers[0]++;
+        lastSamplers[0] = SlotRange{ StartSlot, NumSamplers };
+      }
+
+      void STDMETHODCALLTYPE VSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override {
+        calls.setConstantBuffers[0]++;
+        lastConstantBuffer[0] = ConstantBufferBinding{ NumBuffers != 0 ? ppConstantBuffers[0] : nullptr, 0, 4096 };
+      }
+
+      void STDMETHODCALLTYPE VSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override {
+        calls.setConstantBuffers[0]++;
+        lastConstantBuffer[0] = ConstantBufferBinding{ ppConstantBuffers[0], pFirstConstant[0], pNumConstants[0] };
+      }
+
+      void STDMETHODCALLTYPE VSGetShader(ID3D11VertexShader** ppVertexShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override {
+        InitReturnPtr(ppVertexShader);
+      }
+
+      void STDMETHODCALLTYPE VSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE VSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override {}
+      void STDMETHODCALLTYPE VSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE VSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override {}
+
+      // Pixel shader
+
+      void STDMETHODCALLTYPE PSSetShader(ID3D11PixelShader* pPixelShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override {
+        calls.setPixelShader++;
+      }
+
+      void STDMETHODCALLTYPE PSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override {
+        calls.setShaderResources[1]++;
+        lastShaderResources[1] = SlotRange{ StartSlot, NumViews };
+      }
+
+      void STDMETHODCALLTYPE PSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override {
+        calls.setSamplers[1]++;
+        lastSamplers[1] = SlotRange{ StartSlot, NumSamplers };
+      }
+
+      void STDMETHODCALLTYPE PSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override {
+        calls.setConstantBuffers[1]++;
+        lastConstantBuffer[1] = ConstantBufferBinding{ NumBuffers != 0 ? ppConstantBuffers[0] : nullptr, 0, 4096 };
+      }
+
+      void STDMETHODCALLTYPE PSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override {
+        calls.setConstantBuffers[1]++;
+        lastConstantBuffer[1] = ConstantBufferBinding{ ppConstantBuffers[0], pFirstConstant[0], pNumConstants[0] };
+      }
+
+      void STDMETHODCALLTYPE PSGetShader(ID3D11PixelShader** ppPixelShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override {
+        InitReturnPtr(ppPixelShader);
+      }
+
+      void STDMETHODCALLTYPE PSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE PSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override {}
+      void STDMETHODCALLTYPE PSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE PSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override {}
+
+      // Stages we never use
+
+      void STDMETHODCALLTYPE GSSetShader(ID3D11GeometryShader* pShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override {}
+      void STDMETHODCALLTYPE GSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE GSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override {}
+      void STDMETHODCALLTYPE GSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE GSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override {}
+      void STDMETHODCALLTYPE GSGetShader(ID3D11GeometryShader** ppGeometryShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override { InitReturnPtr(ppGeometryShader); }
+      void STDMETHODCALLTYPE GSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE GSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override {}
+      void STDMETHODCALLTYPE GSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE GSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override {}
+
+      void STDMETHODCALLTYPE HSSetShader(ID3D11HullShader* pHullShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override {}
+      void STDMETHODCALLTYPE HSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE HSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override {}
+      void STDMETHODCALLTYPE HSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE HSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override {}
+      void STDMETHODCALLTYPE HSGetShader(ID3D11HullShader** ppHullShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override { InitReturnPtr(ppHullShader); }
+      void STDMETHODCALLTYPE HSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE HSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override {}
+      void STDMETHODCALLTYPE HSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE HSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override {}
+
+      void STDMETHODCALLTYPE DSSetShader(ID3D11DomainShader* pDomainShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override {}
+      void STDMETHODCALLTYPE DSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE DSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override {}
+      void STDMETHODCALLTYPE DSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE DSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override {}
+      void STDMETHODCALLTYPE DSGetShader(ID3D11DomainShader** ppDomainShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override { InitReturnPtr(ppDomainShader); }
+      void STDMETHODCALLTYPE DSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE DSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override {}
+      void STDMETHODCALLTYPE DSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE DSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override {}
+
+      void STDMETHODCALLTYPE CSSetShader(ID3D11ComputeShader* pComputeShader, ID3D11ClassInstance* const* ppClassInstances, UINT NumClassInstances) override {}
+      void STDMETHODCALLTYPE CSSetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView* const* ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE CSSetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts) override {}
+      void STDMETHODCALLTYPE CSSetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState* const* ppSamplers) override {}
+      void STDMETHODCALLTYPE CSSetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE CSSetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer* const* ppConstantBuffers, const UINT* pFirstConstant, const UINT* pNumConstants) override {}
+      void STDMETHODCALLTYPE CSGetShader(ID3D11ComputeShader** ppComputeShader, ID3D11ClassInstance** ppClassInstances, UINT* pNumClassInstances) override { InitReturnPtr(ppComputeShader); }
+      void STDMETHODCALLTYPE CSGetShaderResources(UINT StartSlot, UINT NumViews, ID3D11ShaderResourceView** ppShaderResourceViews) override {}
+      void STDMETHODCALLTYPE CSGetUnorderedAccessViews(UINT StartSlot, UINT NumUAVs, ID3D11UnorderedAccessView** ppUnorderedAccessViews) override {}
+      void STDMETHODCALLTYPE CSGetSamplers(UINT StartSlot, UINT NumSamplers, ID3D11SamplerState** ppSamplers) override {}
+      void STDMETHODCALLTYPE CSGetConstantBuffers(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers) override {}
+      void STDMETHODCALLTYPE CSGetConstantBuffers1(UINT StartSlot, UINT NumBuffers, ID3D11Buffer** ppConstantBuffers, UINT* pFirstConstant, UINT* pNumConstants) override {}
+
+      void STDMETHODCALLTYPE SOSetTargets(UINT NumBuffers, ID3D11Buffer* const* ppSOTargets, const UINT* pOffsets) override {}
+      void STDMETHODCALLTYPE SOGetTargets(UINT NumBuffers, ID3D11Buffer** ppSOTargets) override {}
+
+      // Rasterizer and output merger
+
+      void STDMETHODCALLTYPE RSSetState(ID3D11RasterizerState* pRasterizerState) override {
+        calls.setRasterizerState++;
+      }
+
+      void STDMETHODCALLTYPE RSSetViewports(UINT NumViewports, const D3D11_VIEWPORT* pViewports) override {
+        calls.setViewports++;
+      }
+
+      void STDMETHODCALLTYPE RSSetScissorRects(UINT NumRects, const D3D11_RECT* pRects) override {
+        calls.setScissorRects++;
+      }
+
+      void STDMETHODCALLTYPE RSGetState(ID3D11RasterizerState** ppRasterizerState) override {
+        InitReturnPtr(ppRasterizerState);
+      }
+
+      void STDMETHODCALLTYPE RSGetViewports(UINT* pNumViewports, D3D11_VIEWPORT* pViewports) override {
+        *pNumViewports = 0;
+      }
+
+      void STDMETHODCALLTYPE RSGetScissorRects(UINT* pNumRects, D3D11_RECT* pRects) override {
+        *pNumRects = 0;
+      }
+
+      void STDMETHODCALLTYPE OMSetRenderTargets(UINT NumViews, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView) override {
+        calls.setRenderTargets++;
+      }
+
+      void STDMETHODCALLTYPE OMSetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView* const* ppRenderTargetViews, ID3D11DepthStencilView* pDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView* const* ppUnorderedAccessViews, const UINT* pUAVInitialCounts) override {
+        calls.setRenderTargets++;
+      }
+
+      void STDMETHODCALLTYPE OMSetBlendState(ID3D11BlendState* pBlendState, const FLOAT BlendFactor[4], UINT SampleMask) override {
+        calls.setBlendState++;
+      }
+
+      void STDMETHODCALLTYPE OMSetDepthStencilState(ID3D11DepthStencilState* pDepthStencilState, UINT StencilRef) override {
+        calls.setDepthStencilState++;
+      }
+
+      void STDMETHODCALLTYPE OMGetRenderTargets(UINT NumViews, ID3D11RenderTargetView** ppRenderTargetViews, ID3D11DepthStencilView** ppDepthStencilView) override {
+        InitReturnPtr(ppDepthStencilView);
+      }
+
+      void STDMETHODCALLTYPE OMGetRenderTargetsAndUnorderedAccessViews(UINT NumRTVs, ID3D11RenderTargetView** ppRenderTargetViews, ID3D11DepthStencilView** ppDepthStencilView, UINT UAVStartSlot, UINT NumUAVs, ID3D11UnorderedAccessView** ppUnorderedAccessViews) override {
+        InitReturnPtr(ppDepthStencilView);
+      }
+
+      void STDMETHODCALLTYPE OMGetBlendState(ID3D11BlendState** ppBlendState, FLOAT BlendFactor[4], UINT* pSampleMask) override {
+        InitReturnPtr(ppBlendState);
+      }
+
+      void STDMETHODCALLTYPE OMGetDepthStencilState(ID3D11DepthStencilState** ppDepthStencilState, UINT* pStencilRef) override {
+        InitReturnPtr(ppDepthStencilState);
+      }
+
+      // Context
+
+      void STDMETHODCALLTYPE ExecuteCommandList(ID3D11CommandList* pCommandList, BOOL RestoreContextState) override {}
+      void STDMETHODCALLTYPE ClearState() override {}
+      void STDMETHODCALLTYPE Flush() override {}
+
+      D3D11_DEVICE_CONTEXT_TYPE STDMETHODCALLTYPE GetType() override {
+        return D3D11_DEVICE_CONTEXT_IMMEDIATE;
+      }
+
+      UINT STDMETHODCALLTYPE GetContextFlags() override {
+        return 0;
+      }
+
+      HRESULT STDMETHODCALLTYPE FinishCommandList(BOOL RestoreDeferredContextState, ID3D11CommandList** ppCommandList) override {
+        InitReturnPtr(ppCommandList);
+        return DXGI_ERROR_INVALID_CALL;
+      }
+
+      void STDMETHODCALLTYPE SwapDeviceContextState(ID3DDeviceContextState* pState, ID3DDeviceContextState** ppPreviousState) override {
+        InitReturnPtr(ppPreviousState);
+      }
+
+    private:
+
+      ID3D11Device* m_device;
+      ULONG m_refCount = 1;
+
+      std::vector<Com<MockQuery>> m_pendingQueries;
+
+    };
+
+  }
+
+}
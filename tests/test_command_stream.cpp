@@ -0,0 +1,152 @@
+#include "../src/d3d9/d3d9_command_stream.h"
+#include "test_utils.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  constexpr size_t ChunkSize = D3D9CommandStream::chunkSize;
+  constexpr size_t MaxCommandSize = D3D9CommandStream::maxCommandSize;
+
+  // What the worker saw, written only on its side and read after synchronize.
+  struct Seen {
+    uint32_t commands = 0;
+    bool intact = true;
+  };
+
+  bool filledWith(const uint8_t* data, size_t length, uint8_t value) {
+    for (size_t i = 0; i < length; i++) {
+      if (data[i] != value)
+        return false;
+    }
+    return true;
+  }
+
+  // A command with a payload and a second, state sized, block, the way runRenderer records a UP draw.
+  void emitTwoBlocks(D3D9CommandStream& stream, Seen& seen, size_t payloadLength, size_t stateLength, uint8_t value) {
+    stream.begin({ payloadLength, stateLength });
+
+    uint8_t* payload = reinterpret_cast<uint8_t*>(stream.allocData(payloadLength));
+    std::memset(payload, value, payloadLength);
+
+    uint8_t* state = reinterpret_cast<uint8_t*>(stream.allocData(stateLength));
+    std::memset(state, value ^ 0xFF, stateLength);
+
+    stream.emit([&seen, payload, payloadLength, state, stateLength, value] (D3D9ImmediateRenderer*) {
+      seen.commands++;
+      seen.intact &= filledWith(payload, payloadLength, value) && filledWith(state, stateLength, value ^ 0xFF);
+    });
+  }
+
+  // Churns through chunks so a recycled one would get overwritten.
+  void churn(D3D9CommandStream& stream, Seen& seen) {
+    for (uint32_t i = 0; i < 64; i++) {
+      uint8_t* data = reinterpret_cast<uint8_t*>(stream.allocData(ChunkSize / 4));
+      std::memset(data, 0xEE, ChunkSize / 4);
+      stream.emit([&seen] (D3D9ImmediateRenderer*) { seen.commands++; });
+    }
+  }
+
+  void testSecondBlockDoesNotFlush() {
+    D3D9CommandStream stream(nullptr);
+    Seen seen;
+
+    // The payload alone fits with a command, the state block after it doesn't.
+    // Checking each block on its own would flush between them and leave the payload in a chunk the worker recycles.
+    const size_t payloadLength = ChunkSize - MaxCommandSize - 64;
+    emitTwoBlocks(stream, seen, payloadLength, 128, 0x5A);
+
+    DXUP_CHECK(stream.submitted() == 0);
+
+    churn(stream, seen);
+    stream.synchronize();
+
+    DXUP_CHECK(seen.commands == 65);
+    DXUP_CHECK(seen.intact);
+  }
+
+  void testBeginFlushesOnce() {
+    D3D9CommandStream stream(nullptr);
+    Seen seen;
+
+    // Leave the chunk with room for the payload and a command but not the state block too.
+    const size_t used = ChunkSize / 2;
+    uint8_t* filler = reinterpret_cast<uint8_t*>(stream.allocData(used));
+    std::memset(filler, 0, used);
+    stream.emit([&seen] (D3D9ImmediateRenderer*) { seen.commands++; });
+
+    const size_t payloadLength = ChunkSize - used - MaxCommandSize - 128;
+    stream.begin({ payloadLength, 256 });
+    DXUP_CHECK(stream.submitted() == 1);
+
+    uint8_t* payload = reinterpret_cast<uint8_t*>(stream.allocData(payloadLength));
+    std::memset(payload, 0x33, payloadLength);
+    uint8_t* state = reinterpret_cast<uint8_t*>(stream.allocData(256));
+    std::memset(state, 0x44, 256);
+
+    // Everything went where begin made room.
+    DXUP_CHECK(stream.submitted() == 1);
+
+    stream.emit([&seen, payload, payloadLength, state] (D3D9ImmediateRenderer*) {
+      seen.commands++;
+      seen.intact &= filledWith(payload, payloadLength, 0x33) && filledWith(state, 256, 0x44);
+    });
+    DXUP_CHECK(stream.submitted() == 1);
+
+    churn(stream, seen);
+    stream.synchronize();
+
+    DXUP_CHECK(seen.commands == 66);
+    DXUP_CHECK(seen.intact);
+  }
+
+  void testBeginIsOpenUntilEmit() {
+    D3D9CommandStream stream(nullptr);
+    Seen seen;
+
+    const size_t used = ChunkSize - 4 * MaxCommandSize;
+    stream.allocData(used);
+    stream.emit([&seen] (D3D9ImmediateRenderer*) { seen.commands++; });
+
+    // A nested begin, like runRenderer's after a caller already made room, mustn't flush again.
+    stream.begin({ 2 * MaxCommandSize, 512 });
+    DXUP_CHECK(stream.submitted() == 1);
+    stream.allocData(2 * MaxCommandSize);
+
+    stream.begin({ 512 });
+    stream.allocData(512);
+    DXUP_CHECK(stream.submitted() == 1);
+
+    stream.emit([&seen] (D3D9ImmediateRenderer*) { seen.commands++; });
+    stream.synchronize();
+
+    DXUP_CHECK(seen.commands == 2);
+  }
+
+  void testOversizedCommand() {
+    D3D9CommandStream stream(nullptr);
+    Seen seen;
+
+    // Bigger than a chunk, gets one of its own.
+    emitTwoBlocks(stream, seen, ChunkSize * 3, 1024, 0x77);
+    churn(stream, seen);
+    stream.synchronize();
+
+    DXUP_CHECK(seen.commands == 65);
+    DXUP_CHECK(seen.intact);
+  }
+
+}
+
+int main() {
+  run("command stream second block does not flush", testSecondBlockDoesNotFlush);
+  run("command stream begin flushes once", testBeginFlushesOnce);
+  run("command stream begin is open until emit", testBeginIsOpenUntilEmit);
+  run("command stream oversized command", testOversizedCommand);
+
+  return result();
+}
@@ -0,0 +1,145 @@
+#include "../src/d3d9/d3d9_constant_buffer.h"
+#include "mock_d3d11.h"
+#include "test_utils.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  constexpr uint32_t RegisterSize = 4 * sizeof(float);
+  constexpr uint32_t IntOffset = sizeof(D3D9ShaderConstants::floatConstants);
+  constexpr uint32_t BoolOffset = IntOffset + sizeof(D3D9ShaderConstants::intConstants);
+
+  struct ConstantBufferFixture {
+    MockDevice device;
+    MockContext context{ &device };
+    D3D11ContextShadow shadow{ &context };
+    D3D11UploadHeap heap{ &device };
+
+    D3D9ShaderConstants constants;
+
+    ConstantBufferFixture(bool partialUpdates) {
+      device.partialConstantUpdates = partialUpdates;
+
+      for (uint32_t i = 0; i < constants.floatConstants.size(); i++) {
+        for (uint32_t j = 0; j < 4; j++)
+          constants.floatConstants[i].data[j] = float(i * 4 + j);
+      }
+
+      for (uint32_t i = 0; i < constants.intConstants.size(); i++) {
+        for (uint32_t j = 0; j < 4; j++)
+          constants.intConstants[i].data[j] = int(i * 4 + j);
+      }
+    }
+
+    // What the GPU would see offset bytes into the constants bound to the stage.
+    const uint8_t* bound(bool pixel, uint32_t offset) {
+      MockContext::ConstantBufferBinding& binding = context.lastConstantBuffer[pixel];
+      MockBuffer* buffer = static_cast<MockBuffer*>(binding.buffer);
+      return buffer->data() + binding.firstConstant * RegisterSize + offset;
+    }
+  };
+
+  void testPartialUploadsOnlyDirtyRegisters() {
+    ConstantBufferFixture fixture(true);
+    D3D9ConstantBuffer<false> buffer(&fixture.device, &fixture.context, &fixture.shadow, &fixture.heap);
+
+    DXUP_CHECK(fixture.device.buffersCreated == 1);
+
+    D3D9ConstantRanges dirty;
+    dirty.floats.add(10, 4);
+    buffer.update(fixture.constants, dirty);
+
+    DXUP_CHECK(fixture.context.calls.updateSubresource == 1);
+    DXUP_CHECK(fixture.context.calls.updateBytes == 4 * RegisterSize);
+    DXUP_CHECK(fixture.context.calls.map == 0);
+    DXUP_CHECK(std::memcmp(fixture.bound(false, 10 * RegisterSize), &fixture.constants.floatConstants[10], 4 * RegisterSize) == 0);
+
+    // The whole buffer stays bound, it just isn't sent.
+    DXUP_CHECK(fixture.context.calls.setConstantBuffers[0] == 1);
+    DXUP_CHECK(fixture.context.lastConstantBuffer[0].firstConstant == 0);
+    DXUP_CHECK(fixture.context.lastConstantBuffer[0].numConstants == buffer.getConstantCount());
+
+    // Separate writes merge into the range covering them.
+    fixture.context.resetCalls();
+    dirty = D3D9ConstantRanges();
+    dirty.floats.add(3, 1);
+    dirty.floats.add(8, 2);
+    buffer.update(fixture.constants, dirty);
+
+    DXUP_CHECK(fixture.context.calls.updateSubresource == 1);
+    DXUP_CHECK(fixture.context.calls.updateBytes == 7 * RegisterSize);
+    DXUP_CHECK(fixture.context.calls.setConstantBuffers[0] == 0);
+
+    // Nothing dirty, nothing sent.
+    fixture.context.resetCalls();
+    buffer.update(fixture.constants, D3D9ConstantRanges());
+    DXUP_CHECK(fixture.context.calls.updateSubresource == 0);
+    DXUP_CHECK(fixture.context.calls.updateBytes == 0);
+  }
+
+  void testPartialIntsAndBools() {
+    ConstantBufferFixture fixture(true);
+    D3D9ConstantBuffer<true> buffer(&fixture.device, &fixture.context, &fixture.shadow, &fixture.heap);
+
+    fixture.constants.boolConstants[0] = 1;
+    fixture.constants.boolConstants[5] = 1;
+
+    D3D9ConstantRanges dirty;
+    dirty.ints.add(2, 1);
+    dirty.bools.add(5, 1);
+    buffer.update(fixture.constants, dirty);
+
+    DXUP_CHECK(fixture.context.calls.updateSubresource == 2);
+    DXUP_CHECK(fixture.context.calls.updateBytes == 2 * RegisterSize);
+    DXUP_CHECK(fixture.context.calls.setConstantBuffers[1] == 1);
+    DXUP_CHECK(fixture.context.calls.setConstantBuffers[0] == 0);
+
+    DXUP_CHECK(std::memcmp(fixture.bound(true, IntOffset + 2 * RegisterSize), &fixture.constants.intConstants[2], RegisterSize) == 0);
+
+    uint32_t bools;
+    std::memcpy(&bools, fixture.bound(true, BoolOffset), sizeof(bools));
+    DXUP_CHECK(bools == ((1u << 0) | (1u << 5)));
+  }
+
+  void testFallbackUploadsEverything() {
+    ConstantBufferFixture fixture(false);
+    D3D9ConstantBuffer<false> buffer(&fixture.device, &fixture.context, &fixture.shadow, &fixture.heap);
+
+    fixture.constants.boolConstants[3] = 1;
+
+    D3D9ConstantRanges dirty;
+    dirty.floats.add(0, 1);
+    buffer.update(fixture.constants, dirty);
+
+    DXUP_CHECK(fixture.context.calls.updateSubresource == 0);
+    DXUP_CHECK(fixture.context.calls.map == 1);
+    DXUP_CHECK(fixture.context.calls.setConstantBuffers[0] == 1);
+    DXUP_CHECK(fixture.context.lastConstantBuffer[0].numConstants == buffer.getConstantCount());
+
+    DXUP_CHECK(std::memcmp(fixture.bound(false, 0), fixture.constants.floatConstants.data(), sizeof(fixture.constants.floatConstants)) == 0);
+    DXUP_CHECK(std::memcmp(fixture.bound(false, IntOffset), fixture.constants.intConstants.data(), sizeof(fixture.constants.intConstants)) == 0);
+
+    uint32_t bools;
+    std::memcpy(&bools, fixture.bound(false, BoolOffset), sizeof(bools));
+    DXUP_CHECK(bools == (1u << 3));
+
+    // Each update lands after the last one in the ring, so the binding moves.
+    uint32_t firstOffset = fixture.context.lastConstantBuffer[0].firstConstant;
+    buffer.update(fixture.constants, dirty);
+
+    DXUP_CHECK(fixture.context.calls.map == 2);
+    DXUP_CHECK(fixture.context.calls.setConstantBuffers[0] == 2);
+    DXUP_CHECK(fixture.context.lastConstantBuffer[0].firstConstant == firstOffset + buffer.getConstantCount());
+  }
+
+}
+
+int main() {
+  run("constant buffer partial upload of dirty registers", testPartialUploadsOnlyDirtyRegisters);
+  run("constant buffer partial ints and bools", testPartialIntsAndBools);
+  run("constant buffer fallback uploads everything", testFallbackUploadsEverything);
+
+  return result();
+}
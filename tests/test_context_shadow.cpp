@@ -0,0 +1,239 @@
+#include "../src/d3d9/d3d11_context_shadow.h"
+#include "mock_d3d11.h"
+#include "test_utils.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  // Views are only ever compared by the shadow, never touched, so stand-ins will do.
+  template <typename T>
+  T* fakeObject(uintptr_t id) {
+    return reinterpret_cast<T*>(0x10000 + id * 0x100);
+  }
+
+  Com<ID3D11Buffer> makeBuffer(MockDevice& device) {
+    D3D11_BUFFER_DESC desc = {};
+    desc.ByteWidth = 64;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+
+    Com<ID3D11Buffer> buffer;
+    device.CreateBuffer(&desc, nullptr, &buffer);
+    return buffer;
+  }
+
+  void testRedundantBindsSkipped() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11ContextShadow shadow(&context);
+
+    Com<ID3D11Buffer> buffer = makeBuffer(device);
+
+    for (uint32_t i = 0; i < 3; i++) {
+      shadow.setIndexBuffer(buffer.ptr(), DXGI_FORMAT_R16_UINT, 0);
+      shadow.setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+      shadow.setVertexShader(nullptr);
+      shadow.setPixelShader(nullptr);
+      shadow.setInputLayout(nullptr);
+      shadow.setRasterizerState(nullptr);
+      shadow.setDepthStencilState(nullptr, 0);
+      shadow.setConstantBuffer<true>(buffer.ptr(), 0, 16);
+    }
+
+    DXUP_CHECK(context.calls.setIndexBuffer == 1);
+    DXUP_CHECK(context.calls.setTopology == 1);
+    DXUP_CHECK(context.calls.setVertexShader == 1);
+    DXUP_CHECK(context.calls.setPixelShader == 1);
+    DXUP_CHECK(context.calls.setInputLayout == 1);
+    DXUP_CHECK(context.calls.setRasterizerState == 1);
+    DXUP_CHECK(context.calls.setDepthStencilState == 1);
+    DXUP_CHECK(context.calls.setConstantBuffers[1] == 1);
+    DXUP_CHECK(context.calls.setConstantBuffers[0] == 0);
+
+    // Any part of a binding changing makes the call.
+    shadow.setIndexBuffer(buffer.ptr(), DXGI_FORMAT_R16_UINT, 16);
+    shadow.setIndexBuffer(buffer.ptr(), DXGI_FORMAT_R32_UINT, 16);
+    shadow.setDepthStencilState(nullptr, 1);
+    shadow.setConstantBuffer<true>(buffer.ptr(), 16, 16);
+
+    DXUP_CHECK(context.calls.setIndexBuffer == 3);
+    DXUP_CHECK(context.indexOffset == 16);
+    DXUP_CHECK(context.calls.setDepthStencilState == 2);
+    DXUP_CHECK(context.calls.setConstantBuffers[1] == 2);
+    DXUP_CHECK(context.lastConstantBuffer[1].firstConstant == 16);
+    DXUP_CHECK(context.lastConstantBuffer[1].numConstants == 16);
+  }
+
+  void testFixedFunctionState() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11ContextShadow shadow(&context);
+
+    const FLOAT factor[4] = { 0.0f, 0.5f, 1.0f, 1.0f };
+    const FLOAT otherFactor[4] = { 0.0f, 0.5f, 1.0f, 0.0f };
+
+    shadow.setBlendState(nullptr, factor, 0xFFFFFFFF);
+    shadow.setBlendState(nullptr, factor, 0xFFFFFFFF);
+    DXUP_CHECK(context.calls.setBlendState == 1);
+
+    shadow.setBlendState(nullptr, otherFactor, 0xFFFFFFFF);
+    shadow.setBlendState(nullptr, otherFactor, 0x1);
+    DXUP_CHECK(context.calls.setBlendState == 3);
+
+    D3D11_VIEWPORT viewport = { 0.0f, 0.0f, 640.0f, 480.0f, 0.0f, 1.0f };
+    shadow.setViewport(viewport);
+    shadow.setViewport(viewport);
+    viewport.MaxDepth = 0.5f;
+    shadow.setViewport(viewport);
+    DXUP_CHECK(context.calls.setViewports == 2);
+
+    D3D11_RECT rect = { 0, 0, 640, 480 };
+    shadow.setScissorRect(rect);
+    shadow.setScissorRect(rect);
+    DXUP_CHECK(context.calls.setScissorRects == 1);
+  }
+
+  void testVertexBufferRange() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11ContextShadow shadow(&context);
+
+    Com<ID3D11Buffer> a = makeBuffer(device);
+    Com<ID3D11Buffer> b = makeBuffer(device);
+
+    ID3D11Buffer* buffers[4] = { a.ptr(), a.ptr(), a.ptr(), a.ptr() };
+    UINT strides[4] = { 16, 16, 16, 16 };
+    UINT offsets[4] = { 0, 0, 0, 0 };
+
+    shadow.setVertexBuffers(0, 4, buffers, strides, offsets);
+    DXUP_CHECK(context.calls.setVertexBuffers == 1);
+    DXUP_CHECK(context.lastVertexBuffers.start == 0);
+    DXUP_CHECK(context.lastVertexBuffers.count == 4);
+
+    shadow.setVertexBuffers(0, 4, buffers, strides, offsets);
+    DXUP_CHECK(context.calls.setVertexBuffers == 1);
+
+    // Only the stream whose offset moved goes out.
+    offsets[2] = 64;
+    shadow.setVertexBuffers(0, 4, buffers, strides, offsets);
+    DXUP_CHECK(context.calls.setVertexBuffers == 2);
+    DXUP_CHECK(context.lastVertexBuffers.start == 2);
+    DXUP_CHECK(context.lastVertexBuffers.count == 1);
+    DXUP_CHECK(context.vertexOffsets[2] == 64);
+
+    // Slots 1 and 3 changed, the unchanged one between them rides along.
+    buffers[1] = b.ptr();
+    strides[3] = 32;
+    shadow.setVertexBuffers(0, 4, buffers, strides, offsets);
+    DXUP_CHECK(context.calls.setVertexBuffers == 3);
+    DXUP_CHECK(context.lastVertexBuffers.start == 1);
+    DXUP_CHECK(context.lastVertexBuffers.count == 3);
+    DXUP_CHECK(context.vertexBuffers[1] == b.ptr());
+  }
+
+  void testShaderResourceAndSamplerRanges() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11ContextShadow shadow(&context);
+
+    ID3D11ShaderResourceView* srvs[16] = {};
+    for (uint32_t i = 0; i < 16; i++)
+      srvs[i] = fakeObject<ID3D11ShaderResourceView>(i);
+
+    shadow.setShaderResources<true>(0, 16, srvs);
+    DXUP_CHECK(context.calls.setShaderResources[1] == 1);
+    DXUP_CHECK(context.lastShaderResources[1].start == 0);
+    DXUP_CHECK(context.lastShaderResources[1].count == 16);
+
+    shadow.setShaderResources<true>(0, 16, srvs);
+    DXUP_CHECK(context.calls.setShaderResources[1] == 1);
+
+    srvs[5] = fakeObject<ID3D11ShaderResourceView>(100);
+    srvs[9] = nullptr;
+    shadow.setShaderResources<true>(0, 16, srvs);
+    DXUP_CHECK(context.calls.setShaderResources[1] == 2);
+    DXUP_CHECK(context.lastShaderResources[1].start == 5);
+    DXUP_CHECK(context.lastShaderResources[1].count == 5);
+
+    // Stages are tracked apart.
+    shadow.setShaderResources<false>(0, 4, srvs);
+    DXUP_CHECK(context.calls.setShaderResources[0] == 1);
+    DXUP_CHECK(context.calls.setShaderResources[1] == 2);
+
+    // Binding a slot range that starts later only looks at those slots.
+    ID3D11SamplerState* samplers[16] = {};
+    shadow.setSamplers<true>(0, 16, samplers);
+    DXUP_CHECK(context.calls.setSamplers[1] == 1);
+
+    D3D11_SAMPLER_DESC samplerDesc = {};
+    Com<ID3D11SamplerState> sampler;
+    device.CreateSamplerState(&samplerDesc, &sampler);
+
+    ID3D11SamplerState* one = sampler.ptr();
+    shadow.setSamplers<true>(12, 1, &one);
+    shadow.setSamplers<true>(12, 1, &one);
+    DXUP_CHECK(context.calls.setSamplers[1] == 2);
+    DXUP_CHECK(context.lastSamplers[1].start == 12);
+    DXUP_CHECK(context.lastSamplers[1].count == 1);
+  }
+
+  void testRenderTargetsDropShaderResources() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11ContextShadow shadow(&context);
+
+    ID3D11ShaderResourceView* srvs[2] = { fakeObject<ID3D11ShaderResourceView>(0), fakeObject<ID3D11ShaderResourceView>(1) };
+    ID3D11RenderTargetView* rtv = fakeObject<ID3D11RenderTargetView>(2);
+
+    shadow.setShaderResources<true>(0, 2, srvs);
+    shadow.setRenderTargets(1, &rtv, nullptr);
+    shadow.setRenderTargets(1, &rtv, nullptr);
+    DXUP_CHECK(context.calls.setRenderTargets == 1);
+
+    // The runtime may have unbound those SRVs, so they have to go out again.
+    shadow.setShaderResources<true>(0, 2, srvs);
+    DXUP_CHECK(context.calls.setShaderResources[1] == 2);
+
+    shadow.setRenderTargets(0, nullptr, fakeObject<ID3D11DepthStencilView>(3));
+    DXUP_CHECK(context.calls.setRenderTargets == 2);
+  }
+
+  void testInvalidate() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11ContextShadow shadow(&context);
+
+    Com<ID3D11Buffer> buffer = makeBuffer(device);
+    ID3D11Buffer* buffers[1] = { buffer.ptr() };
+    UINT strides[1] = { 16 };
+    UINT offsets[1] = { 0 };
+
+    shadow.setVertexBuffers(0, 1, buffers, strides, offsets);
+    shadow.setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+    shadow.setPixelShader(nullptr);
+
+    shadow.invalidate();
+
+    shadow.setVertexBuffers(0, 1, buffers, strides, offsets);
+    shadow.setPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+    shadow.setPixelShader(nullptr);
+
+    DXUP_CHECK(context.calls.setVertexBuffers == 2);
+    DXUP_CHECK(context.calls.setTopology == 2);
+    DXUP_CHECK(context.calls.setPixelShader == 2);
+  }
+
+}
+
+int main() {
+  run("context shadow skips redundant binds", testRedundantBindsSkipped);
+  run("context shadow fixed function state", testFixedFunctionState);
+  run("context shadow vertex buffer range", testVertexBufferRange);
+  run("context shadow srv and sampler ranges", testShaderResourceAndSamplerRanges);
+  run("context shadow render targets drop srvs", testRenderTargetsDropShaderResources);
+  run("context shadow invalidate", testInvalidate);
+
+  return result();
+}
@@ -0,0 +1,279 @@
+#include "../src/d3d9/d3d9_format_convert.h"
+#include "test_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  const D3DFORMAT Formats[] = {
+    D3DFMT_R8G8B8,
+    D3DFMT_L8,
+    D3DFMT_A8L8,
+    D3DFMT_A4L4,
+    D3DFMT_X4R4G4B4,
+    D3DFMT_R3G3B2,
+    D3DFMT_A8R3G3B2,
+    D3DFMT_P8,
+    D3DFMT_L6V5U5
+  };
+
+  // Bytes past the end of every destination row that no conversion may touch.
+  constexpr uint32_t GuardSize = 64;
+  constexpr uint8_t Guard = 0xCD;
+
+  uint32_t pixel(uint32_t b, uint32_t g, uint32_t r, uint32_t a) {
+    return b | (g << 8) | (r << 16) | (a << 24);
+  }
+
+  // Written from the format definitions rather than the converter: rounded unorm scaling, truncated snorm scaling.
+  uint32_t unorm8(uint32_t value, uint32_t bits) {
+    return uint32_t(std::lround(value * 255.0 / ((1u << bits) - 1)));
+  }
+
+  uint32_t snorm8(uint32_t value, uint32_t bits) {
+    int32_t signedValue = value >= (1u << (bits - 1)) ? int32_t(value) - int32_t(1u << bits) : int32_t(value);
+    int32_t scaled = std::max(int32_t(std::trunc(signedValue * 127.0 / ((1 << (bits - 1)) - 1))), -127);
+    return uint8_t(int8_t(scaled));
+  }
+
+  std::array<PALETTEENTRY, 256> testPalette() {
+    std::array<PALETTEENTRY, 256> palette;
+    for (uint32_t i = 0; i < 256; i++)
+      palette[i] = PALETTEENTRY{ BYTE(i), BYTE(255 - i), BYTE(i * 7), BYTE(i ^ 0x5A) };
+    return palette;
+  }
+
+  // What a pixel whose bytes read value in little endian should come out as.
+  uint32_t reference(D3DFORMAT format, const PALETTEENTRY* palette, uint32_t value) {
+    switch (format) {
+    case D3DFMT_R8G8B8:
+      return value | 0xFF000000;
+
+    case D3DFMT_L8:
+      return pixel(value, value, value, 0xFF);
+
+    case D3DFMT_A8L8:
+      return pixel(value & 0xFF, value & 0xFF, value & 0xFF, value >> 8);
+
+    case D3DFMT_A4L4: {
+      uint32_t l = unorm8(value & 0xF, 4);
+      return pixel(l, l, l, unorm8(value >> 4, 4));
+    }
+
+    case D3DFMT_X4R4G4B4:
+      return pixel(unorm8(value & 0xF, 4), unorm8((value >> 4) & 0xF, 4), unorm8((value >> 8) & 0xF, 4), 0xFF);
+
+    case D3DFMT_R3G3B2:
+    case D3DFMT_A8R3G3B2: {
+      uint32_t alpha = format == D3DFMT_A8R3G3B2 ? value >> 8 : 0xFF;
+      return pixel(unorm8(value & 0x3, 2), unorm8((value >> 2) & 0x7, 3), unorm8((value >> 5) & 0x7, 3), alpha);
+    }
+
+    case D3DFMT_P8:
+      if (palette == nullptr)
+        return pixel(value, value, value, 0xFF);
+      return pixel(palette[value].peBlue, palette[value].peGreen, palette[value].peRed, palette[value].peFlags);
+
+    case D3DFMT_L6V5U5:
+      return snorm8(value & 0x1F, 5) | (snorm8((value >> 5) & 0x1F, 5) << 8) | ((((value >> 10) & 0x3F) * 127 / 63) << 16) | (127u << 24);
+
+    default:
+      return 0;
+    }
+  }
+
+  uint32_t bytesPerPixel(D3DFORMAT format) {
+    return conversionBitsPerPixel(format) / 8;
+  }
+
+  std::vector<uint8_t> randomRow(D3DFORMAT format, UINT width, std::mt19937& rng) {
+    std::vector<uint8_t> row(width * bytesPerPixel(format));
+    for (uint8_t& byte : row)
+      byte = uint8_t(rng());
+    return row;
+  }
+
+  // Converts a single row into a guarded buffer and checks nothing past it was written.
+  std::vector<uint8_t> convertRow(D3DFORMAT format, const PALETTEENTRY* palette, const std::vector<uint8_t>& src, UINT width) {
+    std::vector<uint8_t> dst(width * 4 + GuardSize, Guard);
+    convertPixels(format, palette, dst.data(), width * 4, width * 4, src.data(), UINT(src.size()), UINT(src.size()), width, 1, 1);
+
+    DXUP_CHECK(std::all_of(dst.begin() + width * 4, dst.end(), [](uint8_t byte) { return byte == Guard; }));
+
+    dst.resize(width * 4);
+    return dst;
+  }
+
+  // Every value of the 8 and 16 bit formats in one row, through whichever kernels this CPU gets.
+  void testEveryInput(bool scalar) {
+    forceScalarConversion(scalar);
+    const std::array<PALETTEENTRY, 256> palette = testPalette();
+
+    for (D3DFORMAT format : Formats) {
+      uint32_t bytes = bytesPerPixel(format);
+      if (bytes == 3)
+        continue;
+
+      UINT width = 1u << (bytes * 8);
+      std::vector<uint8_t> src(width * bytes);
+      for (uint32_t i = 0; i < width; i++)
+        std::memcpy(&src[i * bytes], &i, bytes);
+
+      for (const PALETTEENTRY* pal : { static_cast<const PALETTEENTRY*>(nullptr), palette.data() }) {
+        if (pal != nullptr && format != D3DFMT_P8)
+          continue;
+
+        std::vector<uint8_t> dst = convertRow(format, pal, src, width);
+
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < width; i++) {
+          uint32_t out;
+          std::memcpy(&out, &dst[i * 4], sizeof(out));
+          if (out != reference(format, pal, i)) {
+            if (mismatches++ == 0)
+              std::fprintf(stderr, "format %d, input 0x%x: got 0x%08x, expected 0x%08x\n", format, i, out, reference(format, pal, i));
+          }
+        }
+
+        DXUP_CHECK(mismatches == 0);
+      }
+    }
+
+    forceScalarConversion(false);
+  }
+
+  void testEveryInputSimd() {
+    testEveryInput(false);
+  }
+
+  void testEveryInputScalar() {
+    testEveryInput(true);
+  }
+
+  // All 2^24 R8G8B8 pixels, a row of 4096 at a time.
+  void testEveryR8G8B8Input() {
+    constexpr UINT Width = 4096;
+    std::vector<uint8_t> src(Width * 3);
+    std::vector<uint8_t> dst(Width * 4);
+
+    uint32_t mismatches = 0;
+    for (uint32_t row = 0; row < (1u << 24) / Width; row++) {
+      for (uint32_t x = 0; x < Width; x++) {
+        uint32_t value = row * Width + x;
+        std::memcpy(&src[x * 3], &value, 3);
+      }
+
+      convertPixels(D3DFMT_R8G8B8, nullptr, dst.data(), Width * 4, Width * 4, src.data(), Width * 3, Width * 3, Width, 1, 1);
+
+      for (uint32_t x = 0; x < Width; x++) {
+        uint32_t out;
+        std::memcpy(&out, &dst[x * 4], sizeof(out));
+        if (out != reference(D3DFMT_R8G8B8, nullptr, row * Width + x))
+          mismatches++;
+      }
+    }
+
+    DXUP_CHECK(mismatches == 0);
+  }
+
+  // Every width up to 64 so each kernel's vector loop runs zero, one and several times with every tail length after it.
+  void testSimdMatchesScalarAtEveryWidth() {
+    std::mt19937 rng(0xD3D9);
+    std::array<PALETTEENTRY, 256> palette = testPalette();
+
+    for (D3DFORMAT format : Formats) {
+      const PALETTEENTRY* pal = format == D3DFMT_P8 ? palette.data() : nullptr;
+
+      for (UINT width = 0; width <= 64; width++) {
+        std::vector<uint8_t> src = randomRow(format, width, rng);
+
+        forceScalarConversion(false);
+        std::vector<uint8_t> simd = convertRow(format, pal, src, width);
+
+        forceScalarConversion(true);
+        std::vector<uint8_t> scalar = convertRow(format, pal, src, width);
+
+        if (simd != scalar)
+          std::fprintf(stderr, "format %d, width %u: SIMD and scalar differ\n", format, width);
+        DXUP_CHECK(simd == scalar);
+      }
+    }
+
+    forceScalarConversion(false);
+  }
+
+  // A box inside larger padded rows and slices only touches its own pixels.
+  void testPitchesAndDepth() {
+    constexpr UINT Width = 19, Height = 5, Depth = 3;
+    constexpr UINT SrcRowPitch = Width * 2 + 10, SrcSlicePitch = SrcRowPitch * Height + 6;
+    constexpr UINT DstRowPitch = Width * 4 + 24, DstSlicePitch = DstRowPitch * Height + 40;
+
+    std::mt19937 rng(9);
+    std::vector<uint8_t> src(SrcSlicePitch * Depth);
+    for (uint8_t& byte : src)
+      byte = uint8_t(rng());
+
+    std::vector<uint8_t> dst(DstSlicePitch * Depth, Guard);
+    convertPixels(D3DFMT_X4R4G4B4, nullptr, dst.data(), DstRowPitch, DstSlicePitch, src.data(), SrcRowPitch, SrcSlicePitch, Width, Height, Depth);
+
+    uint32_t mismatches = 0;
+    uint32_t overwrites = 0;
+    for (UINT z = 0; z < Depth; z++) {
+      for (UINT y = 0; y < Height; y++) {
+        const uint8_t* srcRow = &src[z * SrcSlicePitch + y * SrcRowPitch];
+        const uint8_t* dstRow = &dst[z * DstSlicePitch + y * DstRowPitch];
+
+        for (UINT x = 0; x < Width; x++) {
+          uint16_t in;
+          uint32_t out;
+          std::memcpy(&in, &srcRow[x * 2], sizeof(in));
+          std::memcpy(&out, &dstRow[x * 4], sizeof(out));
+          if (out != reference(D3DFMT_X4R4G4B4, nullptr, in))
+            mismatches++;
+        }
+
+        for (UINT x = Width * 4; x < DstRowPitch; x++) {
+          if (dstRow[x] != Guard)
+            overwrites++;
+        }
+      }
+    }
+
+    DXUP_CHECK(mismatches == 0);
+    DXUP_CHECK(overwrites == 0);
+  }
+
+  void testWhichFormatsConvert() {
+    for (D3DFORMAT format : Formats)
+      DXUP_CHECK(needsConversion(format));
+
+    DXUP_CHECK(conversionBitsPerPixel(D3DFMT_R8G8B8) == 24);
+    DXUP_CHECK(conversionBitsPerPixel(D3DFMT_L6V5U5) == 16);
+    DXUP_CHECK(conversionBitsPerPixel(D3DFMT_P8) == 8);
+
+    // DXGI has these natively.
+    DXUP_CHECK(!needsConversion(D3DFMT_A8R8G8B8));
+    DXUP_CHECK(!needsConversion(D3DFMT_V8U8));
+    DXUP_CHECK(!needsConversion(D3DFMT_R5G6B5));
+  }
+
+}
+
+int main() {
+  run("format convert which formats convert", testWhichFormatsConvert);
+  run("format convert every 8 and 16 bit input", testEveryInputSimd);
+  run("format convert every 8 and 16 bit input, scalar", testEveryInputScalar);
+  run("format convert every R8G8B8 input", testEveryR8G8B8Input);
+  run("format convert SIMD matches scalar at every width", testSimdMatchesScalarAtEveryWidth);
+  run("format convert pitches and depth", testPitchesAndDepth);
+
+  return result();
+}
@@ -0,0 +1,148 @@
+#include "test_renderer.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  // Per-vertex positions on stream 0, per-instance data on stream 1.
+  RendererFixture instancedFixture() {
+    return RendererFixture{
+      {
+        inputElement("POSITION", DXGI_FORMAT_R32G32B32_FLOAT, 0, 0),
+        inputElement("TEXCOORD", DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0)
+      },
+      {
+        vertexElement(0, 0, D3DDECLTYPE_FLOAT3, D3DDECLUSAGE_POSITION),
+        vertexElement(1, 0, D3DDECLTYPE_FLOAT4, D3DDECLUSAGE_TEXCOORD),
+        D3DVERTEXELEMENT9 D3DDECL_END()
+      }
+    };
+  }
+
+  const MockInputLayout* boundLayout(RendererFixture& fixture) {
+    return static_cast<const MockInputLayout*>(fixture.context.inputLayout);
+  }
+
+  void testInstancedDraw() {
+    RendererFixture fixture = instancedFixture();
+
+    DXUP_CHECK(SUCCEEDED(fixture.state.SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | 4)));
+    DXUP_CHECK(SUCCEEDED(fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1)));
+
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 5, 0, 3, 6, 2);
+
+    DXUP_CHECK(fixture.context.calls.drawIndexedInstanced == 1);
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 0);
+    DXUP_CHECK(fixture.context.lastDraw.count == 6);
+    DXUP_CHECK(fixture.context.lastDraw.instanceCount == 4);
+    DXUP_CHECK(fixture.context.lastDraw.start == 6);
+    DXUP_CHECK(fixture.context.lastDraw.baseVertex == 5);
+    DXUP_CHECK(fixture.context.lastDraw.startInstance == 0);
+
+    const MockInputLayout* layout = boundLayout(fixture);
+    DXUP_CHECK(layout != nullptr);
+    if (layout == nullptr)
+      return;
+
+    const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements = layout->elements();
+    DXUP_CHECK(elements.size() == 2);
+    DXUP_CHECK(elements[0].InputSlot == 0);
+    DXUP_CHECK(elements[0].InputSlotClass == D3D11_INPUT_PER_VERTEX_DATA);
+    DXUP_CHECK(elements[0].InstanceDataStepRate == 0);
+    DXUP_CHECK(elements[1].InputSlot == 1);
+    DXUP_CHECK(elements[1].InputSlotClass == D3D11_INPUT_PER_INSTANCE_DATA);
+    DXUP_CHECK(elements[1].InstanceDataStepRate == 1);
+    DXUP_CHECK(std::string(elements[1].SemanticName) == "TEXCOORD");
+  }
+
+  void testLayoutVariantsAreCached() {
+    RendererFixture fixture = instancedFixture();
+
+    fixture.state.SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | 8);
+    fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1);
+
+    const MockInputLayout* rateOne = boundLayout(fixture);
+    size_t layouts = fixture.device.inputLayouts.size();
+
+    // A different divisor is a different layout.
+    fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 2);
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1);
+
+    const MockInputLayout* rateTwo = boundLayout(fixture);
+    DXUP_CHECK(rateTwo != rateOne);
+    DXUP_CHECK(fixture.device.inputLayouts.size() == layouts + 1);
+    DXUP_CHECK(rateTwo->elements()[1].InstanceDataStepRate == 2);
+
+    // Going back finds the one we already made.
+    fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1);
+
+    DXUP_CHECK(boundLayout(fixture) == rateOne);
+    DXUP_CHECK(fixture.device.inputLayouts.size() == layouts + 1);
+
+    // Changing only the instance count is not a layout change.
+    uint32_t layoutBinds = fixture.context.calls.setInputLayout;
+    fixture.state.SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | 3);
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1);
+
+    DXUP_CHECK(fixture.context.calls.setInputLayout == layoutBinds);
+    DXUP_CHECK(fixture.context.lastDraw.instanceCount == 3);
+  }
+
+  void testResetToPerVertex() {
+    RendererFixture fixture = instancedFixture();
+
+    fixture.state.SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | 2);
+    fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1);
+
+    fixture.state.SetStreamSourceFreq(0, 1);
+    fixture.state.SetStreamSourceFreq(1, 1);
+    fixture.renderer.DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1);
+
+    DXUP_CHECK(fixture.context.calls.drawIndexedInstanced == 1);
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 1);
+
+    const MockInputLayout* layout = boundLayout(fixture);
+    for (const D3D11_INPUT_ELEMENT_DESC& element : layout->elements())
+      DXUP_CHECK(element.InputSlotClass == D3D11_INPUT_PER_VERTEX_DATA);
+  }
+
+  void testOnlyIndexedDrawsInstance() {
+    RendererFixture fixture = instancedFixture();
+
+    fixture.state.SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | 4);
+    fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+    fixture.renderer.DrawPrimitive(D3DPT_TRIANGLELIST, 0, 1);
+
+    DXUP_CHECK(fixture.context.calls.draw == 1);
+    DXUP_CHECK(fixture.context.calls.drawInstanced == 0);
+    DXUP_CHECK(fixture.context.calls.drawIndexedInstanced == 0);
+  }
+
+  void testInvalidSettings() {
+    RendererFixture fixture = instancedFixture();
+
+    DXUP_CHECK(fixture.state.SetStreamSourceFreq(0, D3DSTREAMSOURCE_INSTANCEDATA | 1) == D3DERR_INVALIDCALL);
+    DXUP_CHECK(fixture.state.SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | D3DSTREAMSOURCE_INDEXEDDATA | 1) == D3DERR_INVALIDCALL);
+    DXUP_CHECK(fixture.state.SetStreamSourceFreq(1, 0) == D3DERR_INVALIDCALL);
+    DXUP_CHECK(fixture.state.SetStreamSourceFreq(16, 1) == D3DERR_INVALIDCALL);
+
+    // None of them stuck.
+    DXUP_CHECK(fixture.state.getStreamFreq(0) == 1);
+    DXUP_CHECK(fixture.state.getStreamFreq(1) == 1);
+  }
+
+}
+
+int main() {
+  run("instancing draw parameters and layout", testInstancedDraw);
+  run("instancing layout variants are cached", testLayoutVariantsAreCached);
+  run("instancing reset to per vertex", testResetToPerVertex);
+  run("instancing only on indexed draws", testOnlyIndexedDrawsInstance);
+  run("instancing rejects invalid settings", testInvalidSettings);
+
+  return result();
+}
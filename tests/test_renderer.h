@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../src/d3d9/d3d9_renderer.h"
+#include "mock_d3d11.h"
+#include "test_utils.h"
+
+namespace dxup {
+
+  namespace test {
+
+    // A D3D9State with what a device reset would normally fill in, and a look at what the renderer leaves dirty.
+    class TestState : public D3D9State {
+
+    public:
+
+      TestState()
+        : D3D9State{ nullptr, 0 } {
+        renderState.fill(0);
+        for (auto& states : samplerStates)
+          states.fill(0);
+
+        std::memset(&viewport, 0, sizeof(viewport));
+        std::memset(&scissorRect, 0, sizeof(scissorRect));
+
+        SetRenderState(D3DRS_FILLMODE, D3DFILL_SOLID);
+        SetRenderState(D3DRS_CULLMODE, D3DCULL_NONE);
+        SetRenderState(D3DRS_ZFUNC, D3DCMP_LESSEQUAL);
+        SetRenderState(D3DRS_STENCILFUNC, D3DCMP_ALWAYS);
+        SetRenderState(D3DRS_SRCBLEND, D3DBLEND_ONE);
+        SetRenderState(D3DRS_DESTBLEND, D3DBLEND_ZERO);
+        SetRenderState(D3DRS_BLENDOP, D3DBLENDOP_ADD);
+        SetRenderState(D3DRS_COLORWRITEENABLE, 0xF);
+        SetRenderState(D3DRS_BLENDFACTOR, 0xFFFFFFFF);
+
+        D3DVIEWPORT9 vp = { 0, 0, 640, 480, 0.0f, 1.0f };
+        SetViewport(&vp);
+      }
+
+      UINT getStreamFreq(UINT stream) const {
+        return streamFreqs[stream];
+      }
+
+    };
+
+    inline D3D11_INPUT_ELEMENT_DESC inputElement(const char* semantic, DXGI_FORMAT format, UINT slot, UINT offset) {
+      return D3D11_INPUT_ELEMENT_DESC{ semantic, 0, format, slot, offset, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+    }
+
+    inline D3DVERTEXELEMENT9 vertexElement(WORD stream, WORD offset, BYTE type, BYTE usage) {
+      return D3DVERTEXELEMENT9{ stream, offset, type, D3DDECLMETHOD_DEFAULT, usage, 0 };
+    }
+
+    // An immediate renderer over the mock device with a position-only (or given) declaration and an empty vs_2_0 bound.
+    struct RendererFixture {
+
+      RendererFixture()
+        : RendererFixture{
+            { inputElement("POSITION", DXGI_FORMAT_R32G32B32_FLOAT, 0, 0) },
+            { vertexElement(0, 0, D3DDECLTYPE_FLOAT3, D3DDECLUSAGE_POSITION), D3DVERTEXELEMENT9 D3DDECL_END() } } {}
+
+      RendererFixture(std::vector<D3D11_INPUT_ELEMENT_DESC> d3d11Elements, std::vector<D3DVERTEXELEMENT9> d3d9Elements) {
+        decl = new Direct3DVertexDeclaration9(nullptr, d3d11Elements, d3d9Elements);
+
+        // vs_2_0, end.
+        static const DWORD code[] = { 0xFFFE0200, 0x0000FFFF };
+
+        dx9asm::ShaderBytecode* translation = nullptr;
+        dx9asm::toDXBC(reinterpret_cast<const uint32_t*>(code), &translation);
+
+        Com<ID3D11VertexShader> d3d11Shader;
+        device.CreateVertexShader(translation->getBytecode(), translation->getByteSize(), nullptr, &d3d11Shader);
+
+        shader = new Direct3DVertexShader9(0, nullptr, code, d3d11Shader.ptr(), translation);
+
+        state.SetVertexDeclaration(decl.ptr());
+        state.SetVertexShader(shader.ptr());
+      }
+
+      MockDevice device;
+      MockContext context{ &device };
+      TestState state;
+      D3D9ImmediateRenderer renderer{ &device, &context, &state };
+
+      Com<Direct3DVertexDeclaration9> decl;
+      Com<Direct3DVertexShader9> shader;
+
+      // Contents of whatever buffer the context has bound, starting at the bound offset.
+      template <typename T>
+      const T* boundVertices(UINT slot) {
+        MockBuffer* buffer = static_cast<MockBuffer*>(context.vertexBuffers[slot]);
+        return reinterpret_cast<const T*>(buffer->data() + context.vertexOffsets[slot]);
+      }
+
+      template <typename T>
+      const T* boundIndices() {
+        MockBuffer* buffer = static_cast<MockBuffer*>(context.indexBuffer);
+        return reinterpret_cast<const T*>(buffer->data() + context.indexOffset);
+      }
+
+    };
+
+  }
+
+}
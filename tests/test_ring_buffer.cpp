@@ -0,0 +1,179 @@
+#include "../src/d3d9/d3d11_ring_buffer.h"
+#include "../src/d3d9/d3d11_upload_heap.h"
+#include "mock_d3d11.h"
+#include "test_utils.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  constexpr uint32_t ChunkSize = 256 * 1024;
+
+  uint32_t write(MockContext& context, D3D11RingBuffer& ring, uint32_t length, uint8_t value = 0) {
+    ring.reserve(&context, length);
+
+    void* data;
+    ring.map(&context, &data, length);
+    std::memset(data, value, length);
+    return ring.unmap(&context, length);
+  }
+
+  void testAlignmentAndMapTypes() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11RingBuffer ring(&device, D3D11_BIND_VERTEX_BUFFER, 16);
+
+    DXUP_CHECK(ring.getBuffer() == nullptr);
+
+    DXUP_CHECK(write(context, ring, 5) == 0);
+    DXUP_CHECK(write(context, ring, 17) == 16);
+    DXUP_CHECK(write(context, ring, 16) == 48);
+    DXUP_CHECK(ring.getOffset() == 64);
+
+    // Only the first write into a chunk may throw its contents away.
+    DXUP_CHECK(context.calls.mapDiscard == 1);
+    DXUP_CHECK(context.calls.mapNoOverwrite == 2);
+    DXUP_CHECK(device.buffersCreated == 1);
+  }
+
+  void testWritesLandAtTheirOffset() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11RingBuffer ring(&device, D3D11_BIND_VERTEX_BUFFER, 16);
+
+    uint32_t a = write(context, ring, 32, 0xAA);
+    uint32_t b = write(context, ring, 32, 0xBB);
+
+    MockBuffer* buffer = static_cast<MockBuffer*>(ring.getBuffer());
+    DXUP_CHECK(buffer->data()[a] == 0xAA && buffer->data()[a + 31] == 0xAA);
+    DXUP_CHECK(buffer->data()[b] == 0xBB && buffer->data()[b + 31] == 0xBB);
+  }
+
+  void testGrowsWhenFull() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11RingBuffer ring(&device, D3D11_BIND_VERTEX_BUFFER, 16);
+
+    write(context, ring, ChunkSize - 16);
+    ID3D11Buffer* first = ring.getBuffer();
+
+    // Still fits.
+    DXUP_CHECK(write(context, ring, 16) == ChunkSize - 16);
+    DXUP_CHECK(ring.getBuffer() == first);
+
+    // Doesn't, and the full chunk is still in use this frame, so we need another one, twice as big.
+    DXUP_CHECK(write(context, ring, 16) == 0);
+    DXUP_CHECK(ring.getBuffer() != first);
+    DXUP_CHECK(device.buffersCreated == 2);
+
+    D3D11_BUFFER_DESC desc;
+    ring.getBuffer()->GetDesc(&desc);
+    DXUP_CHECK(desc.ByteWidth == ChunkSize * 2);
+    DXUP_CHECK(desc.Usage == D3D11_USAGE_DYNAMIC);
+    DXUP_CHECK(desc.BindFlags == D3D11_BIND_VERTEX_BUFFER);
+
+    // Something bigger than any chunk gets a chunk big enough for it.
+    write(context, ring, ChunkSize * 5);
+    ring.getBuffer()->GetDesc(&desc);
+    DXUP_CHECK(desc.ByteWidth == ChunkSize * 8);
+    DXUP_CHECK(device.buffersCreated == 3);
+  }
+
+  void testChunksRecycledOnlyAfterFence() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11RingBuffer ring(&device, D3D11_BIND_VERTEX_BUFFER, 16);
+
+    write(context, ring, ChunkSize);
+    ID3D11Buffer* first = ring.getBuffer();
+
+    ring.endFrame(&context);
+    DXUP_CHECK(device.queriesCreated == 1);
+    DXUP_CHECK(context.calls.end == 1);
+
+    write(context, ring, ChunkSize * 2);
+    ID3D11Buffer* second = ring.getBuffer();
+    DXUP_CHECK(second != first);
+
+    ring.endFrame(&context);
+
+    // The GPU hasn't caught up with either frame, so the first chunk can't be touched yet.
+    write(context, ring, ChunkSize);
+    ID3D11Buffer* third = ring.getBuffer();
+    DXUP_CHECK(third != first && third != second);
+    DXUP_CHECK(device.buffersCreated == 3);
+
+    write(context, ring, ChunkSize * 3);
+    DXUP_CHECK(ring.getBuffer() == third);
+
+    context.finishGpuWork();
+
+    // Now it comes back, and the first write into it discards.
+    uint32_t discards = context.calls.mapDiscard;
+    DXUP_CHECK(write(context, ring, ChunkSize) == 0);
+    DXUP_CHECK(ring.getBuffer() == first);
+    DXUP_CHECK(context.calls.mapDiscard == discards + 1);
+    DXUP_CHECK(device.buffersCreated == 3);
+  }
+
+  void testCurrentChunkCarriesOver() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11RingBuffer ring(&device, D3D11_BIND_VERTEX_BUFFER, 16);
+
+    write(context, ring, 64);
+    ring.endFrame(&context);
+    context.finishGpuWork();
+
+    // The chunk we were filling keeps going after the end of the frame without a discard.
+    DXUP_CHECK(write(context, ring, 64) == 64);
+    DXUP_CHECK(context.calls.mapDiscard == 1);
+    DXUP_CHECK(context.calls.mapNoOverwrite == 1);
+  }
+
+  void testUploadHeapAlignment() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11UploadHeap heap(&device);
+
+    DXUP_CHECK(D3D11UploadHeap::alignedLength(1) == 16);
+    DXUP_CHECK(D3D11UploadHeap::alignedLength(32) == 32);
+
+    // Geometry pushes in one map share a buffer and stay 16 byte aligned.
+    const uint8_t vertices[20] = {};
+    const uint8_t indices[6] = {};
+
+    heap.begin(&context, uploadUsage::vertices, D3D11UploadHeap::alignedLength(sizeof(vertices)) + D3D11UploadHeap::alignedLength(sizeof(indices)));
+    uint32_t vertexOffset = heap.push(uploadUsage::vertices, vertices, sizeof(vertices));
+    uint32_t indexOffset = heap.push(uploadUsage::indices, indices, sizeof(indices));
+    ID3D11Buffer* geometry = heap.end(&context);
+
+    DXUP_CHECK(vertexOffset == 0);
+    DXUP_CHECK(indexOffset == 32);
+    DXUP_CHECK(context.calls.map == 1);
+
+    // Constants live in their own buffer, at offsets *SetConstantBuffers1 can address.
+    const uint8_t constants[32] = {};
+    ID3D11Buffer* constantBuffer;
+    DXUP_CHECK(heap.upload(&context, uploadUsage::constants, constants, sizeof(constants), &constantBuffer) == 0);
+    DXUP_CHECK(heap.upload(&context, uploadUsage::constants, constants, sizeof(constants), &constantBuffer) == 256);
+    DXUP_CHECK(constantBuffer != geometry);
+
+    D3D11_BUFFER_DESC desc;
+    constantBuffer->GetDesc(&desc);
+    DXUP_CHECK(desc.BindFlags == D3D11_BIND_CONSTANT_BUFFER);
+  }
+
+}
+
+int main() {
+  run("ring buffer alignment and map types", testAlignmentAndMapTypes);
+  run("ring buffer writes land at their offset", testWritesLandAtTheirOffset);
+  run("ring buffer grows when full", testGrowsWhenFull);
+  run("ring buffer recycles chunks only after their fence", testChunksRecycledOnlyAfterFence);
+  run("ring buffer current chunk carries over", testCurrentChunkCarriesOver);
+  run("upload heap alignment", testUploadHeapAlignment);
+
+  return result();
+}
@@ -0,0 +1,129 @@
+#include "../src/d3d9/d3d11_staging_pool.h"
+#include "mock_d3d11.h"
+#include "test_utils.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  constexpr uint64_t MiB = 1024 * 1024;
+
+  // Owners are only ever compared, any distinct addresses do.
+  int ownerStorage[3];
+  DXUPResource* const OwnerA = reinterpret_cast<DXUPResource*>(&ownerStorage[0]);
+  DXUPResource* const OwnerB = reinterpret_cast<DXUPResource*>(&ownerStorage[1]);
+  DXUPResource* const OwnerC = reinterpret_cast<DXUPResource*>(&ownerStorage[2]);
+
+  // A DEFAULT RGBA8 texture of size x size, 4 * size * size bytes of staging.
+  Com<ID3D11Resource> makeTexture(MockDevice& device, UINT size) {
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = size;
+    desc.Height = size;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_DEFAULT;
+
+    Com<ID3D11Texture2D> texture;
+    device.CreateTexture2D(&desc, nullptr, &texture);
+    return texture.ptr();
+  }
+
+  // Borrows staging for texture and gives it straight back, returns whether it came back intact.
+  bool cycle(D3D11StagingPool& pool, MockContext& context, DXUPResource* owner, ID3D11Resource* texture) {
+    Com<ID3D11Resource> staging;
+    bool intact = false;
+    DXUP_CHECK(pool.acquire(&context, owner, texture, staging, &intact));
+    pool.release(&context, owner, staging.ptr());
+    return intact;
+  }
+
+  void testReusesOwnStaging() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11StagingPool pool(&device, 32 * MiB);
+
+    Com<ID3D11Resource> texture = makeTexture(device, 256);
+    uint32_t before = device.texturesCreated;
+
+    DXUP_CHECK(!cycle(pool, context, OwnerA, texture.ptr()));
+    DXUP_CHECK(cycle(pool, context, OwnerA, texture.ptr()));
+    DXUP_CHECK(device.texturesCreated == before + 1);
+  }
+
+  void testOversizedStagingSurvives() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11StagingPool pool(&device, 1 * MiB);
+
+    // 4MiB of staging against a 1MiB budget, every lock after the first still gets it back as it left it.
+    Com<ID3D11Resource> texture = makeTexture(device, 1024);
+    uint32_t before = device.texturesCreated;
+
+    cycle(pool, context, OwnerA, texture.ptr());
+    for (uint32_t i = 0; i < 8; i++)
+      DXUP_CHECK(cycle(pool, context, OwnerA, texture.ptr()));
+
+    DXUP_CHECK(device.texturesCreated == before + 1);
+  }
+
+  void testOlderEntriesGoFirst() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11StagingPool pool(&device, 4 * MiB);
+
+    Com<ID3D11Resource> small = makeTexture(device, 512);
+    Com<ID3D11Resource> big = makeTexture(device, 1024);
+    uint32_t before = device.texturesCreated;
+
+    // 1MiB, 1MiB, then 4MiB: both small ones make way for the big one.
+    cycle(pool, context, OwnerA, small.ptr());
+    context.finishGpuWork();
+
+    Com<ID3D11Resource> heldA;
+    Com<ID3D11Resource> heldB;
+    bool intact;
+    pool.acquire(&context, OwnerA, small.ptr(), heldA, &intact);
+    pool.acquire(&context, OwnerB, small.ptr(), heldB, &intact);
+    pool.release(&context, OwnerA, heldA.ptr());
+    pool.release(&context, OwnerB, heldB.ptr());
+
+    cycle(pool, context, OwnerC, big.ptr());
+    DXUP_CHECK(device.texturesCreated == before + 3);
+
+    DXUP_CHECK(cycle(pool, context, OwnerC, big.ptr()));
+    DXUP_CHECK(!cycle(pool, context, OwnerA, small.ptr()));
+    DXUP_CHECK(device.texturesCreated == before + 4);
+  }
+
+  void testOwnerlessOversizedStagingIsEvicted() {
+    MockDevice device;
+    MockContext context(&device);
+    D3D11StagingPool pool(&device, 1 * MiB);
+
+    Com<ID3D11Resource> texture = makeTexture(device, 1024);
+    uint32_t before = device.texturesCreated;
+
+    // Given back by a texture that's going away, nobody is coming back for it.
+    Com<ID3D11Resource> staging;
+    bool intact;
+    pool.acquire(&context, OwnerA, texture.ptr(), staging, &intact);
+    pool.release(nullptr, nullptr, staging.ptr());
+    staging = nullptr;
+
+    DXUP_CHECK(!cycle(pool, context, OwnerB, texture.ptr()));
+    DXUP_CHECK(device.texturesCreated == before + 2);
+  }
+
+}
+
+int main() {
+  run("staging pool reuses own staging", testReusesOwnStaging);
+  run("staging pool oversized staging survives", testOversizedStagingSurvives);
+  run("staging pool older entries go first", testOlderEntriesGoFirst);
+  run("staging pool ownerless oversized staging is evicted", testOwnerlessOversizedStagingIsEvicted);
+
+  return result();
+}
@@ -0,0 +1,204 @@
+#include "../src/d3d9/d3d9_state_cache.h"
+#include "mock_d3d11.h"
+#include "test_utils.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  using SamplerCache = StateCache<D3D11_SAMPLER_DESC, ID3D11SamplerState>;
+
+  D3D11_SAMPLER_DESC samplerDesc(uint32_t id) {
+    D3D11_SAMPLER_DESC desc = {};
+    desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    desc.AddressU = D3D11_TEXTURE_ADDRESS_WRAP;
+    desc.AddressV = D3D11_TEXTURE_ADDRESS_WRAP;
+    desc.AddressW = D3D11_TEXTURE_ADDRESS_WRAP;
+    desc.MaxAnisotropy = 1;
+    desc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    desc.MaxLOD = float(id);
+    return desc;
+  }
+
+  Com<ID3D11SamplerState> makeSampler(MockDevice& device, const D3D11_SAMPLER_DESC& desc) {
+    Com<ID3D11SamplerState> sampler;
+    device.CreateSamplerState(&desc, &sampler);
+    return sampler;
+  }
+
+  // Pushes id under the given hash and hands back the object so it can be compared against lookups.
+  ID3D11SamplerState* push(MockDevice& device, SamplerCache& cache, size_t hash, uint32_t id) {
+    D3D11_SAMPLER_DESC desc = samplerDesc(id);
+    Com<ID3D11SamplerState> sampler = makeSampler(device, desc);
+    cache.pushState(hash, desc, sampler.ptr());
+    return sampler.ptr();
+  }
+
+  ID3D11SamplerState* lookup(SamplerCache& cache, size_t hash, uint32_t id) {
+    return cache.lookupObject(hash, samplerDesc(id));
+  }
+
+  void testHitAndMiss() {
+    MockDevice device;
+    SamplerCache cache;
+
+    D3D11_SAMPLER_DESC desc = samplerDesc(0);
+    size_t hash = cache.hash(desc);
+
+    DXUP_CHECK(cache.lookupObject(hash, desc) == nullptr);
+    DXUP_CHECK(cache.misses() == 1);
+
+    ID3D11SamplerState* sampler = push(device, cache, hash, 0);
+    DXUP_CHECK(cache.lookupObject(hash, desc) == sampler);
+    DXUP_CHECK(cache.lookupObject(cache.hash(samplerDesc(0)), samplerDesc(0)) == sampler);
+    DXUP_CHECK(cache.hits() == 2);
+    DXUP_CHECK(cache.size() == 1);
+  }
+
+  void testCollisionsCompareDescs() {
+    MockDevice device;
+    SamplerCache cache;
+
+    // Same hash, different descs, a hash match alone must never be a hit.
+    ID3D11SamplerState* a = push(device, cache, 42, 1);
+    ID3D11SamplerState* b = push(device, cache, 42, 2);
+
+    DXUP_CHECK(lookup(cache, 42, 1) == a);
+    DXUP_CHECK(lookup(cache, 42, 2) == b);
+    DXUP_CHECK(lookup(cache, 42, 3) == nullptr);
+
+    // Neighbouring home slot lands in the middle of the chain.
+    ID3D11SamplerState* c = push(device, cache, 43, 3);
+    DXUP_CHECK(lookup(cache, 43, 3) == c);
+    DXUP_CHECK(lookup(cache, 43, 1) == nullptr);
+    DXUP_CHECK(cache.size() == 3);
+  }
+
+  void testEvictsLeastRecentlyUsed() {
+    MockDevice device;
+    SamplerCache cache;
+
+    std::vector<ID3D11SamplerState*> samplers;
+    for (uint32_t i = 0; i < SamplerCache::MaxObjects; i++)
+      samplers.push_back(push(device, cache, i, i));
+
+    DXUP_CHECK(cache.size() == SamplerCache::MaxObjects);
+    DXUP_CHECK(cache.evictions() == 0);
+
+    // Touch the oldest so the next one in line goes instead.
+    DXUP_CHECK(lookup(cache, 0, 0) == samplers[0]);
+
+    push(device, cache, SamplerCache::MaxObjects, SamplerCache::MaxObjects);
+
+    DXUP_CHECK(cache.evictions() == 1);
+    DXUP_CHECK(cache.size() == SamplerCache::MaxObjects);
+    DXUP_CHECK(lookup(cache, 0, 0) == samplers[0]);
+    DXUP_CHECK(lookup(cache, 1, 1) == nullptr);
+    DXUP_CHECK(lookup(cache, 2, 2) == samplers[2]);
+    DXUP_CHECK(lookup(cache, SamplerCache::MaxObjects, SamplerCache::MaxObjects) != nullptr);
+  }
+
+  // Evicts the head of a collision chain starting at home and checks the rest of the chain survives the shift.
+  void checkChainSurvivesErase(size_t home) {
+    MockDevice device;
+    SamplerCache cache;
+
+    push(device, cache, home, 0);
+    ID3D11SamplerState* b = push(device, cache, home, 1);
+    ID3D11SamplerState* c = push(device, cache, home, 2);
+    ID3D11SamplerState* d = push(device, cache, home + 1, 3);
+
+    // Fill with states homed well away from the chain.
+    for (uint32_t i = 4; i < SamplerCache::MaxObjects; i++)
+      push(device, cache, home + SamplerCache::TableSize / 2 + i, i);
+
+    push(device, cache, home + SamplerCache::TableSize / 2 + SamplerCache::MaxObjects, SamplerCache::MaxObjects);
+
+    DXUP_CHECK(cache.evictions() == 1);
+    DXUP_CHECK(lookup(cache, home, 0) == nullptr);
+    DXUP_CHECK(lookup(cache, home, 1) == b);
+    DXUP_CHECK(lookup(cache, home, 2) == c);
+    DXUP_CHECK(lookup(cache, home + 1, 3) == d);
+
+    // The hole must be reusable too.
+    ID3D11SamplerState* e = push(device, cache, home, SamplerCache::MaxObjects + 1);
+    DXUP_CHECK(lookup(cache, home, SamplerCache::MaxObjects + 1) == e);
+    DXUP_CHECK(lookup(cache, home, 1) == b);
+  }
+
+  void testEraseKeepsChains() {
+    checkChainSurvivesErase(100);
+
+    // Chain wrapping around the end of the table.
+    checkChainSurvivesErase(SamplerCache::TableSize - 2);
+  }
+
+  void testKeyPacker() {
+    D3D9StateKey key = D3D9StateKeyPacker()
+      .push(0x3, 2)
+      .push(0xFF, 4)
+      .push(0x1, 1)
+      .key();
+
+    // Values are masked to their width.
+    DXUP_CHECK(key.lo == (0x3ull | (0xFull << 2) | (0x1ull << 6)));
+    DXUP_CHECK(key.hi == 0);
+
+    // A field that would straddle the words starts the high one.
+    key = D3D9StateKeyPacker()
+      .push(0, 60)
+      .push(0x1F, 5)
+      .push(0x1, 1)
+      .key();
+
+    DXUP_CHECK(key.lo == 0);
+    DXUP_CHECK(key.hi == (0x1Full | (0x1ull << 5)));
+
+    // A field that exactly fills the low word doesn't move.
+    key = D3D9StateKeyPacker()
+      .push(0, 32)
+      .push(0xFFFFFFFF, 32)
+      .push(0x1, 1)
+      .key();
+
+    DXUP_CHECK(key.lo == 0xFFFFFFFF00000000ull);
+    DXUP_CHECK(key.hi == 0x1);
+
+    D3D9StateKey a = D3D9StateKeyPacker().push(1, 8).push(2, 8).key();
+    D3D9StateKey b = D3D9StateKeyPacker().push(2, 8).push(1, 8).key();
+    DXUP_CHECK(!(a == b));
+    DXUP_CHECK(a == D3D9StateKeyPacker().push(1, 8).push(2, 8).key());
+  }
+
+  void testKeyMap() {
+    MockDevice device;
+    StateKeyMap<ID3D11SamplerState> map;
+
+    Com<ID3D11SamplerState> sampler = makeSampler(device, samplerDesc(0));
+
+    D3D9StateKey key = D3D9StateKeyPacker().push(7, 8).key();
+    DXUP_CHECK(map.lookupObject(key) == nullptr);
+
+    map.pushState(key, sampler.ptr());
+    DXUP_CHECK(map.lookupObject(key) == sampler.ptr());
+
+    // Filling up starts over rather than growing past the limit.
+    for (uint64_t i = 0; i < StateKeyMap<ID3D11SamplerState>::MaxKeys; i++)
+      map.pushState(D3D9StateKeyPacker().push(i, 32).push(1, 1).key(), sampler.ptr());
+
+    DXUP_CHECK(map.lookupObject(key) == nullptr);
+  }
+
+}
+
+int main() {
+  run("state cache hit and miss", testHitAndMiss);
+  run("state cache collisions compare descs", testCollisionsCompareDescs);
+  run("state cache evicts least recently used", testEvictsLeastRecentlyUsed);
+  run("state cache erase keeps chains", testEraseKeepsChains);
+  run("state key packer", testKeyPacker);
+  run("state key map", testKeyMap);
+
+  return result();
+}
@@ -0,0 +1,104 @@
+#include "test_renderer.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  struct Vertex {
+    float x, y, z;
+  };
+
+  constexpr UINT Stride = sizeof(Vertex);
+
+  // Vertex i of a fan sits at x = i so it can be told apart once uploaded.
+  std::vector<Vertex> fanVertices(UINT primitiveCount) {
+    std::vector<Vertex> vertices(primitiveCount + 2);
+    for (UINT i = 0; i < vertices.size(); i++)
+      vertices[i] = Vertex{ float(i), 0.0f, 0.0f };
+    return vertices;
+  }
+
+  // What fan should come out as: (1, 2, 0), (2, 3, 0)... of its indices.
+  template <typename T>
+  bool isListOf(const T* list, const std::vector<T>& fan) {
+    for (size_t i = 0; i + 2 < fan.size(); i++) {
+      if (list[3 * i] != fan[i + 1] || list[3 * i + 1] != fan[i + 2] || list[3 * i + 2] != fan[0])
+        return false;
+    }
+    return true;
+  }
+
+  void testUpFanBecomesList() {
+    RendererFixture fixture;
+    std::vector<Vertex> vertices = fanVertices(4);
+
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLEFAN, 4, vertices.data(), Stride);
+
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 1);
+    DXUP_CHECK(fixture.context.lastDraw.count == 12);
+    DXUP_CHECK(fixture.context.lastDraw.baseVertex == 0);
+    DXUP_CHECK(fixture.context.topology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    // Small enough for 16 bit indices, and in the same buffer as the vertices.
+    DXUP_CHECK(fixture.context.indexFormat == DXGI_FORMAT_R16_UINT);
+    DXUP_CHECK(fixture.context.indexBuffer == fixture.context.vertexBuffers[0]);
+    DXUP_CHECK(isListOf(fixture.boundIndices<uint16_t>(), std::vector<uint16_t>{ 0, 1, 2, 3, 4, 5 }));
+    DXUP_CHECK(fixture.boundVertices<Vertex>(0)[5].x == 5.0f);
+  }
+
+  void testIndexedUpFanBecomesList() {
+    RendererFixture fixture;
+    std::vector<Vertex> vertices = fanVertices(3);
+    std::vector<uint16_t> fan = { 4, 3, 2, 1, 0 };
+
+    fixture.renderer.DrawIndexedPrimitiveUP(D3DPT_TRIANGLEFAN, 0, 5, 3, fan.data(), D3DFMT_INDEX16, vertices.data(), Stride);
+
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 1);
+    DXUP_CHECK(fixture.context.lastDraw.count == 9);
+    DXUP_CHECK(fixture.context.indexFormat == DXGI_FORMAT_R16_UINT);
+    DXUP_CHECK(isListOf(fixture.boundIndices<uint16_t>(), fan));
+    DXUP_CHECK(fixture.boundVertices<Vertex>(0)[4].x == 4.0f);
+  }
+
+  void testIndexedFanFromCopy() {
+    RendererFixture fixture;
+    std::vector<uint32_t> fan = { 9, 8, 7, 6, 5 };
+
+    fixture.renderer.DrawIndexedTriangleFan(5, 3, fan.data(), D3DFMT_INDEX32);
+
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 1);
+    DXUP_CHECK(fixture.context.lastDraw.count == 9);
+    DXUP_CHECK(fixture.context.lastDraw.baseVertex == 5);
+    DXUP_CHECK(fixture.context.indexFormat == DXGI_FORMAT_R32_UINT);
+    DXUP_CHECK(isListOf(fixture.boundIndices<uint32_t>(), fan));
+  }
+
+  void testFansMakeNoBuffers() {
+    RendererFixture fixture;
+    std::vector<uint32_t> fan(66);
+    for (uint32_t i = 0; i < fan.size(); i++)
+      fan[i] = i * 3;
+
+    // Every draw a different range, nothing to reuse. It all has to go through the upload heap's ring.
+    fixture.renderer.DrawIndexedTriangleFan(0, 1, fan.data(), D3DFMT_INDEX32);
+    const uint32_t buffers = fixture.device.buffersCreated;
+
+    // Well within the ring's first chunk.
+    for (uint32_t i = 0; i < 300; i++)
+      fixture.renderer.DrawIndexedTriangleFan(0, 1 + i % 64, &fan[i % 2], D3DFMT_INDEX32);
+
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 301);
+    DXUP_CHECK(fixture.device.buffersCreated == buffers);
+  }
+
+}
+
+int main() {
+  run("triangle fan UP fan becomes list", testUpFanBecomesList);
+  run("triangle fan indexed UP fan becomes list", testIndexedUpFanBecomesList);
+  run("triangle fan indexed fan from copy", testIndexedFanFromCopy);
+  run("triangle fan fans make no buffers", testFansMakeNoBuffers);
+
+  return result();
+}
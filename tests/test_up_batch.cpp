@@ -0,0 +1,176 @@
+#include "test_renderer.h"
+
+using namespace dxup;
+using namespace dxup::test;
+
+namespace {
+
+  struct Vertex {
+    float x, y, z;
+  };
+
+  constexpr UINT Stride = sizeof(Vertex);
+
+  // One triangle whose vertices are tagged with which draw they came from.
+  std::array<Vertex, 3> triangle(float id) {
+    return { Vertex{ id, 0.0f, 0.0f }, Vertex{ id, 1.0f, 0.0f }, Vertex{ id, 2.0f, 0.0f } };
+  }
+
+  void testListDrawsMerge() {
+    RendererFixture fixture;
+
+    for (uint32_t i = 0; i < 10; i++) {
+      std::array<Vertex, 3> vertices = triangle(float(i));
+      fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    }
+
+    // Held until something needs the context.
+    DXUP_CHECK(fixture.context.calls.draw == 0);
+
+    fixture.renderer.endFrame();
+
+    DXUP_CHECK(fixture.context.calls.draw == 1);
+    DXUP_CHECK(fixture.context.lastDraw.count == 30);
+    DXUP_CHECK(fixture.context.lastDraw.start == 0);
+    DXUP_CHECK(fixture.context.calls.map == 1);
+    DXUP_CHECK(fixture.context.topology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    // In submission order, in one go.
+    const Vertex* uploaded = fixture.boundVertices<Vertex>(0);
+    for (uint32_t i = 0; i < 10; i++) {
+      DXUP_CHECK(uploaded[i * 3].x == float(i));
+      DXUP_CHECK(uploaded[i * 3 + 2].y == 2.0f);
+    }
+  }
+
+  void testStateChangeSplitsBatch() {
+    RendererFixture fixture;
+    std::array<Vertex, 3> vertices = triangle(0.0f);
+
+    for (uint32_t i = 0; i < 3; i++)
+      fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+
+    fixture.state.SetRenderState(D3DRS_CULLMODE, D3DCULL_CW);
+
+    for (uint32_t i = 0; i < 2; i++)
+      fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+
+    // The first batch had to go out under the old state.
+    DXUP_CHECK(fixture.context.calls.draw == 1);
+    DXUP_CHECK(fixture.context.lastDraw.count == 9);
+
+    fixture.renderer.endFrame();
+    DXUP_CHECK(fixture.context.calls.draw == 2);
+    DXUP_CHECK(fixture.context.lastDraw.count == 6);
+
+    // Setting what's already set changes nothing, so it doesn't split.
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    fixture.state.SetRenderState(D3DRS_CULLMODE, D3DCULL_CW);
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    fixture.renderer.flushBatch();
+
+    DXUP_CHECK(fixture.context.calls.draw == 3);
+    DXUP_CHECK(fixture.context.lastDraw.count == 6);
+  }
+
+  void testShapeChangeSplitsBatch() {
+    RendererFixture fixture;
+    std::array<Vertex, 8> vertices = {};
+
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    fixture.renderer.DrawPrimitiveUP(D3DPT_LINELIST, 2, vertices.data(), Stride);
+    fixture.renderer.DrawPrimitiveUP(D3DPT_LINELIST, 2, vertices.data(), Stride + 4);
+    fixture.renderer.flushBatch();
+
+    DXUP_CHECK(fixture.context.calls.draw == 3);
+    DXUP_CHECK(fixture.context.topology == D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+  }
+
+  void testStripsAreNotBatched() {
+    RendererFixture fixture;
+    std::array<Vertex, 4> vertices = {};
+
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, vertices.data(), Stride);
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLESTRIP, 2, vertices.data(), Stride);
+
+    DXUP_CHECK(fixture.context.calls.draw == 2);
+    DXUP_CHECK(fixture.context.lastDraw.count == 4);
+  }
+
+  void testRegularDrawFlushesBatch() {
+    RendererFixture fixture;
+    std::array<Vertex, 3> vertices = triangle(0.0f);
+
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    DXUP_CHECK(fixture.context.calls.draw == 0);
+
+    fixture.renderer.DrawPrimitive(D3DPT_TRIANGLELIST, 0, 1);
+
+    DXUP_CHECK(fixture.context.calls.draw == 2);
+    DXUP_CHECK(fixture.context.lastDraw.count == 3);
+
+    // Stream 0 was left pointing at the batch's upload, the real draw had to put the app's binding back.
+    DXUP_CHECK(fixture.context.calls.setVertexBuffers == 2);
+    DXUP_CHECK(fixture.context.vertexBuffers[0] == nullptr);
+  }
+
+  void testIndexedDrawsRebase() {
+    RendererFixture fixture;
+
+    const uint16_t indices[3] = { 2, 1, 0 };
+    for (uint32_t i = 0; i < 4; i++) {
+      std::array<Vertex, 3> vertices = triangle(float(i));
+      fixture.renderer.DrawIndexedPrimitiveUP(D3DPT_TRIANGLELIST, 0, 3, 1, indices, D3DFMT_INDEX16, vertices.data(), Stride);
+    }
+
+    fixture.renderer.endFrame();
+
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 1);
+    DXUP_CHECK(fixture.context.calls.draw == 0);
+    DXUP_CHECK(fixture.context.lastDraw.count == 12);
+    DXUP_CHECK(fixture.context.lastDraw.baseVertex == 0);
+
+    // Each draw's indices now point at its own vertices in the merged buffer.
+    const uint16_t* uploaded = fixture.boundIndices<uint16_t>();
+    const Vertex* vertices = fixture.boundVertices<Vertex>(0);
+    for (uint32_t i = 0; i < 4; i++) {
+      DXUP_CHECK(uploaded[i * 3 + 0] == i * 3 + 2);
+      DXUP_CHECK(uploaded[i * 3 + 2] == i * 3 + 0);
+      DXUP_CHECK(vertices[uploaded[i * 3]].x == float(i));
+    }
+
+    // Vertices and indices went up in the same map.
+    DXUP_CHECK(fixture.context.calls.map == 1);
+    DXUP_CHECK(fixture.context.indexBuffer == fixture.context.vertexBuffers[0]);
+  }
+
+  void testIndexFormatSplitsBatch() {
+    RendererFixture fixture;
+    std::array<Vertex, 3> vertices = triangle(0.0f);
+
+    const uint16_t shortIndices[3] = { 0, 1, 2 };
+    const uint32_t longIndices[3] = { 0, 1, 2 };
+
+    fixture.renderer.DrawIndexedPrimitiveUP(D3DPT_TRIANGLELIST, 0, 3, 1, shortIndices, D3DFMT_INDEX16, vertices.data(), Stride);
+    fixture.renderer.DrawIndexedPrimitiveUP(D3DPT_TRIANGLELIST, 0, 3, 1, longIndices, D3DFMT_INDEX32, vertices.data(), Stride);
+    fixture.renderer.DrawPrimitiveUP(D3DPT_TRIANGLELIST, 1, vertices.data(), Stride);
+    fixture.renderer.endFrame();
+
+    DXUP_CHECK(fixture.context.calls.drawIndexed == 2);
+    DXUP_CHECK(fixture.context.calls.draw == 1);
+  }
+
+}
+
+int main() {
+  run("up batch merges list draws", testListDrawsMerge);
+  run("up batch splits on state change", testStateChangeSplitsBatch);
+  run("up batch splits on shape change", testShapeChangeSplitsBatch);
+  run("up batch leaves strips alone", testStripsAreNotBatched);
+  run("up batch flushed by regular draw", testRegularDrawFlushesBatch);
+  run("up batch rebases indices", testIndexedDrawsRebase);
+  run("up batch splits on index format", testIndexFormatSplitsBatch);
+
+  return result();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+
+namespace dxup {
+
+  namespace test {
+
+    inline uint32_t& failures() {
+      static uint32_t count = 0;
+      return count;
+    }
+
+    inline void check(bool passed, const char* expr, const char* file, int line) {
+      if (passed)
+        return;
+
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+      failures()++;
+    }
+
+    // Runs a named case and reports how many checks it failed.
+    template <typename Fn>
+    void run(const char* name, Fn fn) {
+      uint32_t before = failures();
+      fn();
+
+      uint32_t failed = failures() - before;
+      if (failed != 0)
+        std::fprintf(stderr, "FAIL %s (%u checks)\n", name, failed);
+      else
+        std::printf("ok   %s\n", name);
+    }
+
+    inline int result() {
+      return failures() == 0 ? 0 : 1;
+    }
+
+  }
+
+}
+
+#define DXUP_CHECK(expr) ::dxup::test::check(bool(expr), #expr, __FILE__, __LINE__)